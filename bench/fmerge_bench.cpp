@@ -0,0 +1,378 @@
+// Benchmark for FolderMerger
+//
+// Generates a synthetic set of folders in a scratch directory, then times the scan, backup,
+// merge, sync and confirm steps of a merge separately over several runs. Every step also counts the
+// heap allocations it makes and the most heap memory it had in use at once.
+//
+// Usage: fmerge_bench [bench options] [fmerge options]
+//   --dir PATH            scratch directory (default: /dev/shm if it exists, otherwise the temp directory)
+//   --folders N           folders to merge (default: 8)
+//   --files N             files per folder (default: 1000)
+//   --size-dist DIST      fixed, uniform or lognormal (default: fixed)
+//   --min-size BYTES      smallest file, also the size used by 'fixed' (default: 4096)
+//   --max-size BYTES      largest file (default: 1048576)
+//   --nesting N           levels of nested folders inside every folder (default: 0)
+//   --runs N              number of runs (default: 3)
+//   --seed N              seed for file sizes and contents (default: 1)
+//   --no-backup           skip the backup step
+// Every other option is passed on to FolderMerger, e.g. --threads 8 --mode move, --report FILE writes the last run's phases
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <filesystem>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <cstddef>
+
+#include "folder_merger.hpp"
+#include "command_line.hpp"
+
+namespace {
+  // Heap use of the whole program, counted by the operator new and delete below
+  std::atomic<uint64_t> g_allocations(0);
+  std::atomic<uint64_t> g_heap_bytes(0);
+  std::atomic<uint64_t> g_peak_heap_bytes(0);
+
+  // Room kept in front of every allocation for its size, keeps the alignment new guarantees
+  const size_t kAllocHeader = alignof(std::max_align_t);
+
+  void* countedAlloc(size_t size) {
+    char* block = static_cast<char*>(std::malloc(size + kAllocHeader));
+    if (block == nullptr) {
+      return nullptr;
+    }
+    *reinterpret_cast<size_t*>(block) = size;
+
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t kInUse = g_heap_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t peak = g_peak_heap_bytes.load(std::memory_order_relaxed);
+    while (kInUse > peak && !g_peak_heap_bytes.compare_exchange_weak(peak, kInUse, std::memory_order_relaxed)) {}
+    return block + kAllocHeader;
+  }
+
+  void countedFree(void* ptr) {
+    if (ptr == nullptr) {
+      return;
+    }
+    char* block = static_cast<char*>(ptr) - kAllocHeader;
+    g_heap_bytes.fetch_sub(*reinterpret_cast<size_t*>(block), std::memory_order_relaxed);
+    std::free(block);
+  }
+}
+
+void* operator new(size_t size) {
+  void* ptr = countedAlloc(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void operator delete(void* ptr) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr) noexcept { countedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { countedFree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { countedFree(ptr); }
+
+namespace {
+  const char* const kPhaseNames[] = { "scan", "backup", "merge", "sync", "confirm" };
+  const int kPhaseCount = 5;
+
+  struct BenchConfig {
+    std::filesystem::path scratch_dir;
+    int folders = 8;
+    int files_per_folder = 1000;
+    std::string size_dist = "fixed";
+    uint64_t min_size = 4096;
+    uint64_t max_size = 1024 * 1024;
+    int nesting = 0;
+    int runs = 3;
+    unsigned int seed = 1;
+    bool backup = true;
+  };
+
+  // Totals of a generated folder set
+  struct TreeStats {
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+  };
+
+  // Swallows FolderMerger's console output while a step is timed
+  class NullBuffer : public std::streambuf {
+   protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+  };
+
+  /**
+   * @brief Read the bench's own options, everything else is kept for FolderMerger
+   *
+   * @return true if success ; false if an option was not understood
+   */
+  bool parseBenchOptions(int argc, char* argv[], BenchConfig& config, std::vector<char*>& merger_args) {
+    merger_args.push_back(argv[0]);
+    for (int i = 1; i < argc; i++) {
+      const std::string kArg = argv[i];
+      if (kArg == "--no-backup") {
+        config.backup = false;
+        continue;
+      }
+
+      const bool kIsBenchFlag = (kArg == "--dir" || kArg == "--folders" || kArg == "--files" || kArg == "--size-dist"
+                                 || kArg == "--min-size" || kArg == "--max-size" || kArg == "--nesting"
+                                 || kArg == "--runs" || kArg == "--seed");
+      if (!kIsBenchFlag) {
+        merger_args.push_back(argv[i]);
+        continue;
+      }
+      else if (i + 1 >= argc) {
+        std::cout << "ERROR: " << kArg << " expects a value\n";
+        return false;
+      }
+
+      const std::string kValue = argv[++i];
+      if (kArg == "--dir") {
+        config.scratch_dir = kValue;
+      }
+      else if (kArg == "--size-dist") {
+        if (kValue != "fixed" && kValue != "uniform" && kValue != "lognormal") {
+          std::cout << "ERROR: --size-dist expects 'fixed', 'uniform' or 'lognormal'\n";
+          return false;
+        }
+        config.size_dist = kValue;
+      }
+      else if (kValue.empty() || kValue.find_first_not_of("0123456789") != std::string::npos) {
+        std::cout << "ERROR: " << kArg << " expects a positive number, got: \"" << kValue << "\"\n";
+        return false;
+      }
+      else if (kArg == "--folders")  { config.folders = std::stoi(kValue); }
+      else if (kArg == "--files")    { config.files_per_folder = std::stoi(kValue); }
+      else if (kArg == "--min-size") { config.min_size = std::stoull(kValue); }
+      else if (kArg == "--max-size") { config.max_size = std::stoull(kValue); }
+      else if (kArg == "--nesting")  { config.nesting = std::stoi(kValue); }
+      else if (kArg == "--runs")     { config.runs = std::max(1, std::stoi(kValue)); }
+      else if (kArg == "--seed")     { config.seed = static_cast<unsigned int>(std::stoul(kValue)); }
+    }
+
+    if (config.max_size < config.min_size) {
+      config.max_size = config.min_size;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Pick the size of the next generated file
+   */
+  uint64_t nextFileSize(const BenchConfig& config, std::mt19937_64& rng) {
+    if (config.size_dist == "uniform") {
+      return std::uniform_int_distribution<uint64_t>(config.min_size, config.max_size)(rng);
+    }
+    else if (config.size_dist == "lognormal") {
+      // centered between the bounds on a log scale, most files small with a long tail of big ones
+      const double kLogMin = std::log(static_cast<double>(std::max<uint64_t>(config.min_size, 1)));
+      const double kLogMax = std::log(static_cast<double>(std::max<uint64_t>(config.max_size, 1)));
+      std::lognormal_distribution<double> dist((kLogMin + kLogMax) / 2, (kLogMax - kLogMin) / 6 + 0.01);
+      const double kSize = std::clamp(dist(rng), static_cast<double>(config.min_size), static_cast<double>(config.max_size));
+      return static_cast<uint64_t>(kSize);
+    }
+
+    return config.min_size;
+  }
+
+  /**
+   * @brief Write the folder set to merge, every file gets unique contents
+   *
+   * @return TreeStats totals of the files written
+   */
+  TreeStats generateTree(const BenchConfig& config, const std::filesystem::path& main_dir, const std::vector<char>& noise) {
+    std::mt19937_64 rng(config.seed);
+    TreeStats stats;
+    uint64_t file_id = 0;
+
+    for (int folder = 0; folder < config.folders; folder++) {
+      char folder_name[32];
+      std::snprintf(folder_name, sizeof(folder_name), "folder_%04d", folder);
+      std::filesystem::path level_dir = main_dir / folder_name;
+
+      // spread the files evenly over the folder and its nested levels
+      const int kLevels = config.nesting + 1;
+      for (int level = 0; level < kLevels; level++) {
+        if (level > 0) {
+          level_dir /= "nested_" + std::to_string(level);
+        }
+        std::filesystem::create_directories(level_dir);
+
+        const int kFiles = config.files_per_folder / kLevels + (level < config.files_per_folder % kLevels ? 1 : 0);
+        for (int i = 0; i < kFiles; i++) {
+          char file_name[32];
+          std::snprintf(file_name, sizeof(file_name), "%06d.bin", i);
+
+          const uint64_t kSize = nextFileSize(config, rng);
+          std::ofstream ofstream(level_dir / file_name, std::ios_base::binary);
+
+          // the file id comes first so no two files are identical
+          ofstream.write(reinterpret_cast<const char*>(&file_id), std::min<uint64_t>(sizeof(file_id), kSize));
+          uint64_t written = std::min<uint64_t>(sizeof(file_id), kSize);
+          while (written < kSize) {
+            const uint64_t kOffset = (file_id * 7919 + written) % noise.size();
+            const uint64_t kChunk = std::min<uint64_t>(kSize - written, noise.size() - kOffset);
+            ofstream.write(noise.data() + kOffset, static_cast<std::streamsize>(kChunk));
+            written += kChunk;
+          }
+
+          stats.files++;
+          stats.bytes += kSize;
+          file_id++;
+        }
+      }
+    }
+
+    return stats;
+  }
+
+  double mean(const std::vector<double>& values) {
+    double sum = 0;
+    for (double value : values) {
+      sum += value;
+    }
+    return values.empty() ? 0 : sum / values.size();
+  }
+
+  double standardDeviation(const std::vector<double>& values) {
+    const double kMean = mean(values);
+    double sum = 0;
+    for (double value : values) {
+      sum += (value - kMean) * (value - kMean);
+    }
+    return values.size() < 2 ? 0 : std::sqrt(sum / (values.size() - 1));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  BenchConfig config;
+  std::vector<char*> merger_args;
+  if (!parseBenchOptions(argc, argv, config, merger_args)) {
+    return 1;
+  }
+
+  MergeOptions options;
+  options.verbosity = Verbosity::Quiet;
+  options.nested_folder_policy = NestedFolderPolicy::Skip;
+  if (!parseCommandLine(static_cast<int>(merger_args.size()), merger_args.data(), options)) {
+    return 1;
+  }
+
+  if (config.scratch_dir.empty()) {
+    config.scratch_dir = std::filesystem::exists("/dev/shm") ? std::filesystem::path("/dev/shm") : std::filesystem::temp_directory_path();
+  }
+  const std::filesystem::path kMainDir = config.scratch_dir / "fmerge_bench";
+  const std::filesystem::path kStartDir = std::filesystem::current_path();
+
+  // random bytes that file contents are cut from
+  std::vector<char> noise(4 * 1024 * 1024);
+  std::mt19937_64 noise_rng(config.seed);
+  for (auto& byte : noise) {
+    byte = static_cast<char>(noise_rng());
+  }
+
+  std::cout << "fmerge_bench: " << config.folders << " folders x " << config.files_per_folder << " files, "
+            << config.size_dist << " sizes " << config.min_size << "-" << config.max_size << " bytes, nesting "
+            << config.nesting << ", " << config.runs << " runs in " << kMainDir << std::endl;
+
+  std::vector<double> seconds[kPhaseCount];
+  std::vector<double> allocations[kPhaseCount];
+  uint64_t peak_heap[kPhaseCount] = {}; // Most heap in use during the step over every run, on top of what was in use before it
+  TreeStats tree;
+  NullBuffer null_buffer;
+
+  for (int run = 0; run < config.runs; run++) {
+    std::filesystem::remove_all(kMainDir);
+    std::filesystem::create_directories(kMainDir);
+    tree = generateTree(config, kMainDir, noise);
+
+    // FolderMerger works with paths relative to the main directory
+    std::filesystem::current_path(kMainDir);
+    FolderMerger folder_merger(kMainDir, "fmerge_bench", options);
+    std::streambuf* const kConsole = std::cout.rdbuf(&null_buffer);
+
+    auto time_phase = [&](int phase, auto&& step) {
+      const uint64_t kStartAllocations = g_allocations.load();
+      const uint64_t kStartHeap = g_heap_bytes.load();
+      g_peak_heap_bytes.store(kStartHeap);
+      const auto kStart = std::chrono::steady_clock::now();
+      const bool kSuccess = step();
+      seconds[phase].push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - kStart).count());
+      allocations[phase].push_back(static_cast<double>(g_allocations.load() - kStartAllocations));
+      peak_heap[phase] = std::max(peak_heap[phase], g_peak_heap_bytes.load() - kStartHeap);
+      return kSuccess;
+    };
+
+    std::vector<std::filesystem::path> ordering_list;
+    std::filesystem::path index_path = "";
+    std::filesystem::path temp_folder = folder_merger.getTempFolder();
+    bool success = time_phase(0, [&] { ordering_list = folder_merger.getMergeableFolders(); return !ordering_list.empty(); });
+    std::sort(ordering_list.begin(), ordering_list.end());
+
+    if (success && config.backup) {
+      success = time_phase(1, [&] { return folder_merger.createBackup(ordering_list); });
+    }
+    if (success) {
+      success = time_phase(2, [&] { return folder_merger.merge(ordering_list, index_path); });
+    }
+    if (success) {
+      success = time_phase(3, [&] { return folder_merger.syncMerge(); });
+    }
+    if (success) {
+      std::filesystem::path dest_path = ordering_list[0];
+      time_phase(4, [&] { return folder_merger.confirmMerge(ordering_list, temp_folder, dest_path); });
+    }
+
+    std::cout.rdbuf(kConsole);
+    std::filesystem::current_path(kStartDir);
+
+    // the report covers the last run
+    if (run == config.runs - 1 && !options.report_file.empty()) {
+      folder_merger.writeReport(options.report_file);
+    }
+
+    if (!success) {
+      std::cout << "ERROR: Run " << run << " failed, rerun with --verbosity per-file to see why." << std::endl;
+      std::filesystem::remove_all(kMainDir);
+      return 1;
+    }
+    std::cout << "Run " << (run + 1) << "/" << config.runs << " done." << std::endl;
+  }
+  std::filesystem::remove_all(kMainDir);
+
+  std::printf("\n%llu files, %s per run\n", static_cast<unsigned long long>(tree.files), ProgressReporter::formatBytes(tree.bytes).c_str());
+  std::printf("%-8s %10s %10s %10s %10s %12s %12s %12s %12s\n", "phase", "mean (s)", "min (s)", "max (s)", "stddev", "files/s", "MB/s",
+              "allocs", "peak heap");
+  for (int phase = 0; phase < kPhaseCount; phase++) {
+    if (seconds[phase].empty()) {
+      continue;
+    }
+
+    const double kMean = mean(seconds[phase]);
+    const double kMin = *std::min_element(seconds[phase].begin(), seconds[phase].end());
+    const double kMax = *std::max_element(seconds[phase].begin(), seconds[phase].end());
+    const double kFilesPerSecond = kMean > 0 ? tree.files / kMean : 0;
+    const double kMegabytesPerSecond = kMean > 0 ? tree.bytes / kMean / (1024 * 1024) : 0;
+    std::printf("%-8s %10.4f %10.4f %10.4f %10.4f %12.0f %12.1f %12.0f %12s\n", kPhaseNames[phase], kMean, kMin, kMax,
+                standardDeviation(seconds[phase]), kFilesPerSecond, kMegabytesPerSecond, mean(allocations[phase]),
+                ProgressReporter::formatBytes(peak_heap[phase]).c_str());
+  }
+
+  return 0;
+}
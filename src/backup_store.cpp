@@ -0,0 +1,261 @@
+#include "backup_store.hpp"
+
+#include <ctime>
+#include <fstream>
+#include <algorithm>
+#include <charconv>
+
+#include "merge_journal.hpp"
+#include "durability.hpp"
+
+static const char* const MANIFEST_HEADER = "fmerge-backup";
+static const char* const MANIFEST_VERSION = "1";
+
+/**
+ * @brief Split a manifest record into its fields
+ *
+ * @param line record to split
+ *
+ * @return std::vector<std::string> fields, still escaped
+ */
+static std::vector<std::string> splitRecord(const std::string& line) {
+  std::vector<std::string> fields;
+  size_t field_start = 0;
+  size_t field_end;
+  while ((field_end = line.find('\t', field_start)) != std::string::npos) {
+    fields.push_back(line.substr(field_start, field_end - field_start));
+    field_start = field_end + 1;
+  }
+  fields.push_back(line.substr(field_start));
+
+  return fields;
+}
+
+/**
+ * @brief Read a whole field as a number, negative numbers included
+ *
+ * @param field text to read
+ * @param number where to store the number
+ *
+ * @return true if success ; false if the field is not a number
+ */
+template <typename T>
+static bool parseNumber(const std::string& field, T& number) {
+  const char* const kEnd = field.data() + field.size();
+  const std::from_chars_result kResult = std::from_chars(field.data(), kEnd, number);
+  return !field.empty() && kResult.ec == std::errc() && kResult.ptr == kEnd;
+}
+
+/**
+ * @brief Read a manifest written by writeManifest()
+ *
+ * @param manifest_file file to read
+ * @param manifest manifest to fill
+ * @param directory only read the files of a manifest for this directory, empty = read any manifest
+ *
+ * @return true if success ; false if the file cannot be read, is not a manifest or is for another directory
+ */
+static bool readManifestFor(const std::filesystem::path& manifest_file, BackupManifest& manifest, const std::filesystem::path& directory) {
+  std::ifstream ifstream(manifest_file, std::ios_base::binary);
+  if (!ifstream.is_open()) {
+    return false;
+  }
+
+  manifest = BackupManifest();
+  std::string line;
+  if (!std::getline(ifstream, line) || line != std::string(MANIFEST_HEADER) + "\t" + MANIFEST_VERSION) {
+    return false;
+  }
+
+  while (std::getline(ifstream, line)) {
+    const std::vector<std::string> kFields = splitRecord(line);
+    const std::string& kType = kFields[0];
+
+    if (kType == "D" && kFields.size() == 2) {
+      manifest.directory = MergeJournal::unescape(kFields[1]);
+      if (!directory.empty() && manifest.directory.lexically_normal() != directory.lexically_normal()) {
+        return false;
+      }
+    }
+    else if (kType == "F" && kFields.size() == 2) {
+      manifest.folders.push_back(MergeJournal::unescape(kFields[1]));
+    }
+    else if (kType == "O" && kFields.size() == 5) {
+      ManifestFile file;
+      file.key = kFields[1];
+      file.path = MergeJournal::unescape(kFields[4]);
+      if (!parseNumber(kFields[2], file.size) || !parseNumber(kFields[3], file.write_time)) {
+        return false;
+      }
+      manifest.files.push_back(std::move(file));
+    }
+    else if (!line.empty()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/
+
+/**
+ * @brief Pick the file for a new manifest, named after the backup and the time, e.g. "Backup-20240131-154500.txt"
+ *
+ * @param name name of the backup
+ *
+ * @return std::filesystem::path manifest file that does not exist yet
+ */
+std::filesystem::path BackupStore::getNewManifestPath(const std::string& name) const {
+  const std::time_t kNow = std::time(nullptr);
+  std::tm local {};
+#ifdef _WIN32
+  localtime_s(&local, &kNow);
+#else
+  localtime_r(&kNow, &local);
+#endif
+  char buffer[32];
+  std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", &local);
+
+  const std::string kStem = name + "-" + buffer;
+  std::filesystem::path manifest_path = getManifestFolder() / (kStem + ".txt");
+  std::error_code ec;
+  for (int i = 2; std::filesystem::exists(manifest_path, ec); i++) {
+    manifest_path = getManifestFolder() / (kStem + "-" + std::to_string(i) + ".txt");
+  }
+
+  return manifest_path;
+}
+
+/**
+ * @brief Collect the files backed up from a directory by earlier backups, the newest backup of a file wins
+ *
+ * @param directory directory the files were backed up from
+ * @param known gets every file, keyed by its generic path relative to the directory
+ *
+ * @return number of manifests read
+ */
+size_t BackupStore::loadKnownFiles(const std::filesystem::path& directory, std::unordered_map<std::string, ManifestFile>& known) const {
+  std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> manifest_files;
+  std::error_code ec;
+  for (std::filesystem::directory_iterator it(getManifestFolder(), ec), end; !ec && it != end; it.increment(ec)) {
+    std::error_code time_ec;
+    if (it->path().extension() == ".txt") {
+      manifest_files.emplace_back(it->last_write_time(time_ec), it->path());
+    }
+  }
+  std::sort(manifest_files.begin(), manifest_files.end()); // oldest first
+
+  size_t manifest_count = 0;
+  BackupManifest manifest;
+  for (const auto& [write_time, manifest_file] : manifest_files) {
+    if (!readManifestFor(manifest_file, manifest, directory)) {
+      continue;
+    }
+
+    for (auto& file : manifest.files) {
+      const std::string kPath = file.path.generic_string();
+      known[kPath] = std::move(file);
+    }
+    manifest_count++;
+  }
+
+  return manifest_count;
+}
+
+/**
+ * @brief Make the name of the object holding some contents
+ *
+ * @param hash XXH64 hash of the contents
+ * @param size size of the contents in bytes, two files must match in both to share an object
+ * @param variant 1 for the first contents with this hash and size, higher for different contents that share them
+ *
+ * @return std::string key, e.g. "0123456789abcdef-4096" or "0123456789abcdef-4096-2"
+ */
+std::string BackupStore::makeKey(uint64_t hash, uint64_t size, unsigned int variant) {
+  char digits[16];
+  for (int i = 15; i >= 0; i--) {
+    digits[i] = "0123456789abcdef"[hash & 0xF];
+    hash >>= 4;
+  }
+
+  std::string key = std::string(digits, sizeof(digits)) + "-" + std::to_string(size);
+  if (variant > 1) {
+    key += "-" + std::to_string(variant);
+  }
+  return key;
+}
+
+/**
+ * @brief Get the last write time of a file as a plain number, only comparable with other numbers from this function
+ *
+ * @param file file to look at
+ * @param ec set to the error if the time cannot be read
+ *
+ * @return int64_t last write time in ticks of the filesystem clock
+ */
+int64_t BackupStore::getWriteTime(const std::filesystem::path& file, std::error_code& ec) {
+  const std::filesystem::file_time_type kTime = std::filesystem::last_write_time(file, ec);
+  return ec ? 0 : static_cast<int64_t>(kTime.time_since_epoch().count());
+}
+
+/**
+ * @brief Save a manifest, written next to the file first and renamed over it so it is never seen half written
+ *
+ * @param manifest manifest to save
+ * @param manifest_file file to write
+ * @param sync wait until the manifest and its folder are on the disk
+ * @param ec set to the error if it fails
+ *
+ * @return true if success ; false if error
+ */
+bool writeManifest(const BackupManifest& manifest, const std::filesystem::path& manifest_file, bool sync, std::error_code& ec) {
+  std::filesystem::path partial_file = manifest_file;
+  partial_file += ".partial";
+
+  std::ofstream ofstream(partial_file, std::ios_base::binary | std::ios_base::trunc);
+  if (!ofstream.is_open()) {
+    ec = std::make_error_code(std::errc::io_error);
+    return false;
+  }
+
+  auto field = [](const std::filesystem::path& path) { return MergeJournal::escape(path.generic_string()); };
+
+  ofstream << MANIFEST_HEADER << "\t" << MANIFEST_VERSION << "\n";
+  ofstream << "D\t" << MergeJournal::escape(manifest.directory.string()) << "\n";
+  for (const auto& folder : manifest.folders) {
+    ofstream << "F\t" << field(folder) << "\n";
+  }
+  for (const auto& file : manifest.files) {
+    ofstream << "O\t" << file.key << "\t" << file.size << "\t" << file.write_time << "\t" << field(file.path) << "\n";
+  }
+
+  ofstream.close();
+  if (ofstream.fail()) {
+    ec = std::make_error_code(std::errc::io_error);
+    return false;
+  }
+
+  if (sync && !syncFile(partial_file, ec)) {
+    return false;
+  }
+  std::filesystem::rename(partial_file, manifest_file, ec);
+  if (ec) {
+    return false;
+  }
+  return !sync || syncDirectory(manifest_file.parent_path(), ec);
+}
+
+/**
+ * @brief Read a manifest written by writeManifest()
+ *
+ * @param manifest_file file to read
+ * @param manifest manifest to fill
+ *
+ * @return true if success ; false if the file cannot be read or is not a manifest
+ */
+bool readManifest(const std::filesystem::path& manifest_file, BackupManifest& manifest) {
+  return readManifestFor(manifest_file, manifest, "");
+}
@@ -0,0 +1,61 @@
+#ifndef BACKUP_STORE_HPP
+#define BACKUP_STORE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+#include <system_error>
+
+// One file of a backup
+struct ManifestFile {
+  std::string key; // Object holding the file's contents, see BackupStore::makeKey()
+  uint64_t size = 0;
+  int64_t write_time = 0; // Last write time when it was backed up, lets the next backup skip hashing it again
+  std::filesystem::path path; // Relative to the backed up directory, e.g. "chapter1/001.png"
+};
+
+// Everything one backup holds, saved as one record per line with fields separated by tabs and escaped like the
+// journal's:
+//   fmerge-backup 1                   header, first line of the file
+//   D <directory>                     directory the folders were backed up from
+//   F <folder>                        folder to recreate, relative to the directory, parents first
+//   O <key> <size> <write time> <file>  file to recreate from an object, relative to the directory
+struct BackupManifest {
+  std::filesystem::path directory;
+  std::vector<std::filesystem::path> folders;
+  std::vector<ManifestFile> files;
+};
+
+// Backups of any number of runs kept in one folder, every distinct file contents is stored only once
+//
+//   <store>/objects/<2 hex digits>/<16 hex digits>-<size>  contents of a file, named after its XXH64 hash and size
+//   <store>/objects/<2 hex digits>/<16 hex digits>-<size>-<n>  another contents with the same hash and size
+//   <store>/manifests/<name>.txt                           one backup, see BackupManifest
+//
+// An object is copied under a ".partial" name and renamed once it is on the disk, and a manifest is written only
+// after all of its objects, so an interrupted backup never leaves a manifest or an object that cannot be trusted.
+class BackupStore {
+ private:
+  // vars
+  std::filesystem::path m_root;
+
+ public:
+  explicit BackupStore(const std::filesystem::path& root) : m_root(root) {}
+
+  const std::filesystem::path& getRoot() const { return m_root; }
+  std::filesystem::path getManifestFolder() const { return m_root / "manifests"; }
+  std::filesystem::path getObjectFolder(const std::string& key) const { return m_root / "objects" / key.substr(0, 2); }
+  std::filesystem::path getObjectPath(const std::string& key) const { return getObjectFolder(key) / key; }
+  std::filesystem::path getNewManifestPath(const std::string& name) const;
+  size_t loadKnownFiles(const std::filesystem::path& directory, std::unordered_map<std::string, ManifestFile>& known) const;
+
+  static std::string makeKey(uint64_t hash, uint64_t size, unsigned int variant = 1);
+  static int64_t getWriteTime(const std::filesystem::path& file, std::error_code& ec);
+};
+
+bool writeManifest(const BackupManifest& manifest, const std::filesystem::path& manifest_file, bool sync, std::error_code& ec);
+bool readManifest(const std::filesystem::path& manifest_file, BackupManifest& manifest);
+
+#endif // BACKUP_STORE_HPP
@@ -0,0 +1,387 @@
+#include "command_line.hpp"
+
+#include <iostream>
+#include <string>
+#include <cctype>
+#include <charconv>
+#include <limits>
+
+#include "copy_backend.hpp"
+#include "tar_writer.hpp"
+#include "durability.hpp"
+
+/**
+ * @brief Read an unsigned number from a command line value
+ *
+ * @param flag flag the value belongs to, used for error messages
+ * @param value text to read
+ * @param out where to store the number
+ * 
+ * @return true if success ; false if error
+ */
+static bool parseUnsigned(const std::string& flag, const std::string& value, unsigned int& out) {
+  if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) {
+    std::cout << "ERROR: " << flag << " expects a positive number, got: \"" << value << "\"\n";
+    return false;
+  }
+
+  const char* kEnd = value.data() + value.size();
+  const std::from_chars_result kResult = std::from_chars(value.data(), kEnd, out);
+  if (kResult.ec != std::errc() || kResult.ptr != kEnd) {
+    std::cout << "ERROR: " << flag << " expects a number of at most " << std::numeric_limits<unsigned int>::max() << ", got: \"" << value << "\"\n";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Read a size in bytes from a command line value, with an optional K, M or G suffix
+ *
+ * @param flag flag the value belongs to, used for error messages
+ * @param value text to read, e.g. "4096", "512K" or "1G"
+ * @param out where to store the number of bytes
+ * 
+ * @return true if success ; false if error
+ */
+static bool parseSize(const std::string& flag, const std::string& value, uint64_t& out) {
+  const std::string kSuffixes = "KMG";
+  const size_t kSuffix = value.empty() ? std::string::npos : kSuffixes.find(static_cast<char>(std::toupper(value.back())));
+  const std::string kNumber = (kSuffix == std::string::npos) ? value : value.substr(0, value.size() - 1);
+  if (kNumber.empty() || kNumber.find_first_not_of("0123456789") != std::string::npos) {
+    std::cout << "ERROR: " << flag << " expects a size like 4096, 512K, 64M or 1G, got: \"" << value << "\"\n";
+    return false;
+  }
+
+  // the number must still fit once the suffix multiplies it
+  const unsigned int kShift = (kSuffix == std::string::npos) ? 0 : 10 * static_cast<unsigned int>(kSuffix + 1);
+  const char* kEnd = kNumber.data() + kNumber.size();
+  const std::from_chars_result kResult = std::from_chars(kNumber.data(), kEnd, out);
+  if (kResult.ec != std::errc() || kResult.ptr != kEnd || out > (std::numeric_limits<uint64_t>::max() >> kShift)) {
+    std::cout << "ERROR: " << flag << " is too large, got: \"" << value << "\"\n";
+    return false;
+  }
+  out <<= kShift;
+  return true;
+}
+
+/**
+ * @brief Set one option from a flag and its value
+ *
+ * @param flag flag naming the option, e.g. "--mode"
+ * @param value value given with the flag
+ * @param options options to change
+ * 
+ * @return true if success ; false if the flag or its value was not understood
+ */
+bool parseOption(const std::string& flag, const std::string& value, MergeOptions& options) {
+  if (flag == THREADS_FLAG) {
+    if (!parseUnsigned(flag, value, options.thread_count)) {
+      return false;
+    }
+  }
+  else if (flag == MODE_FLAG) {
+    if (value == "copy") {
+      options.transfer_mode = TransferMode::Copy;
+    }
+    else if (value == "move") {
+      options.transfer_mode = TransferMode::Move;
+    }
+    else {
+      std::cout << "ERROR: " << flag << " expects 'copy' or 'move', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == BACKUP_BACKEND_FLAG) {
+    if (!parseBackendName(value, options.backup_backend)) {
+      std::cout << "ERROR: " << flag << " expects 'auto', 'reflink', 'copy-file-range', 'hardlink' or 'copy', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == IO_URING_FLAG) {
+    if (!parseUnsigned(flag, value, options.io_uring_depth)) {
+      return false;
+    }
+  }
+  else if (flag == DEDUP_FLAG) {
+    if (value == "off") {
+      options.dedup_mode = DedupMode::Off;
+    }
+    else if (value == "skip") {
+      options.dedup_mode = DedupMode::Skip;
+    }
+    else if (value == "hardlink") {
+      options.dedup_mode = DedupMode::Hardlink;
+    }
+    else {
+      std::cout << "ERROR: " << flag << " expects 'off', 'skip' or 'hardlink', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == EXCLUDE_FILE_FLAG) {
+    options.exclude_files.push_back(value);
+  }
+  else if (flag == VERBOSITY_FLAG) {
+    if (value == "quiet") {
+      options.verbosity = Verbosity::Quiet;
+    }
+    else if (value == "progress") {
+      options.verbosity = Verbosity::Progress;
+    }
+    else if (value == "per-file") {
+      options.verbosity = Verbosity::PerFile;
+    }
+    else {
+      std::cout << "ERROR: " << flag << " expects 'quiet', 'progress' or 'per-file', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == LOG_FILE_FLAG) {
+    options.log_file = value;
+  }
+  else if (flag == ON_NESTED_FLAG) {
+    if (value == "ask") {
+      options.nested_folder_policy = NestedFolderPolicy::Ask;
+    }
+    else if (value == "skip") {
+      options.nested_folder_policy = NestedFolderPolicy::Skip;
+    }
+    else if (value == "quit") {
+      options.nested_folder_policy = NestedFolderPolicy::Quit;
+    }
+    else if (value == "recurse") {
+      options.nested_folder_policy = NestedFolderPolicy::Recurse;
+    }
+    else {
+      std::cout << "ERROR: " << flag << " expects 'ask', 'skip', 'quit' or 'recurse', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == REPORT_FLAG) {
+    options.report_file = value;
+  }
+  else if (flag == STREAM_FLAG) {
+    if (value == "off") {
+      options.stream_mode = StreamMode::Off;
+    }
+    else if (value == "fadvise") {
+      options.stream_mode = StreamMode::Fadvise;
+    }
+    else if (value == "direct") {
+      options.stream_mode = StreamMode::Direct;
+    }
+    else {
+      std::cout << "ERROR: " << flag << " expects 'off', 'fadvise' or 'direct', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == STREAM_THRESHOLD_FLAG) {
+    if (!parseSize(flag, value, options.stream_threshold)) {
+      return false;
+    }
+  }
+  else if (flag == BACKUP_STORE_FLAG) {
+    options.backup_store = value;
+  }
+  else if (flag == SORT_MEMORY_FLAG) {
+    if (!parseSize(flag, value, options.sort_memory)) {
+      return false;
+    }
+  }
+  else if (flag == PREALLOCATE_FLAG) {
+    if (value == "on") {
+      options.preallocate = true;
+    }
+    else if (value == "off") {
+      options.preallocate = false;
+    }
+    else {
+      std::cout << "ERROR: " << flag << " expects 'on' or 'off', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == ARCHIVE_COMPRESSION_FLAG) {
+    if (!TarWriter::parseCompressionName(value, options.archive_compression)) {
+      std::cout << "ERROR: " << flag << " expects 'auto', 'none', 'gzip', 'zstd' or 'xz', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == DURABILITY_FLAG) {
+    if (!parseDurabilityName(value, options.durability)) {
+      std::cout << "ERROR: " << flag << " expects 'none', 'batch', 'syncfs' or 'strict', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == WIDTH_GROWTH_FLAG) {
+    if (value == "rename") {
+      options.width_growth = WidthGrowthPolicy::Rename;
+    }
+    else if (value == "keep") {
+      options.width_growth = WidthGrowthPolicy::Keep;
+    }
+    else {
+      std::cout << "ERROR: " << flag << " expects 'rename' or 'keep', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == IN_PLACE_FLAG) {
+    if (value == "on") {
+      options.in_place = true;
+    }
+    else if (value == "off") {
+      options.in_place = false;
+    }
+    else {
+      std::cout << "ERROR: " << flag << " expects 'on' or 'off', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else if (flag == VERIFY_FLAG) {
+    if (value == "on") {
+      options.verify = true;
+    }
+    else if (value == "off") {
+      options.verify = false;
+    }
+    else {
+      std::cout << "ERROR: " << flag << " expects 'on' or 'off', got: \"" << value << "\"\n";
+      return false;
+    }
+  }
+  else {
+    std::cout << "ERROR: Unknown argument: " << flag << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Set one setting of a merge job, flags that are not job flags set the job's options
+ *
+ * @param flag flag naming the setting, e.g. "--folder" or "--mode"
+ * @param value value given with the flag
+ * @param job job to change
+ * 
+ * @return true if success ; false if the flag or its value was not understood
+ */
+bool parseJobOption(const std::string& flag, const std::string& value, MergeJob& job) {
+  if (flag == DIR_FLAG) {
+    job.directory = value;
+  }
+  else if (flag == FOLDER_FLAG) {
+    job.folders.push_back(value);
+  }
+  else if (flag == BACKUP_FLAG) {
+    job.backup_name = (value == NONE_VALUE) ? "" : value;
+  }
+  else if (flag == INDEX_FLAG) {
+    job.index_name = (value == NONE_VALUE) ? "" : value;
+  }
+  else if (flag == ARCHIVE_FLAG) {
+    job.archive_name = (value == NONE_VALUE) ? "" : value;
+  }
+  else if (flag == EXCLUDE_FLAG) {
+    job.excludes.push_back(value);
+  }
+  else if (flag == DRY_RUN_FLAG) {
+    job.dry_run = true;
+    job.plan_output = (value == NONE_VALUE) ? "" : value;
+  }
+  else if (flag == RUN_PLAN_FLAG) {
+    job.plan_file = value;
+  }
+  else if (flag == RESTORE_FLAG) {
+    job.restore_manifest = value;
+  }
+  else if (flag == WATCH_FLAG) {
+    if (!parseUnsigned(flag, value, job.watch_seconds)) {
+      return false;
+    }
+  }
+  else {
+    return parseOption(flag, value, job.options);
+  }
+
+  if (value.empty()) {
+    std::cout << "ERROR: " << flag << " expects a value\n";
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Fill a MergeOptions instance from the program's command line
+ *
+ * @param argc argument count passed to main
+ * @param argv argument list passed to main
+ * @param options options to fill, flags that are not given keep their current value
+ * 
+ * @return true if success ; false if an argument was not understood
+ */
+bool parseCommandLine(int argc, char* argv[], MergeOptions& options) {
+  for (int i = 1; i < argc; i++) {
+    // every flag takes exactly one value
+    if (i + 1 >= argc) {
+      std::cout << "ERROR: Unknown or incomplete argument: " << argv[i] << "\n";
+      return false;
+    }
+
+    if (!parseOption(argv[i], argv[i + 1], options)) {
+      return false;
+    }
+    i++;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Read the program's command line, including the flags of a merge job
+ *
+ * @param argc argument count passed to main
+ * @param argv argument list passed to main
+ * @param command_line where to store the options, job and job files
+ * 
+ * @return true if success ; false if an argument was not understood
+ */
+bool parseCommandLine(int argc, char* argv[], CommandLine& command_line) {
+  for (int i = 1; i < argc; i++) {
+    const std::string kArg = argv[i];
+
+    // every flag takes exactly one value
+    if (i + 1 >= argc) {
+      std::cout << "ERROR: Unknown or incomplete argument: " << kArg << "\n";
+      return false;
+    }
+    const std::string kValue = argv[++i];
+
+    if (kArg == JOB_FILE_FLAG) {
+      command_line.job_files.push_back(kValue);
+    }
+    else if (kArg == PARALLEL_JOBS_FLAG) {
+      if (!parseUnsigned(kArg, kValue, command_line.parallel_jobs)) {
+        return false;
+      }
+    }
+    else if (kArg == JOBS_PER_DEVICE_FLAG) {
+      if (!parseUnsigned(kArg, kValue, command_line.jobs_per_device)) {
+        return false;
+      }
+    }
+    else if (kArg == DIR_FLAG || kArg == FOLDER_FLAG || kArg == BACKUP_FLAG || kArg == INDEX_FLAG || kArg == ARCHIVE_FLAG || kArg == EXCLUDE_FLAG
+             || kArg == DRY_RUN_FLAG || kArg == RUN_PLAN_FLAG || kArg == WATCH_FLAG || kArg == RESTORE_FLAG) {
+      if (!parseJobOption(kArg, kValue, command_line.job)) {
+        return false;
+      }
+      command_line.has_job = true;
+    }
+    else if (!parseOption(kArg, kValue, command_line.options)) {
+      return false;
+    }
+  }
+
+  // the job uses the options no matter where they were given
+  command_line.job.options = command_line.options;
+  return true;
+}
@@ -0,0 +1,70 @@
+#ifndef COMMAND_LINE_HPP
+#define COMMAND_LINE_HPP
+
+#include <vector>
+#include <string>
+#include <filesystem>
+
+#include "merge_options.hpp"
+#include "merge_job.hpp"
+
+// Command line flags
+const char* const THREADS_FLAG = "--threads";
+const char* const MODE_FLAG = "--mode";
+const char* const BACKUP_BACKEND_FLAG = "--backup-backend";
+const char* const IO_URING_FLAG = "--io-uring";
+const char* const DEDUP_FLAG = "--dedup";
+const char* const EXCLUDE_FILE_FLAG = "--exclude-file";
+const char* const VERBOSITY_FLAG = "--verbosity";
+const char* const LOG_FILE_FLAG = "--log-file";
+const char* const ON_NESTED_FLAG = "--on-nested";
+const char* const REPORT_FLAG = "--report";
+const char* const VERIFY_FLAG = "--verify";
+const char* const STREAM_FLAG = "--stream";
+const char* const STREAM_THRESHOLD_FLAG = "--stream-threshold";
+const char* const PREALLOCATE_FLAG = "--preallocate";
+const char* const WIDTH_GROWTH_FLAG = "--on-width-growth";
+const char* const ARCHIVE_COMPRESSION_FLAG = "--archive-compression";
+const char* const DURABILITY_FLAG = "--durability";
+const char* const SORT_MEMORY_FLAG = "--sort-memory";
+const char* const BACKUP_STORE_FLAG = "--backup-store";
+const char* const IN_PLACE_FLAG = "--in-place";
+
+// Flags of a merge job, any of them runs fmerge without prompts
+const char* const DIR_FLAG = "--dir";
+const char* const FOLDER_FLAG = "--folder";
+const char* const BACKUP_FLAG = "--backup";
+const char* const INDEX_FLAG = "--index";
+const char* const ARCHIVE_FLAG = "--archive";
+const char* const EXCLUDE_FLAG = "--exclude";
+const char* const JOB_FILE_FLAG = "--job-file";
+const char* const DRY_RUN_FLAG = "--dry-run";
+const char* const RUN_PLAN_FLAG = "--run-plan";
+const char* const WATCH_FLAG = "--watch";
+const char* const RESTORE_FLAG = "--restore";
+
+// Flags for running several jobs at once
+const char* const PARALLEL_JOBS_FLAG = "--parallel-jobs";
+const char* const JOBS_PER_DEVICE_FLAG = "--jobs-per-device";
+
+// Value of BACKUP_FLAG, INDEX_FLAG, ARCHIVE_FLAG and DRY_RUN_FLAG that turns them off
+const char* const NONE_VALUE = "none";
+
+// Everything given on the command line
+struct CommandLine {
+  MergeOptions options; // Options for the interactive merge, and the defaults of every job file
+  MergeJob job; // Job made of the job flags on the command line
+  bool has_job = false;
+  std::vector<std::filesystem::path> job_files;
+  unsigned int parallel_jobs = 1; // Jobs run at the same time
+  unsigned int jobs_per_device = 0; // Jobs run at the same time on one disk, 0 = 1 on hard drives, 4 on anything else
+
+  bool isHeadless() const { return has_job || !job_files.empty(); }
+};
+
+bool parseOption(const std::string& flag, const std::string& value, MergeOptions& options);
+bool parseJobOption(const std::string& flag, const std::string& value, MergeJob& job);
+bool parseCommandLine(int argc, char* argv[], MergeOptions& options);
+bool parseCommandLine(int argc, char* argv[], CommandLine& command_line);
+
+#endif // COMMAND_LINE_HPP
@@ -0,0 +1,575 @@
+#include "copy_backend.hpp"
+
+#include <vector>
+#include <fstream>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "file_hash.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#endif
+
+#ifdef __linux__
+static const size_t STREAM_CHUNK_SIZE = 8 * 1024 * 1024; // Bytes read and written at a time by streamCopy()
+static const size_t STREAM_ALIGNMENT = 4096; // O_DIRECT needs the buffer, offsets and lengths aligned to the device's blocks
+#endif
+
+#ifdef __linux__
+/**
+ * @brief Open a source file for reading and create its destination with the same permissions
+ *
+ * @param source file to read from
+ * @param destination file to create or truncate
+ * @param source_fd set to the opened source descriptor
+ * @param destination_fd set to the opened destination descriptor
+ * @param ec set if either file cannot be opened
+ * 
+ * @return true if success ; false if error
+ */
+static bool openPair(const std::filesystem::path& source, const std::filesystem::path& destination,
+                     int& source_fd, int& destination_fd, std::error_code& ec) {
+  source_fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (source_fd < 0) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+
+  struct stat source_stat;
+  if (fstat(source_fd, &source_stat) != 0) {
+    ec.assign(errno, std::generic_category());
+    close(source_fd);
+    return false;
+  }
+
+  destination_fd = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, source_stat.st_mode & 07777);
+  if (destination_fd < 0) {
+    ec.assign(errno, std::generic_category());
+    close(source_fd);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Share the source's data blocks with the destination, only btrfs, XFS and similar support this
+ *
+ * @return true if success ; false if error
+ */
+static bool reflinkFile(const std::filesystem::path& source, const std::filesystem::path& destination, std::error_code& ec) {
+  int source_fd, destination_fd;
+  if (!openPair(source, destination, source_fd, destination_fd, ec)) {
+    return false;
+  }
+
+  if (ioctl(destination_fd, FICLONE, source_fd) != 0) {
+    ec.assign(errno, std::generic_category());
+  }
+
+  close(source_fd);
+  close(destination_fd);
+  return !ec;
+}
+
+/**
+ * @brief Copy a file inside the kernel without moving the data through user space
+ *
+ * @return true if success ; false if error
+ */
+static bool copyFileRange(const std::filesystem::path& source, const std::filesystem::path& destination, std::error_code& ec) {
+  int source_fd, destination_fd;
+  if (!openPair(source, destination, source_fd, destination_fd, ec)) {
+    return false;
+  }
+
+  while (true) {
+    const ssize_t kCopied = copy_file_range(source_fd, nullptr, destination_fd, nullptr, 1 << 30, 0);
+    if (kCopied == 0) {
+      break;
+    }
+    else if (kCopied < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ec.assign(errno, std::generic_category());
+      break;
+    }
+  }
+
+  close(source_fd);
+  close(destination_fd);
+  return !ec;
+}
+#endif
+
+#ifdef __linux__
+/**
+ * @brief Turn O_DIRECT on or off for an open file
+ *
+ * @return true if success ; false if the filesystem does not support O_DIRECT
+ */
+static bool setDirectIo(int fd, bool direct) {
+  const int kFlags = fcntl(fd, F_GETFL);
+  return kFlags >= 0 && fcntl(fd, F_SETFL, direct ? (kFlags | O_DIRECT) : (kFlags & ~O_DIRECT)) == 0;
+}
+
+/**
+ * @brief Read until the buffer is full or the file ends
+ *
+ * @return ssize_t bytes read, -1 on error with errno set
+ */
+static ssize_t readAt(int fd, char* buffer, size_t length, off_t offset) {
+  size_t done = 0;
+  while (done < length) {
+    const ssize_t kRead = pread(fd, buffer + done, length - done, offset + done);
+    if (kRead < 0 && errno == EINTR) {
+      continue;
+    }
+    else if (kRead < 0) {
+      return -1;
+    }
+    else if (kRead == 0) {
+      break;
+    }
+    done += static_cast<size_t>(kRead);
+  }
+
+  return static_cast<ssize_t>(done);
+}
+
+/**
+ * @brief Write a whole buffer
+ *
+ * @return true if success ; false on error with errno set
+ */
+static bool writeAt(int fd, const char* buffer, size_t length, off_t offset) {
+  size_t done = 0;
+  while (done < length) {
+    const ssize_t kWritten = pwrite(fd, buffer + done, length - done, offset + done);
+    if (kWritten < 0 && errno == EINTR) {
+      continue;
+    }
+    else if (kWritten < 0) {
+      return false;
+    }
+    done += static_cast<size_t>(kWritten);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Start writing a chunk back to disk, then wait for the chunk before it and drop both from the page cache
+ *
+ * The disk always has one chunk in flight while the next one is read, so dropping the cache costs little speed.
+ *
+ * @param offset start of the chunk that was just written
+ * @param length length of the chunk that was just written, 0 only waits for the pending chunk
+ * @param pending_offset start of the chunk still being written back, replaced by this chunk
+ * @param pending_length length of the chunk still being written back, replaced by this chunk
+ */
+static void writeBehind(int source_fd, int destination_fd, off_t offset, size_t length, off_t& pending_offset, size_t& pending_length) {
+  if (length > 0) {
+    sync_file_range(destination_fd, offset, static_cast<off_t>(length), SYNC_FILE_RANGE_WRITE);
+    posix_fadvise(source_fd, offset, static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+  }
+  if (pending_length > 0) {
+    sync_file_range(destination_fd, pending_offset, static_cast<off_t>(pending_length),
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(destination_fd, pending_offset, static_cast<off_t>(pending_length), POSIX_FADV_DONTNEED);
+  }
+
+  pending_offset = offset;
+  pending_length = length;
+}
+#endif
+
+/**
+ * @brief Add a run of zero bytes to a hash, the contents of a hole in a sparse file
+ *
+ * @param hasher hash to add to
+ * @param length number of zero bytes
+ */
+static void hashZeros(FileHasher& hasher, uint64_t length) {
+  static const char kZeros[64 * 1024] = {};
+  while (length > 0) {
+    const size_t kLength = static_cast<size_t>(std::min<uint64_t>(length, sizeof(kZeros)));
+    hasher.update(kZeros, kLength);
+    length -= kLength;
+  }
+}
+
+/**
+ * @brief Get a readable name of a copy backend
+ *
+ * @param backend backend to name
+ * 
+ * @return the name used on the command line
+ */
+const char* getBackendName(CopyBackend backend) {
+  switch (backend) {
+    case CopyBackend::Auto:          return "auto";
+    case CopyBackend::Reflink:       return "reflink";
+    case CopyBackend::CopyFileRange: return "copy-file-range";
+    case CopyBackend::Hardlink:      return "hardlink";
+    case CopyBackend::Copy:          return "copy";
+  }
+
+  return "unknown";
+}
+
+/**
+ * @brief Find the copy backend with the given name
+ *
+ * @param name name used on the command line
+ * @param backend set to the matching backend
+ * 
+ * @return true if success ; false if there is no backend with that name
+ */
+bool parseBackendName(const std::string& name, CopyBackend& backend) {
+  for (CopyBackend candidate : { CopyBackend::Auto, CopyBackend::Reflink, CopyBackend::CopyFileRange,
+                                 CopyBackend::Hardlink, CopyBackend::Copy }) {
+    if (name == getBackendName(candidate)) {
+      backend = candidate;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief Get the backends to try in order, cheapest first, always ending with a plain copy
+ *
+ * @param preferred backend chosen by the user, Auto tries every backend
+ * @param allow_hardlink false if the copies have to stay independent of their sources
+ * 
+ * @return std::vector<CopyBackend> list of backends to fall back through
+ */
+std::vector<CopyBackend> getBackendCandidates(CopyBackend preferred, bool allow_hardlink) {
+  std::vector<CopyBackend> candidates;
+
+  if (preferred == CopyBackend::Auto) {
+    candidates.push_back(CopyBackend::Reflink);
+    if (allow_hardlink) {
+      candidates.push_back(CopyBackend::Hardlink);
+    }
+    candidates.push_back(CopyBackend::CopyFileRange);
+  }
+  else if (preferred != CopyBackend::Copy && (preferred != CopyBackend::Hardlink || allow_hardlink)) {
+    candidates.push_back(preferred);
+  }
+
+  candidates.push_back(CopyBackend::Copy);
+  return candidates;
+}
+
+/**
+ * @brief Check if an error means a backend cannot be used here, rather than that the file itself is bad
+ *
+ * @param ec error returned by copyWithBackend()
+ * 
+ * @return true if the next backend should be tried
+ */
+bool isUnsupportedError(const std::error_code& ec) {
+  return ec == std::errc::operation_not_supported
+      || ec == std::errc::function_not_supported
+      || ec == std::errc::not_supported
+      || ec == std::errc::cross_device_link
+      || ec == std::errc::invalid_argument
+      || ec == std::errc::inappropriate_io_control_operation
+      || ec == std::errc::too_many_links
+      || ec == std::errc::operation_not_permitted;
+}
+
+/**
+ * @brief Copy a single file using a specific backend, overwriting the destination
+ *
+ * @param backend how to copy the data, must not be Auto
+ * @param source file to copy
+ * @param destination where to put the copy
+ * @param ec set if the copy failed
+ * 
+ * @return true if success ; false if error
+ */
+bool copyWithBackend(CopyBackend backend, const std::filesystem::path& source, const std::filesystem::path& destination, std::error_code& ec) {
+  ec.clear();
+
+  switch (backend) {
+    case CopyBackend::Reflink: {
+#ifdef __linux__
+      return reflinkFile(source, destination, ec);
+#else
+      ec = std::make_error_code(std::errc::not_supported);
+      return false;
+#endif
+    }
+    case CopyBackend::CopyFileRange: {
+#ifdef __linux__
+      return copyFileRange(source, destination, ec);
+#else
+      ec = std::make_error_code(std::errc::not_supported);
+      return false;
+#endif
+    }
+    case CopyBackend::Hardlink: {
+      std::filesystem::remove(destination, ec);
+      std::filesystem::create_hard_link(source, destination, ec);
+      return !ec;
+    }
+    case CopyBackend::Copy: {
+      std::filesystem::copy_file(source, destination, std::filesystem::copy_options::overwrite_existing, ec);
+      return !ec;
+    }
+    case CopyBackend::Auto: {
+      break;
+    }
+  }
+
+  ec = std::make_error_code(std::errc::invalid_argument);
+  return false;
+}
+
+/**
+ * @brief Copy a file through a buffer in user space and hash the bytes on their way through, so neither file is read twice
+ *
+ * @param source file to copy
+ * @param destination file to create or overwrite, gets the source's permissions
+ * @param hashes set to the hash of every byte read from the source and of every byte the destination accepted
+ * @param ec set if either file cannot be read or written
+ * 
+ * @return true if success ; false if error
+ */
+bool copyAndHash(const std::filesystem::path& source, const std::filesystem::path& destination, CopyHashes& hashes, std::error_code& ec) {
+  ec.clear();
+  thread_local std::vector<char> buffer(256 * 1024);
+  FileHasher source_hasher;
+  FileHasher destination_hasher;
+
+#ifdef __linux__
+  int source_fd, destination_fd;
+  if (!openPair(source, destination, source_fd, destination_fd, ec)) {
+    return false;
+  }
+
+  while (!ec) {
+    const ssize_t kRead = read(source_fd, buffer.data(), buffer.size());
+    if (kRead == 0) {
+      break;
+    }
+    else if (kRead < 0) {
+      if (errno != EINTR) {
+        ec.assign(errno, std::generic_category());
+      }
+      continue;
+    }
+    source_hasher.update(buffer.data(), static_cast<size_t>(kRead));
+
+    ssize_t written = 0;
+    while (written < kRead) {
+      const ssize_t kWritten = write(destination_fd, buffer.data() + written, static_cast<size_t>(kRead - written));
+      if (kWritten < 0 && errno != EINTR) {
+        ec.assign(errno, std::generic_category());
+        break;
+      }
+      else if (kWritten > 0) {
+        destination_hasher.update(buffer.data() + written, static_cast<size_t>(kWritten));
+        written += kWritten;
+      }
+    }
+  }
+
+  close(source_fd);
+  if (close(destination_fd) != 0 && !ec) {
+    ec.assign(errno, std::generic_category());
+  }
+#else
+  std::ifstream ifstream(source, std::ios_base::binary);
+  std::ofstream ofstream(destination, std::ios_base::binary | std::ios_base::trunc);
+  if (!ifstream.is_open() || !ofstream.is_open()) {
+    ec = std::make_error_code(std::errc::io_error);
+    return false;
+  }
+
+  while (ifstream) {
+    ifstream.read(buffer.data(), buffer.size());
+    const std::streamsize kRead = ifstream.gcount();
+    source_hasher.update(buffer.data(), static_cast<size_t>(kRead));
+    if (ofstream.write(buffer.data(), kRead)) {
+      destination_hasher.update(buffer.data(), static_cast<size_t>(kRead));
+    }
+  }
+
+  ofstream.close();
+  if (ifstream.bad() || ofstream.fail()) {
+    ec = std::make_error_code(std::errc::io_error);
+  }
+  else {
+    std::filesystem::permissions(destination, std::filesystem::status(source).permissions(), ec);
+  }
+#endif
+
+  hashes.source = source_hasher.digest();
+  hashes.destination = destination_hasher.digest();
+  return !ec;
+}
+
+/**
+ * @brief Copy a big file in large chunks without filling the page cache, keeping the holes of a sparse file
+ *
+ * With StreamMode::Fadvise every chunk is written back to disk as soon as the next one is read, and both the source's
+ * and the copy's chunks are dropped from the page cache. StreamMode::Direct reads and writes around the cache with
+ * O_DIRECT, and falls back to Fadvise on filesystems that refuse it. Outside of Linux it is a plain copy.
+ *
+ * @param source file to copy
+ * @param destination file to create or overwrite, gets the source's permissions
+ * @param mode how the page cache is avoided, Off is treated like Fadvise
+ * @param preallocate reserve the whole file before writing, so it ends up in few extents. Skipped for sparse sources
+ * @param hashes set to the hashes of the bytes read and written if not null, holes are hashed as the zeros they read as
+ * @param ec set if either file cannot be read or written
+ * 
+ * @return true if success ; false if error
+ */
+bool streamCopy(const std::filesystem::path& source, const std::filesystem::path& destination, StreamMode mode, bool preallocate,
+                CopyHashes* hashes, std::error_code& ec) {
+  ec.clear();
+
+#ifdef __linux__
+  thread_local std::unique_ptr<char, void (*)(void*)> buffer(nullptr, std::free);
+  if (!buffer) {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, STREAM_ALIGNMENT, STREAM_CHUNK_SIZE) != 0) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+      return false;
+    }
+    buffer.reset(static_cast<char*>(memory));
+  }
+
+  int source_fd, destination_fd;
+  if (!openPair(source, destination, source_fd, destination_fd, ec)) {
+    return false;
+  }
+
+  struct stat source_stat;
+  if (fstat(source_fd, &source_stat) != 0) {
+    ec.assign(errno, std::generic_category());
+    close(source_fd);
+    close(destination_fd);
+    return false;
+  }
+  const off_t kSize = source_stat.st_size;
+
+  // set after opening, so a filesystem without O_DIRECT (tmpfs, many network shares) only loses the flag
+  bool direct = (mode == StreamMode::Direct && setDirectIo(source_fd, true) && setDirectIo(destination_fd, true));
+  if (mode == StreamMode::Direct && !direct) {
+    setDirectIo(source_fd, false);
+  }
+  posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  // a sparse source would have its holes filled in
+  const bool kSparse = (static_cast<off_t>(source_stat.st_blocks) * 512 < kSize);
+  if (preallocate && !kSparse && kSize > 0) {
+    fallocate(destination_fd, FALLOC_FL_KEEP_SIZE, 0, kSize); // only a hint, not every filesystem supports it
+  }
+
+  FileHasher source_hasher;
+  FileHasher destination_hasher;
+  off_t hashed = 0; // everything before this was added to the hashes
+  off_t pending_offset = 0;
+  size_t pending_length = 0;
+  off_t position = 0;
+  while (!ec && position < kSize) {
+    // skip to the next data, holes read as zeros and are left as holes in the copy
+    off_t data_start = lseek(source_fd, position, SEEK_DATA);
+    off_t data_end = kSize;
+    if (data_start < 0 && errno == ENXIO) { // only a hole is left
+      break;
+    }
+    else if (data_start < 0) { // the filesystem cannot tell, copy everything
+      data_start = position;
+    }
+    else {
+      data_end = std::min(lseek(source_fd, data_start, SEEK_HOLE), kSize);
+      data_end = (data_end < data_start) ? kSize : data_end;
+    }
+
+    for (off_t offset = data_start; !ec && offset < data_end;) {
+      const size_t kLength = static_cast<size_t>(std::min<off_t>(STREAM_CHUNK_SIZE, data_end - offset));
+      // O_DIRECT only moves whole blocks, the padding past the end of the file is cut off again below
+      const size_t kIoLength = direct ? (kLength + STREAM_ALIGNMENT - 1) / STREAM_ALIGNMENT * STREAM_ALIGNMENT : kLength;
+
+      const ssize_t kRead = readAt(source_fd, buffer.get(), kIoLength, offset);
+      const size_t kData = (kRead > 0) ? std::min(static_cast<size_t>(kRead), kLength) : 0;
+      if (kRead >= 0 && direct) {
+        std::memset(buffer.get() + kRead, 0, kIoLength - static_cast<size_t>(kRead));
+      }
+
+      const bool kFailed = (kRead < 0 || !writeAt(destination_fd, buffer.get(), direct ? kIoLength : kData, offset));
+      if (kFailed && errno == EINVAL && direct) { // the file's blocks are not aligned the way O_DIRECT needs
+        direct = false;
+        setDirectIo(source_fd, false);
+        setDirectIo(destination_fd, false);
+        continue;
+      }
+
+      if (hashes != nullptr && kData > 0) {
+        hashZeros(source_hasher, static_cast<uint64_t>(offset - hashed));
+        source_hasher.update(buffer.get(), kData);
+      }
+      if (kFailed) {
+        ec.assign(errno, std::generic_category());
+        break;
+      }
+      else if (kData == 0) { // the source got shorter while it was copied
+        data_end = offset;
+        break;
+      }
+
+      if (hashes != nullptr) {
+        hashZeros(destination_hasher, static_cast<uint64_t>(offset - hashed));
+        destination_hasher.update(buffer.get(), kData);
+        hashed = offset + static_cast<off_t>(kData);
+      }
+      if (!direct) {
+        writeBehind(source_fd, destination_fd, offset, kData, pending_offset, pending_length);
+      }
+      offset += static_cast<off_t>(kData);
+    }
+    position = data_end;
+  }
+
+  writeBehind(source_fd, destination_fd, 0, 0, pending_offset, pending_length);
+
+  // sets the size after a trailing hole, and cuts off the O_DIRECT padding
+  if (!ec && ftruncate(destination_fd, kSize) != 0) {
+    ec.assign(errno, std::generic_category());
+  }
+  if (hashes != nullptr) {
+    hashZeros(source_hasher, static_cast<uint64_t>(kSize - hashed));
+    hashZeros(destination_hasher, static_cast<uint64_t>(kSize - hashed));
+    hashes->source = source_hasher.digest();
+    hashes->destination = destination_hasher.digest();
+  }
+
+  close(source_fd);
+  if (close(destination_fd) != 0 && !ec) {
+    ec.assign(errno, std::generic_category());
+  }
+  return !ec;
+#else
+  (void)mode;
+  (void)preallocate;
+  if (hashes != nullptr) {
+    return copyAndHash(source, destination, *hashes, ec);
+  }
+  return copyWithBackend(CopyBackend::Copy, source, destination, ec);
+#endif
+}
@@ -0,0 +1,23 @@
+#ifndef COPY_BACKEND_HPP
+#define COPY_BACKEND_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+
+#include "merge_options.hpp"
+#include "file_hash.hpp"
+
+const char* getBackendName(CopyBackend backend);
+bool parseBackendName(const std::string& name, CopyBackend& backend);
+
+std::vector<CopyBackend> getBackendCandidates(CopyBackend preferred, bool allow_hardlink);
+bool isUnsupportedError(const std::error_code& ec);
+bool streamCopy(const std::filesystem::path& source, const std::filesystem::path& destination, StreamMode mode, bool preallocate,
+                CopyHashes* hashes, std::error_code& ec);
+bool copyAndHash(const std::filesystem::path& source, const std::filesystem::path& destination, CopyHashes& hashes, std::error_code& ec);
+bool copyWithBackend(CopyBackend backend, const std::filesystem::path& source, const std::filesystem::path& destination, std::error_code& ec);
+
+#endif // COPY_BACKEND_HPP
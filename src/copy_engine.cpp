@@ -0,0 +1,312 @@
+#include "copy_engine.hpp"
+
+#include <iostream>
+#include <system_error>
+#include <algorithm>
+
+#include "copy_backend.hpp"
+#include "uring_copier.hpp"
+#include "file_hash.hpp"
+#include "durability.hpp"
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/ 
+
+/**
+ * @brief Check if a file is big enough to be copied with streamCopy()
+ *
+ * @param task copy to check
+ * 
+ * @return true if it should stay out of the page cache ; false if a reflink or hardlink copies no data anyway
+ */
+bool CopyEngine::isStreamed(const CopyTask& task) const {
+  const CopyBackend kBackend = getActiveBackend();
+  return m_stream_mode != StreamMode::Off && task.size >= m_stream_threshold
+      && kBackend != CopyBackend::Reflink && kBackend != CopyBackend::Hardlink;
+}
+
+/**
+ * @brief Copy one file, overwriting whatever is at the destination
+ *
+ * @param task source and destination of the copy
+ * @param verified set to false if verifying is on and the copy does not match the source
+ * 
+ * @return true if success ; false if error
+ */
+bool CopyEngine::copyFile(const CopyTask& task, bool& verified) {
+  std::error_code ec;
+  const std::filesystem::path kSource = task.source.path();
+  const std::filesystem::path kDestination = task.destination.path();
+
+  if (isStreamed(task)) {
+    CopyHashes hashes;
+    if (!streamCopy(kSource, kDestination, m_stream_mode, m_preallocate, m_verify ? &hashes : nullptr, ec)) {
+      std::lock_guard<std::mutex> lock(m_output_mutex);
+      *m_console << "ERROR: Cannot copy " << task.source.filename() << " to "
+                << task.destination.filename() << ": " << ec.message() << "\n";
+      return false;
+    }
+
+    verified = !m_verify || verifyCopy(task, hashes);
+    return true;
+  }
+
+  // a plain copy can move the bytes through here, so they are hashed on their way instead of being read again
+  if (m_verify && getActiveBackend() == CopyBackend::Copy) {
+    CopyHashes hashes;
+    if (!copyAndHash(kSource, kDestination, hashes, ec)) {
+      std::lock_guard<std::mutex> lock(m_output_mutex);
+      *m_console << "ERROR: Cannot copy " << task.source.filename() << " to "
+                << task.destination.filename() << ": " << ec.message() << "\n";
+      return false;
+    }
+
+    verified = verifyCopy(task, hashes);
+    return true;
+  }
+
+  size_t backend_idx = m_backend_idx;
+
+  while (!copyWithBackend(m_backends[backend_idx], kSource, kDestination, ec)) {
+    if (!isUnsupportedError(ec) || backend_idx + 1 >= m_backends.size()) {
+      std::lock_guard<std::mutex> lock(m_output_mutex);
+      *m_console << "ERROR: Cannot copy " << task.source.filename() << " to "
+                << task.destination.filename() << ": " << ec.message() << "\n";
+      return false;
+    }
+
+    // the filesystem does not support this backend, every worker moves on to the next one
+    std::error_code remove_ec;
+    std::filesystem::remove(kDestination, remove_ec);
+
+    size_t expected = backend_idx;
+    m_backend_idx.compare_exchange_strong(expected, backend_idx + 1);
+    backend_idx++;
+  }
+
+  // reflinks and copy_file_range copy inside the kernel, no byte came through here to hash
+  if (m_verify && m_backends[backend_idx] != CopyBackend::Hardlink) {
+    CopyHashes hashes;
+    verified = rereadCopy(task, hashes) && verifyCopy(task, hashes);
+  }
+  return true;
+}
+
+/**
+ * @brief Rename one file to its destination, falls back to a copy if the destination is on another device
+ *
+ * @param task source and destination of the move
+ * @param verified set to false if the move fell back to a copy that does not match the source
+ * 
+ * @return true if success ; false if error
+ */
+bool CopyEngine::moveFile(const CopyTask& task, bool& verified) {
+  std::error_code ec;
+  std::filesystem::rename(task.source.path(), task.destination.path(), ec);
+
+  if (ec == std::errc::cross_device_link) {
+    // source is removed when the merge is confirmed, same as in copy mode
+    return copyFile(task, verified);
+  }
+  else if (ec) {
+    std::lock_guard<std::mutex> lock(m_output_mutex);
+    *m_console << "ERROR: Cannot move " << task.source.filename() << " to "
+              << task.destination.filename() << ": " << ec.message() << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Hardlink a destination to its source, falls back to a copy if the filesystem cannot link
+ *
+ * @param task source and destination of the link, the source is never moved
+ * 
+ * @return true if success ; false if error
+ */
+bool CopyEngine::linkFile(const CopyTask& task) {
+  std::error_code ec;
+  const std::filesystem::path kSource = task.source.path();
+  const std::filesystem::path kDestination = task.destination.path();
+  if (copyWithBackend(CopyBackend::Hardlink, kSource, kDestination, ec)) {
+    return true;
+  }
+  else if (isUnsupportedError(ec) && copyWithBackend(CopyBackend::Copy, kSource, kDestination, ec)) {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(m_output_mutex);
+  *m_console << "ERROR: Cannot link " << task.destination.filename() << " to "
+            << task.source.filename() << ": " << ec.message() << "\n";
+  return false;
+}
+
+/**
+ * @brief Check a finished copy against the hashes taken while it was copied, nothing is read
+ *
+ * @param task source and destination of the copy
+ * @param hashes hashes of the bytes read from the source and written to the destination
+ * 
+ * @return true if the destination got the bytes of the source ; false if they differ
+ */
+bool CopyEngine::verifyCopy(const CopyTask& task, const CopyHashes& hashes) {
+  if (hashes.source == hashes.destination) {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(m_output_mutex);
+  *m_console << "ERROR: The copy of " << task.source.filename() << " in " << task.destination.filename() << " does not match the source\n";
+  return false;
+}
+
+/**
+ * @brief Hash both files of a copy the kernel made, used for the backends that do not pass the bytes through a buffer
+ *
+ * @param task source and destination of the copy
+ * @param hashes set to the hashes of the source and the destination
+ * 
+ * @return true if success ; false if either file cannot be read
+ */
+bool CopyEngine::rereadCopy(const CopyTask& task, CopyHashes& hashes) {
+  std::error_code ec;
+  if (hashFile(task.source.path(), hashes.source, ec) && hashFile(task.destination.path(), hashes.destination, ec)) {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(m_output_mutex);
+  *m_console << "ERROR: The copy of " << task.source.filename() << " in " << task.destination.filename()
+            << " cannot be read back: " << ec.message() << "\n";
+  return false;
+}
+
+/**
+ * @brief Wait until a finished transfer is on the disk, used when every file has to be synced on its own
+ *
+ * @param task transfer to sync the destination of
+ * 
+ * @return true if success ; false if error
+ */
+bool CopyEngine::syncCopy(const CopyTask& task) {
+  std::error_code ec;
+  if (syncFile(task.destination.path(), ec)) {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(m_output_mutex);
+  *m_console << "ERROR: Cannot sync " << task.destination.filename() << " to the disk: " << ec.message() << "\n";
+  return false;
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/ 
+
+/**
+ * @brief Create a copy engine that runs its copies on a thread pool
+ *
+ * @param pool workers to copy with
+ * @param mode copy every file or rename them into place
+ * @param backends ways to copy a file's data, the first one that the filesystem supports is used
+ */
+CopyEngine::CopyEngine(ThreadPool& pool, TransferMode mode, std::vector<CopyBackend> backends)
+  : m_pool(pool), m_mode(mode), m_backends(std::move(backends)), m_backend_idx(0), m_console(&std::cout) {
+}
+
+/**
+ * @brief Copy or move every task in parallel, each worker takes the next task in the list until none are left
+ *
+ * Plain copies go through io_uring instead when useIoUring() was called and it is available, except for the big files
+ * that setStreaming() keeps out of the page cache. With setVerify() on, every copy is checked against the bytes hashed
+ * on their way through it, only the copies the kernel makes with a reflink or copy_file_range are read back. With
+ * syncEachFile() on, a file only counts as done once it is on the disk, links excepted.
+ *
+ * @param tasks list of files to transfer, none of the destinations may repeat
+ * @param on_task_done called from the worker with the task's index after each successful transfer, optional
+ * @param on_task_unverified called from the worker with the task's index, before on_task_done, if the copy does not
+ *                           match its source. The transfer still counts as successful, optional
+ * 
+ * @return true if every copy succeeded ; false if any copy failed
+ */
+bool CopyEngine::run(const std::vector<CopyTask>& tasks, const std::function<void(size_t)>& on_task_done,
+                     const std::function<void(size_t)>& on_task_unverified) {
+  std::atomic<bool> success(true);
+  std::vector<size_t> pool_tasks;
+  pool_tasks.reserve(tasks.size());
+
+  const bool kTryUring = (m_uring_depth > 0 && m_mode == TransferMode::Copy && getActiveBackend() == CopyBackend::Copy);
+  std::vector<size_t> uring_tasks;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (kTryUring && !tasks[i].link && !isStreamed(tasks[i])) {
+      uring_tasks.push_back(i);
+    }
+    else {
+      pool_tasks.push_back(i);
+    }
+  }
+
+  if (!uring_tasks.empty()) {
+    UringCopier copier(m_uring_depth);
+    copier.hashWhileCopying(m_verify);
+    copier.syncEachFile(m_sync_each_file);
+    if (copier.isAvailable()) {
+      copier.run(tasks, uring_tasks, [&](size_t idx, const std::error_code& ec, const CopyHashes& hashes) {
+        if (ec) {
+          std::lock_guard<std::mutex> lock(m_output_mutex);
+          *m_console << "ERROR: Cannot copy " << tasks[idx].source.filename() << " to "
+                    << tasks[idx].destination.filename() << ": " << ec.message() << "\n";
+          success = false;
+          return;
+        }
+
+        if (m_verify && !verifyCopy(tasks[idx], hashes) && on_task_unverified) {
+          on_task_unverified(idx);
+        }
+        if (on_task_done) {
+          on_task_done(idx);
+        }
+      });
+    }
+    else {
+      *m_console << "io_uring is not available, copying on " << m_pool.size() << " threads instead." << std::endl;
+      pool_tasks.insert(pool_tasks.end(), uring_tasks.begin(), uring_tasks.end());
+      std::sort(pool_tasks.begin(), pool_tasks.end());
+    }
+  }
+
+  std::atomic<size_t> next_task(0);
+  TaskGroup group(m_pool);
+  for (unsigned int i = 0; i < m_pool.size(); i++) {
+    group.submit([&] {
+      size_t next;
+      while ((next = next_task.fetch_add(1, std::memory_order_relaxed)) < pool_tasks.size()) {
+        size_t idx = pool_tasks[next];
+        const CopyTask& task = tasks[idx];
+        bool transferred;
+        bool verified = true;
+        if (task.link) {
+          transferred = linkFile(task);
+        }
+        else {
+          transferred = (m_mode == TransferMode::Move) ? moveFile(task, verified) : copyFile(task, verified);
+        }
+
+        if (!transferred || (m_sync_each_file && !task.link && !syncCopy(task))) {
+          success = false;
+          continue;
+        }
+        else if (!verified && on_task_unverified) {
+          on_task_unverified(idx);
+        }
+
+        if (on_task_done) {
+          on_task_done(idx);
+        }
+      }
+    });
+  }
+
+  group.wait();
+  return success;
+}
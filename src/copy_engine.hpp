@@ -0,0 +1,64 @@
+#ifndef COPY_ENGINE_HPP
+#define COPY_ENGINE_HPP
+
+#include <cstdint>
+#include <vector>
+#include <filesystem>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <ostream>
+
+#include "thread_pool.hpp"
+#include "merge_options.hpp"
+#include "path_table.hpp"
+#include "file_hash.hpp"
+
+// A single file to copy, destination names are decided before any copy starts
+struct CopyTask {
+  FilePath source;
+  FilePath destination;
+  bool link = false; // Hardlink the destination to the source instead, used for duplicate files
+  uint64_t size = 0; // Size of the source in bytes, 0 if unknown
+};
+
+class CopyEngine {
+ private:
+  // vars
+  ThreadPool& m_pool;
+  TransferMode m_mode;
+  std::vector<CopyBackend> m_backends; // Backends to fall back through, cheapest first
+  std::atomic<size_t> m_backend_idx; // First backend that has not been found unsupported
+  unsigned int m_uring_depth = 0; // Files copied at once through io_uring, 0 = copy on the pool
+  bool m_verify = false; // Hash the bytes of every copy on their way through and check the destination got the source's
+  StreamMode m_stream_mode = StreamMode::Off; // How files of at least m_stream_threshold bytes are copied
+  uint64_t m_stream_threshold = 0;
+  bool m_preallocate = true;
+  bool m_sync_each_file = false; // Sync every copied or moved file to the disk before it counts as done
+  std::mutex m_output_mutex; // Keeps error messages from different workers apart
+  std::ostream* m_console; // Where errors are written
+
+  // funcs
+  bool isStreamed(const CopyTask& task) const;
+  bool copyFile(const CopyTask& task, bool& verified);
+  bool moveFile(const CopyTask& task, bool& verified);
+  bool linkFile(const CopyTask& task);
+  bool verifyCopy(const CopyTask& task, const CopyHashes& hashes);
+  bool rereadCopy(const CopyTask& task, CopyHashes& hashes);
+  bool syncCopy(const CopyTask& task);
+
+ public:
+  CopyEngine(ThreadPool& pool, TransferMode mode = TransferMode::Copy, std::vector<CopyBackend> backends = { CopyBackend::Copy });
+
+  CopyBackend getActiveBackend() const { return m_backends[m_backend_idx]; }
+  void useIoUring(unsigned int queue_depth) { m_uring_depth = queue_depth; }
+  void setVerify(bool verify) { m_verify = verify; }
+  void setStreaming(StreamMode mode, uint64_t threshold, bool preallocate) { m_stream_mode = mode; m_stream_threshold = threshold; m_preallocate = preallocate; }
+  void syncEachFile(bool sync) { m_sync_each_file = sync; }
+  void setConsole(std::ostream& console) { m_console = &console; }
+
+  bool run(const std::vector<CopyTask>& tasks, const std::function<void(size_t)>& on_task_done = nullptr,
+           const std::function<void(size_t)>& on_task_unverified = nullptr);
+};
+
+#endif // COPY_ENGINE_HPP
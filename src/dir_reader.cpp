@@ -0,0 +1,153 @@
+#include "dir_reader.hpp"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <cstring>
+#include <cstddef>
+
+// Record written by getdents64, not every libc declares it
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+#endif
+
+/**
+ * @brief Open a folder for reading
+ *
+ * @param directory folder to read
+ * @param read_sizes also read the size of every file, costs one stat per file
+ * @param ec set if the folder cannot be opened
+ */
+DirReader::DirReader(const std::filesystem::path& directory, bool read_sizes, std::error_code& ec)
+  : m_directory(directory), m_read_sizes(read_sizes) {
+  ec.clear();
+
+#ifdef __linux__
+  m_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (m_fd < 0) {
+    ec.assign(errno, std::generic_category());
+    return;
+  }
+  m_buffer.reset(new char[M_BUFFER_SIZE]);
+#else
+  m_iterator = std::filesystem::directory_iterator(directory, ec);
+#endif
+}
+
+/**
+ * @brief Close the folder
+ */
+DirReader::~DirReader() {
+#ifdef __linux__
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+#endif
+}
+
+/**
+ * @brief Read the next entry, "." and ".." are left out
+ *
+ * @param entry set to the entry, its name stays valid until the next call
+ * @param ec set if the folder cannot be read any further
+ *
+ * @return true if there was an entry ; false once every entry was read or on error
+ */
+bool DirReader::next(DirEntry& entry, std::error_code& ec) {
+#ifdef __linux__
+  if (m_fd < 0) {
+    return false;
+  }
+
+  while (true) {
+    if (m_buffer_pos >= m_buffer_end) {
+      const long kRead = syscall(SYS_getdents64, m_fd, m_buffer.get(), M_BUFFER_SIZE);
+      if (kRead < 0) {
+        ec.assign(errno, std::generic_category());
+        return false;
+      }
+      else if (kRead == 0) {
+        return false;
+      }
+      m_buffer_pos = 0;
+      m_buffer_end = static_cast<size_t>(kRead);
+    }
+
+    const LinuxDirent64* dirent_ptr = reinterpret_cast<const LinuxDirent64*>(m_buffer.get() + m_buffer_pos);
+    m_buffer_pos += dirent_ptr->d_reclen;
+
+    const char* name = m_buffer.get() + (m_buffer_pos - dirent_ptr->d_reclen) + offsetof(LinuxDirent64, d_name);
+    if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+      continue;
+    }
+
+    entry.name = name;
+    entry.type = EntryType::Other;
+    entry.size = 0;
+    const unsigned char kDType = dirent_ptr->d_type;
+    entry.is_link = (kDType == DT_LNK);
+    const bool kNeedsStat = (kDType == DT_UNKNOWN || kDType == DT_LNK) || (kDType == DT_REG && m_read_sizes);
+
+    if (kNeedsStat) {
+      // follow symlinks, like std::filesystem::is_directory() does. A listing without types does not tell links
+      // apart, so the entry itself is looked at first
+      struct stat entry_stat;
+      int stat_result = fstatat(m_fd, name, &entry_stat, kDType == DT_UNKNOWN ? AT_SYMLINK_NOFOLLOW : 0);
+      if (stat_result == 0 && kDType == DT_UNKNOWN && S_ISLNK(entry_stat.st_mode)) {
+        entry.is_link = true;
+        stat_result = fstatat(m_fd, name, &entry_stat, 0);
+      }
+      if (stat_result == 0) {
+        if (S_ISDIR(entry_stat.st_mode)) {
+          entry.type = EntryType::Directory;
+        }
+        else if (S_ISREG(entry_stat.st_mode)) {
+          entry.type = EntryType::File;
+          entry.size = static_cast<uint64_t>(entry_stat.st_size);
+        }
+      }
+    }
+    else if (kDType == DT_DIR) {
+      entry.type = EntryType::Directory;
+    }
+    else if (kDType == DT_REG) {
+      entry.type = EntryType::File;
+    }
+    return true;
+  }
+#else
+  if (m_iterator == std::filesystem::directory_iterator()) {
+    return false;
+  }
+
+  const std::filesystem::directory_entry& kEntry = *m_iterator;
+  std::error_code entry_ec;
+  m_name = kEntry.path().filename().string();
+  entry.name = m_name;
+  entry.type = EntryType::Other;
+  entry.size = 0;
+  entry.is_link = kEntry.is_symlink(entry_ec);
+
+  // directory_entry caches the type and size from the listing on Windows
+  if (kEntry.is_directory(entry_ec)) {
+    entry.type = EntryType::Directory;
+  }
+  else if (kEntry.is_regular_file(entry_ec)) {
+    entry.type = EntryType::File;
+    if (m_read_sizes) {
+      entry.size = kEntry.file_size(entry_ec);
+    }
+  }
+
+  m_iterator.increment(ec);
+  return true;
+#endif
+}
@@ -0,0 +1,57 @@
+#ifndef DIR_READER_HPP
+#define DIR_READER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <filesystem>
+#include <system_error>
+
+enum class EntryType : uint8_t {
+  File,
+  Directory,
+  Other
+};
+
+// One entry of a folder, as handed out by DirReader
+struct DirEntry {
+  std::string_view name; // Only valid until the next entry is read
+  EntryType type = EntryType::Other;
+  uint64_t size = 0; // File size in bytes, 0 for folders or if sizes were not read
+  bool is_link = false; // The entry is a symbolic link, type is the type of what it points to
+};
+
+// Reads the entries of one folder front to back, without keeping any of them
+//
+// On Linux the listing is read with getdents64 into one large buffer, so a folder of millions of entries takes a few
+// hundred syscalls instead of tens of thousands. The type of an entry comes from the listing where possible.
+class DirReader {
+ private:
+  // consts
+  static constexpr size_t M_BUFFER_SIZE = 1024 * 1024; // Bytes of directory entries read by one getdents64 call
+
+  // vars
+  std::filesystem::path m_directory;
+  bool m_read_sizes;
+#ifdef __linux__
+  int m_fd = -1;
+  std::unique_ptr<char[]> m_buffer; // Never initialized, only the part the kernel fills is touched
+  size_t m_buffer_pos = 0;
+  size_t m_buffer_end = 0;
+#else
+  std::filesystem::directory_iterator m_iterator;
+  std::string m_name; // Name of the last entry, m_iterator's path only gives a copy
+#endif
+
+ public:
+  DirReader(const std::filesystem::path& directory, bool read_sizes, std::error_code& ec);
+  ~DirReader();
+
+  DirReader(const DirReader&) = delete;
+  DirReader& operator=(const DirReader&) = delete;
+
+  const std::filesystem::path& getDirectory() const { return m_directory; }
+  bool next(DirEntry& entry, std::error_code& ec);
+};
+
+#endif // DIR_READER_HPP
@@ -0,0 +1,141 @@
+#include "dir_snapshot.hpp"
+
+#include <algorithm>
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/ 
+
+/**
+ * @brief Read every entry of a folder with a DirReader
+ *
+ * @param directory folder to read
+ * @param read_sizes also read the size of every file, costs one stat per file
+ * @param ec set if the folder cannot be read
+ */
+DirSnapshot::DirSnapshot(const std::filesystem::path& directory, bool read_sizes, std::error_code& ec)
+  : m_directory(directory) {
+  ec.clear();
+
+  DirReader reader(directory, read_sizes, ec);
+  DirEntry entry;
+  while (reader.next(entry, ec)) {
+    addEntry(entry.name, entry.type, entry.size, entry.is_link);
+  }
+}
+
+/**
+ * @brief Get the extension of an entry, the same one std::filesystem::path::extension() gives
+ *
+ * @param idx entry to get the extension of
+ *
+ * @return std::string_view extension with its dot, e.g. ".png", empty if it has none or the name starts with its only dot
+ */
+std::string_view DirSnapshot::getExtension(size_t idx) const {
+  const std::string_view kName = getName(idx);
+  const size_t kDot = kName.rfind('.');
+  if (kDot == std::string_view::npos || kDot == 0 || kName == "..") {
+    return std::string_view();
+  }
+  return kName.substr(kDot);
+}
+
+/**
+ * @brief Add up the size of every file in the snapshot
+ *
+ * @return total number of bytes
+ */
+uint64_t DirSnapshot::getTotalSize() const {
+  uint64_t total = 0;
+  for (const auto& entry : m_entries) {
+    total += entry.size;
+  }
+
+  return total;
+}
+
+/**
+ * @brief Remove every entry, the memory is kept for the next ones
+ */
+void DirSnapshot::clear() {
+  m_entries.clear();
+  m_names.clear();
+}
+
+/**
+ * @brief Put the entries in natural name order, so the order no longer depends on the filesystem
+ */
+void DirSnapshot::sortByName() {
+  std::sort(m_entries.begin(), m_entries.end(), [this](const SnapshotEntry& a, const SnapshotEntry& b) {
+    return isNaturallyBefore(std::string_view(m_names).substr(a.name_offset, a.name_length),
+                             std::string_view(m_names).substr(b.name_offset, b.name_length));
+  });
+}
+
+/**
+ * @brief Append an entry to the table
+ *
+ * @param name filename of the entry
+ * @param type file, folder or anything else
+ * @param size size in bytes
+ * @param is_link the entry is a symbolic link, type is the type of what it points to
+ */
+void DirSnapshot::addEntry(std::string_view name, EntryType type, uint64_t size, bool is_link) {
+  SnapshotEntry entry;
+  entry.size = size;
+  entry.name_offset = static_cast<uint32_t>(m_names.size());
+  entry.name_length = static_cast<uint16_t>(name.size());
+  entry.type = type;
+  entry.is_link = is_link;
+
+  m_names.append(name);
+  m_entries.push_back(entry);
+}
+
+/**
+ * @brief Compare two names the way people number things, runs of digits are compared by value
+ *
+ * @param a first name
+ * @param b second name
+ * 
+ * @return true if a comes before b, e.g. "page2" before "page10"
+ */
+bool DirSnapshot::isNaturallyBefore(std::string_view a, std::string_view b) {
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a.size() && j < b.size()) {
+    const bool kDigitA = (a[i] >= '0' && a[i] <= '9');
+    const bool kDigitB = (b[j] >= '0' && b[j] <= '9');
+    if (!kDigitA || !kDigitB) {
+      if (a[i] != b[j]) {
+        return static_cast<unsigned char>(a[i]) < static_cast<unsigned char>(b[j]);
+      }
+      i++;
+      j++;
+      continue;
+    }
+
+    // skip leading zeroes, then the longer number is the bigger one
+    while (i < a.size() && a[i] == '0') i++;
+    while (j < b.size() && b[j] == '0') j++;
+    size_t end_a = i;
+    size_t end_b = j;
+    while (end_a < a.size() && a[end_a] >= '0' && a[end_a] <= '9') end_a++;
+    while (end_b < b.size() && b[end_b] >= '0' && b[end_b] <= '9') end_b++;
+
+    if (end_a - i != end_b - j) {
+      return (end_a - i) < (end_b - j);
+    }
+    const int kCompare = a.substr(i, end_a - i).compare(b.substr(j, end_b - j));
+    if (kCompare != 0) {
+      return kCompare < 0;
+    }
+    i = end_a;
+    j = end_b;
+  }
+
+  if (a.size() - i != b.size() - j) {
+    return (a.size() - i) < (b.size() - j);
+  }
+  return a < b; // only leading zeroes differ, keep the order total
+}
@@ -0,0 +1,51 @@
+#ifndef DIR_SNAPSHOT_HPP
+#define DIR_SNAPSHOT_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+
+#include "dir_reader.hpp"
+
+// One row of a DirSnapshot, the name is stored in the snapshot's name buffer
+struct SnapshotEntry {
+  uint64_t size; // File size in bytes, 0 for folders or if sizes were not read
+  uint32_t name_offset;
+  uint16_t name_length;
+  EntryType type;
+  bool is_link; // See DirEntry::is_link
+};
+
+// Every entry of a single folder, read with one pass over the directory
+class DirSnapshot {
+ private:
+  // vars
+  std::filesystem::path m_directory;
+  std::vector<SnapshotEntry> m_entries;
+  std::string m_names; // Every entry name, back to back
+
+ public:
+  DirSnapshot() = default;
+  explicit DirSnapshot(const std::filesystem::path& directory) : m_directory(directory) {} // Empty, read it later
+  DirSnapshot(const std::filesystem::path& directory, bool read_sizes, std::error_code& ec);
+
+  const std::filesystem::path& getDirectory() const { return m_directory; }
+  size_t size() const { return m_entries.size(); }
+  const SnapshotEntry& operator[](size_t idx) const { return m_entries[idx]; }
+  size_t getMemoryUsage() const { return m_names.size() + m_entries.size() * sizeof(SnapshotEntry); }
+
+  std::string_view getName(size_t idx) const { return std::string_view(m_names).substr(m_entries[idx].name_offset, m_entries[idx].name_length); }
+  std::filesystem::path getPath(size_t idx) const { return m_directory / std::filesystem::path(std::string(getName(idx))); }
+  std::string_view getExtension(size_t idx) const;
+  uint64_t getTotalSize() const;
+  void addEntry(std::string_view name, EntryType type, uint64_t size, bool is_link = false);
+  void clear();
+  void sortByName();
+
+  static bool isNaturallyBefore(std::string_view a, std::string_view b);
+};
+
+#endif // DIR_SNAPSHOT_HPP
@@ -0,0 +1,171 @@
+#include "dir_tree.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/
+
+/**
+ * @brief Loop run by every worker, reads folders until there are none left anywhere
+ *
+ * @param worker index of the worker's own deque
+ */
+void DirTree::workerLoop(size_t worker) {
+  while (true) {
+    DirNode* node = takeNode(worker);
+    if (node != nullptr) {
+      readNode(node, worker);
+      if (m_pending_nodes.fetch_sub(1) == 1) {
+        m_work_available.notify_all(); // that was the last folder
+      }
+      continue;
+    }
+
+    if (m_pending_nodes == 0) {
+      return;
+    }
+
+    // another worker is still reading, it may queue more folders
+    std::unique_lock<std::mutex> lock(m_idle_mutex);
+    m_work_available.wait_for(lock, std::chrono::milliseconds(1));
+  }
+}
+
+/**
+ * @brief Take the next folder to read, from the back of the worker's own deque or the front of another's
+ *
+ * @param worker index of the worker's own deque
+ *
+ * @return DirNode* folder to read, nullptr if every deque is empty
+ */
+DirNode* DirTree::takeNode(size_t worker) {
+  {
+    WorkQueue& own = *m_queues[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.nodes.empty()) {
+      DirNode* node = own.nodes.back();
+      own.nodes.pop_back();
+      return node;
+    }
+  }
+
+  for (size_t i = 1; i < m_queues.size(); i++) {
+    WorkQueue& victim = *m_queues[(worker + i) % m_queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.nodes.empty()) {
+      DirNode* node = victim.nodes.front();
+      victim.nodes.pop_front();
+      return node;
+    }
+  }
+
+  return nullptr;
+}
+
+/**
+ * @brief Read one folder and queue every folder inside it on the worker's own deque
+ *
+ * @param node folder to read, its snapshot only holds the folder's path so far
+ * @param worker index of the worker's own deque
+ */
+void DirTree::readNode(DirNode* node, size_t worker) {
+  node->snapshot = DirSnapshot(node->snapshot.getDirectory(), m_read_sizes, node->error);
+  if (node->error || !m_enter_folder) {
+    return;
+  }
+
+  node->snapshot.sortByName();
+  node->children.resize(node->snapshot.size());
+
+  std::vector<DirNode*> new_nodes;
+  for (size_t i = 0; i < node->snapshot.size(); i++) {
+    // a link to a folder is never entered, it could lead back up the tree or out of the folders being merged
+    if (node->snapshot[i].type != EntryType::Directory || node->snapshot[i].is_link || !m_enter_folder(node->snapshot.getName(i))) {
+      continue;
+    }
+
+    node->children[i] = std::make_unique<DirNode>();
+    node->children[i]->snapshot = DirSnapshot(node->snapshot.getPath(i));
+    new_nodes.push_back(node->children[i].get());
+  }
+
+  if (new_nodes.empty()) {
+    return;
+  }
+
+  m_pending_nodes += new_nodes.size();
+  m_node_count += new_nodes.size();
+  {
+    // pushed in reverse, so the first subfolder is read next and the rest are left for thieves
+    WorkQueue& own = *m_queues[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.nodes.insert(own.nodes.end(), new_nodes.rbegin(), new_nodes.rend());
+  }
+  m_work_available.notify_all();
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/
+
+/**
+ * @brief Read a set of folders on every worker of a pool, and everything below them if enter_folder is given
+ *
+ * @param pool workers to read with
+ * @param roots folders to read
+ * @param read_sizes also read the size of every file
+ * @param enter_folder called with the name of every folder found, return true to read it too. Empty = only read
+ *                     the roots. Every folder of a tree read this way is sorted by name, see DirSnapshot::sortByName()
+ */
+void DirTree::scan(ThreadPool& pool, const std::vector<std::filesystem::path>& roots, bool read_sizes, std::function<bool(std::string_view)> enter_folder) {
+  m_read_sizes = read_sizes;
+  m_enter_folder = std::move(enter_folder);
+
+  const size_t kWorkerCount = std::max<size_t>(1, pool.size());
+  m_queues.clear();
+  for (size_t i = 0; i < kWorkerCount; i++) {
+    m_queues.push_back(std::make_unique<WorkQueue>());
+  }
+
+  // deal the roots out like cards, so every worker starts with its own
+  m_roots.clear();
+  for (size_t i = 0; i < roots.size(); i++) {
+    m_roots.push_back(std::make_unique<DirNode>());
+    m_roots.back()->snapshot = DirSnapshot(roots[i]);
+    m_queues[i % kWorkerCount]->nodes.push_back(m_roots.back().get());
+  }
+  m_pending_nodes = roots.size();
+  m_node_count = roots.size();
+
+  TaskGroup group(pool);
+  for (size_t i = 0; i < kWorkerCount; i++) {
+    group.submit([this, i] { workerLoop(i); });
+  }
+  group.wait();
+}
+
+/**
+ * @brief Find the first folder of a tree that could not be read, in depth first order
+ *
+ * @param node top of the tree
+ *
+ * @return const DirNode* folder that could not be read, nullptr if every folder was read
+ */
+const DirNode* DirTree::findError(const DirNode& node) {
+  if (node.error) {
+    return &node;
+  }
+
+  for (const auto& child : node.children) {
+    if (child) {
+      const DirNode* kError = findError(*child);
+      if (kError != nullptr) {
+        return kError;
+      }
+    }
+  }
+
+  return nullptr;
+}
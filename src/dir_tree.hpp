@@ -0,0 +1,67 @@
+#ifndef DIR_TREE_HPP
+#define DIR_TREE_HPP
+
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <filesystem>
+#include <system_error>
+
+#include "dir_snapshot.hpp"
+#include "thread_pool.hpp"
+
+// A folder read together with every folder below it
+struct DirNode {
+  DirSnapshot snapshot;
+  std::error_code error; // Set if the folder could not be read
+  std::vector<std::unique_ptr<DirNode>> children; // One slot per snapshot entry, set for every folder that was read
+};
+
+// Snapshots of a set of folder trees, read in parallel with work stealing
+//
+// Every worker keeps its own deque of folders still to read. It takes the newest folder from the back of its own
+// deque, so it keeps reading down the branch it is in, and an idle worker steals the oldest folder from the front
+// of another worker's deque, which is the top of a branch nobody has started yet.
+class DirTree {
+ private:
+  // Folders waiting to be read by one worker
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<DirNode*> nodes;
+  };
+
+  // vars
+  std::vector<std::unique_ptr<DirNode>> m_roots;
+  std::vector<std::unique_ptr<WorkQueue>> m_queues;
+  std::atomic<size_t> m_pending_nodes; // Folders queued or being read
+  std::atomic<size_t> m_node_count;
+  std::mutex m_idle_mutex;
+  std::condition_variable m_work_available; // Signalled when a folder is queued or the last one is read
+  bool m_read_sizes = false;
+  std::function<bool(std::string_view)> m_enter_folder;
+
+  // funcs
+  void workerLoop(size_t worker);
+  DirNode* takeNode(size_t worker);
+  void readNode(DirNode* node, size_t worker);
+
+ public:
+  DirTree() : m_pending_nodes(0), m_node_count(0) {}
+
+  DirTree(const DirTree&) = delete;
+  DirTree& operator=(const DirTree&) = delete;
+
+  void scan(ThreadPool& pool, const std::vector<std::filesystem::path>& roots, bool read_sizes, std::function<bool(std::string_view)> enter_folder);
+
+  size_t size() const { return m_roots.size(); }
+  const DirNode& operator[](size_t idx) const { return *m_roots[idx]; }
+  size_t getNodeCount() const { return m_node_count; }
+  static const DirNode* findError(const DirNode& node);
+};
+
+#endif // DIR_TREE_HPP
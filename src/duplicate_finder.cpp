@@ -0,0 +1,132 @@
+#include "duplicate_finder.hpp"
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include "file_hash.hpp"
+
+/**
+ * @brief Create a duplicate finder that hashes files on a thread pool
+ *
+ * @param pool workers to hash with
+ */
+DuplicateFinder::DuplicateFinder(ThreadPool& pool)
+  : m_pool(pool), m_console(&std::cout) {
+}
+
+/**
+ * @brief Find every file that has the same contents as an earlier file in the list
+ *
+ * @param files files in merge order, the snapshots must have been read with sizes
+ * 
+ * @return std::vector<size_t> with the index of the first identical file for every file, or its own index if it is unique
+ */
+std::vector<size_t> DuplicateFinder::findDuplicates(const std::vector<FileRef>& files) {
+  std::vector<size_t> original(files.size());
+  m_duplicate_count = 0;
+  m_bytes_saved = 0;
+  m_bytes_hashed = 0;
+
+  // only files that share a size can be identical
+  std::unordered_map<uint64_t, std::vector<size_t>> size_groups;
+  for (size_t i = 0; i < files.size(); i++) {
+    original[i] = i;
+    size_groups[(*files[i].snapshot)[files[i].idx].size].push_back(i);
+  }
+
+  std::vector<size_t> candidates;
+  for (const auto& group : size_groups) {
+    if (group.second.size() > 1) {
+      candidates.insert(candidates.end(), group.second.begin(), group.second.end());
+    }
+  }
+
+  // hash every candidate in parallel, an unreadable file is never treated as a duplicate
+  std::vector<uint64_t> hashes(files.size());
+  std::vector<char> hashed(files.size(), 0); // not vector<bool>, so workers can write their own element
+  std::atomic<size_t> next_candidate(0);
+  std::atomic<uint64_t> bytes_hashed(0);
+  std::mutex output_mutex;
+
+  TaskGroup group(m_pool);
+  for (unsigned int i = 0; i < m_pool.size(); i++) {
+    group.submit([&] {
+      size_t candidate_idx;
+      while ((candidate_idx = next_candidate.fetch_add(1, std::memory_order_relaxed)) < candidates.size()) {
+        const size_t kFile = candidates[candidate_idx];
+        const DirSnapshot& snapshot = *files[kFile].snapshot;
+
+        std::error_code ec;
+        if (hashFile(snapshot.getPath(files[kFile].idx), hashes[kFile], ec)) {
+          hashed[kFile] = 1;
+          bytes_hashed += snapshot[files[kFile].idx].size;
+        }
+        else {
+          std::lock_guard<std::mutex> lock(output_mutex);
+          *m_console << "ERROR: Cannot read " << snapshot.getPath(files[kFile].idx) << ": " << ec.message() << "\n";
+        }
+      }
+    });
+  }
+  group.wait();
+
+  m_bytes_hashed = bytes_hashed;
+
+  // within a size group, the first file in merge order with a hash is the original
+  std::vector<size_t> matches; // files whose hash matches an earlier file's
+  for (const auto& group : size_groups) {
+    if (group.second.size() < 2) {
+      continue;
+    }
+
+    std::unordered_map<uint64_t, size_t> first_with_hash;
+    for (size_t file : group.second) { // indices were added in merge order
+      if (!hashed[file]) {
+        continue;
+      }
+
+      auto inserted = first_with_hash.emplace(hashes[file], file);
+      if (!inserted.second) {
+        original[file] = inserted.first->second;
+        matches.push_back(file);
+      }
+    }
+  }
+
+  // two different files can share a hash, so a match only counts once its bytes are compared with the original's.
+  // A file that differs, or cannot be read, is kept as a file of its own
+  std::atomic<size_t> next_match(0);
+  TaskGroup compare_group(m_pool);
+  for (unsigned int i = 0; i < m_pool.size(); i++) {
+    compare_group.submit([&] {
+      size_t match_idx;
+      while ((match_idx = next_match.fetch_add(1, std::memory_order_relaxed)) < matches.size()) {
+        const size_t kFile = matches[match_idx];
+        const FileRef& kCopy = files[kFile];
+        const FileRef& kOriginal = files[original[kFile]];
+
+        bool equal = false;
+        std::error_code ec;
+        if (!compareFiles(kOriginal.snapshot->getPath(kOriginal.idx), kCopy.snapshot->getPath(kCopy.idx), equal, ec)) {
+          std::lock_guard<std::mutex> lock(output_mutex);
+          *m_console << "ERROR: Cannot compare " << kCopy.snapshot->getPath(kCopy.idx) << ": " << ec.message() << "\n";
+        }
+        if (!equal) {
+          original[kFile] = kFile; // each worker only writes the entries of its own matches
+        }
+      }
+    });
+  }
+  compare_group.wait();
+
+  for (size_t file : matches) {
+    if (original[file] != file) {
+      m_duplicate_count++;
+      m_bytes_saved += (*files[file].snapshot)[files[file].idx].size;
+    }
+  }
+
+  return original;
+}
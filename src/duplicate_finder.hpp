@@ -0,0 +1,39 @@
+#ifndef DUPLICATE_FINDER_HPP
+#define DUPLICATE_FINDER_HPP
+
+#include <cstdint>
+#include <vector>
+#include <ostream>
+
+#include "thread_pool.hpp"
+#include "dir_snapshot.hpp"
+
+// A file inside a DirSnapshot
+struct FileRef {
+  const DirSnapshot* snapshot;
+  size_t idx;
+};
+
+// Finds byte-identical files: files are grouped by size first, only files that share a size are hashed, and files that
+// share a hash are compared byte for byte
+class DuplicateFinder {
+ private:
+  // vars
+  ThreadPool& m_pool;
+  std::ostream* m_console; // Where read errors are written
+  uint64_t m_duplicate_count = 0;
+  uint64_t m_bytes_saved = 0;
+  uint64_t m_bytes_hashed = 0;
+
+ public:
+  explicit DuplicateFinder(ThreadPool& pool);
+
+  void setConsole(std::ostream& console) { m_console = &console; }
+  std::vector<size_t> findDuplicates(const std::vector<FileRef>& files);
+
+  uint64_t getDuplicateCount() const { return m_duplicate_count; }
+  uint64_t getBytesSaved() const { return m_bytes_saved; }
+  uint64_t getBytesHashed() const { return m_bytes_hashed; }
+};
+
+#endif // DUPLICATE_FINDER_HPP
@@ -0,0 +1,202 @@
+#include "durability.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <algorithm>
+#include <mutex>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+  const size_t kSyncBatch = 64; // Files a worker syncs before it takes the next batch
+
+  std::atomic<uint64_t> g_sync_calls(0); // fsync() and syncfs() calls made so far, for the run report
+}
+
+/**
+ * @brief Get a readable name of a durability mode
+ *
+ * @param mode mode to name
+ *
+ * @return the name used on the command line
+ */
+const char* getDurabilityName(DurabilityMode mode) {
+  switch (mode) {
+    case DurabilityMode::None:   return "none";
+    case DurabilityMode::Batch:  return "batch";
+    case DurabilityMode::Syncfs: return "syncfs";
+    case DurabilityMode::Strict: return "strict";
+  }
+
+  return "unknown";
+}
+
+/**
+ * @brief Find the durability mode with the given name
+ *
+ * @param name name used on the command line
+ * @param mode set to the matching mode
+ *
+ * @return true if success ; false if there is no mode with that name
+ */
+bool parseDurabilityName(const std::string& name, DurabilityMode& mode) {
+  for (DurabilityMode candidate : { DurabilityMode::None, DurabilityMode::Batch, DurabilityMode::Syncfs, DurabilityMode::Strict }) {
+    if (name == getDurabilityName(candidate)) {
+      mode = candidate;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief Wait until a file's data and size are on the disk
+ *
+ * @param file file to sync
+ * @param ec set to the error if it fails
+ *
+ * @return true if success ; false if error
+ */
+bool syncFile(const std::filesystem::path& file, std::error_code& ec) {
+  g_sync_calls++;
+#ifdef _WIN32
+  const int kFd = _wopen(file.c_str(), _O_RDWR | _O_BINARY);
+  if (kFd < 0 || _commit(kFd) != 0) {
+    ec = std::error_code(errno, std::generic_category());
+    if (kFd >= 0) {
+      _close(kFd);
+    }
+    return false;
+  }
+  _close(kFd);
+#else
+  // Linux syncs through a read-only descriptor, so files copied without write permission can be synced too
+  const int kFd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (kFd < 0 || fsync(kFd) != 0) {
+    ec = std::error_code(errno, std::generic_category());
+    if (kFd >= 0) {
+      close(kFd);
+    }
+    return false;
+  }
+  close(kFd);
+#endif
+  return true;
+}
+
+/**
+ * @brief Wait until the entries of a folder are on the disk, so files created, renamed or deleted in it stay that way
+ *
+ * @param directory folder to sync
+ * @param ec set to the error if it fails
+ *
+ * @return true if success ; false if error. Always true on Windows, which cannot sync a folder and does not need to
+ */
+bool syncDirectory(const std::filesystem::path& directory, std::error_code& ec) {
+#ifdef _WIN32
+  (void)directory;
+  (void)ec;
+#else
+  g_sync_calls++;
+  const int kFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (kFd < 0 || fsync(kFd) != 0) {
+    ec = std::error_code(errno, std::generic_category());
+    if (kFd >= 0) {
+      close(kFd);
+    }
+    return false;
+  }
+  close(kFd);
+#endif
+  return true;
+}
+
+/**
+ * @brief Wait until everything written to a filesystem is on the disk, with one call instead of one per file
+ *
+ * Also writes back what other programs wrote to the same filesystem, so it can take longer than the merge's own data.
+ *
+ * @param path any file or folder on the filesystem
+ * @param ec set to the error if it fails, function_not_supported outside Linux
+ *
+ * @return true if success ; false if error
+ */
+bool syncFilesystem(const std::filesystem::path& path, std::error_code& ec) {
+#ifdef __linux__
+  g_sync_calls++;
+  const int kFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (kFd < 0 || syncfs(kFd) != 0) {
+    ec = std::error_code(errno, std::generic_category());
+    if (kFd >= 0) {
+      close(kFd);
+    }
+    return false;
+  }
+  close(kFd);
+  return true;
+#else
+  (void)path;
+  ec = std::make_error_code(std::errc::function_not_supported);
+  return false;
+#endif
+}
+
+/**
+ * @brief Sync the destination of every transfer, each worker of the pool takes the next batch of files
+ *
+ * Hardlinks are skipped, they hold no data of their own and their entries are synced with their folder.
+ *
+ * @param pool workers to sync with
+ * @param tasks transfers whose destinations to sync
+ * @param failed_file set to the first file that could not be synced
+ * @param ec set to the error of that file
+ *
+ * @return true if success ; false if any file could not be synced, the others are still synced
+ */
+bool syncDestinations(ThreadPool& pool, const std::vector<CopyTask>& tasks, std::filesystem::path& failed_file, std::error_code& ec) {
+  std::atomic<size_t> next_batch(0);
+  std::mutex error_mutex;
+  bool success = true;
+
+  TaskGroup group(pool);
+  for (unsigned int i = 0; i < pool.size(); i++) {
+    group.submit([&] {
+      size_t first;
+      while ((first = next_batch.fetch_add(kSyncBatch, std::memory_order_relaxed)) < tasks.size()) {
+        const size_t kLast = std::min(first + kSyncBatch, tasks.size());
+        for (size_t idx = first; idx < kLast; idx++) {
+          std::error_code sync_ec;
+          if (tasks[idx].link || syncFile(tasks[idx].destination.path(), sync_ec)) {
+            continue;
+          }
+
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (success) {
+            failed_file = tasks[idx].destination.path();
+            ec = sync_ec;
+            success = false;
+          }
+        }
+      }
+    });
+  }
+
+  group.wait();
+  return success;
+}
+
+/**
+ * @brief Get the number of fsync() and syncfs() calls made so far by every thread
+ *
+ * @return uint64_t number of calls
+ */
+uint64_t getSyncCallCount() {
+  return g_sync_calls.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,23 @@
+#ifndef DURABILITY_HPP
+#define DURABILITY_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+
+#include "merge_options.hpp"
+#include "thread_pool.hpp"
+#include "copy_engine.hpp"
+
+const char* getDurabilityName(DurabilityMode mode);
+bool parseDurabilityName(const std::string& name, DurabilityMode& mode);
+
+bool syncFile(const std::filesystem::path& file, std::error_code& ec);
+bool syncDirectory(const std::filesystem::path& directory, std::error_code& ec);
+bool syncFilesystem(const std::filesystem::path& path, std::error_code& ec);
+bool syncDestinations(ThreadPool& pool, const std::vector<CopyTask>& tasks, std::filesystem::path& failed_file, std::error_code& ec);
+uint64_t getSyncCallCount();
+
+#endif // DURABILITY_HPP
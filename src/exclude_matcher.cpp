@@ -0,0 +1,299 @@
+#include "exclude_matcher.hpp"
+
+#include <fstream>
+#include <algorithm>
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/ 
+
+/**
+ * @brief Add a string to the trie
+ *
+ * @param str string to add
+ * @param reversed add the string back to front, used for suffixes
+ */
+void ExcludeMatcher::Trie::insert(std::string_view str, bool reversed) {
+  uint32_t node = 0;
+  for (size_t i = 0; i < str.size(); i++) {
+    const unsigned char kChar = reversed ? str[str.size() - 1 - i] : str[i];
+    const uint64_t kKey = (static_cast<uint64_t>(node) << 8) | kChar;
+
+    auto edge = edges.find(kKey);
+    if (edge == edges.end()) {
+      const uint32_t kChild = static_cast<uint32_t>(terminal.size());
+      terminal.push_back(false);
+      edge = edges.emplace(kKey, kChild).first;
+    }
+    node = edge->second;
+  }
+
+  terminal[node] = true;
+}
+
+/**
+ * @brief Check if any string in the trie is a prefix (or suffix, if reversed) of a string
+ *
+ * @param str string to check
+ * @param reversed walk the string back to front
+ * 
+ * @return true if a match was found
+ */
+bool ExcludeMatcher::Trie::matches(std::string_view str, bool reversed) const {
+  uint32_t node = 0;
+  for (size_t i = 0; i <= str.size(); i++) {
+    if (terminal[node]) {
+      return true;
+    }
+    else if (i == str.size()) {
+      break;
+    }
+
+    const unsigned char kChar = reversed ? str[str.size() - 1 - i] : str[i];
+    const auto kEdge = edges.find((static_cast<uint64_t>(node) << 8) | kChar);
+    if (kEdge == edges.end()) {
+      return false;
+    }
+    node = kEdge->second;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Add a glob to the automaton, sharing the nodes of every pattern that starts with the same tokens
+ *
+ * @param pattern glob using '*', '?' and '[...]' ('[!...]' negates, a '[' without a closing ']' is a normal character)
+ */
+void ExcludeMatcher::GlobAutomaton::insert(std::string_view pattern) {
+  uint32_t node = 0;
+  size_t p = 0;
+  while (p < pattern.size()) {
+    std::string_view token;
+    std::bitset<256> accepts;
+    if (pattern[p] == '*') {
+      token = pattern.substr(p, 1);
+      accepts.set();
+      p++;
+      if (nodes[node].star) {
+        continue; // "**" matches what "*" does
+      }
+    }
+    else if (pattern[p] == '?') {
+      token = pattern.substr(p, 1);
+      accepts.set();
+      p++;
+    }
+    else if (pattern[p] == '[' && pattern.find(']', p + 2) != std::string_view::npos) {
+      const size_t kEnd = pattern.find(']', p + 2);
+      token = pattern.substr(p, kEnd - p + 1);
+      size_t first = p + 1;
+      const bool kNegate = (pattern[first] == '!');
+      if (kNegate) {
+        first++;
+      }
+
+      for (int c = 0; c < 256; c++) {
+        const char kChar = static_cast<char>(c);
+        bool in_set = false;
+        for (size_t i = first; i < kEnd; i++) {
+          if (i + 2 < kEnd && pattern[i + 1] == '-') {
+            in_set |= (kChar >= pattern[i] && kChar <= pattern[i + 2]);
+            i += 2;
+          }
+          else {
+            in_set |= (kChar == pattern[i]);
+          }
+        }
+        accepts[c] = (in_set != kNegate);
+      }
+      p = kEnd + 1;
+    }
+    else {
+      // a literal character, including a '[' that is never closed
+      const uint64_t kKey = (static_cast<uint64_t>(node) << 8) | static_cast<unsigned char>(pattern[p]);
+      auto edge = literal_edges.find(kKey);
+      if (edge == literal_edges.end()) {
+        edge = literal_edges.emplace(kKey, static_cast<uint32_t>(nodes.size())).first;
+        nodes.emplace_back();
+      }
+      node = edge->second;
+      p++;
+      continue;
+    }
+
+    uint32_t child = 0;
+    for (const uint32_t kChild : nodes[node].wild_children) {
+      if (nodes[kChild].token == token) {
+        child = kChild;
+        break;
+      }
+    }
+    if (child == 0) {
+      child = static_cast<uint32_t>(nodes.size());
+      nodes.emplace_back();
+      nodes[child].token = std::string(token);
+      nodes[child].accepts = accepts;
+      nodes[child].star = (token == "*");
+      nodes[node].wild_children.push_back(child);
+    }
+    node = child;
+  }
+
+  nodes[node].terminal = true;
+}
+
+/**
+ * @brief Add a node to a set of states, along with every '*' node after it, since a '*' may match nothing
+ *
+ * @param node node entered
+ * @param states states to add to
+ */
+void ExcludeMatcher::GlobAutomaton::enter(uint32_t node, std::vector<uint32_t>& states) const {
+  states.push_back(node);
+  for (const uint32_t kChild : nodes[node].wild_children) {
+    if (nodes[kChild].star) {
+      enter(kChild, states);
+    }
+  }
+}
+
+/**
+ * @brief Check if a name matches any glob of the automaton
+ *
+ * @param name filename to check
+ * 
+ * @return true if the whole name matches a pattern
+ */
+bool ExcludeMatcher::GlobAutomaton::matches(std::string_view name) const {
+  if (nodes.size() == 1) {
+    return false;
+  }
+
+  std::vector<uint32_t> states;
+  std::vector<uint32_t> next_states;
+  enter(0, states);
+
+  for (const char kChar : name) {
+    const unsigned char kByte = static_cast<unsigned char>(kChar);
+    next_states.clear();
+    for (const uint32_t kState : states) {
+      const Node& kNode = nodes[kState];
+      if (kNode.star) {
+        enter(kState, next_states);
+      }
+
+      const auto kEdge = literal_edges.find((static_cast<uint64_t>(kState) << 8) | kByte);
+      if (kEdge != literal_edges.end()) {
+        enter(kEdge->second, next_states);
+      }
+      for (const uint32_t kChild : kNode.wild_children) {
+        if (!nodes[kChild].star && nodes[kChild].accepts[kByte]) {
+          enter(kChild, next_states);
+        }
+      }
+    }
+
+    // patterns that share a state after different paths, e.g. "*a*" and "a*", only need it followed once
+    std::sort(next_states.begin(), next_states.end());
+    next_states.erase(std::unique(next_states.begin(), next_states.end()), next_states.end());
+    states.swap(next_states);
+    if (states.empty()) {
+      return false;
+    }
+  }
+
+  for (const uint32_t kState : states) {
+    if (nodes[kState].terminal) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/ 
+
+/**
+ * @brief Add a pattern, it is sorted into the fastest index that can hold it
+ *
+ * @param pattern exact filename or glob
+ */
+void ExcludeMatcher::add(const std::string& pattern) {
+  if (pattern.empty()) {
+    return;
+  }
+  m_pattern_count++;
+
+  // a pattern always matches itself too, so a name like "Cover [HQ].jpg" can be excluded as it is
+  m_exact.insert(pattern);
+  const size_t kFirstWildcard = pattern.find_first_of("*?[");
+  if (kFirstWildcard == std::string::npos) {
+    return;
+  }
+
+  // only a single '*', either at the end or at the start
+  const size_t kLastWildcard = pattern.find_last_of("*?[");
+  if (kFirstWildcard == kLastWildcard && pattern[kFirstWildcard] == '*') {
+    if (kFirstWildcard == pattern.size() - 1) {
+      m_prefixes.insert(std::string_view(pattern).substr(0, kFirstWildcard), false);
+      return;
+    }
+    else if (kFirstWildcard == 0) {
+      m_suffixes.insert(std::string_view(pattern).substr(1), true);
+      return;
+    }
+  }
+
+  m_globs.insert(pattern);
+}
+
+/**
+ * @brief Add every pattern in a file, one per line, lines starting with '#' are ignored
+ *
+ * @param path file to read
+ * 
+ * @return true if success ; false if the file cannot be read
+ */
+bool ExcludeMatcher::loadFile(const std::filesystem::path& path) {
+  std::ifstream ifstream(path);
+  if (!ifstream.is_open()) {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(ifstream, line)) {
+    // trim whitespace and windows line endings
+    const size_t kStart = line.find_first_not_of(" \t\r");
+    if (kStart == std::string::npos || line[kStart] == '#') {
+      continue;
+    }
+    const size_t kEnd = line.find_last_not_of(" \t\r");
+
+    add(line.substr(kStart, kEnd - kStart + 1));
+  }
+
+  return true;
+}
+
+/**
+ * @brief Check if a filename matches any pattern
+ *
+ * @param name filename, without any parent folders
+ * 
+ * @return true if the file is excluded
+ */
+bool ExcludeMatcher::matches(std::string_view name) const {
+  if (m_pattern_count == 0) {
+    return false;
+  }
+  else if (m_exact.find(std::string(name)) != m_exact.end()) {
+    return true;
+  }
+  else if (m_prefixes.matches(name, false) || m_suffixes.matches(name, true)) {
+    return true;
+  }
+
+  return m_globs.matches(name);
+}
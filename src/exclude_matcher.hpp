@@ -0,0 +1,67 @@
+#ifndef EXCLUDE_MATCHER_HPP
+#define EXCLUDE_MATCHER_HPP
+
+#include <cstdint>
+#include <bitset>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <filesystem>
+
+// Matches filenames against any number of glob patterns ('*', '?' and '[...]'), every pattern also matches the name
+// that is spelled exactly like it
+//
+// Patterns are sorted into an index as they are added:
+//   Thumbs.db   exact names, one hash lookup
+//   ._*         prefixes, one walk forwards through a trie
+//   *.tmp       suffixes, one walk backwards through a trie
+//   a*b?c       anything else, merged into one automaton that is run over the name once
+class ExcludeMatcher {
+ private:
+  // Edges of a trie, stored in one table keyed by (node << 8 | character)
+  struct Trie {
+    std::unordered_map<uint64_t, uint32_t> edges;
+    std::vector<bool> terminal = { false }; // Node 0 is the root
+
+    void insert(std::string_view str, bool reversed);
+    bool matches(std::string_view str, bool reversed) const;
+  };
+
+  // Every glob that does not fit a trie, as one automaton whose states are shared by patterns that start alike.
+  // A name is read once, following every state that is still alive, so the cost does not grow with the number
+  // of patterns, only with how many of them match the name's start
+  struct GlobAutomaton {
+    struct Node {
+      std::string token; // '?', '*' or '[...]' the node is entered by, empty for a literal character
+      std::bitset<256> accepts; // Characters the token matches
+      bool star = false; // Entered by '*', it stays in the node on any character
+      bool terminal = false; // A pattern ends here
+      std::vector<uint32_t> wild_children; // Children entered by a wildcard token
+    };
+
+    std::unordered_map<uint64_t, uint32_t> literal_edges; // Keyed by (node << 8 | character)
+    std::vector<Node> nodes = { Node() }; // Node 0 is the start
+
+    void insert(std::string_view pattern);
+    void enter(uint32_t node, std::vector<uint32_t>& states) const;
+    bool matches(std::string_view name) const;
+  };
+
+  // vars
+  std::unordered_set<std::string> m_exact;
+  Trie m_prefixes;
+  Trie m_suffixes;
+  GlobAutomaton m_globs;
+  size_t m_pattern_count = 0;
+
+ public:
+  void add(const std::string& pattern);
+  bool loadFile(const std::filesystem::path& path);
+
+  bool matches(std::string_view name) const;
+  size_t size() const { return m_pattern_count; }
+};
+
+#endif // EXCLUDE_MATCHER_HPP
@@ -0,0 +1,235 @@
+#include "file_hash.hpp"
+
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+namespace {
+  const uint64_t kPrime1 = 11400714785074694791ULL;
+  const uint64_t kPrime2 = 14029467366897019727ULL;
+  const uint64_t kPrime3 = 1609587929392839161ULL;
+  const uint64_t kPrime4 = 9650029242287828579ULL;
+  const uint64_t kPrime5 = 2870177450012600261ULL;
+
+  const size_t kReadChunk = 1 << 20; // Bytes read at once by hashFile() and compareFiles()
+
+  inline uint64_t rotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+  }
+
+  // little endian reads, the hash is only compared on the machine that made it
+  inline uint64_t read64(const unsigned char* ptr) {
+    uint64_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+  }
+
+  inline uint32_t read32(const unsigned char* ptr) {
+    uint32_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+  }
+
+  inline uint64_t mixRound(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    acc = rotateLeft(acc, 31);
+    return acc * kPrime1;
+  }
+
+  inline uint64_t mergeRound(uint64_t acc, uint64_t value) {
+    acc ^= mixRound(0, value);
+    return acc * kPrime1 + kPrime4;
+  }
+}
+
+/**
+ * @brief Create a hasher, ready to take data
+ *
+ * @param seed changes every hash value, hashes are only comparable with the same seed
+ */
+FileHasher::FileHasher(uint64_t seed)
+  : m_seed(seed) {
+  reset();
+}
+
+/**
+ * @brief Forget all data given so far
+ */
+void FileHasher::reset() {
+  m_acc[0] = m_seed + kPrime1 + kPrime2;
+  m_acc[1] = m_seed + kPrime2;
+  m_acc[2] = m_seed;
+  m_acc[3] = m_seed - kPrime1;
+  m_buffered = 0;
+  m_total_length = 0;
+}
+
+/**
+ * @brief Add more data to the hash
+ *
+ * @param data bytes to add
+ * @param length number of bytes
+ */
+void FileHasher::update(const void* data, size_t length) {
+  const unsigned char* ptr = static_cast<const unsigned char*>(data);
+  const unsigned char* const kEnd = ptr + length;
+  m_total_length += length;
+
+  // top up a partly filled stripe first
+  if (m_buffered + length < 32) {
+    std::memcpy(m_buffer + m_buffered, ptr, length);
+    m_buffered += length;
+    return;
+  }
+  else if (m_buffered > 0) {
+    const size_t kFill = 32 - m_buffered;
+    std::memcpy(m_buffer + m_buffered, ptr, kFill);
+    ptr += kFill;
+
+    for (int i = 0; i < 4; i++) {
+      m_acc[i] = mixRound(m_acc[i], read64(m_buffer + i * 8));
+    }
+    m_buffered = 0;
+  }
+
+  // four independent lanes, the compiler keeps them all in flight
+  uint64_t acc0 = m_acc[0], acc1 = m_acc[1], acc2 = m_acc[2], acc3 = m_acc[3];
+  while (kEnd - ptr >= 32) {
+    acc0 = mixRound(acc0, read64(ptr));
+    acc1 = mixRound(acc1, read64(ptr + 8));
+    acc2 = mixRound(acc2, read64(ptr + 16));
+    acc3 = mixRound(acc3, read64(ptr + 24));
+    ptr += 32;
+  }
+  m_acc[0] = acc0; m_acc[1] = acc1; m_acc[2] = acc2; m_acc[3] = acc3;
+
+  m_buffered = static_cast<size_t>(kEnd - ptr);
+  std::memcpy(m_buffer, ptr, m_buffered);
+}
+
+/**
+ * @brief Get the hash of all data given so far, more data may still be added afterwards
+ *
+ * @return 64-bit hash value
+ */
+uint64_t FileHasher::digest() const {
+  uint64_t hash;
+  if (m_total_length >= 32) {
+    hash = rotateLeft(m_acc[0], 1) + rotateLeft(m_acc[1], 7) + rotateLeft(m_acc[2], 12) + rotateLeft(m_acc[3], 18);
+    for (int i = 0; i < 4; i++) {
+      hash = mergeRound(hash, m_acc[i]);
+    }
+  }
+  else {
+    hash = m_seed + kPrime5;
+  }
+
+  hash += m_total_length;
+
+  const unsigned char* ptr = m_buffer;
+  const unsigned char* const kEnd = m_buffer + m_buffered;
+  while (kEnd - ptr >= 8) {
+    hash ^= mixRound(0, read64(ptr));
+    hash = rotateLeft(hash, 27) * kPrime1 + kPrime4;
+    ptr += 8;
+  }
+  if (kEnd - ptr >= 4) {
+    hash ^= static_cast<uint64_t>(read32(ptr)) * kPrime1;
+    hash = rotateLeft(hash, 23) * kPrime2 + kPrime3;
+    ptr += 4;
+  }
+  while (ptr < kEnd) {
+    hash ^= (*ptr) * kPrime5;
+    hash = rotateLeft(hash, 11) * kPrime1;
+    ptr++;
+  }
+
+  // avalanche
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+
+  return hash;
+}
+
+/**
+ * @brief Hash a whole file, reading it in fixed size chunks so it is never fully in memory
+ *
+ * @param path file to hash
+ * @param hash set to the file's hash
+ * @param ec set if the file cannot be read
+ * 
+ * @return true if success ; false if error
+ */
+bool hashFile(const std::filesystem::path& path, uint64_t& hash, std::error_code& ec) {
+  ec.clear();
+  std::FILE* file = std::fopen(path.string().c_str(), "rb");
+  if (file == nullptr) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+
+  std::vector<unsigned char> buffer(kReadChunk);
+  FileHasher hasher;
+  size_t read;
+  while ((read = std::fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+    hasher.update(buffer.data(), read);
+  }
+
+  if (std::ferror(file)) {
+    ec = std::make_error_code(std::errc::io_error);
+  }
+  std::fclose(file);
+
+  hash = hasher.digest();
+  return !ec;
+}
+
+/**
+ * @brief Compare two files byte for byte, reading both in fixed size chunks
+ *
+ * @param a first file
+ * @param b second file
+ * @param equal set to true if both hold the same bytes
+ * @param ec set if either file cannot be read
+ *
+ * @return true if success ; false if error
+ */
+bool compareFiles(const std::filesystem::path& a, const std::filesystem::path& b, bool& equal, std::error_code& ec) {
+  ec.clear();
+  equal = false;
+  std::FILE* file_a = std::fopen(a.string().c_str(), "rb");
+  if (file_a == nullptr) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+  std::FILE* file_b = std::fopen(b.string().c_str(), "rb");
+  if (file_b == nullptr) {
+    ec.assign(errno, std::generic_category());
+    std::fclose(file_a);
+    return false;
+  }
+
+  std::vector<unsigned char> buffer_a(kReadChunk);
+  std::vector<unsigned char> buffer_b(kReadChunk);
+  equal = true;
+  while (equal) {
+    const size_t kReadA = std::fread(buffer_a.data(), 1, buffer_a.size(), file_a);
+    const size_t kReadB = std::fread(buffer_b.data(), 1, buffer_b.size(), file_b);
+    equal = (kReadA == kReadB && std::memcmp(buffer_a.data(), buffer_b.data(), kReadA) == 0);
+    if (kReadA == 0 || kReadA < buffer_a.size()) {
+      break;
+    }
+  }
+
+  if (std::ferror(file_a) || std::ferror(file_b)) {
+    ec = std::make_error_code(std::errc::io_error);
+    equal = false;
+  }
+  std::fclose(file_a);
+  std::fclose(file_b);
+
+  return !ec;
+}
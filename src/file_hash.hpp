@@ -0,0 +1,36 @@
+#ifndef FILE_HASH_HPP
+#define FILE_HASH_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+#include <system_error>
+
+// Streaming 64-bit XXH64 hash, fast enough to keep up with the disk while copying
+class FileHasher {
+ private:
+  // vars
+  uint64_t m_acc[4];
+  unsigned char m_buffer[32]; // Bytes that do not yet fill a 32 byte stripe
+  size_t m_buffered = 0;
+  uint64_t m_total_length = 0;
+  uint64_t m_seed;
+
+ public:
+  explicit FileHasher(uint64_t seed = 0);
+
+  void reset();
+  void update(const void* data, size_t length);
+  uint64_t digest() const;
+};
+
+// Hashes of one copy, taken from the bytes read from the source and the bytes written to the destination
+struct CopyHashes {
+  uint64_t source = 0;
+  uint64_t destination = 0;
+};
+
+bool hashFile(const std::filesystem::path& path, uint64_t& hash, std::error_code& ec);
+bool compareFiles(const std::filesystem::path& a, const std::filesystem::path& b, bool& equal, std::error_code& ec);
+
+#endif // FILE_HASH_HPP
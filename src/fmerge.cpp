@@ -0,0 +1,68 @@
+#include "fmerge.hpp"
+
+#include <memory>
+
+#include "folder_merger.hpp"
+
+/**
+ * @brief Run a merge job on a FolderMerger and collect its result
+ *
+ * @param folder_merger merger to run the job on
+ * @param job job to run
+ * @param callbacks functions the merge reports to
+ * 
+ * @return MergeResult outcome of the job
+ */
+static MergeResult runOnMerger(FolderMerger& folder_merger, const MergeJob& job, const MergeCallbacks& callbacks) {
+  folder_merger.setCallbacks(callbacks);
+
+  MergeResult result;
+  for (const auto& exclude_file : job.options.exclude_files) {
+    if (!folder_merger.addExcludeFile(exclude_file)) {
+      result.error = folder_merger.getError();
+      return result;
+    }
+  }
+  folder_merger.addToExcludeList(std::vector<std::filesystem::path>(job.excludes.begin(), job.excludes.end()));
+
+  result.success = folder_merger.runJob(job);
+  result.error = folder_merger.getError();
+  if (result.success) {
+    result.merged_folder = folder_merger.getMergedFolder();
+    result.file_count = folder_merger.getTasks().size();
+    for (const auto& task : folder_merger.getTasks()) {
+      result.byte_count += task.size;
+    }
+  }
+
+  return result;
+}
+
+/**
+ * @brief Merge folders without any prompts, on a thread pool of its own
+ *
+ * The merge never reads std::cin, and only writes to std::cout if callbacks.on_message is not set.
+ *
+ * @param job directory, folders, backup, index and options of the merge
+ * @param callbacks functions to report progress, file events and messages to, all optional
+ * 
+ * @return MergeResult whether the merge succeeded, and why not if it did not
+ */
+MergeResult runMerge(const MergeJob& job, const MergeCallbacks& callbacks) {
+  FolderMerger folder_merger(getJobDirectory(job), "", job.options);
+  return runOnMerger(folder_merger, job, callbacks);
+}
+
+/**
+ * @brief Merge folders without any prompts, sharing a thread pool with the caller's other merges
+ *
+ * @param job directory, folders, backup, index and options of the merge, options.thread_count is ignored
+ * @param callbacks functions to report progress, file events and messages to, all optional
+ * @param pool workers to copy with, several merges may use it at the same time
+ * 
+ * @return MergeResult whether the merge succeeded, and why not if it did not
+ */
+MergeResult runMerge(const MergeJob& job, const MergeCallbacks& callbacks, ThreadPool& pool) {
+  FolderMerger folder_merger(getJobDirectory(job), "", job.options, pool);
+  return runOnMerger(folder_merger, job, callbacks);
+}
@@ -0,0 +1,27 @@
+#ifndef FMERGE_HPP
+#define FMERGE_HPP
+
+// Public interface of libfmerge, for running merges inside another program
+
+#include <cstdint>
+#include <vector>
+#include <filesystem>
+
+#include "merge_options.hpp"
+#include "merge_job.hpp"
+#include "merge_events.hpp"
+#include "thread_pool.hpp"
+
+// Outcome of runMerge()
+struct MergeResult {
+  bool success = false;
+  MergeError error; // Why the merge failed, code is None on success
+  std::filesystem::path merged_folder; // Folder holding the merged files, set on success
+  uint64_t file_count = 0; // Files placed in the merged folder
+  uint64_t byte_count = 0; // Bytes in those files, 0 if the sizes were not read
+};
+
+MergeResult runMerge(const MergeJob& job, const MergeCallbacks& callbacks = MergeCallbacks());
+MergeResult runMerge(const MergeJob& job, const MergeCallbacks& callbacks, ThreadPool& pool);
+
+#endif // FMERGE_HPP
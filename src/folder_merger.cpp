@@ -5,26 +5,102 @@
 ******************************************************************************/ 
 
 /**
- * @brief Check if a file is a valid file to use in an ordering_list
+ * @brief Check if a filename matches any exclude pattern
  *
- * @param file file to check
+ * @param name filename to check
+ * 
+ * @return true if the file should be skipped
+ */
+bool FolderMerger::isExcluded(std::string_view name) const {
+  return m_excludes.matches(name);
+}
+
+/**
+ * @brief Print an error and remember it as the reason the merge failed, unless an earlier error already is
+ *
+ * @param code kind of error
+ * @param message what went wrong, printed after "ERROR: "
+ * @param path file or folder the error is about, optional
+ * 
+ * @return false, so callers can return the result directly
+ */
+bool FolderMerger::fail(MergeErrorCode code, const std::string& message, const std::filesystem::path& path) {
+  m_reporter.flush();
+  console() << "ERROR: " << message << std::endl;
+
+  if (m_error.code == MergeErrorCode::None) {
+    m_error = { code, message, path };
+  }
+  return false;
+}
+
+/**
+ * @brief Tell the console when the log file could not be opened, the per-file log then goes to the console if anywhere
+ *
+ * The reporter opens the log before the callbacks are set, so it cannot print the error itself.
+ */
+void FolderMerger::checkLogFile() {
+  if (!m_options.log_file.empty() && !m_reporter.isLogOpen()) {
+    console() << "ERROR: Cannot open log file: " << m_options.log_file << ", logging to the console instead." << std::endl;
+  }
+}
+
+/**
+ * @brief Check if a snapshot entry is a valid file to use in an ordering_list
+ *
+ * @param snapshot snapshot holding the entry
+ * @param idx index of the entry to check
  * 
  * @return true if success ; false if error
  */
-bool FolderMerger::isValidOrderedListEntry(std::filesystem::path file) {
+bool FolderMerger::isValidOrderedListEntry(const DirSnapshot& snapshot, size_t idx) {
+  const std::filesystem::path kFilename = std::string(snapshot.getName(idx));
+
   // if file is in the exclude list, return false
-  if (m_exclude_list.find(file.filename()) != m_exclude_list.end()) {
-    std::cout << file.filename() << " is an excluded filename. Skipping.\n";
+  if (isExcluded(snapshot.getName(idx))) {
+    console() << kFilename << " is an excluded filename. Skipping.\n";
+    return false;
+  }
+  else if (snapshot[idx].type != EntryType::Directory) {
+    console() << kFilename << " is not a directory, cannot merge this file. Skipping.\n";
+    return false;
+  }
+  else if (isBackupStore(snapshot.getPath(idx))) {
+    console() << kFilename << " is the backup store. Skipping.\n";
     return false;
   }
-  else if (!std::filesystem::is_directory(file)) {
-    std::cout << file.filename() << " is not a directory, cannot merge this file. Skipping.\n";
+  else if (isBackupFolder(snapshot.getPath(idx))) {
+    console() << kFilename << " is a backup of an earlier merge. Skipping.\n";
     return false;
   }
 
   return true;
 }
 
+/**
+ * @brief Check if a folder is a backup made by an earlier merge, every backup folder holds M_BACKUP_MARKER
+ *
+ * @param folder folder to check
+ * 
+ * @return true if it is a backup ; false if not
+ */
+bool FolderMerger::isBackupFolder(const std::filesystem::path& folder) const {
+  std::error_code ec;
+  return std::filesystem::is_regular_file(folder / M_BACKUP_MARKER, ec);
+}
+
+/**
+ * @brief Check if a folder is the --backup-store folder, which must never be merged
+ *
+ * @param folder folder to check
+ * 
+ * @return true if it is the backup store ; false if not, or if there is no backup store
+ */
+bool FolderMerger::isBackupStore(const std::filesystem::path& folder) const {
+  return !m_options.backup_store.empty()
+         && folder.lexically_normal() == (m_main_directory / m_options.backup_store).lexically_normal();
+}
+
 /**
  * @brief Check if a string containing the order of files is in the proper format
  *
@@ -42,12 +118,12 @@ bool FolderMerger::isProperFormat(std::string_view str, const int max_length) {
   for (int i = 0; i < kLength; i++) {
     if (num_of_nums > max_length) {
       // current number is greater than the length of the array
-      std::cout << "ERROR: Too many numbers entered.\n" << std::endl;
+      console() << "ERROR: Too many numbers entered.\n" << std::endl;
       return false;
     }
     else if (!isdigit(str[i]) && str[i] != ' ') {
       // not a digit or space character: unexpected character entered
-      std::cout << "ERROR: Improper format.\n" << std::endl;
+      console() << "ERROR: Improper format.\n" << std::endl;
       return false;
     }
     else if (str[i] == ' ') {
@@ -67,12 +143,12 @@ bool FolderMerger::isProperFormat(std::string_view str, const int max_length) {
 
       if (curr_val > max_length) {
         // value exceeds maximum value allowed
-        std::cout << "ERROR: " << curr_val << " is not the within range(0 - " << max_length << ").\n" << std::endl;
+        console() << "ERROR: " << curr_val << " is not the within range(0 - " << max_length << ").\n" << std::endl;
         return false;
       }
       else if (seen.find(curr_val) != seen.end()) {
         // if number has already been entered
-        std::cout << "ERROR: Do not enter a number more than once.\n" << std::endl;
+        console() << "ERROR: Do not enter a number more than once.\n" << std::endl;
         return false;
       }
       else {
@@ -93,10 +169,16 @@ bool FolderMerger::isProperFormat(std::string_view str, const int max_length) {
  * @return std::vector<std::filesystem::path> containing path elements
  */
 std::vector<std::filesystem::path> FolderMerger::getDirectoryEntries(std::filesystem::path directory) {
+  std::error_code ec;
+  const DirSnapshot kSnapshot(directory, false, ec);
+  if (ec) {
+    fail(MergeErrorCode::ReadFailed, "Cannot read \"" + directory.string() + "\": " + ec.message(), directory);
+  }
+
   std::vector<std::filesystem::path> ret;
-  for (const auto& file : std::filesystem::directory_iterator(directory)) {
-    if (isValidOrderedListEntry(file)) {
-      ret.push_back(file);
+  for (size_t i = 0; i < kSnapshot.size(); i++) {
+    if (isValidOrderedListEntry(kSnapshot, i)) {
+      ret.push_back(kSnapshot.getPath(i));
     }
   }
   
@@ -110,9 +192,9 @@ std::vector<std::filesystem::path> FolderMerger::getDirectoryEntries(std::filesy
  */
 void FolderMerger::printEntries(std::vector<std::filesystem::path>& directory) {
   for (int i = 0; i < directory.size(); i++) {
-    std::cout << i << " - " << directory[i].filename() << "\n";
+    console() << i << " - " << directory[i].filename() << "\n";
   }
-  std::cout << std::endl;
+  console() << std::endl;
 }
 
 /**
@@ -128,11 +210,11 @@ std::vector<std::filesystem::path> FolderMerger::getOrderingList(std::vector<std
   const int kLength = entries.size();
   do {
     printEntries(entries);
-    std::cout << "Enter the order of files using spaces(e.g. '0 1 6 2 5 3 4');\n"
+    console() << "Enter the order of files using spaces(e.g. '0 1 6 2 5 3 4');\n"
               << "Press 'ENTER' if the order is correct and all files should be included: "
               << std::endl;
               
-    std::cout << "ENTER: ";
+    console() << "ENTER: ";
     std::cin >> std::noskipws;
     std::getline(std::cin, input);
   } while (!isProperFormat(input, (kLength - 1)));
@@ -146,12 +228,8 @@ std::vector<std::filesystem::path> FolderMerger::getOrderingList(std::vector<std
   const int kListSize = input.length();
   
   
-  if (input == "") { // if string is empty return original list minus the excluded items
-    for (auto& file : entries) {
-      if (isValidOrderedListEntry(file)) {
-        ordering_list.push_back(file);
-      }
-    }
+  if (input == "") { // if string is empty return original list, excluded items were already removed
+    ordering_list = entries;
   }
   else { // if string is not empty add only the numbered items
     int val = 0;
@@ -168,9 +246,7 @@ std::vector<std::filesystem::path> FolderMerger::getOrderingList(std::vector<std
         continue;
       }
 
-      if (isValidOrderedListEntry(entries[val])) {
-        ordering_list.push_back(entries[val]);
-      }
+      ordering_list.push_back(entries[val]);
       num_elements++;
       val = 0;
     }
@@ -190,16 +266,17 @@ std::vector<std::filesystem::path> FolderMerger::getOrderingList(std::vector<std
  * @return true if success ; false if error occurred
  */
 bool FolderMerger::isValidPath(std::filesystem::path path, bool check_directory) {
-  if (std::filesystem::exists(path)) {
-    if (check_directory && std::filesystem::is_directory(path)) {
-      std::cout << "Path: " << path.filename() << " already exists." << std::endl;
+  std::error_code ec;
+  if (std::filesystem::exists(path, ec)) {
+    if (check_directory && std::filesystem::is_directory(path, ec)) {
+      console() << "Path: " << path.filename() << " already exists." << std::endl;
       return false;
     }
     else if (check_directory) {
         return true;
     }
 
-    std::cout << "Path: " << path.filename() << " already exists." << std::endl;
+    console() << "Path: " << path.filename() << " already exists." << std::endl;
     return false;
   }
 
@@ -210,28 +287,516 @@ bool FolderMerger::isValidPath(std::filesystem::path path, bool check_directory)
  * @brief Creates a backup folder containing all of a std::vector<std::filesystem::path> variable's original content
  *
  * @param ordering_list the vector of paths to copy
+ * @param backup_path name of the backup folder, empty = "Backup", or a name the user enters if that one is taken
  * 
  * @return true if success ; false if error occurred
  */
-bool FolderMerger::createBackup(std::vector<std::filesystem::path>& ordering_list) {
-  std::cout << "Creating backup..." << std::endl;
-  std::filesystem::path backup_path = M_DEFAULT_BACKUP_PATH;
+bool FolderMerger::createBackup(std::vector<std::filesystem::path>& ordering_list, std::filesystem::path backup_path) {
+  console() << "Creating backup..." << std::endl;
+  m_stats.beginPhase("backup");
+
+  // Check if path is a valid backup directory name, a backup store names each backup itself
+  if (backup_path.empty() && !m_options.backup_store.empty()) {
+    backup_path = M_DEFAULT_BACKUP_PATH;
+  }
+  else if (backup_path.empty()) {
+    backup_path = M_DEFAULT_BACKUP_PATH;
+    if (!isValidPath(backup_path, true)) {
+      backup_path = getValidBackupPath();
+    }
+  }
+
+  MergePlan plan;
+  const bool kSuccess = planBackup(ordering_list, m_main_directory / backup_path, plan) && runBackup(plan);
+  m_stats.endPhase();
+
+  if (!kSuccess) {
+    m_stats.setOutcome("backup failed");
+  }
+  return kSuccess;
+}
+
+/**
+ * @brief List every folder and file a backup has to copy
+ *
+ * @param ordering_list folders to back up
+ * @param backup_path backup folder to create, or with a backup store the name its manifest starts with
+ * @param plan gets the backup folder, backend, folders and copies
+ * 
+ * @return true if success ; false if a folder cannot be read
+ */
+bool FolderMerger::planBackup(const std::vector<std::filesystem::path>& ordering_list, std::filesystem::path backup_path, MergePlan& plan) {
+  // a backup into the store is planned like a folder named after its manifest, the folder is never created
+  if (!m_options.backup_store.empty()) {
+    const BackupStore kStore(m_main_directory / m_options.backup_store);
+    plan.backup_store = kStore.getRoot();
+    backup_path = kStore.getNewManifestPath(backup_path.filename().string());
+  }
+
+  plan.backup_path = backup_path;
+  plan.backup_backend = m_options.backup_backend;
+  plan.backup_folders = { backup_path };
+  plan.backup_tasks.clear();
+
+  for (const auto& folder : ordering_list) {
+    // new_folder will be : path-to-parent/backup_path/folder
+    std::filesystem::path new_folder = backup_path / folder.filename();
+    plan.backup_folders.push_back(new_folder);
+
+    std::error_code ec;
+    std::filesystem::recursive_directory_iterator files(folder, ec);
+    for (; !ec && files != std::filesystem::recursive_directory_iterator(); files.increment(ec)) {
+      const std::filesystem::directory_entry& kFile = *files;
+      std::filesystem::path new_filename = new_folder / kFile.path().lexically_relative(folder);
+      std::error_code entry_ec;
+      if (kFile.is_directory(entry_ec)) {
+        plan.backup_folders.push_back(new_filename);
+      }
+      else {
+        const uint64_t kSize = kFile.file_size(entry_ec);
+        plan.backup_tasks.push_back({ plan.paths->add(kFile.path()), plan.paths->add(new_filename), false, entry_ec ? 0 : kSize });
+      }
+    }
+    if (ec) {
+      return fail(MergeErrorCode::BackupFailed, "Cannot read \"" + folder.string() + "\" to back it up: " + ec.message(), folder);
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Make the backup of a plan
+ *
+ * @param plan plan holding the backup folder, folders and copies
+ * 
+ * @return true if success ; false if not every file could be backed up
+ */
+bool FolderMerger::runBackup(const MergePlan& plan) {
+  m_store_keys.clear();
+  if (!plan.backup_store.empty()) {
+    return runStoreBackup(plan);
+  }
+
+  // create every folder right away, so the files can be copied in any order
+  for (const auto& folder : plan.backup_folders) {
+    std::error_code ec;
+    std::filesystem::create_directories(folder, ec);
+  }
+
+  // marks the folder as a backup, so a later job that merges every folder of the directory leaves it alone
+  if (!(std::ofstream(plan.backup_path / M_BACKUP_MARKER) << "Backup made by fmerge, this folder is never merged.\n")) {
+    return fail(MergeErrorCode::BackupFailed, "Cannot create the backup folder \"" + plan.backup_path.string() + "\"", plan.backup_path);
+  }
+
+  // a hardlinked backup shares its data with the merged files in move mode, and with the first folder's files when
+  // they are renumbered in place, so it would not stay untouched
+  const bool kAllowHardlink = (m_options.transfer_mode == TransferMode::Copy && !plan.in_place && !m_options.in_place);
+  if (plan.backup_backend == CopyBackend::Hardlink && !kAllowHardlink) {
+    console() << "Hardlink backups cannot be used in move mode or with in-place renumbering, using copies instead." << std::endl;
+  }
+
+  const std::vector<CopyTask>& tasks = plan.backup_tasks;
+  uint64_t total_bytes = 0;
+  for (const auto& task : tasks) {
+    total_bytes += task.size;
+  }
+
+  CopyEngine engine(m_pool, TransferMode::Copy, getBackendCandidates(plan.backup_backend, kAllowHardlink));
+  engine.useIoUring(m_options.io_uring_depth);
+  engine.setStreaming(m_options.stream_mode, m_options.stream_threshold, m_options.preallocate);
+  engine.syncEachFile(m_options.durability == DurabilityMode::Strict);
+  engine.setConsole(console());
+  m_reporter.beginPhase("Backing up", tasks.size(), total_bytes);
+  const bool kSuccess = engine.run(tasks, [&](size_t idx) { m_reporter.fileDone(tasks[idx].size); });
+  m_reporter.endPhase();
+  m_stats.addWork(tasks.size(), total_bytes);
+
+  if (!kSuccess) {
+    return fail(MergeErrorCode::BackupFailed, "Could not back up every file.", plan.backup_path);
+  }
+
+  // the merged folders are deleted later on, by then their backup has to be on the disk. Ends the caller's backup
+  // phase, so the report shows syncing on its own
+  if (m_options.durability != DurabilityMode::None) {
+    m_stats.beginPhase("backup sync");
+    std::vector<std::filesystem::path> folders = plan.backup_folders;
+    folders.push_back(plan.backup_path.parent_path());
+    std::filesystem::path failed_path;
+    std::error_code ec;
+    const bool kSynced = syncTransfers(tasks, folders, failed_path, ec);
+    m_stats.addWork(tasks.size(), 0);
+    if (!kSynced) {
+      return fail(MergeErrorCode::BackupFailed, "Cannot sync the backup \"" + failed_path.string() + "\" to the disk: " + ec.message(), failed_path);
+    }
+  }
+
+  console() << "Backed up " << tasks.size() << " files using: " << getBackendName(engine.getActiveBackend()) << std::endl;
+  return true;
+}
+
+/**
+ * @brief Make the backup of a plan in its backup store, only contents the store does not hold yet are copied
+ *
+ * Files whose size and write time match an earlier backup of the same directory keep that backup's object without
+ * being read, every other file is hashed to find its object. Objects are synced before they get their final name,
+ * and the manifest is written last.
+ *
+ * @param plan plan holding the backup store, the manifest to write as its backup folder, and the files
+ *
+ * @return true if success ; false if not every file could be backed up
+ */
+bool FolderMerger::runStoreBackup(const MergePlan& plan) {
+  const BackupStore kStore(plan.backup_store);
+  const std::vector<CopyTask>& tasks = plan.backup_tasks;
+
+  BackupManifest manifest;
+  manifest.directory = m_main_directory;
+  for (size_t i = 1; i < plan.backup_folders.size(); i++) { // the first one is the backup itself
+    manifest.folders.push_back(plan.backup_folders[i].lexically_relative(plan.backup_path));
+  }
+
+  std::unordered_map<std::string, ManifestFile> known;
+  kStore.loadKnownFiles(m_main_directory, known);
+
+  manifest.files.resize(tasks.size());
+  std::vector<size_t> hash_files;
+  uint64_t hash_bytes = 0;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    ManifestFile& file = manifest.files[i];
+    const std::filesystem::path kSource = tasks[i].source.path();
+    std::error_code ec;
+    file.path = tasks[i].destination.path().lexically_relative(plan.backup_path);
+    file.size = std::filesystem::file_size(kSource, ec);
+    if (!ec) {
+      file.write_time = BackupStore::getWriteTime(kSource, ec);
+    }
+    if (ec) {
+      return fail(MergeErrorCode::BackupFailed, "Cannot read \"" + kSource.string() + "\": " + ec.message(), kSource);
+    }
+
+    const auto kKnown = known.find(file.path.generic_string());
+    if (kKnown != known.end() && kKnown->second.size == file.size && kKnown->second.write_time == file.write_time) {
+      file.key = kKnown->second.key;
+    }
+    else {
+      hash_files.push_back(i);
+      hash_bytes += file.size;
+    }
+  }
+  known.clear();
+
+  // hash the new and changed files, each worker takes the next file
+  std::vector<uint64_t> hashes(tasks.size());
+  std::atomic<size_t> next_file(0);
+  std::mutex error_mutex;
+  std::filesystem::path failed_path;
+  std::error_code hash_ec;
+  m_reporter.beginPhase("Hashing", hash_files.size(), hash_bytes);
+  TaskGroup group(m_pool);
+  for (unsigned int i = 0; i < m_pool.size(); i++) {
+    group.submit([&] {
+      size_t idx;
+      while ((idx = next_file.fetch_add(1, std::memory_order_relaxed)) < hash_files.size()) {
+        ManifestFile& file = manifest.files[hash_files[idx]];
+        uint64_t hash = 0;
+        std::error_code ec;
+        if (hashFile(tasks[hash_files[idx]].source.path(), hash, ec)) {
+          file.key = BackupStore::makeKey(hash, file.size);
+          hashes[hash_files[idx]] = hash;
+        }
+        else {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (!hash_ec) {
+            failed_path = tasks[hash_files[idx]].source.path();
+            hash_ec = ec;
+          }
+        }
+        m_reporter.fileDone(file.size);
+      }
+    });
+  }
+  group.wait();
+  m_reporter.endPhase();
+  if (hash_ec) {
+    return fail(MergeErrorCode::BackupFailed, "Cannot read \"" + failed_path.string() + "\": " + hash_ec.message(), failed_path);
+  }
+
+  // two different contents can share a hash, so a hashed file only gets the key of an object, or of an earlier file of
+  // this backup, once its bytes match it. The first file with a key that has no object yet is the one copied
+  std::vector<char> hashed(tasks.size(), 0);
+  for (size_t idx : hash_files) {
+    hashed[idx] = 1;
+  }
+  std::unordered_map<std::string, size_t> first_with_key;
+  std::vector<std::pair<size_t, std::filesystem::path>> comparisons; // file, and the object or file it has to match
+  uint64_t compare_bytes = 0;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    const std::string& kKey = manifest.files[i].key;
+    std::error_code ec;
+    if (std::filesystem::exists(kStore.getObjectPath(kKey), ec)) {
+      if (hashed[i]) {
+        comparisons.emplace_back(i, kStore.getObjectPath(kKey));
+        compare_bytes += manifest.files[i].size;
+      }
+      continue;
+    }
+
+    const auto kFirst = first_with_key.emplace(kKey, i);
+    if (hashed[i] && !kFirst.second) {
+      comparisons.emplace_back(i, tasks[kFirst.first->second].source.path());
+      compare_bytes += manifest.files[i].size;
+    }
+  }
+
+  std::vector<char> differs(tasks.size(), 0);
+  next_file = 0;
+  m_reporter.beginPhase("Comparing", comparisons.size(), compare_bytes);
+  TaskGroup compare_group(m_pool);
+  for (unsigned int i = 0; i < m_pool.size(); i++) {
+    compare_group.submit([&] {
+      size_t idx;
+      while ((idx = next_file.fetch_add(1, std::memory_order_relaxed)) < comparisons.size()) {
+        const size_t kFile = comparisons[idx].first;
+        bool equal = false;
+        std::error_code ec;
+        if (!compareFiles(tasks[kFile].source.path(), comparisons[idx].second, equal, ec)) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (!hash_ec) {
+            failed_path = tasks[kFile].source.path();
+            hash_ec = ec;
+          }
+        }
+        differs[kFile] = equal ? 0 : 1;
+        m_reporter.fileDone(manifest.files[kFile].size);
+      }
+    });
+  }
+  compare_group.wait();
+  m_reporter.endPhase();
+  if (hash_ec) {
+    return fail(MergeErrorCode::BackupFailed, "Cannot read \"" + failed_path.string() + "\": " + hash_ec.message(), failed_path);
+  }
+
+  // a file that does not match gets the first variant of its key that holds its bytes or is still free
+  for (const auto& comparison : comparisons) {
+    const size_t kFile = comparison.first;
+    for (unsigned int variant = 2; differs[kFile]; variant++) {
+      const std::string kKey = BackupStore::makeKey(hashes[kFile], manifest.files[kFile].size, variant);
+      std::error_code ec;
+      const bool kHasObject = std::filesystem::exists(kStore.getObjectPath(kKey), ec);
+      const auto kFirst = first_with_key.find(kKey);
+      bool equal = false;
+      if (!kHasObject && kFirst == first_with_key.end()) {
+        first_with_key.emplace(kKey, kFile);
+        equal = true;
+      }
+      else if (!compareFiles(tasks[kFile].source.path(), kHasObject ? kStore.getObjectPath(kKey) : tasks[kFirst->second].source.path(), equal, ec)) {
+        return fail(MergeErrorCode::BackupFailed, "Cannot read \"" + tasks[kFile].source.string() + "\": " + ec.message(), tasks[kFile].source.path());
+      }
+      if (equal) {
+        manifest.files[kFile].key = kKey;
+        differs[kFile] = 0;
+      }
+    }
+  }
+
+  // copy every contents the store does not hold yet, once, under a name that is only trusted after the sync
+  std::vector<CopyTask> object_tasks;
+  std::vector<std::filesystem::path> object_folders;
+  std::unordered_set<std::string> seen_keys;
+  uint64_t object_bytes = 0;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    const std::string& kKey = manifest.files[i].key;
+    std::error_code ec;
+    if (!seen_keys.insert(kKey).second || std::filesystem::exists(kStore.getObjectPath(kKey), ec)) {
+      continue;
+    }
+
+    const std::filesystem::path kFolder = kStore.getObjectFolder(kKey);
+    if (std::find(object_folders.begin(), object_folders.end(), kFolder) == object_folders.end()) {
+      std::filesystem::create_directories(kFolder, ec);
+      object_folders.push_back(kFolder);
+    }
+    std::filesystem::path partial_path = kStore.getObjectPath(kKey);
+    partial_path += ".partial";
+    std::filesystem::remove(partial_path, ec); // left behind by an interrupted backup
+
+    object_tasks.push_back({ tasks[i].source, plan.paths->add(partial_path), false, manifest.files[i].size });
+    object_bytes += manifest.files[i].size;
+  }
+
+  // an object is never a hardlink, a source file edited in place later would change it and every manifest naming it
+  // would restore the wrong bytes
+  if (plan.backup_backend == CopyBackend::Hardlink) {
+    console() << "Backup store objects cannot be hardlinks, using reflinks or copies instead." << std::endl;
+  }
+  const CopyBackend kObjectBackend = (plan.backup_backend == CopyBackend::Hardlink) ? CopyBackend::Auto : plan.backup_backend;
+  CopyEngine engine(m_pool, TransferMode::Copy, getBackendCandidates(kObjectBackend, false));
+  engine.useIoUring(m_options.io_uring_depth);
+  engine.setStreaming(m_options.stream_mode, m_options.stream_threshold, m_options.preallocate);
+  engine.syncEachFile(m_options.durability == DurabilityMode::Strict);
+  engine.setConsole(console());
+  m_reporter.beginPhase("Backing up", object_tasks.size(), object_bytes);
+  const bool kSuccess = engine.run(object_tasks, [&](size_t idx) { m_reporter.fileDone(object_tasks[idx].size); });
+  m_reporter.endPhase();
+  m_stats.addWork(tasks.size(), object_bytes);
+
+  if (!kSuccess) {
+    return fail(MergeErrorCode::BackupFailed, "Could not back up every file.", kStore.getRoot());
+  }
+
+  // a file changed after it was hashed would be stored under the wrong contents
+  for (size_t i = 0; i < tasks.size(); i++) {
+    const std::filesystem::path kSource = tasks[i].source.path();
+    std::error_code ec;
+    const uint64_t kSize = std::filesystem::file_size(kSource, ec);
+    const int64_t kWriteTime = BackupStore::getWriteTime(kSource, ec);
+    if (ec || kSize != manifest.files[i].size || kWriteTime != manifest.files[i].write_time) {
+      return fail(MergeErrorCode::BackupFailed, "\"" + kSource.string() + "\" changed while it was backed up.", kSource);
+    }
+  }
+
+  // ends the caller's backup phase, so the report shows syncing on its own
+  if (m_options.durability != DurabilityMode::None) {
+    m_stats.beginPhase("backup sync");
+  }
+  std::error_code ec;
+  if (!syncTransfers(object_tasks, { kStore.getRoot() }, failed_path, ec)) {
+    return fail(MergeErrorCode::BackupFailed, "Cannot sync the backup \"" + failed_path.string() + "\" to the disk: " + ec.message(), failed_path);
+  }
+  for (const auto& task : object_tasks) {
+    std::filesystem::path object_path = task.destination.path();
+    object_path.replace_extension();
+    std::filesystem::rename(task.destination.path(), object_path, ec);
+    if (ec) {
+      return fail(MergeErrorCode::BackupFailed, "Cannot add \"" + object_path.string() + "\" to the backup store: " + ec.message(), object_path);
+    }
+  }
+  if (!syncTransfers({}, object_folders, failed_path, ec)) {
+    return fail(MergeErrorCode::BackupFailed, "Cannot sync the backup \"" + failed_path.string() + "\" to the disk: " + ec.message(), failed_path);
+  }
+
+  std::filesystem::create_directories(kStore.getManifestFolder(), ec);
+  if (!writeManifest(manifest, plan.backup_path, m_options.durability != DurabilityMode::None, ec)) {
+    return fail(MergeErrorCode::BackupFailed, "Cannot write the backup manifest \"" + plan.backup_path.string() + "\": " + ec.message(), plan.backup_path);
+  }
+  m_stats.addWork(tasks.size(), 0);
+
+  m_store_manifest = plan.backup_path;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    m_store_keys[tasks[i].source.string()] = manifest.files[i].key;
+  }
+
+  console() << "Backed up " << tasks.size() << " files into " << plan.backup_path << ", " << object_tasks.size() << " new ("
+            << ProgressReporter::formatBytes(object_bytes) << ") using: " << getBackendName(engine.getActiveBackend()) << std::endl;
+  return true;
+}
+
+/**
+ * @brief Add the merged folder to the backup store as a backup of its own, made of the objects of the backup taken
+ * before the merge, so the next backup finds its files unchanged without reading them
+ *
+ * @param merged_folder folder the merged files ended up in
+ */
+void FolderMerger::recordMergedFolder(const std::filesystem::path& merged_folder) {
+  BackupManifest manifest;
+  manifest.directory = m_main_directory;
+  manifest.folders.push_back(merged_folder.filename());
+
+  // duplicates linked to another merged file are left out, the next backup reads them again
+  for (const auto& task : m_tasks) {
+    const auto kKey = m_store_keys.find(task.source.string());
+    if (task.link || kKey == m_store_keys.end()) {
+      continue;
+    }
+
+    ManifestFile file;
+    file.key = kKey->second;
+    file.path = merged_folder.filename() / std::string(task.destination.getName());
+    const std::filesystem::path kMergedFile = merged_folder / std::string(task.destination.getName());
+    std::error_code ec;
+    file.size = std::filesystem::file_size(kMergedFile, ec);
+    file.write_time = ec ? 0 : BackupStore::getWriteTime(kMergedFile, ec);
+    if (!ec && file.size == task.size) {
+      manifest.files.push_back(std::move(file));
+    }
+  }
+
+  std::filesystem::path manifest_file = m_store_manifest;
+  manifest_file.replace_filename(m_store_manifest.stem().string() + "-merged.txt");
+  std::error_code ec;
+  if (!writeManifest(manifest, manifest_file, m_options.durability != DurabilityMode::None, ec)) {
+    console() << "ERROR: Cannot write the backup manifest " << manifest_file << ": " << ec.message() << std::endl;
+  }
+}
+
+/**
+ * @brief Recreate the folders of a backup from the backup store, in the main directory
+ *
+ * Nothing is overwritten: the restore stops before copying anything if one of the files already exists.
+ *
+ * @param manifest_file manifest of the backup, inside the store's manifests folder
+ *
+ * @return true if success ; false if the backup could not be restored completely
+ */
+bool FolderMerger::restoreBackup(const std::filesystem::path& manifest_file) {
+  m_stats.beginPhase("restore");
+  BackupManifest manifest;
+  if (!readManifest(manifest_file, manifest)) {
+    return fail(MergeErrorCode::RestoreFailed, "Cannot read the backup manifest \"" + manifest_file.string() + "\"", manifest_file);
+  }
+  const BackupStore kStore(manifest_file.parent_path().parent_path());
+
+  std::vector<std::filesystem::path> folders = { m_main_directory };
+  std::error_code ec;
+  for (const auto& folder : manifest.folders) {
+    folders.push_back(m_main_directory / folder);
+    std::filesystem::create_directories(folders.back(), ec);
+  }
 
-  // Check if path is a valid backup directory name
-  if (!isValidPath(backup_path, true)) {
-    backup_path = getValidBackupPath();
+  const std::shared_ptr<PathTable> kPaths = std::make_shared<PathTable>();
+  std::vector<CopyTask> tasks;
+  uint64_t total_bytes = 0;
+  for (const auto& file : manifest.files) {
+    const std::filesystem::path kDestination = m_main_directory / file.path;
+    if (std::filesystem::exists(kDestination, ec)) {
+      return fail(MergeErrorCode::RestoreFailed, "\"" + kDestination.string() + "\" already exists, nothing was restored.", kDestination);
+    }
+    tasks.push_back({ kPaths->add(kStore.getObjectPath(file.key)), kPaths->add(kDestination), false, file.size });
+    total_bytes += file.size;
+  }
+
+  // a hardlink would let changes to a restored file change the store
+  CopyEngine engine(m_pool, TransferMode::Copy, getBackendCandidates(m_options.backup_backend, false));
+  engine.useIoUring(m_options.io_uring_depth);
+  engine.setStreaming(m_options.stream_mode, m_options.stream_threshold, m_options.preallocate);
+  engine.syncEachFile(m_options.durability == DurabilityMode::Strict);
+  engine.setConsole(console());
+  console() << "Restoring " << tasks.size() << " files from " << manifest_file << " into " << m_main_directory << std::endl;
+  m_reporter.beginPhase("Restoring", tasks.size(), total_bytes);
+  const bool kSuccess = engine.run(tasks, [&](size_t idx) { m_reporter.fileDone(tasks[idx].size); });
+  m_reporter.endPhase();
+  m_stats.addWork(tasks.size(), total_bytes);
+  if (!kSuccess) {
+    m_stats.setOutcome("restore failed");
+    return fail(MergeErrorCode::RestoreFailed, "Could not restore every file.", manifest_file);
   }
 
-  backup_path = m_main_directory / backup_path;
-  std::filesystem::create_directory(backup_path);
+  // the restored files get their old write times back, so the next backup finds them unchanged
+  for (size_t i = 0; i < tasks.size(); i++) {
+    const std::filesystem::file_time_type kWriteTime{ std::filesystem::file_time_type::duration(manifest.files[i].write_time) };
+    std::filesystem::last_write_time(tasks[i].destination.path(), kWriteTime, ec);
+  }
 
-  // copy all data to backup  
-  for (auto& file : ordering_list) {
-    // new_filename will be : path-to-parent/backup_path/file.extension
-    std::filesystem::path new_filename = backup_path / file.filename();
-    std::filesystem::copy(file, new_filename, std::filesystem::copy_options::recursive);
+  std::filesystem::path failed_path;
+  if (!syncTransfers(tasks, folders, failed_path, ec)) {
+    m_stats.setOutcome("restore failed");
+    return fail(MergeErrorCode::RestoreFailed, "Cannot sync \"" + failed_path.string() + "\" to the disk: " + ec.message(), failed_path);
   }
 
+  m_stats.setOutcome("restored");
+  console() << "Restored " << tasks.size() << " files." << std::endl;
   return true;
 }
 
@@ -243,9 +808,9 @@ bool FolderMerger::createBackup(std::vector<std::filesystem::path>& ordering_lis
 std::filesystem::path FolderMerger::getValidBackupPath() {
   std::string input;
   do {
-    std::cout << "Enter a valid backup folder name: " << std::endl;
+    console() << "Enter a valid backup folder name: " << std::endl;
 
-    std::cout << "ENTER: ";
+    console() << "ENTER: ";
     std::cin >> std::noskipws;
     std::getline(std::cin, input);
     // check if file exists, or if there is not a directory with that name
@@ -267,9 +832,9 @@ std::filesystem::path FolderMerger::getValidIndexPath() {
 
   std::string input;
   do {
-    std::cout << "Enter a valid Index folder name: ";
+    console() << "Enter a valid Index folder name: ";
     
-    std::cout << "ENTER: ";
+    console() << "ENTER: ";
     std::cin >> std::noskipws;
     std::getline(std::cin, input);
     // check if file exists, or if there is not a directory with that name
@@ -287,138 +852,1667 @@ std::filesystem::path FolderMerger::getValidIndexPath() {
  * @return true if succes ; false if error
  */
 bool FolderMerger::merge(std::vector<std::filesystem::path>& ordering_list, std::filesystem::path& index_file) {
-  std::filesystem::path destination_folder = m_main_directory / M_TEMP_FOLDER;
-  std::filesystem::create_directory(destination_folder); // create temp directory
+  m_stats.beginPhase("merge");
+  MergePlan plan;
+  bool success = planMerge(ordering_list, index_file, plan);
+
+  // the backup and index are already made, only the space for the merged files is left to check
+  if (success) {
+    checkPlan(plan, m_pool.size());
+    for (const auto& problem : plan.problems) {
+      if (problem.code == MergeErrorCode::NotEnoughSpace) {
+        success = fail(problem.code, problem.message, problem.path);
+      }
+    }
+  }
+
+  success = success && runPlannedMerge(plan);
+  m_stats.endPhase();
+  return success;
+}
+
+/**
+ * @brief Work out the new name of every file, without copying anything
+ * 
+ * @param ordering_list folders to merge, in order
+ * @param index_file index file to list the first file of every folder in, empty = no index
+ * @param plan gets the folders, the transfers and the index entries
+ * 
+ * @return true if success ; false if a folder cannot be read or the merge has to stop at a nested folder
+ */
+bool FolderMerger::planMerge(const std::vector<std::filesystem::path>& ordering_list, const std::filesystem::path& index_file, MergePlan& plan) {
+  plan.directory = m_main_directory;
+  plan.transfer_mode = m_options.transfer_mode;
+  plan.folders = ordering_list;
+  plan.index_path = index_file;
+  plan.index_starts.assign(ordering_list.size(), "");
+  plan.tasks.clear();
+  const std::filesystem::path kDestinationFolder = m_main_directory / M_TEMP_FOLDER;
+  for (const auto& folder : ordering_list) {
+    if (isBackupStore(folder)) {
+      return fail(MergeErrorCode::InvalidJob, "\"" + folder.filename().string() + "\" is the backup store, it cannot be merged.", folder);
+    }
+  }
+
+  // read every folder once, both passes below work from these snapshots. The sizes are always read, so the plan
+  // knows how much space the merge needs
+  const bool kDedup = (m_options.dedup_mode != DedupMode::Off);
+  std::function<bool(std::string_view)> enter_folder;
+  if (m_options.nested_folder_policy == NestedFolderPolicy::Recurse) {
+    enter_folder = [this](std::string_view name) { return !isExcluded(name); };
+  }
+  // the files of a folder being appended to already have their numbers
+  const size_t kFirstFolder = plan.append ? 1 : 0;
+
+  // the first folder's files can be renamed where they are instead of transferred, unless it is being appended to
+  // or the merge goes into an archive. A duplicate that is skipped would keep its old name in the merged folder, so
+  // looking for duplicates turns it off
+  plan.in_place = m_options.in_place && !plan.append && plan.archive_path.empty() && !kDedup;
+  if (m_options.in_place && !plan.in_place && !plan.append && plan.archive_path.empty()) {
+    console() << "The first folder cannot be renumbered in place when duplicates are looked for, it is merged the usual way." << std::endl;
+  }
+  if (plan.in_place) {
+    plan.renames.clear();
+  }
+
+  // with a sort memory budget every folder is read on its own and sorted on disk once it outgrows the budget,
+  // instead of keeping every entry of every folder in memory until the merge is planned
+  const bool kSortOnDisk = (m_options.sort_memory > 0 && !kDedup && m_options.nested_folder_policy != NestedFolderPolicy::Recurse);
+  std::vector<std::unique_ptr<SortedDirReader>> sorted_folders(ordering_list.size());
+  DirTree tree;
+  if (!kSortOnDisk) {
+    tree.scan(m_pool, std::vector<std::filesystem::path>(ordering_list.begin() + kFirstFolder, ordering_list.end()), true, enter_folder);
+  }
 
   // get length to find smallest prefix of 0's to use
   int length = 0;
-  for (const auto& folder : ordering_list) {
-    for (const auto& file : std::filesystem::directory_iterator(folder)) {
-      if (std::filesystem::is_directory(file)) {
-        std::cout << "Folder detected in " << folder << ", would you like to skip or quit(Enter: "
-                  << M_QUIT_FLAG << " to quit or enter: 'any key' to skip)." << std::endl;
-        
-        std::string input = "";
-        std::cout << "ENTER: ";
-        std::getline(std::cin, input);
-
-        if (input == M_QUIT_FLAG) {
-          return false;
-        }
-      }
-      else if (m_exclude_list.find(file) != m_exclude_list.end()) {
-        std::cout << file.path().filename() << " is not a valid entry. Skipping.\n";
+  std::vector<FileRef> files; // every file to merge, in merge order
+  std::vector<std::vector<FileRef>> entries(ordering_list.size()); // every entry that gets a number, per folder
+  uint64_t sorted_memory = 0; // bytes of entries held by the readers that did not spill
+  for (size_t i = kFirstFolder; i < ordering_list.size(); i++) {
+    if (kSortOnDisk) {
+      if (!readSortedFolder(ordering_list[i], sorted_memory, sorted_folders[i])) {
+        return false;
       }
+      length += static_cast<int>(sorted_folders[i]->size());
+      continue;
+    }
 
-      length++;
+    const DirNode* kError = DirTree::findError(tree[i - kFirstFolder]);
+    if (kError != nullptr) {
+      const std::filesystem::path& kFolder = kError->snapshot.getDirectory();
+      return fail(MergeErrorCode::ReadFailed, "Cannot read \"" + kFolder.string() + "\": " + kError->error.message(), kFolder);
     }
-  }  
 
-  // find how many leading zeroes there will be, e.g. 001.png or 000001.pdf or 1.txt
-  int leading_zeroes = 0;
-  while(length > 9) {
-    length /= 10;
-    leading_zeroes++;
+    if (!collectEntries(tree[i - kFirstFolder], ordering_list[i], entries[i], files)) {
+      return false;
+    }
+    length += static_cast<int>(entries[i].size());
   }
 
-  int idx_num = 1;
-  int folder_idx = 0;
-  int ten_multiple = 10;
+  // find files with the same contents as an earlier file
+  std::vector<size_t> original_file;
+  if (kDedup) {
+    console() << "Looking for duplicate files..." << std::endl;
+    DuplicateFinder finder(m_pool);
+    finder.setConsole(console());
+    original_file = finder.findDuplicates(files);
+
+    m_reporter.flush();
+    console() << "Found " << finder.getDuplicateCount() << " duplicate files, "
+              << (m_options.dedup_mode == DedupMode::Skip ? "skipping" : "linking") << " them saves "
+              << ProgressReporter::formatBytes(finder.getBytesSaved()) << " ("
+              << ProgressReporter::formatBytes(finder.getBytesHashed()) << " hashed)." << std::endl;
+
+    if (m_options.dedup_mode == DedupMode::Skip) {
+      length -= static_cast<int>(finder.getDuplicateCount());
+    }
+  }
 
-  for (const auto& folder : ordering_list) {
-    bool append_to_index = true;
-    std::cout << folder_idx << " - " << folder.stem().string() << ": "; // print header
-    for (const auto& file : std::filesystem::directory_iterator(folder)) {
-      // Check if this file is in the exlcude list
-      if (m_exclude_list.find(file.path().filename()) != m_exclude_list.end()) {
-        std::cout << file.path().filename() << " is not a valid entry. Skipping.\n";
-        continue;
-      }
+  const int kEntryCount = length;
 
-      // Remove a leading zero
-      if (idx_num % ten_multiple == 0) { // divisible by some multiple of ten
-        ten_multiple *= 10;
-        leading_zeroes--;
-      }
+  // pad every number to the digits of the last one, e.g. 001.png or 000001.pdf or 1.txt
+  const uint64_t kLastNumber = plan.first_number + kEntryCount - 1;
+  plan.number_width = std::max(plan.number_width, static_cast<int>(std::to_string(kLastNumber).size()));
 
-      // Add zeroes to string
-      std::string temp_zeroes = "";
-      for (int i = 0; i < leading_zeroes; i++) {
-        temp_zeroes += '0';
-      }
-      
-      // // filename e.g. folder_name/001.txt
-      std::filesystem::path new_file = destination_folder / (temp_zeroes + std::to_string(idx_num) + file.path().extension().string());
+  uint64_t idx_num = plan.first_number;
+  int folder_idx = 0;
+  size_t file_idx = 0; // position in files
+  std::vector<size_t> task_of_file(files.size()); // task that copies each file, used to link duplicates
+
+  // Assign every destination name up front, so the numbering does not depend on the order copies finish in
+  std::vector<CopyTask>& tasks = plan.tasks;
+  tasks.reserve(kEntryCount);
+  PathTable& paths = *plan.paths;
+  const uint32_t kDestinationFolderId = paths.addFolder(kDestinationFolder);
+  const uint32_t kFirstFolderId = plan.in_place ? paths.addFolder(ordering_list[0]) : 0;
+  const DirSnapshot* source_snapshot = nullptr; // snapshot the source folder was last added for
+  uint32_t source_folder = 0;
+  std::string new_name; // reused, a million names should not mean a million strings
+
+  bool append_to_index = true;
+
+  // name one entry and plan its transfer
+  auto plan_entry = [&](const DirSnapshot& snapshot, size_t j, const std::filesystem::path& folder) {
+    const bool kIsFile = (snapshot[j].type != EntryType::Directory);
+    const bool kIsDuplicate = kIsFile && kDedup && original_file[file_idx] != file_idx;
+    if (kIsDuplicate && m_options.dedup_mode == DedupMode::Skip) {
+      file_idx++;
+      return;
+    }
 
-      idx_num++;
+    const std::string_view kName = snapshot.getName(j);
 
-      // Add to index file
-      if (append_to_index && std::filesystem::exists(index_file)) {
-        std::ofstream ofstream;
-        
-        // Open with appending permission
-        ofstream.open(index_file.filename(), std::ios_base::app);
-        if (!ofstream.is_open()) {
-          std::cout << "Error appending: " << folder_idx << "-\"" << folder.stem().string() << "\" to the index file." << std::endl;
-          break;
-        }
+    // Add zeroes to the number, then the extension, e.g. 001.png
+    char digits[24];
+    char* const kDigitsEnd = std::to_chars(digits, digits + sizeof(digits), idx_num).ptr;
+    new_name.assign(plan.number_width - (kDigitsEnd - digits), '0');
+    new_name.append(digits, kDigitsEnd);
+    new_name.append(snapshot.getExtension(j));
+
+    idx_num++;
+
+    // Add to index file
+    if (append_to_index && !index_file.empty()) {
+      m_reporter.logLine("Appending to index file.");
+      plan.index_starts[folder_idx] = new_name;
+      append_to_index = false;
+    }
 
-        std::cout << "Appending to index file." << std::endl;
+    // skipped nested folders still take up a number, but there is nothing to copy
+    if (!kIsFile) {
+      return;
+    }
 
-        ofstream << folder_idx << " - " << folder.stem() << "\n"
-                 << "Starts on the file named: " << new_file.filename()
-                 << "\n" << std::endl;
+    if (&snapshot != source_snapshot) {
+      source_snapshot = &snapshot;
+      source_folder = paths.addFolder(snapshot.getDirectory());
+    }
 
-        ofstream.close();
-        append_to_index = false;
+    // the first folder's files only change their name, a file already named by its number stays as it is
+    if (plan.in_place && folder_idx == 0) {
+      if (source_folder != kFirstFolderId || kName != new_name) {
+        plan.renames.push_back({ paths.add(source_folder, kName), paths.add(kFirstFolderId, new_name) });
+      }
+      if (m_reporter.isLogging()) {
+        m_reporter.logRename(snapshot.getPath(j).lexically_relative(folder), new_name);
       }
+      if (m_callbacks.on_file) {
+        m_callbacks.on_file({ FileEventType::Planned, snapshot.getPath(j), ordering_list[0] / new_name, snapshot[j].size });
+      }
+      file_idx++;
+      return;
+    }
+
+    const FilePath kSource = kIsDuplicate ? tasks[task_of_file[original_file[file_idx]]].destination : paths.add(source_folder, kName);
+    const FilePath kDestination = paths.add(kDestinationFolderId, new_name);
+
+    if (m_reporter.isLogging()) {
+      m_reporter.logRename(snapshot.getPath(j).lexically_relative(folder), new_name);
+    }
+    if (m_callbacks.on_file) {
+      m_callbacks.on_file({ FileEventType::Planned, snapshot.getPath(j), kDestination.path(), snapshot[j].size });
+    }
+    tasks.push_back({ kSource, kDestination, kIsDuplicate, snapshot[j].size });
+    if (kDedup) {
+      task_of_file[file_idx] = tasks.size() - 1;
+    }
+    file_idx++;
+  };
+
+  for (const auto& folder : ordering_list) {
+    if (plan.append && folder_idx == 0) { // the folder being appended to
+      folder_idx++;
+      continue;
+    }
 
-      // print and copy file
-      std::cout << "Old filename: " << file.path().filename() << "\nNew filename: " << new_file.filename() << "\n";
-      std::filesystem::copy(file.path(), new_file, std::filesystem::copy_options::overwrite_existing);
+    append_to_index = true;
+    source_snapshot = nullptr; // a chunk of a sorted folder can reuse the memory of an earlier one
+    m_reporter.logLine(std::to_string(folder_idx) + " - " + folder.stem().string() + ":"); // print header
+    if (kSortOnDisk) {
+      SortedDirReader& reader = *sorted_folders[folder_idx];
+      std::error_code ec;
+      const DirSnapshot* chunk;
+      while ((chunk = reader.nextChunk(ec)) != nullptr) {
+        for (size_t j = 0; j < chunk->size(); j++) {
+          plan_entry(*chunk, j, folder);
+        }
+      }
+      if (ec) {
+        return fail(MergeErrorCode::ReadFailed, "Cannot read the sorted entries of \"" + folder.string() + "\": " + ec.message(), folder);
+      }
+      sorted_folders[folder_idx].reset();
+    }
+    for (const FileRef& entry : entries[folder_idx]) {
+      plan_entry(*entry.snapshot, entry.idx, folder);
     }
 
-    std::cout << std::endl;
+    m_reporter.logLine("");
 
     folder_idx++;
   }
+  m_reporter.flush();
 
-  return true;
+  return !plan.in_place || checkInPlaceNames(plan);
 }
 
 /**
- * @brief Complete merge by moving folder from temp directory to the main directory
+ * @brief Make sure renumbering the first folder in place does not overwrite what is left in it
  *
- * @param src_path path to old filename
- * @param dest_path path to the new filename
+ * Excluded files and nested folders keep their names, so none of them may have the name of a numbered file.
+ *
+ * @param plan plan made by planMerge() with the first folder renumbered in place
+ *
+ * @return true if success ; false if the first folder cannot be read or an entry would be overwritten
  */
-void FolderMerger::confirmMerge(std::vector<std::filesystem::path>& ordering_list, std::filesystem::path& src_path, std::filesystem::path& dest_path) {
-  // delete everything in the ordering list
-  for (auto& folder : ordering_list) {
-    if (std::filesystem::remove_all(folder)) {
-      std::cout << "Successfully deleted folder: " << folder.filename() << std::endl;
-      continue;
+bool FolderMerger::checkInPlaceNames(const MergePlan& plan) {
+  const std::filesystem::path& kFolder = plan.folders[0];
+  std::unordered_set<std::string> kept_names;
+  std::error_code ec;
+  DirReader reader(kFolder, false, ec);
+  DirEntry entry;
+  while (reader.next(entry, ec)) {
+    if (entry.type == EntryType::Directory || isExcluded(entry.name)) {
+      kept_names.emplace(entry.name);
     }
-    else {
-      std::cout << "ERROR: Cannot delete: " << folder.filename() << std::endl;
+  }
+  if (ec) {
+    return fail(MergeErrorCode::ReadFailed, "Cannot read \"" + kFolder.string() + "\": " + ec.message(), kFolder);
+  }
+
+  auto is_kept = [&](const FilePath& file) { return kept_names.count(std::string(file.getName())) > 0; };
+  for (const auto& rename : plan.renames) {
+    if (is_kept(rename.destination)) {
+      return fail(MergeErrorCode::InvalidJob, "\"" + std::string(rename.destination.getName()) + "\" in \"" + kFolder.filename().string()
+                  + "\" is not renumbered and would be overwritten, it cannot be merged in place.", rename.destination.path());
+    }
+  }
+  for (const auto& task : plan.tasks) {
+    if (is_kept(task.destination)) {
+      return fail(MergeErrorCode::InvalidJob, "\"" + std::string(task.destination.getName()) + "\" in \"" + kFolder.filename().string()
+                  + "\" is not renumbered and would be overwritten, it cannot be merged in place.", kFolder / std::string(task.destination.getName()));
     }
   }
 
-  std::filesystem::rename(src_path, dest_path);
-  std::cout << "Successfully merged files." << std::endl;
+  return true;
 }
 
 /**
- * @brief Delete the temporary folder
- *
+ * @brief Copy or move every file of a plan into the temp folder and fill in the index file
+ * 
+ * @param plan plan made by planMerge(), its backup and index file have to be made already
+ * 
+ * @return true if success ; false if not every file could be transferred
+ */
+bool FolderMerger::runPlannedMerge(const MergePlan& plan) {
+  std::error_code ec;
+  std::filesystem::create_directory(m_main_directory / M_TEMP_FOLDER, ec); // create temp directory
+  if (ec) {
+    return fail(MergeErrorCode::TransferFailed, "Cannot create the temp folder: " + ec.message(), m_main_directory / M_TEMP_FOLDER);
+  }
+  m_tasks = plan.tasks;
+  m_unverified_tasks.clear();
+  m_appending = plan.append || plan.in_place;
+  m_renames = plan.renames;
+  m_renames_staged = false;
+
+  if (!plan.index_path.empty()) {
+    // Open with appending permission
+    std::ofstream ofstream(plan.index_path, std::ios_base::app);
+    writeIndex(plan, ofstream);
+
+    if (!ofstream.is_open()) {
+      console() << "Error appending to the index file: " << plan.index_path.filename() << std::endl;
+    }
+  }
+
+  // write down the plan before anything is copied, so a crash can be resumed from here
+  if (m_journal.create(plan.transfer_mode, plan.folders, m_appending)) {
+    bool written = true;
+    for (const auto& rename : m_renames) {
+      written = written && m_journal.addRename(rename);
+    }
+    for (const auto& task : m_tasks) {
+      written = written && m_journal.addTask(task);
+    }
+    if (m_options.durability == DurabilityMode::Strict) {
+      written = written && m_journal.markSyncedDone();
+    }
+    written = written && m_journal.beginCopying();
+
+    // a plan that is not all on the disk could not be resumed from, nothing was copied yet
+    if (!written) {
+      return fail(MergeErrorCode::TransferFailed, "Cannot write \"" + M_JOURNAL_FILE.string() + "\": " + m_journal.getError().message(),
+                  m_journal.getPath());
+    }
+  }
+  else {
+    console() << "ERROR: Cannot create " << M_JOURNAL_FILE << ", this merge cannot be resumed if it is interrupted." << std::endl;
+  }
+
+  // copy or move all files
+  std::vector<size_t> task_indices(m_tasks.size());
+  for (size_t i = 0; i < m_tasks.size(); i++) {
+    task_indices[i] = i;
+  }
+
+  return transferFiles(task_indices);
+}
+
+/**
+ * @brief Read and sort the entries of a folder that get a number, within the --sort-memory budget
+ *
+ * @param folder folder being merged
+ * @param memory_used bytes of entries kept in memory by the folders read before, the folder is spilled to disk
+ *                    if it does not fit next to them
+ * @param reader set to the reader that hands out the entries in name order
+ *
+ * @return true if success ; false if the folder cannot be read or the merge should stop at a nested folder
+ */
+bool FolderMerger::readSortedFolder(const std::filesystem::path& folder, uint64_t& memory_used, std::unique_ptr<SortedDirReader>& reader) {
+  bool stopped = false;
+  auto keep_entry = [&](const DirEntry& entry) {
+    if (stopped) {
+      return false;
+    }
+    else if (isExcluded(entry.name)) {
+      m_reporter.logLine("\"" + std::string(entry.name) + "\" is not a valid entry. Skipping.");
+      if (m_callbacks.on_file) {
+        m_callbacks.on_file({ FileEventType::Excluded, folder / std::string(entry.name), "", entry.size });
+      }
+      return false;
+    }
+    else if (entry.type == EntryType::Directory && !handleNestedFolder(folder)) {
+      stopped = true;
+      return false;
+    }
+    return true;
+  };
+
+  reader = std::make_unique<SortedDirReader>(folder, m_main_directory, m_options.sort_memory);
+  std::error_code ec;
+  if (!reader->read(true, keep_entry, ec)) {
+    return fail(MergeErrorCode::ReadFailed, "Cannot read \"" + folder.string() + "\": " + ec.message(), folder);
+  }
+  else if (stopped) {
+    return false;
+  }
+
+  if (reader->getRunCount() == 0 && memory_used + reader->getMemoryUsage() > m_options.sort_memory) {
+    if (!reader->spill(ec)) {
+      return fail(MergeErrorCode::ReadFailed, "Cannot sort \"" + folder.string() + "\": " + ec.message(), folder);
+    }
+  }
+  memory_used += reader->getMemoryUsage();
+  return true;
+}
+
+/**
+ * @brief List the entries of a folder that get a number, in merge order, going into nested folders when recursing
+ *
+ * @param node folder to list, read by the DirTree
+ * @param folder folder being merged that holds node, the top of its tree
+ * @param entries gets every file, and every skipped nested folder since those keep their number
+ * @param files gets every file, the input to the duplicate finder
+ * 
+ * @return true if success ; false if the merge should stop at a nested folder
+ */
+bool FolderMerger::collectEntries(const DirNode& node, const std::filesystem::path& folder, std::vector<FileRef>& entries, std::vector<FileRef>& files) {
+  const DirSnapshot& snapshot = node.snapshot;
+  for (size_t j = 0; j < snapshot.size(); j++) {
+    if (isExcluded(snapshot.getName(j))) {
+      m_reporter.logLine("\"" + std::string(snapshot.getName(j)) + "\" is not a valid entry. Skipping.");
+      if (m_callbacks.on_file) {
+        m_callbacks.on_file({ FileEventType::Excluded, snapshot.getPath(j), "", snapshot[j].size });
+      }
+      continue;
+    }
+    else if (snapshot[j].type != EntryType::Directory) {
+      files.push_back({ &snapshot, j });
+      entries.push_back({ &snapshot, j });
+    }
+    else if (!node.children.empty() && node.children[j]) { // read by a recursive scan, its files take its place
+      if (!collectEntries(*node.children[j], folder, entries, files)) {
+        return false;
+      }
+    }
+    else if (handleNestedFolder(folder)) {
+      entries.push_back({ &snapshot, j });
+    }
+    else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Decide what to do with a folder found inside a folder being merged
+ *
+ * @param folder folder being merged that holds the nested folder
+ * 
+ * @return true if the nested folder should be skipped ; false if the merge should stop
+ */
+bool FolderMerger::handleNestedFolder(const std::filesystem::path& folder) {
+  switch (m_options.nested_folder_policy) {
+    case NestedFolderPolicy::Skip: {
+      m_reporter.logLine("Folder detected in \"" + folder.string() + "\". Skipping.");
+      return true;
+    }
+    case NestedFolderPolicy::Recurse: // only left for folders that are not entered, such as links to folders
+    case NestedFolderPolicy::Quit: {
+      return fail(MergeErrorCode::NestedFolder, "Folder detected in \"" + folder.string() + "\", stopping the merge.", folder);
+    }
+    case NestedFolderPolicy::Ask: {
+      break;
+    }
+  }
+
+  m_reporter.flush();
+  console() << "Folder detected in " << folder << ", would you like to skip or quit(Enter: "
+            << M_QUIT_FLAG << " to quit or enter: 'any key' to skip)." << std::endl;
+  
+  std::string input = "";
+  console() << "ENTER: ";
+  std::getline(std::cin, input);
+
+  if (input == M_QUIT_FLAG) {
+    m_error = { MergeErrorCode::NestedFolder, "The merge was stopped at a nested folder.", folder };
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Copy or move a set of planned files into the temp folder, marking each one done in the journal
+ *
+ * @param task_indices indices into m_tasks of the files to transfer
+ * 
+ * @return true if success ; false if any file could not be transferred
+ */
+bool FolderMerger::transferFiles(const std::vector<size_t>& task_indices) {
+  // duplicates are linked to their original's copy, so they have to wait until every other file is done
+  std::vector<CopyTask> passes[2];
+  std::vector<size_t> pass_indices[2];
+  for (size_t idx : task_indices) {
+    const int kPass = m_tasks[idx].link ? 1 : 0;
+    passes[kPass].push_back(m_tasks[idx]);
+    pass_indices[kPass].push_back(idx);
+  }
+
+  const bool kMove = (m_options.transfer_mode == TransferMode::Move);
+  console() << (kMove ? "Moving " : "Copying ") << passes[0].size() << " files";
+  if (!passes[1].empty()) {
+    console() << " and linking " << passes[1].size() << " duplicates";
+  }
+  console() << " using " << m_pool.size() << " threads." << std::endl;
+
+  uint64_t total_bytes = 0;
+  for (const auto& task : passes[0]) {
+    total_bytes += task.size;
+  }
+
+  CopyEngine engine(m_pool, m_options.transfer_mode);
+  engine.useIoUring(m_options.io_uring_depth);
+  engine.setVerify(m_options.verify);
+  engine.setStreaming(m_options.stream_mode, m_options.stream_threshold, m_options.preallocate);
+  engine.syncEachFile(m_options.durability == DurabilityMode::Strict);
+  engine.setConsole(console());
+  m_merge_synced = false;
+  std::mutex unverified_mutex;
+  m_reporter.beginPhase(kMove ? "Moving" : "Copying", task_indices.size(), total_bytes);
+  m_stats.addWork(task_indices.size(), total_bytes);
+
+  bool success = true;
+  std::atomic<bool> journal_written(true);
+  for (int pass = 0; pass < 2 && success && journal_written; pass++) {
+    const std::vector<CopyTask>& tasks = passes[pass];
+    const std::vector<size_t>& indices = pass_indices[pass];
+    success = engine.run(tasks, [&](size_t idx) {
+      if (!m_journal.markDone(indices[idx])) {
+        journal_written = false;
+      }
+      m_reporter.fileDone(pass == 0 ? tasks[idx].size : 0);
+      if (m_callbacks.on_file) {
+        m_callbacks.on_file({ FileEventType::Transferred, tasks[idx].source.path(), tasks[idx].destination.path(), tasks[idx].size });
+      }
+    }, [&](size_t idx) {
+      std::lock_guard<std::mutex> lock(unverified_mutex);
+      m_unverified_tasks.push_back(indices[idx]);
+      if (!m_journal.markUnverified(indices[idx])) {
+        journal_written = false;
+      }
+    });
+  }
+  m_reporter.endPhase();
+
+  // finished transfers the journal lost would be trusted, or redone from deleted sources, after a crash
+  if (!journal_written) {
+    return fail(MergeErrorCode::TransferFailed, "Cannot write \"" + M_JOURNAL_FILE.string() + "\": " + m_journal.getError().message(),
+                m_journal.getPath());
+  }
+  if (!success) {
+    fail(MergeErrorCode::TransferFailed, std::string("Not every file could be ") + (kMove ? "moved." : "copied."));
+  }
+
+  return success;
+}
+
+/**
+ * @brief Make sure finished transfers are on the disk, the way MergeOptions::durability asks for
+ *
+ * @param tasks transfers whose destinations have to be kept
+ * @param folders folders the destinations were created in, their entries are synced after the files
+ * @param failed_path set to the file or folder that could not be synced
+ * @param ec set to the error of failed_path
+ * 
+ * @return true if success ; false if anything could not be synced
+ */
+bool FolderMerger::syncTransfers(const std::vector<CopyTask>& tasks, const std::vector<std::filesystem::path>& folders,
+                                 std::filesystem::path& failed_path, std::error_code& ec) {
+  if (m_options.durability == DurabilityMode::None) {
+    return true;
+  }
+
+  // strict mode synced every file as it was written, syncfs() syncs all of them at once
+  bool files_synced = (m_options.durability == DurabilityMode::Strict);
+  if (m_options.durability == DurabilityMode::Syncfs && !folders.empty()) {
+    if (syncFilesystem(folders[0], ec)) {
+      files_synced = true;
+    }
+    else if (ec != std::errc::function_not_supported) {
+      failed_path = folders[0];
+      return false;
+    }
+    ec.clear();
+  }
+  if (!files_synced && !syncDestinations(m_pool, tasks, failed_path, ec)) {
+    return false;
+  }
+
+  for (const auto& folder : folders) {
+    if (!syncDirectory(folder, ec)) {
+      failed_path = folder;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Write every file of a plan into its tar archive in numbering order, instead of into the temp folder
+ *
+ * The files go under a folder named after the first merged folder, and the index file is the first member. The
+ * archive is written as "<archive>.part" and only renamed once it is complete and synced, so nothing that looks like
+ * a finished archive is left behind when the merge stops partway.
+ *
+ * @param plan plan made by planMerge() with an archive path
+ * 
+ * @return true if success ; false if a file could not be read or the archive could not be written
+ */
+bool FolderMerger::writeArchive(const MergePlan& plan) {
+  const std::filesystem::path kPartPath = plan.archive_path.string() + ".part";
+  const std::string kFolderName = plan.folders[0].filename().generic_u8string();
+  m_tasks = plan.tasks;
+  m_unverified_tasks.clear();
+
+  uint64_t total_bytes = 0;
+  for (const auto& task : m_tasks) {
+    total_bytes += task.link ? 0 : task.size;
+  }
+  console() << "Writing " << m_tasks.size() << " files into " << plan.archive_path.filename() << "." << std::endl;
+  m_reporter.beginPhase("Archiving", m_tasks.size(), total_bytes);
+  m_stats.addWork(m_tasks.size(), total_bytes);
+
+  TarWriter writer;
+  std::error_code ec;
+  std::filesystem::path failed_file;
+  const bool kSync = (m_options.durability != DurabilityMode::None);
+  bool success = writer.open(kPartPath, plan.archive_compression, kSync, ec) && writer.addDirectory(kFolderName, ec);
+  if (success && !plan.index_path.empty()) {
+    std::ostringstream index;
+    writeIndex(plan, index);
+    success = writer.addData(plan.index_path.filename().generic_u8string(), index.str(), ec);
+  }
+
+  // duplicates become hardlinks to the entry of the file they duplicate
+  for (size_t i = 0; success && i < m_tasks.size(); i++) {
+    const CopyTask& task = m_tasks[i];
+    const std::string kName = kFolderName + "/" + task.destination.filename().generic_u8string();
+    success = task.link ? writer.addHardlink(kName, kFolderName + "/" + task.source.filename().generic_u8string(), ec)
+                        : writer.addFile(task.source.path(), kName, ec);
+    if (!success) {
+      failed_file = task.source.path();
+      break;
+    }
+
+    m_reporter.fileDone(task.link ? 0 : task.size);
+    if (m_callbacks.on_file) {
+      m_callbacks.on_file({ FileEventType::Transferred, task.source.path(), plan.archive_path / kName, task.size });
+    }
+  }
+  success = success && writer.finish(ec);
+  m_reporter.endPhase();
+
+  if (success) {
+    std::filesystem::rename(kPartPath, plan.archive_path, ec);
+    success = !ec;
+  }
+  // finish() synced the archive itself, its new name has to be on the disk too before the folders are deleted
+  if (success && kSync) {
+    success = syncDirectory(plan.archive_path.parent_path(), ec);
+  }
+  if (!success) {
+    std::error_code remove_ec;
+    std::filesystem::remove(kPartPath, remove_ec);
+    const std::string kCompressor = (plan.archive_compression == ArchiveCompression::None) ? "" : std::string(" with ") + TarWriter::getCompressionName(plan.archive_compression);
+    const std::string kWhere = failed_file.empty() ? "" : " at \"" + failed_file.string() + "\"";
+    return fail(MergeErrorCode::ArchiveFailed, "Cannot write the archive \"" + plan.archive_path.filename().string() + "\"" + kCompressor + kWhere + ": " + ec.message(),
+                failed_file.empty() ? plan.archive_path : failed_file);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Make sure the files of the last merge are on the disk, before the folders they came from are deleted
+ *
+ * confirmMerge() calls it first, callers that time the steps of a merge can call it on its own.
+ * 
+ * @return true if success ; false if a file or folder could not be synced, nothing may be deleted then
+ */
+bool FolderMerger::syncMerge() {
+  if (m_merge_synced || m_options.durability == DurabilityMode::None) {
+    return true;
+  }
+
+  console() << "Syncing the merged files to the disk (" << getDurabilityName(m_options.durability) << ")..." << std::endl;
+  m_stats.beginPhase("sync");
+  std::filesystem::path failed_path;
+  std::error_code ec;
+  m_merge_synced = syncTransfers(m_tasks, { getTempFolder(), m_main_directory }, failed_path, ec);
+  m_stats.addWork(m_tasks.size(), 0);
+  m_stats.endPhase();
+
+  if (!m_merge_synced) {
+    m_stats.setOutcome("sync failed");
+    return fail(MergeErrorCode::SyncFailed, "Cannot sync \"" + failed_path.string() + "\" to the disk: " + ec.message()
+                + ". The merged folders were kept, run fmerge again to resume the merge.", failed_path);
+  }
+  return true;
+}
+
+/**
+ * @brief Complete merge by moving folder from temp directory to the main directory
+ *
+ * @param src_path path to old filename
+ * @param dest_path path to the new filename
+ * 
+ * @return true if success ; false if the merged files could not be synced to the disk, nothing was deleted then
+ */
+bool FolderMerger::confirmMerge(std::vector<std::filesystem::path>& ordering_list, std::filesystem::path& src_path, std::filesystem::path& dest_path) {
+  if (!syncMerge()) {
+    return false;
+  }
+
+  // nothing is deleted before the journal says so, a crash would redo the merge from deleted folders otherwise
+  if (!m_journal.beginConfirm()) {
+    return fail(MergeErrorCode::SyncFailed, "Cannot write \"" + M_JOURNAL_FILE.string() + "\": " + m_journal.getError().message()
+                + ". The merged folders were kept, run fmerge again to resume the merge.", m_journal.getPath());
+  }
+  m_stats.beginPhase("confirm");
+
+  // a folder holding a file whose copy did not verify is kept, so the file is not lost
+  std::vector<bool> keep_folder(ordering_list.size(), false);
+  for (size_t task_idx : m_unverified_tasks) {
+    for (size_t i = 0; i < ordering_list.size(); i++) {
+      const std::filesystem::path kRelative = m_tasks[task_idx].source.path().lexically_relative(ordering_list[i]);
+      if (!kRelative.empty() && *kRelative.begin() != "..") {
+        keep_folder[i] = true;
+      }
+    }
+  }
+
+  // an appended-to folder stays where it is, the new files join it before their folders are deleted
+  if (m_appending) {
+    if (!moveIntoMergedFolder(src_path, dest_path)) {
+      m_stats.endPhase();
+      return fail(MergeErrorCode::TransferFailed, "Not every file could be renamed or moved into \"" + dest_path.filename().string()
+                  + "\". The appended folders were kept, run fmerge again to finish the merge.", dest_path);
+    }
+
+    std::error_code ec;
+    if (m_options.durability != DurabilityMode::None && !syncDirectory(dest_path, ec)) {
+      m_stats.endPhase();
+      return fail(MergeErrorCode::SyncFailed, "Cannot sync \"" + dest_path.string() + "\" to the disk: " + ec.message()
+                  + ". The appended folders were kept, run fmerge again to finish the merge.", dest_path);
+    }
+  }
+
+  // a resumed confirm may find the temp folder already renamed, the first folder is then the merged one
+  std::error_code ec;
+  const bool kMergedFolderInPlace = !m_appending && !std::filesystem::exists(src_path, ec) && std::filesystem::exists(dest_path, ec);
+
+  // delete everything in the ordering list
+  removeFolders(ordering_list, (m_appending || kMergedFolderInPlace) ? 1 : 0, keep_folder);
+
+  // the merged folder takes the first folder's name, so a kept first folder has to make room for it
+  if (!m_appending && keep_folder[0] && std::filesystem::exists(src_path, ec) && std::filesystem::exists(dest_path, ec)) {
+    const std::filesystem::path kKeptPath = dest_path.string() + " (unverified)";
+    std::filesystem::rename(dest_path, kKeptPath, ec);
+    if (ec) {
+      console() << "ERROR: Cannot rename " << dest_path.filename() << " to " << kKeptPath.filename() << ": " << ec.message() << std::endl;
+    }
+    else {
+      console() << "Renamed the kept folder " << dest_path.filename() << " to " << kKeptPath.filename() << std::endl;
+    }
+  }
+
+  if (!m_appending && std::filesystem::exists(src_path, ec)) {
+    std::filesystem::rename(src_path, dest_path, ec);
+    if (ec) {
+      m_stats.endPhase();
+      return fail(MergeErrorCode::TransferFailed, "Cannot rename the temp folder to \"" + dest_path.filename().string() + "\": " + ec.message()
+                  + ". The journal was kept, run fmerge again to finish the merge.", src_path);
+    }
+  }
+  m_merged_folder = dest_path;
+  m_journal.remove();
+  if (!m_appending && !m_store_keys.empty()) {
+    recordMergedFolder(dest_path);
+  }
+  m_store_keys.clear();
+  m_stats.endPhase();
+  m_stats.setOutcome("merged");
+  console() << "Successfully merged files." << std::endl;
+
+  if (!m_unverified_tasks.empty()) {
+    fail(MergeErrorCode::VerifyFailed, std::to_string(m_unverified_tasks.size()) + " copies did not match their source, the folders they came from were kept.");
+  }
+  return true;
+}
+
+/**
+ * @brief Delete the folders that were merged
+ *
+ * @param folders ordering list of the merge
+ * @param first index of the first folder to delete
+ * @param keep_folder true for every folder to leave in place, e.g. because a copy of one of its files did not match
+ */
+void FolderMerger::removeFolders(const std::vector<std::filesystem::path>& folders, size_t first, const std::vector<bool>& keep_folder) {
+  for (size_t i = first; i < folders.size(); i++) {
+    const std::filesystem::path& folder = folders[i];
+    if (keep_folder[i]) {
+      console() << "Kept folder: " << folder.filename() << ", not every copy of its files matched." << std::endl;
+      continue;
+    }
+
+    std::error_code ec;
+    if (!std::filesystem::exists(folder, ec)) { // already deleted before the merge was resumed
+      continue;
+    }
+
+    std::filesystem::remove_all(folder, ec);
+    if (!ec) {
+      console() << "Successfully deleted folder: " << folder.filename() << std::endl;
+    }
+    else {
+      console() << "ERROR: Cannot delete: " << folder.filename() << ": " << ec.message() << std::endl;
+    }
+  }
+}
+
+/**
+ * @brief Rename files of the merged folder in two steps, first every file to a temporary name next to its new name,
+ *        then every file to its new name, so a file can take a name another one is giving up
+ *
+ * Both steps are spread over the thread pool. A file already under its temporary name is skipped, and the journal
+ * marks when the first step is done, so it can be run again after a crash.
+ *
+ * @param renames files to rename, every new name is a different one
+ *
+ * @return true if success ; false if a file could not be renamed, the ones left keep their old or temporary name
+ */
+bool FolderMerger::renameFiles(const std::vector<CopyTask>& renames) {
+  auto temp_path = [this](const CopyTask& rename) {
+    return rename.destination.getFolder() / (M_RENAME_PREFIX + std::string(rename.destination.getName()));
+  };
+
+  // run step on every rename, each worker takes the next batch of them
+  const size_t kBatch = 256;
+  std::atomic<size_t> next_batch(0);
+  std::atomic<size_t> renamed(0);
+  std::atomic<bool> success(true);
+  std::mutex console_mutex;
+  auto run_step = [&](const std::function<bool(const CopyTask&, std::error_code&)>& step) {
+    next_batch = 0;
+    TaskGroup group(m_pool);
+    for (unsigned int i = 0; i < m_pool.size(); i++) {
+      group.submit([&] {
+        size_t first;
+        while ((first = next_batch.fetch_add(kBatch, std::memory_order_relaxed)) < renames.size()) {
+          const size_t kLast = std::min(first + kBatch, renames.size());
+          for (size_t idx = first; idx < kLast; idx++) {
+            std::error_code ec;
+            if (step(renames[idx], ec)) {
+              continue;
+            }
+
+            success = false;
+            std::lock_guard<std::mutex> lock(console_mutex);
+            console() << "ERROR: Cannot rename " << renames[idx].source.filename() << " to " << renames[idx].destination.filename()
+                      << ": " << ec.message() << std::endl;
+          }
+        }
+      });
+    }
+    group.wait();
+  };
+
+  // a file that is not where it was is already under its temporary name, or was renamed by an earlier version
+  if (!m_renames_staged) {
+    run_step([&](const CopyTask& rename, std::error_code& ec) {
+      if (!std::filesystem::exists(rename.source.path(), ec) || std::filesystem::exists(temp_path(rename), ec)) {
+        return !ec;
+      }
+      std::filesystem::rename(rename.source.path(), temp_path(rename), ec);
+      return !ec;
+    });
+    if (!success) {
+      return false;
+    }
+
+    // the temporary names have to be on the disk before any file takes a name that another one had
+    std::set<std::filesystem::path> folders;
+    for (const auto& rename : renames) {
+      folders.insert(rename.source.getFolder());
+      folders.insert(rename.destination.getFolder());
+    }
+    for (const auto& folder : folders) {
+      std::error_code ec;
+      if (m_options.durability != DurabilityMode::None && !syncDirectory(folder, ec)) {
+        console() << "ERROR: Cannot sync " << folder << " to the disk: " << ec.message() << std::endl;
+        return false;
+      }
+    }
+    if (!m_journal.markRenamesStaged()) {
+      console() << "ERROR: Cannot write " << M_JOURNAL_FILE << ": " << m_journal.getError().message() << std::endl;
+      return false;
+    }
+    m_renames_staged = true;
+  }
+
+  // nothing is overwritten, a file that was added under a new name after the plan was made keeps it
+  run_step([&](const CopyTask& rename, std::error_code& ec) {
+    const std::filesystem::path kTempPath = temp_path(rename);
+    if (!std::filesystem::exists(kTempPath, ec)) {
+      return !ec;
+    }
+    else if (std::filesystem::exists(rename.destination.path(), ec)) {
+      ec = std::make_error_code(std::errc::file_exists);
+      return false;
+    }
+    std::filesystem::rename(kTempPath, rename.destination.path(), ec);
+    renamed += ec ? 0 : 1;
+    return !ec;
+  });
+
+  if (renamed > 0) {
+    console() << "Renamed " << renamed << " files of the merged folder to their new numbers." << std::endl;
+  }
+
+  // nested folders whose files were all renamed out of them are left empty
+  std::vector<std::filesystem::path> emptied_folders;
+  for (const auto& rename : renames) {
+    if (rename.source.getFolder() != rename.destination.getFolder()) {
+      emptied_folders.push_back(rename.source.getFolder());
+    }
+  }
+  std::sort(emptied_folders.begin(), emptied_folders.end(), [](const std::filesystem::path& a, const std::filesystem::path& b) {
+    // deepest first, so a parent is removed after its children
+    return a.native().size() != b.native().size() ? a.native().size() > b.native().size() : a < b;
+  });
+  emptied_folders.erase(std::unique(emptied_folders.begin(), emptied_folders.end()), emptied_folders.end());
+  for (const auto& folder : emptied_folders) {
+    std::error_code ec;
+    std::filesystem::remove(folder, ec); // only removes it if it is empty
+  }
+
+  return success;
+}
+
+/**
+ * @brief Finish an append by renaming the merged folder's files and moving the new files into it
+ *
+ * Every step is skipped for files that are already in place, so it can be run again after a crash.
+ *
+ * @param temp_folder folder holding the appended files
+ * @param merged_folder folder being appended to
+ *
+ * @return true if success ; false if a merged file could not be renamed or an appended file could not be moved, the
+ *         appended files that were not moved are left in the temp folder
+ */
+bool FolderMerger::moveIntoMergedFolder(const std::filesystem::path& temp_folder, const std::filesystem::path& merged_folder) {
+  if (!renameFiles(m_renames)) {
+    return false;
+  }
+
+  std::error_code ec;
+  if (!std::filesystem::exists(temp_folder, ec)) { // emptied and removed before the merge was resumed
+    return !ec;
+  }
+  const DirSnapshot kTempSnapshot(temp_folder, false, ec);
+  if (ec) {
+    console() << "ERROR: Cannot read " << temp_folder.filename() << ": " << ec.message() << std::endl;
+    return false;
+  }
+
+  // nothing in the merged folder is overwritten, a file that is in the way keeps the new file in the temp folder
+  bool success = true;
+  for (size_t i = 0; i < kTempSnapshot.size(); i++) {
+    const std::filesystem::path kFile = kTempSnapshot.getPath(i);
+    const std::filesystem::path kDestination = merged_folder / kFile.filename();
+    if (std::filesystem::exists(kDestination, ec) || ec) {
+      ec = ec ? ec : std::make_error_code(std::errc::file_exists);
+    }
+    else {
+      std::filesystem::rename(kFile, kDestination, ec);
+    }
+    if (ec) {
+      console() << "ERROR: Cannot move " << kFile.filename() << " into " << merged_folder.filename() << ": " << ec.message() << std::endl;
+      success = false;
+    }
+  }
+
+  // only removed once it is empty, so a file that could not be moved is not lost
+  std::filesystem::remove(temp_folder, ec);
+  return success;
+}
+
+/**
+ * @brief Delete the temporary folder
+ *
  * @param src_path path to the file to delete
  */
-void FolderMerger::undoMerge(std::filesystem::path& temp_folder_path) {
-  if (std::filesystem::remove_all(temp_folder_path) != 0) {
-    std::cout << "ERROR: Cannot delete: " << temp_folder_path.filename() << std::endl;
+void FolderMerger::undoMerge(std::filesystem::path& temp_folder_path) {
+  m_stats.beginPhase("undo");
+
+  // in move mode the temp folder holds the only copy of some files, it is kept until every one is back
+  if (m_options.transfer_mode == TransferMode::Move && !restoreMovedFiles()) {
+    m_stats.endPhase();
+    m_stats.setOutcome("undo failed");
+    console() << "ERROR: Not every file could be moved back, kept " << temp_folder_path.filename()
+              << " and the journal. Run fmerge again to resume or undo the merge." << std::endl;
+    return;
+  }
+
+  std::error_code ec;
+  std::filesystem::remove_all(temp_folder_path, ec);
+  if (ec) {
+    m_stats.endPhase();
+    m_stats.setOutcome("undo failed");
+    console() << "ERROR: Cannot delete " << temp_folder_path.filename() << ": " << ec.message()
+              << ", kept the journal. Run fmerge again to undo the merge." << std::endl;
+    return;
+  }
+  m_journal.remove();
+  m_stats.endPhase();
+  m_stats.setOutcome("undone");
+  
+  console() << "Successfully deleted temporary folder." << std::endl;
+}
+
+/**
+ * @brief Move every file that was renamed into the temp folder back to where it came from
+ *
+ * @return true if success ; false if a file could not be moved back, it is still in the temp folder
+ */
+bool FolderMerger::restoreMovedFiles() {
+  int restored = 0;
+  bool success = true;
+  for (const auto& task : m_tasks) {
+    std::error_code ec;
+    if (task.link) { // duplicates were never moved, their source is in the temp folder
+      continue;
+    }
+    else if (!std::filesystem::exists(task.destination.path(), ec) || std::filesystem::exists(task.source.path(), ec)) {
+      continue; // never moved, or it was copied from another device
+    }
+
+    std::filesystem::rename(task.destination.path(), task.source.path(), ec);
+    if (ec) {
+      console() << "ERROR: Cannot move " << task.destination.filename() << " back to "
+                << task.source.path() << ": " << ec.message() << "\n";
+      success = false;
+      continue;
+    }
+    restored++;
+  }
+
+  console() << "Moved " << restored << " files back to their original folders." << std::endl;
+  return success;
+}
+
+/**
+ * @brief Make a merge with the answers taken from a job instead of prompts
+ *
+ * @param job folders, order, backup and index to use
+ * 
+ * @return true if success ; false if the job could not be run or the merge failed
+ */
+bool FolderMerger::mergeJob(const MergeJob& job) {
+  // nobody is there to answer
+  if (m_options.nested_folder_policy == NestedFolderPolicy::Ask) {
+    m_options.nested_folder_policy = NestedFolderPolicy::Quit;
+  }
+
+  if (!job.restore_manifest.empty()) {
+    return restoreBackup(job.restore_manifest);
+  }
+
+  if (!job.dry_run && m_journal.exists() && resumeMerge(false)) {
+    if (m_error.code != MergeErrorCode::None) {
+      return false;
+    }
+    console() << "Finished an interrupted merge in " << m_main_directory << " instead of running the job." << std::endl;
+    return true;
+  }
+
+  if (!job.plan_file.empty()) {
+    MergePlan plan;
+    if (!loadPlan(job.plan_file, plan)) {
+      return fail(MergeErrorCode::PlanFailed, "Cannot read the plan file \"" + job.plan_file.string() + "\"", job.plan_file);
+    }
+    else if (plan.directory.lexically_normal() != m_main_directory.lexically_normal()) {
+      return fail(MergeErrorCode::PlanFailed, "The plan file \"" + job.plan_file.string() + "\" is for \"" + plan.directory.string() + "\"", job.plan_file);
+    }
+
+    // the transfers were planned for the plan's mode
+    m_options.transfer_mode = plan.transfer_mode;
+    console() << "Running the plan in " << job.plan_file << std::endl;
+    return runPlan(plan);
+  }
+
+  m_stats.beginPhase("scan");
+  std::vector<std::filesystem::path> main_dir_files = getDirectoryEntries(m_main_directory);
+  m_stats.addWork(main_dir_files.size(), 0);
+  m_stats.endPhase();
+
+  // every folder in name order, unless the job lists them
+  m_stats.beginPhase("ordering");
+  std::vector<std::filesystem::path> ordering_list;
+  if (job.folders.empty()) {
+    // backups of earlier runs made before backups were marked only go by their name
+    for (const auto& folder : main_dir_files) {
+      const std::string kName = folder.filename().string();
+      if (isBackupFolderName(kName, job.backup_name) || isBackupFolderName(kName, M_DEFAULT_BACKUP_PATH)) {
+        console() << folder.filename() << " is named like a backup. Skipping, list the folders of the job to merge it.\n";
+        continue;
+      }
+      ordering_list.push_back(folder);
+    }
+    std::sort(ordering_list.begin(), ordering_list.end());
+  }
+  for (const auto& folder : job.folders) {
+    const std::filesystem::path kFolder = m_main_directory / folder;
+    if (std::find(main_dir_files.begin(), main_dir_files.end(), kFolder) == main_dir_files.end()) {
+      return fail(MergeErrorCode::InvalidJob, "\"" + folder.string() + "\" is not a folder that can be merged.", kFolder);
+    }
+    else if (std::find(ordering_list.begin(), ordering_list.end(), kFolder) != ordering_list.end()) {
+      return fail(MergeErrorCode::InvalidJob, "\"" + folder.string() + "\" is listed more than once.", kFolder);
+    }
+    ordering_list.push_back(kFolder);
+  }
+  m_stats.addWork(ordering_list.size(), 0);
+  m_stats.endPhase();
+
+  if (ordering_list.empty()) {
+    return fail(MergeErrorCode::InvalidJob, "There are no folders to merge in \"" + m_main_directory.string() + "\"", m_main_directory);
+  }
+
+  console() << (job.dry_run ? "Planning the merge of " : "Merging ") << ordering_list.size() << " folders in " << m_main_directory << ":" << std::endl;
+  printEntries(ordering_list);
+
+  // work out everything the merge will do before touching anything
+  m_stats.beginPhase("plan");
+  MergePlan plan;
+  if (!job.backup_name.empty() && !planBackup(ordering_list, m_main_directory / job.backup_name, plan)) {
+    m_stats.endPhase();
+    return false;
+  }
+  if (!job.archive_name.empty()) {
+    plan.archive_path = m_main_directory / job.archive_name;
+    plan.archive_compression = (m_options.archive_compression == ArchiveCompression::Auto) ? TarWriter::getCompression(plan.archive_path)
+                                                                                            : m_options.archive_compression;
+    m_options.transfer_mode = TransferMode::Copy; // the sources are read into the archive, nothing is renamed
+  }
+  const std::filesystem::path kIndexPath = job.index_name.empty() ? "" : m_main_directory / (job.index_name.string() + ".txt");
+  const bool kPlanned = planMerge(ordering_list, kIndexPath, plan);
+  m_stats.addWork(plan.tasks.size() + plan.backup_tasks.size(), 0);
+  m_stats.endPhase();
+  if (!kPlanned) {
+    return false;
+  }
+  else if (!job.dry_run) {
+    return runPlan(plan);
+  }
+
+  checkPlan(plan, m_pool.size());
+  if (m_journal.exists()) {
+    plan.problems.push_back({ MergeErrorCode::InvalidJob, "An interrupted merge has to be resumed first.", m_journal.getPath() });
+  }
+  printPlan(plan, console());
+  m_stats.setOutcome("planned");
+
+  if (!job.plan_output.empty()) {
+    if (!savePlan(plan, job.plan_output)) {
+      return fail(MergeErrorCode::PlanFailed, "Cannot write the plan file \"" + job.plan_output.string() + "\"", job.plan_output);
+    }
+    console() << "Saved the plan to " << job.plan_output << std::endl;
+  }
+
+  if (!plan.problems.empty() && m_error.code == MergeErrorCode::None) {
+    m_error = plan.problems[0];
+  }
+  return plan.problems.empty();
+}
+
+/**
+ * @brief Make the backup, index and merge of a plan, then confirm the merge
+ *
+ * @param plan plan to run, made by planMerge() or read from a plan file
+ * 
+ * @return true if success ; false if the plan cannot be run or the merge failed
+ */
+bool FolderMerger::runPlan(MergePlan& plan) {
+  checkPlan(plan, m_pool.size());
+  if (m_options.verbosity != Verbosity::Quiet) {
+    printPlan(plan, console());
   }
-  
-  std::cout << "Successfully deleted temporary folder." << std::endl;
+  if (!plan.problems.empty()) {
+    return fail(plan.problems[0].code, plan.problems[0].message, plan.problems[0].path);
+  }
+
+  if (!plan.backup_path.empty()) {
+    console() << "Creating backup..." << std::endl;
+    m_stats.beginPhase("backup");
+    const bool kBackedUp = runBackup(plan);
+    m_stats.endPhase();
+    if (!kBackedUp) {
+      m_stats.setOutcome("backup failed");
+      return false;
+    }
+  }
+
+  // the merged files and the index only go into the archive, the folders are deleted once it is complete
+  if (!plan.archive_path.empty()) {
+    m_stats.beginPhase("archive");
+    const bool kArchived = writeArchive(plan);
+    m_stats.endPhase();
+    if (!kArchived) {
+      m_stats.setOutcome("archive failed");
+      return false;
+    }
+
+    m_stats.beginPhase("confirm");
+    removeFolders(plan.folders, 0, std::vector<bool>(plan.folders.size(), false));
+    m_merged_folder = plan.archive_path;
+    m_stats.endPhase();
+    m_stats.setOutcome("archived");
+    console() << "Successfully merged files into " << plan.archive_path.filename() << "." << std::endl;
+    return true;
+  }
+
+  if (!plan.index_path.empty()) {
+    m_stats.beginPhase("index");
+    if (!std::ofstream(plan.index_path, plan.append ? std::ios_base::app : std::ios_base::out).is_open()) {
+      return fail(MergeErrorCode::IndexFailed, "Cannot create the index file \"" + plan.index_path.filename().string() + "\"", plan.index_path);
+    }
+    m_stats.endPhase();
+  }
+
+  std::filesystem::path src_path = m_main_directory / M_TEMP_FOLDER;
+  std::filesystem::path dest_path = plan.folders[0];
+  m_stats.beginPhase("merge");
+  const bool kMerged = runPlannedMerge(plan);
+  m_stats.endPhase();
+  if (!kMerged) {
+    undoMerge(src_path);
+    return false;
+  }
+
+  return confirmMerge(plan.folders, src_path, dest_path) && m_unverified_tasks.empty();
+}
+
+/**
+ * @brief Read the numbers of the files of a merged folder, every one is named by its number, e.g. 0042.png
+ *
+ * @param snapshot merged folder
+ * @param last_number set to the highest number
+ * @param width set to the digits of the widest number
+ * @param numbered_files gets every numbered entry and the digits of its number
+ * 
+ * @return size_t first entry that is not named by a number, snapshot.size() if there is none
+ */
+size_t FolderMerger::getNumberedFiles(const DirSnapshot& snapshot, uint64_t& last_number, int& width, std::vector<std::pair<size_t, size_t>>& numbered_files) const {
+  for (size_t i = 0; i < snapshot.size(); i++) {
+    const std::string_view kName = snapshot.getName(i);
+    const size_t kDigits = std::min(kName.find('.'), kName.size());
+    if (isExcluded(kName)) {
+      continue;
+    }
+    else if (snapshot[i].type == EntryType::Directory || kDigits == 0 || kDigits > 18
+             || kName.substr(0, kDigits).find_first_not_of("0123456789") != std::string_view::npos) {
+      return i;
+    }
+
+    last_number = std::max(last_number, static_cast<uint64_t>(std::stoull(std::string(kName.substr(0, kDigits)))));
+    width = std::max(width, static_cast<int>(kDigits));
+    numbered_files.push_back({ i, kDigits });
+  }
+
+  return snapshot.size();
+}
+
+/**
+ * @brief Work out how to append folders to an already merged folder, continuing its numbers and its index
+ *
+ * @param merged_folder folder made by an earlier merge, every file in it is named by its number
+ * @param folders folders to append, in order
+ * @param index_file index file to add the folders to, empty = no index
+ * @param plan gets the transfers, and the renames if the numbers get wider
+ * 
+ * @return true if success ; false if the merged folder is not one or a folder cannot be read
+ */
+bool FolderMerger::planAppend(const std::filesystem::path& merged_folder, const std::vector<std::filesystem::path>& folders, const std::filesystem::path& index_file, MergePlan& plan) {
+  std::error_code ec;
+  const DirSnapshot kMerged(merged_folder, false, ec);
+  if (ec) {
+    return fail(MergeErrorCode::ReadFailed, "Cannot read \"" + merged_folder.string() + "\": " + ec.message(), merged_folder);
+  }
+
+  uint64_t last_number = 0;
+  int width = 0;
+  std::vector<std::pair<size_t, size_t>> numbered_files;
+  const size_t kUnnumbered = getNumberedFiles(kMerged, last_number, width, numbered_files);
+  if (kUnnumbered < kMerged.size()) {
+    return fail(MergeErrorCode::InvalidJob, "\"" + merged_folder.filename().string() + "\" is not a merged folder, \""
+                + std::string(kMerged.getName(kUnnumbered)) + "\" is not named by its number.", merged_folder);
+  }
+
+  // the index numbers folders from 0, the appended ones come after the last one in it, e.g. "7 - "chapter 7""
+  uint64_t last_index_entry = 0;
+  if (!index_file.empty()) {
+    std::ifstream ifstream(index_file);
+    std::string line;
+    while (std::getline(ifstream, line)) {
+      const size_t kDash = line.find(" - ");
+      if (kDash != std::string::npos && kDash > 0 && kDash < 19 && line.find_first_not_of("0123456789") == kDash) {
+        last_index_entry = std::max(last_index_entry, static_cast<uint64_t>(std::stoull(line.substr(0, kDash))));
+      }
+    }
+  }
+
+  plan.append = true;
+  plan.first_number = last_number + 1;
+  plan.number_width = width;
+  plan.index_offset = last_index_entry;
+
+  std::vector<std::filesystem::path> ordering_list = { merged_folder };
+  ordering_list.insert(ordering_list.end(), folders.begin(), folders.end());
+  if (!planMerge(ordering_list, index_file, plan)) {
+    return false;
+  }
+
+  // narrower numbers would sort after wider ones by name, e.g. 99.png after 100.png
+  plan.renames.clear();
+  if (m_options.width_growth == WidthGrowthPolicy::Rename) {
+    const uint32_t kMergedFolder = plan.paths->addFolder(merged_folder);
+    for (const auto& numbered_file : numbered_files) {
+      if (numbered_file.second < static_cast<size_t>(plan.number_width)) {
+        std::string new_name(kMerged.getName(numbered_file.first));
+        new_name.insert(0, plan.number_width - numbered_file.second, '0');
+        plan.renames.push_back({ plan.paths->add(kMergedFolder, kMerged.getName(numbered_file.first)), plan.paths->add(kMergedFolder, new_name) });
+      }
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Check if a folder name is one a job's backups are made under, the backup name or "<backup name>-<n>"
+ *
+ * @param name folder name to check
+ * @param backup_name backup name of the job, empty = no backup
+ * 
+ * @return true if the folder is one of the job's backups ; false if not
+ */
+bool FolderMerger::isBackupFolderName(const std::string& name, const std::filesystem::path& backup_name) const {
+  const std::string kBackupName = backup_name.string();
+  if (kBackupName.empty() || name.compare(0, kBackupName.size(), kBackupName) != 0) {
+    return false;
+  }
+  else if (name.size() == kBackupName.size()) {
+    return true;
+  }
+
+  return name.size() > kBackupName.size() + 1 && name[kBackupName.size()] == '-'
+         && name.find_first_not_of("0123456789", kBackupName.size() + 1) == std::string::npos;
+}
+
+/**
+ * @brief Get the backup folder for the next append, every append is backed up into a folder of its own
+ *
+ * @param backup_name backup name of the job
+ * 
+ * @return std::filesystem::path the backup name if no folder has it yet, otherwise the first free "<backup name>-<n>"
+ */
+std::filesystem::path FolderMerger::getAppendBackupPath(const std::filesystem::path& backup_name) const {
+  std::filesystem::path backup_path = m_main_directory / backup_name;
+  std::error_code ec;
+  for (int i = 2; m_options.backup_store.empty() && std::filesystem::exists(backup_path, ec); i++) {
+    backup_path = m_main_directory / (backup_name.string() + "-" + std::to_string(i));
+  }
+  return backup_path;
+}
+
+/**
+ * @brief Number the files of more folders after the files of an already merged folder, then move them into it
+ *
+ * @param merged_folder folder made by an earlier merge, every file in it is named by its number
+ * @param folders folders to append, in order, they are deleted once their files are in the merged folder
+ * @param index_file index file to add the folders to, empty = no index
+ * @param backup_name back up the appended folders first, see getAppendBackupPath(). Empty = no backup
+ * 
+ * @return true if success ; false if the merged folder is not one or the append failed
+ */
+bool FolderMerger::appendFolders(const std::filesystem::path& merged_folder, std::vector<std::filesystem::path> folders, const std::filesystem::path& index_file,
+                                 const std::filesystem::path& backup_name) {
+  console() << "Appending " << folders.size() << " folders to " << merged_folder.filename() << ":" << std::endl;
+  printEntries(folders);
+
+  m_stats.beginPhase("plan");
+  MergePlan plan;
+  const bool kPlanned = (backup_name.empty() || planBackup(folders, getAppendBackupPath(backup_name), plan))
+                        && planAppend(merged_folder, folders, index_file, plan);
+  m_stats.addWork(plan.tasks.size(), 0);
+  m_stats.endPhase();
+
+  return kPlanned && runPlan(plan);
+}
+
+/**
+ * @brief Merge the folders of a job's directory, then keep appending every new folder to the merged one
+ *
+ * A folder is only touched once nothing in it has changed for the job's watch time, so folders that are still
+ * being written are left alone. Runs until MergeCallbacks::should_stop returns true.
+ *
+ * @param job directory, backup and index to use, its first folder is the one to append to, by default the first by name
+ * 
+ * @return true if it was stopped ; false if a merge failed or the directory cannot be watched
+ */
+bool FolderMerger::watchJob(const MergeJob& job) {
+  if (job.dry_run || !job.plan_file.empty()) {
+    return fail(MergeErrorCode::InvalidJob, "A watched directory cannot be planned or merged from a plan.");
+  }
+  else if (job.folders.size() > 1) {
+    return fail(MergeErrorCode::InvalidJob, "A watched directory takes at most one folder, the one to append to.");
+  }
+  else if (!job.archive_name.empty()) {
+    return fail(MergeErrorCode::InvalidJob, "A watched directory cannot be merged into an archive, archives cannot be appended to.");
+  }
+
+  // nobody is there to answer
+  if (m_options.nested_folder_policy == NestedFolderPolicy::Ask) {
+    m_options.nested_folder_policy = NestedFolderPolicy::Quit;
+  }
+
+  // the folders of an interrupted merge are still in the directory, they would be merged twice
+  if (m_journal.exists()) {
+    resumeMerge(false);
+  }
+
+  // a folder that is already merged only gets folders appended to it, otherwise the first merge makes it
+  std::filesystem::path merged_folder = job.folders.empty() ? "" : m_main_directory / job.folders[0];
+  bool is_merged = false;
+  if (merged_folder.empty()) {
+    std::vector<std::filesystem::path> folders;
+    for (const auto& entry : getMergeableFolders()) {
+      if (!isBackupFolderName(entry.filename().string(), job.backup_name)) {
+        folders.push_back(entry);
+      }
+    }
+    std::sort(folders.begin(), folders.end());
+    merged_folder = folders.empty() ? "" : folders[0];
+  }
+  std::error_code ec;
+  const DirSnapshot kMerged(merged_folder, false, ec);
+  if (!merged_folder.empty() && !ec && kMerged.size() > 0) {
+    uint64_t last_number = 0;
+    int width = 0;
+    std::vector<std::pair<size_t, size_t>> numbered_files;
+    is_merged = (getNumberedFiles(kMerged, last_number, width, numbered_files) == kMerged.size());
+  }
+
+  const std::filesystem::path kIndexPath = job.index_name.empty() ? "" : m_main_directory / (job.index_name.string() + ".txt");
+  FolderWatcher watcher(m_main_directory, std::chrono::seconds(job.watch_seconds), [&](const std::string& name) {
+    return name != M_TEMP_FOLDER && !isBackupFolderName(name, job.backup_name) && !isExcluded(name) && !isBackupStore(m_main_directory / name)
+           && !isBackupFolder(m_main_directory / name)
+           && !(is_merged && merged_folder.filename() == name);
+  });
+
+  if (!watcher.start(ec)) {
+    return fail(MergeErrorCode::ReadFailed, "Cannot watch \"" + m_main_directory.string() + "\": " + ec.message(), m_main_directory);
+  }
+  console() << "Watching " << m_main_directory << ", new folders are merged once they have not changed for "
+            << job.watch_seconds << " seconds." << std::endl;
+
+  while (!m_callbacks.should_stop || !m_callbacks.should_stop()) {
+    watcher.wait(M_WATCH_POLL_INTERVAL);
+
+    std::vector<std::filesystem::path> folders;
+    for (const auto& name : watcher.getQuietFolders()) {
+      std::error_code ec;
+      if (std::filesystem::is_directory(m_main_directory / name, ec)) {
+        folders.push_back(m_main_directory / name);
+      }
+    }
+    std::sort(folders.begin(), folders.end());
+    if (folders.empty()) {
+      continue;
+    }
+    else if (is_merged) {
+      if (!appendFolders(merged_folder, folders, kIndexPath, job.backup_name)) {
+        return false;
+      }
+      continue;
+    }
+
+    // the first merge waits for the folder it merges into
+    if (merged_folder.empty()) {
+      merged_folder = folders[0];
+    }
+    auto merged_position = std::find(folders.begin(), folders.end(), merged_folder);
+    if (merged_position == folders.end()) {
+      continue;
+    }
+    std::rotate(folders.begin(), merged_position, merged_position + 1);
+
+    MergeJob first_job = job;
+    first_job.watch_seconds = 0;
+    first_job.folders.clear();
+    for (const auto& folder : folders) {
+      first_job.folders.push_back(folder.filename());
+    }
+    if (!mergeJob(first_job)) {
+      return false;
+    }
+    is_merged = true;
+  }
+
+  console() << "Stopped watching " << m_main_directory << std::endl;
+  return true;
+}
+
+/**
+ * @brief Write the report of the phases run so far, if one was asked for
+ */
+void FolderMerger::finishReport() {
+  if (!m_stats.isEnabled()) {
+    return;
+  }
+  else if (writeReport(m_options.report_file)) {
+    console() << "Wrote report to: " << m_options.report_file << std::endl;
+  }
+  else {
+    console() << "ERROR: Cannot write report to: " << m_options.report_file << std::endl;
+  }
+}
+
+/**
+ * @brief Pick up a merge that was interrupted, using the journal it left behind
+ *
+ * @param ask_to_resume let the user choose between resuming and undoing, otherwise it is resumed
+ * 
+ * @return true if the interrupted merge was finished ; false if a new merge should be started
+ */
+bool FolderMerger::resumeMerge(bool ask_to_resume) {
+  std::filesystem::path src_path = m_main_directory / M_TEMP_FOLDER;
+
+  if (!m_journal.load()) {
+    console() << "ERROR: Cannot read " << M_JOURNAL_FILE << ", starting a new merge." << std::endl;
+    m_journal.remove();
+    return false;
+  }
+
+  m_tasks = m_journal.getTasks();
+  m_unverified_tasks = m_journal.getUnverified();
+  m_appending = m_journal.isAppend();
+  m_renames = m_journal.getRenames();
+  m_renames_staged = m_journal.areRenamesStaged();
+  m_options.transfer_mode = m_journal.getTransferMode();
+  if (m_journal.isDoneSynced()) { // the transfers left have to be as safe as the ones the journal already trusts
+    m_options.durability = DurabilityMode::Strict;
+  }
+  std::vector<std::filesystem::path> ordering_list = m_journal.getOrderingList();
+
+  // nothing was copied yet
+  if (!m_journal.isPlanComplete() || ordering_list.empty()) {
+    console() << "Found a merge that stopped before copying began, undoing it." << std::endl;
+    undoMerge(src_path);
+    return false;
+  }
+
+  std::filesystem::path dest_path = m_main_directory / ordering_list[0];
+  if (m_journal.isConfirming()) {
+    console() << "Found a merge that stopped while deleting the merged folders, finishing it." << std::endl;
+    m_journal.open();
+    m_merge_synced = true; // the journal only gets this far once the merged files are on the disk
+    confirmMerge(ordering_list, src_path, dest_path);
+    return true;
+  }
+
+  // check every transfer, some may have finished after the journal was last synced
+  // copies may have to be read back, so every worker checks the next task
+  std::vector<char> done(m_tasks.size(), 0); // not vector<bool>, so workers can write their own element
+  std::atomic<size_t> next_task(0);
+  TaskGroup group(m_pool);
+  for (unsigned int i = 0; i < m_pool.size(); i++) {
+    group.submit([&] {
+      size_t idx;
+      while ((idx = next_task.fetch_add(1, std::memory_order_relaxed)) < m_tasks.size()) {
+        done[idx] = isTransferDone(m_tasks[idx], m_journal.getDone()[idx]) ? 1 : 0;
+      }
+    });
+  }
+  group.wait();
+
+  std::vector<size_t> remaining_tasks;
+  for (size_t i = 0; i < m_tasks.size(); i++) {
+    if (!done[i]) {
+      remaining_tasks.push_back(i);
+    }
+  }
+
+  console() << "Found an unfinished merge of " << ordering_list.size() << " folders, "
+            << (m_tasks.size() - remaining_tasks.size()) << " of " << m_tasks.size() << " files are done." << std::endl;
+
+  if (ask_to_resume) {
+    console() << "Press 'ENTER' to resume it, or enter " << M_QUIT_FLAG << " to undo it: " << std::endl;
+
+    console() << "ENTER: ";
+    std::string input = "";
+    std::getline(std::cin, input);
+
+    if (input == M_QUIT_FLAG) {
+      undoMerge(src_path);
+      return false;
+    }
+  }
+
+  m_journal.open();
+  std::error_code ec;
+  std::filesystem::create_directory(src_path, ec);
+  if (ec) {
+    return fail(MergeErrorCode::TransferFailed, "Cannot create the temp folder: " + ec.message(), src_path);
+  }
+
+  console() << "Resuming merge, " << remaining_tasks.size() << " files left." << std::endl;
+  m_stats.beginPhase("merge");
+  const bool kSuccess = transferFiles(remaining_tasks);
+  m_stats.endPhase();
+
+  if (kSuccess) {
+    confirmMerge(ordering_list, src_path, dest_path);
+  }
+  else {
+    undoMerge(src_path);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Check if a transfer from an interrupted merge really finished
+ *
+ * @param task transfer to check
+ * @param journaled_done whether the journal lists the transfer as finished
+ * 
+ * @return true if the transfer does not need to be made again
+ */
+bool FolderMerger::isTransferDone(const CopyTask& task, bool journaled_done) {
+  std::error_code ec;
+  const bool kSourceExists = std::filesystem::exists(task.source.path(), ec);
+  const bool kDestinationExists = std::filesystem::exists(task.destination.path(), ec);
+
+  if (task.link) {
+    return journaled_done && kDestinationExists;
+  }
+
+  // a rename is atomic, so a moved file is either fully in place or not moved at all
+  if (m_options.transfer_mode == TransferMode::Move && !kSourceExists) {
+    return kDestinationExists;
+  }
+
+  // a copy is only trusted if the journal says it finished and it has the right size
+  if (!journaled_done || !kSourceExists || !kDestinationExists) {
+    return false;
+  }
+
+  const auto kSourceSize = std::filesystem::file_size(task.source.path(), ec);
+  if (ec || kSourceSize != std::filesystem::file_size(task.destination.path(), ec) || ec) {
+    return false;
+  }
+
+  // unless every copy was synced before it was marked done, a power cut can leave one with the right size but not
+  // the right bytes
+  if (m_journal.isDoneSynced()) {
+    return true;
+  }
+  bool equal = false;
+  return compareFiles(task.source.path(), task.destination.path(), equal, ec) && equal;
 }
 
 /******************************************************************************
@@ -426,63 +2520,126 @@ void FolderMerger::undoMerge(std::filesystem::path& temp_folder_path) {
 ******************************************************************************/ 
 
 /**
- * @brief The only constructor for a FolderMerger instance
+ * @brief Constructor for a FolderMerger instance with its own thread pool
+ *
+ * @param main_directory path to the directory that will will merge folders
+ * @param program_name name of the compiled exe
+ * @param options settings for how the merge is carried out
+ */
+FolderMerger::FolderMerger(std::filesystem::path main_directory, std::filesystem::path program_name, const MergeOptions& options)
+  : m_main_directory(main_directory), m_name(program_name), m_options(options),
+    m_own_pool(std::make_unique<ThreadPool>(options.thread_count)), m_pool(*m_own_pool),
+    m_journal(main_directory / M_JOURNAL_FILE), m_reporter(options.verbosity, options.log_file), m_stats(!options.report_file.empty()) {
+}
+
+/**
+ * @brief Constructor for a FolderMerger instance that shares a thread pool with other mergers running at the same time
  *
  * @param main_directory path to the directory that will will merge folders
  * @param program_name name of the compiled exe
+ * @param options settings for how the merge is carried out, thread_count is ignored
+ * @param pool workers used to copy files, must outlive the merger
+ */
+FolderMerger::FolderMerger(std::filesystem::path main_directory, std::filesystem::path program_name, const MergeOptions& options, ThreadPool& pool)
+  : m_main_directory(main_directory), m_name(program_name), m_options(options), m_pool(pool),
+    m_journal(main_directory / M_JOURNAL_FILE), m_reporter(options.verbosity, options.log_file), m_stats(!options.report_file.empty(), true) {
+}
+
+/**
+ * @brief Report progress, file events and console lines to callbacks instead of the console
+ *
+ * @param callbacks functions to call, the ones that are not set keep the console behavior
  */
-FolderMerger::FolderMerger(std::filesystem::path main_directory, std::filesystem::path program_name)
-  : m_main_directory(main_directory), m_name(program_name) {
+void FolderMerger::setCallbacks(const MergeCallbacks& callbacks) {
+  m_callbacks = callbacks;
+  if (m_callbacks.on_message) {
+    m_message_buffer = std::make_unique<MessageBuffer>(m_callbacks.on_message);
+    m_message_stream = std::make_unique<std::ostream>(m_message_buffer.get());
+    m_console = m_message_stream.get();
+    m_reporter.setConsole(*m_console, false); // a callback gets whole lines, the redrawn progress line would pile up into one
+  }
+  if (m_callbacks.on_progress) {
+    m_reporter.setProgressCallback(m_callbacks.on_progress);
+  }
 }
 
 /**
  * @brief Get a list of filenames to exclude from merging
  */
 void FolderMerger::getCustomExcludes() {
-  std::cout << "Enter files that should be excluded from parsing(Enter " + M_QUIT_FLAG + " to end input): " << std::endl;
+  console() << "Enter files that should be excluded from parsing, '*' and '?' may be used(Enter " + M_QUIT_FLAG + " to end input): " << std::endl;
   std::string input = "";
   while (input != M_QUIT_FLAG) {
     if ((input != M_QUIT_FLAG) && (input != "")) {
-      m_exclude_list[input]++;
+      m_excludes.add(input);
     }
 
-    std::cout << "ENTER: ";
+    console() << "ENTER: ";
     std::cin >> std::noskipws;
-    std::getline(std::cin, input);
+    if (!std::getline(std::cin, input)) { // input was closed
+      break;
+    }
   }
 }
 
 /**
- * @brief Add a list of filenames to exclude from merging, Optional: Default exclude list is empty
+ * @brief Add a list of filenames or glob patterns to exclude from merging, Optional: Default exclude list is empty
  *
  * @param exclude_list list of files to exclude
  */
 void FolderMerger::addToExcludeList(const std::vector<std::filesystem::path>& exclude_list) {
   for (auto& file : exclude_list) {
-    m_exclude_list[file]++;
+    m_excludes.add(file.string());
   }
 }
 
 /**
- * @brief run a FolderMerger instance
+ * @brief Add every filename or glob pattern listed in a file to the exclude list
+ *
+ * @param exclude_file file with one pattern per line, lines starting with '#' are ignored
+ * 
+ * @return true if success ; false if the file cannot be read
  */
-void FolderMerger::run() {
+bool FolderMerger::addExcludeFile(const std::filesystem::path& exclude_file) {
+  if (!m_excludes.loadFile(exclude_file)) {
+    return fail(MergeErrorCode::ExcludeFileUnreadable, "Cannot read exclude file: \"" + exclude_file.string() + "\"", exclude_file);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Ask how the merge should be made, then make it
+ */
+void FolderMerger::mergeInteractively() {
+  // an interrupted merge was found, offer to pick it back up
+  if (m_journal.exists() && resumeMerge(true)) {
+    return;
+  }
+
+  m_stats.beginPhase("scan");
   std::vector<std::filesystem::path> main_dir_files = getDirectoryEntries(m_main_directory);
+  m_stats.addWork(main_dir_files.size(), 0);
+  m_stats.endPhase();
 
   // get a vector containing the correct order of folders
   std::vector<std::filesystem::path> ordering_list;
   bool loop;
+  m_stats.beginPhase("ordering");
   do {
     ordering_list = getOrderingList(main_dir_files);
 
-    std::cout << "\nCurrent Order: " << std::endl;
+    console() << "\nCurrent Order: " << std::endl;
     printEntries(ordering_list);
-    std::cout << "Press 'any key' and press 'ENTER' to go back, or enter "
+    console() << "Press 'any key' and press 'ENTER' to go back, or enter "
               << "nothing and press 'ENTER' if this is the correct order: " << std::endl;
 
-    std::cout << "ENTER: ";
+    console() << "ENTER: ";
     std::string input = "";
-    std::getline(std::cin, input);
+    if (!std::getline(std::cin, input)) { // input was closed, nobody can confirm the order
+      console() << "Closing program." << std::endl;
+      return;
+    }
     
     if (input != "") {
       loop = true;
@@ -491,11 +2648,13 @@ void FolderMerger::run() {
       loop = false;
     }
   } while(loop);
+  m_stats.addWork(ordering_list.size(), 0);
+  m_stats.endPhase();
   
   // Create backup, index, and rename files
   std::filesystem::path index_path = "";
   do {
-    std::cout << "Enter a merge method(Enter only ONE):\n"
+    console() << "Enter a merge method(Enter only ONE):\n"
               << "FLAGNAME  |  RESULT\n"
               << "'ENTER':     Create a Backup AND an Index\n"
               << "'" << M_NO_INDEX_FLAG           << "':        Create a Backup, but Do NOT create an Index.\n"
@@ -504,15 +2663,20 @@ void FolderMerger::run() {
               << "'" << M_QUIT_FLAG               << "':        Quit Program\n"
               << std::endl;
 
-    std::cout << "ENTER: ";
+    console() << "ENTER: ";
     std::string merge_method = "";
-    std::getline(std::cin, merge_method);
+    if (!std::getline(std::cin, merge_method)) { // input was closed
+      merge_method = M_QUIT_FLAG;
+    }
 
     loop = false;
 
     switch(merge_method[1]) {
       case '\0':  { // Create Backup and Index
-        createBackup(ordering_list);
+        if (!createBackup(ordering_list)) {
+          console() << "Closing program." << std::endl;
+          return;
+        }
         index_path = getValidIndexPath();
 
         break;
@@ -522,19 +2686,21 @@ void FolderMerger::run() {
         break;
       }
       case 'b': { // No Index
-        createBackup(ordering_list);
+        if (!createBackup(ordering_list)) {
+          console() << "Closing program." << std::endl;
+          return;
+        }
         break;
       }
       case 'c': { // No Backup or Index
         break;
       }
       case 'q': { // Quit program
-        std::cout << "Closing program." << std::endl;
-        loop = false;
-        break;
+        console() << "Closing program." << std::endl;
+        return;
       }
       default: { // Invalid input
-        std::cout << "ERROR: incorrect entry: " << merge_method << std::endl;
+        console() << "ERROR: incorrect entry: " << merge_method << std::endl;
         loop = true;
       }
     }
@@ -542,11 +2708,13 @@ void FolderMerger::run() {
 
   // create index file if it was chosen
   if (index_path != "") {
+    m_stats.beginPhase("index");
     index_path = index_path.string() + ".txt";
-    std::cout << "Creating Index File." << std::endl;
+    console() << "Creating Index File." << std::endl;
     std::ofstream ofstream;
     ofstream.open(index_path);
     ofstream.close();
+    m_stats.endPhase();
   }
 
   std::filesystem::path src_path = m_main_directory / M_TEMP_FOLDER;
@@ -558,4 +2726,51 @@ void FolderMerger::run() {
   else {
     undoMerge(src_path);
   }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief run a FolderMerger instance
+ */
+void FolderMerger::run() {
+  checkLogFile();
+  mergeInteractively();
+  finishReport();
+}
+
+/**
+ * @brief Run a merge job, without any prompts
+ *
+ * @param job folders, order, backup and index to use, its excludes must already be added
+ * 
+ * @return true if success ; false if the job could not be run or the merge failed
+ */
+bool FolderMerger::runJob(const MergeJob& job) {
+  checkLogFile();
+
+  // a filesystem call the merge does not expect to fail must not take down the caller, or every other job on its threads
+  bool success = false;
+  try {
+    success = (job.watch_seconds > 0) ? watchJob(job) : mergeJob(job);
+  }
+  catch (const std::filesystem::filesystem_error& error) {
+    success = fail(MergeErrorCode::FileSystemError, error.what(), error.path1());
+  }
+  finishReport();
+  return success;
+}
+
+/**
+ * @brief Write the timings of every phase measured so far as JSON, needs MergeOptions::report_file to be set
+ *
+ * @param report_file file to write
+ * 
+ * @return true if success ; false if the report could not be written
+ */
+bool FolderMerger::writeReport(const std::filesystem::path& report_file) {
+  m_stats.endPhase();
+
+  // report the real number of workers instead of 0
+  MergeOptions options = m_options;
+  options.thread_count = m_pool.size();
+  return m_stats.writeReport(report_file, m_main_directory, options);
+}
@@ -5,10 +5,40 @@
 #include <string>
 #include <string_view>
 #include <vector>
+#include <set>
+#include <functional>
 #include <unordered_map>
+#include <unordered_set>
+#include <atomic>
 #include <filesystem>
 #include <algorithm>
 #include <fstream>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <charconv>
+
+#include "merge_options.hpp"
+#include "thread_pool.hpp"
+#include "copy_engine.hpp"
+#include "copy_backend.hpp"
+#include "dir_snapshot.hpp"
+#include "dir_tree.hpp"
+#include "sorted_dir_reader.hpp"
+#include "merge_journal.hpp"
+#include "duplicate_finder.hpp"
+#include "exclude_matcher.hpp"
+#include "progress_reporter.hpp"
+#include "run_stats.hpp"
+#include "merge_job.hpp"
+#include "merge_events.hpp"
+#include "merge_plan.hpp"
+#include "folder_watcher.hpp"
+#include "tar_writer.hpp"
+#include "durability.hpp"
+#include "backup_store.hpp"
+#include "file_hash.hpp"
 
 class FolderMerger {
  private:
@@ -22,16 +52,49 @@ class FolderMerger {
   const std::filesystem::path M_DEFAULT_BACKUP_PATH = "Backup";
   const std::filesystem::path M_DEFAULT_INDEX_PATH = "Index";
   const std::filesystem::path M_TEMP_FOLDER = "_____[TempMergeFolder]_____";
+  const std::filesystem::path M_JOURNAL_FILE = "_____[MergeJournal]_____.txt";
+  const std::filesystem::path M_BACKUP_MARKER = "_____[MergeBackup]_____.txt"; // Written into every backup folder, a folder holding it is never merged
+  const std::string M_RENAME_PREFIX = "_____[Renamed]_____"; // Temporary name of a file of the merged folder while it is renamed
+
+  // consts
+  const std::chrono::milliseconds M_WATCH_POLL_INTERVAL = std::chrono::milliseconds(250); // Longest wait between checks of MergeCallbacks::should_stop
 
   // vars
-  std::unordered_map<std::filesystem::path, int> m_exclude_list; // List of filenames to exclude
+  ExcludeMatcher m_excludes; // Filenames and glob patterns to exclude
   std::filesystem::path m_main_directory; // Path to the main directory
   std::filesystem::path m_name; // Program exe filename
+  MergeOptions m_options; // Settings for how the merge is carried out
+  std::unique_ptr<ThreadPool> m_own_pool; // Pool made for this merger, empty if it shares one
+  ThreadPool& m_pool; // Workers used to copy files
+  std::vector<CopyTask> m_tasks; // Every file transfer made by the last merge
+  std::vector<size_t> m_unverified_tasks; // Transfers whose copy did not match the source, their folders are kept
+  bool m_appending = false; // The last merge keeps the first folder of its ordering list and appends the others to it
+  std::vector<CopyTask> m_renames; // Files of the merged folder to give new numbers when the merge is confirmed
+  bool m_renames_staged = false; // Every file of m_renames is under its temporary name, see renameFiles()
+  std::unordered_map<std::string, std::string> m_store_keys; // Object of every file the last backup put in the backup store, by source path
+  std::filesystem::path m_store_manifest; // Manifest of that backup
+  bool m_merge_synced = false; // syncMerge() made the last transfers durable, so confirmMerge() does not sync them again
+  MergeJournal m_journal; // Record of the current merge, lets it be resumed after a crash
+  std::unique_ptr<MessageBuffer> m_message_buffer; // Hands console lines to m_callbacks.on_message, outlives m_reporter
+  std::unique_ptr<std::ostream> m_message_stream;
+  ProgressReporter m_reporter; // Per-file log and progress line
+  RunStats m_stats; // Timings of every phase, for the --report file
+  MergeCallbacks m_callbacks;
+  std::ostream* m_console = &std::cout; // Where status lines, errors and prompts are written
+  MergeError m_error; // First error the last merge ran into
+  std::filesystem::path m_merged_folder; // Where the merged files ended up, set once a merge is confirmed
 
   // funcs
 
+  std::ostream& console() { return *m_console; }
+  bool fail(MergeErrorCode code, const std::string& message, const std::filesystem::path& path = "");
+  void checkLogFile();
+
   // Check user input
-  bool isValidOrderedListEntry(std::filesystem::path entry);
+  bool isExcluded(std::string_view name) const;
+  bool isValidOrderedListEntry(const DirSnapshot& snapshot, size_t idx);
+  bool isBackupStore(const std::filesystem::path& folder) const;
+  bool isBackupFolder(const std::filesystem::path& folder) const;
   bool isProperFormat(std::string_view str, const int max_length);
  
   // General use
@@ -42,22 +105,67 @@ class FolderMerger {
   std::vector<std::filesystem::path> getOrderingList(std::vector<std::filesystem::path>& entries);
   bool isValidPath(std::filesystem::path path, bool check_directory);
 
-  bool createBackup(std::vector<std::filesystem::path>& ordering_list);
   std::filesystem::path getValidBackupPath();
 
   std::filesystem::path getValidIndexPath();
 
-  bool merge(std::vector<std::filesystem::path>& ordering_list, std::filesystem::path& index_file);
-  void confirmMerge(std::vector<std::filesystem::path>& ordering_list, std::filesystem::path& src_path, std::filesystem::path& dest_path);
-  void undoMerge(std::filesystem::path& temp_folder_path);
+  bool planBackup(const std::vector<std::filesystem::path>& ordering_list, std::filesystem::path backup_path, MergePlan& plan);
+  bool runBackup(const MergePlan& plan);
+  bool runStoreBackup(const MergePlan& plan);
+  void recordMergedFolder(const std::filesystem::path& merged_folder);
+  bool planMerge(const std::vector<std::filesystem::path>& ordering_list, const std::filesystem::path& index_file, MergePlan& plan);
+  bool checkInPlaceNames(const MergePlan& plan);
+  bool runPlannedMerge(const MergePlan& plan);
+  size_t getNumberedFiles(const DirSnapshot& snapshot, uint64_t& last_number, int& width, std::vector<std::pair<size_t, size_t>>& numbered_files) const;
+  bool isBackupFolderName(const std::string& name, const std::filesystem::path& backup_name) const;
+  std::filesystem::path getAppendBackupPath(const std::filesystem::path& backup_name) const;
+  bool planAppend(const std::filesystem::path& merged_folder, const std::vector<std::filesystem::path>& folders, const std::filesystem::path& index_file, MergePlan& plan);
+  bool readSortedFolder(const std::filesystem::path& folder, uint64_t& memory_used, std::unique_ptr<SortedDirReader>& reader);
+  bool collectEntries(const DirNode& node, const std::filesystem::path& folder, std::vector<FileRef>& entries, std::vector<FileRef>& files);
+  bool handleNestedFolder(const std::filesystem::path& folder);
+  bool transferFiles(const std::vector<size_t>& task_indices);
+  bool syncTransfers(const std::vector<CopyTask>& tasks, const std::vector<std::filesystem::path>& folders, std::filesystem::path& failed_path, std::error_code& ec);
+  bool writeArchive(const MergePlan& plan);
+  void removeFolders(const std::vector<std::filesystem::path>& folders, size_t first, const std::vector<bool>& keep_folder);
+  bool renameFiles(const std::vector<CopyTask>& renames);
+  bool moveIntoMergedFolder(const std::filesystem::path& temp_folder, const std::filesystem::path& merged_folder);
+  bool restoreMovedFiles();
+
+  void mergeInteractively();
+  bool mergeJob(const MergeJob& job);
+  bool runPlan(MergePlan& plan);
+  bool watchJob(const MergeJob& job);
+  void finishReport();
+  bool resumeMerge(bool ask_to_resume);
+  bool isTransferDone(const CopyTask& task, bool journaled_done);
 
  public:
-  FolderMerger(std::filesystem::path main_directory, std::filesystem::path program_name);
+  FolderMerger(std::filesystem::path main_directory, std::filesystem::path program_name, const MergeOptions& options = MergeOptions());
+  FolderMerger(std::filesystem::path main_directory, std::filesystem::path program_name, const MergeOptions& options, ThreadPool& pool);
 
   const std::filesystem::path& getName() const { return m_name; }
+  void setCallbacks(const MergeCallbacks& callbacks);
+  const MergeError& getError() const { return m_error; }
+  const std::vector<CopyTask>& getTasks() const { return m_tasks; }
+  const std::filesystem::path& getMergedFolder() const { return m_merged_folder; }
   void getCustomExcludes();
   void addToExcludeList(const std::vector<std::filesystem::path>& exclude_list);
+  bool addExcludeFile(const std::filesystem::path& exclude_file);
   void run();
+  bool runJob(const MergeJob& job);
+  bool writeReport(const std::filesystem::path& report_file);
+
+  // Single steps of run(), for callers that drive a merge without the prompts
+  std::vector<std::filesystem::path> getMergeableFolders() { return getDirectoryEntries(m_main_directory); }
+  std::filesystem::path getTempFolder() const { return m_main_directory / M_TEMP_FOLDER; }
+  bool createBackup(std::vector<std::filesystem::path>& ordering_list, std::filesystem::path backup_path = "");
+  bool merge(std::vector<std::filesystem::path>& ordering_list, std::filesystem::path& index_file);
+  bool appendFolders(const std::filesystem::path& merged_folder, std::vector<std::filesystem::path> folders, const std::filesystem::path& index_file,
+                     const std::filesystem::path& backup_name = "");
+  bool syncMerge();
+  bool restoreBackup(const std::filesystem::path& manifest_file);
+  bool confirmMerge(std::vector<std::filesystem::path>& ordering_list, std::filesystem::path& src_path, std::filesystem::path& dest_path);
+  void undoMerge(std::filesystem::path& temp_folder_path);
 };
 
 #endif // FOLDER_MERGER_HPP
\ No newline at end of file
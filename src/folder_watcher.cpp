@@ -0,0 +1,288 @@
+#include "folder_watcher.hpp"
+
+#include <thread>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+// Anything that changes what is inside a folder
+static const uint32_t FOLDER_EVENTS = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB;
+// Folders appearing in or leaving the watched directory
+static const uint32_t DIRECTORY_EVENTS = IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM;
+#endif
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/
+
+/**
+ * @brief Read the directory, start watching new folders and forget the ones that are gone
+ *
+ * Without inotify this is also how changes are found, by comparing every folder's signature with the last one.
+ */
+void FolderWatcher::scanDirectory() {
+  m_last_scan = Clock::now();
+
+  std::error_code ec;
+  std::map<std::string, bool> seen;
+  for (std::filesystem::directory_iterator it(m_directory, ec), end; !ec && it != end; it.increment(ec)) {
+    std::error_code type_ec;
+    const std::string kName = it->path().filename().string();
+    if (!it->is_directory(type_ec) || it->is_symlink(type_ec) || !m_is_watched(kName)) {
+      continue;
+    }
+    seen[kName] = true;
+
+    auto folder = m_folders.find(kName);
+    if (folder == m_folders.end()) {
+      addFolder(kName);
+    }
+#ifndef __linux__
+    else {
+      const uint64_t kSignature = getSignature(it->path());
+      if (kSignature != folder->second.signature) {
+        folder->second.signature = kSignature;
+        folder->second.last_change = Clock::now();
+      }
+    }
+#endif
+  }
+
+  for (auto folder = m_folders.begin(); !ec && folder != m_folders.end();) {
+    folder = (seen.count(folder->first) == 0) ? m_folders.erase(folder) : std::next(folder);
+  }
+}
+
+/**
+ * @brief Start watching a folder, it counts as just changed
+ *
+ * @param name name of the folder in the directory
+ */
+void FolderWatcher::addFolder(const std::string& name) {
+  Folder& folder = m_folders[name];
+  folder.last_change = Clock::now();
+#ifdef __linux__
+  addWatches(m_directory / name, name);
+#else
+  folder.signature = getSignature(m_directory / name);
+#endif
+}
+
+#ifdef __linux__
+/**
+ * @brief Watch a folder and every folder nested in it
+ *
+ * The watch is added before the folder is listed, so a nested folder made in between is still seen as an event.
+ *
+ * @param path folder to watch
+ * @param folder name of the folder of the directory it belongs to
+ */
+void FolderWatcher::addWatches(const std::filesystem::path& path, const std::string& folder) {
+  const int kWd = inotify_add_watch(m_fd, path.c_str(), FOLDER_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW);
+  if (kWd < 0) { // out of watches, the folder still counts as changed whenever its parent sees an event
+    return;
+  }
+  m_watches[kWd] = { folder, path };
+
+  std::error_code ec;
+  for (std::filesystem::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+    std::error_code type_ec;
+    if (it->is_directory(type_ec) && !it->is_symlink(type_ec)) {
+      addWatches(it->path(), folder);
+    }
+  }
+}
+
+/**
+ * @brief Handle every inotify event that is waiting, without blocking
+ */
+void FolderWatcher::readEvents() {
+  alignas(struct inotify_event) char buffer[64 * 1024];
+  bool overflowed = false;
+
+  while (true) {
+    const ssize_t kRead = read(m_fd, buffer, sizeof(buffer));
+    if (kRead <= 0) {
+      if (kRead < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    const Clock::time_point kNow = Clock::now();
+    for (ssize_t offset = 0; offset < kRead;) {
+      const struct inotify_event* kEvent = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+      offset += sizeof(struct inotify_event) + kEvent->len;
+
+      if (kEvent->mask & IN_Q_OVERFLOW) {
+        overflowed = true;
+        continue;
+      }
+
+      auto watch = m_watches.find(kEvent->wd);
+      if (watch == m_watches.end()) {
+        continue;
+      }
+      else if (kEvent->mask & IN_IGNORED) { // the folder was deleted or moved away
+        m_watches.erase(watch);
+        continue;
+      }
+
+      const std::string kName = (kEvent->len > 0) ? std::string(kEvent->name) : std::string();
+      const bool kNewFolder = (kEvent->mask & IN_ISDIR) && (kEvent->mask & (IN_CREATE | IN_MOVED_TO));
+      if (watch->second.folder.empty()) { // the directory itself, only folders matter there
+        if (!(kEvent->mask & IN_ISDIR)) {
+          continue;
+        }
+        else if (kNewFolder && m_folders.count(kName) == 0 && m_is_watched(kName)) {
+          addFolder(kName);
+        }
+        else if (kEvent->mask & (IN_DELETE | IN_MOVED_FROM)) {
+          m_folders.erase(kName);
+        }
+        continue;
+      }
+
+      auto folder = m_folders.find(watch->second.folder);
+      if (folder == m_folders.end()) {
+        continue;
+      }
+      folder->second.last_change = kNow;
+      if (kNewFolder) {
+        addWatches(watch->second.path / kName, watch->second.folder);
+      }
+    }
+  }
+
+  // events were lost, every folder may have changed
+  if (overflowed) {
+    scanDirectory();
+    for (auto& folder : m_folders) {
+      folder.second.last_change = Clock::now();
+    }
+  }
+}
+#else
+/**
+ * @brief Sum up the names, sizes and write times of everything in a folder
+ *
+ * @param folder folder to read
+ *
+ * @return uint64_t value that changes whenever anything in the folder does
+ */
+uint64_t FolderWatcher::getSignature(const std::filesystem::path& folder) {
+  uint64_t signature = 0;
+  std::error_code ec;
+  for (std::filesystem::recursive_directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+    std::error_code entry_ec;
+    uint64_t entry = std::hash<std::string>()(it->path().string());
+    if (it->is_regular_file(entry_ec)) {
+      entry ^= it->file_size(entry_ec) * 0x9e3779b97f4a7c15ULL;
+    }
+    entry ^= static_cast<uint64_t>(it->last_write_time(entry_ec).time_since_epoch().count());
+    signature += entry * 0x100000001b3ULL;
+  }
+
+  return signature;
+}
+#endif
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/
+
+/**
+ * @brief Create a watcher, nothing is watched until start() is called
+ *
+ * @param directory directory whose folders to watch
+ * @param quiet_time time a folder has to go without changes before getQuietFolders() reports it
+ * @param is_watched returns whether a folder name should be watched at all
+ */
+FolderWatcher::FolderWatcher(std::filesystem::path directory, std::chrono::milliseconds quiet_time, std::function<bool(const std::string&)> is_watched)
+  : m_directory(std::move(directory)), m_quiet_time(quiet_time), m_is_watched(std::move(is_watched)) {
+}
+
+/**
+ * @brief Stop watching
+ */
+FolderWatcher::~FolderWatcher() {
+#ifdef __linux__
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+#endif
+}
+
+/**
+ * @brief Start watching the directory, every folder already in it counts as just changed
+ *
+ * @param ec set if the directory cannot be watched
+ *
+ * @return true if success ; false if error
+ */
+bool FolderWatcher::start(std::error_code& ec) {
+  ec.clear();
+#ifdef __linux__
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd < 0) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+
+  const int kWd = inotify_add_watch(m_fd, m_directory.c_str(), DIRECTORY_EVENTS | IN_ONLYDIR);
+  if (kWd < 0) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+  m_watches[kWd] = { "", m_directory };
+#else
+  if (!std::filesystem::is_directory(m_directory, ec)) {
+    ec = ec ? ec : std::make_error_code(std::errc::not_a_directory);
+    return false;
+  }
+#endif
+
+  scanDirectory();
+  return true;
+}
+
+/**
+ * @brief Wait for changes to come in and take note of them
+ *
+ * @param timeout longest time to wait
+ */
+void FolderWatcher::wait(std::chrono::milliseconds timeout) {
+#ifdef __linux__
+  struct pollfd poll_fd = { m_fd, POLLIN, 0 };
+  if (poll(&poll_fd, 1, static_cast<int>(timeout.count())) > 0) {
+    readEvents();
+  }
+#else
+  std::this_thread::sleep_for(timeout);
+  if (Clock::now() - m_last_scan >= M_POLL_INTERVAL) {
+    scanDirectory();
+  }
+#endif
+}
+
+/**
+ * @brief Get every folder that has gone without changes for the quiet time
+ *
+ * @return std::vector<std::string> folder names, in name order
+ */
+std::vector<std::string> FolderWatcher::getQuietFolders() const {
+  const Clock::time_point kNow = Clock::now();
+  std::vector<std::string> ret;
+  for (const auto& folder : m_folders) {
+    if (kNow - folder.second.last_change >= m_quiet_time && m_is_watched(folder.first)) {
+      ret.push_back(folder.first);
+    }
+  }
+
+  return ret;
+}
@@ -0,0 +1,70 @@
+#ifndef FOLDER_WATCHER_HPP
+#define FOLDER_WATCHER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <system_error>
+
+// Tells which folders of a directory have stopped changing, so folders that are still being written are left alone
+//
+// On Linux every folder is watched with inotify, anything created, written, moved or deleted inside it counts as a
+// change. Elsewhere the folders are read again about once a second and compared with the last read.
+class FolderWatcher {
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // consts
+  const std::chrono::milliseconds M_POLL_INTERVAL = std::chrono::milliseconds(1000); // Time between reads without inotify
+
+  // A folder of the watched directory
+  struct Folder {
+    Clock::time_point last_change;
+    uint64_t signature = 0; // Names, sizes and write times of everything inside, only used without inotify
+  };
+
+  // vars
+  std::filesystem::path m_directory;
+  std::chrono::milliseconds m_quiet_time; // Time a folder has to go without changes
+  std::function<bool(const std::string&)> m_is_watched; // Picks the folder names to watch, asked again before reporting one
+  std::map<std::string, Folder> m_folders; // Every folder being watched, by name
+  Clock::time_point m_last_scan;
+#ifdef __linux__
+  // An inotify watch on a folder or one of its nested folders
+  struct Watch {
+    std::string folder; // Name of the folder it belongs to, empty for the directory itself
+    std::filesystem::path path;
+  };
+
+  int m_fd = -1;
+  std::unordered_map<int, Watch> m_watches; // By watch descriptor
+#endif
+
+  // funcs
+  void scanDirectory();
+  void addFolder(const std::string& name);
+#ifdef __linux__
+  void addWatches(const std::filesystem::path& path, const std::string& folder);
+  void readEvents();
+#else
+  static uint64_t getSignature(const std::filesystem::path& folder);
+#endif
+
+ public:
+  FolderWatcher(std::filesystem::path directory, std::chrono::milliseconds quiet_time, std::function<bool(const std::string&)> is_watched);
+  ~FolderWatcher();
+
+  FolderWatcher(const FolderWatcher&) = delete;
+  FolderWatcher& operator=(const FolderWatcher&) = delete;
+
+  bool start(std::error_code& ec);
+  void wait(std::chrono::milliseconds timeout);
+  std::vector<std::string> getQuietFolders() const;
+};
+
+#endif // FOLDER_WATCHER_HPP
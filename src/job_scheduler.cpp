@@ -0,0 +1,143 @@
+#include "job_scheduler.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/ 
+
+/**
+ * @brief Find the storage device a directory is on
+ *
+ * @param directory directory to look up
+ * 
+ * @return Device the whole disk for a partition, so jobs on two partitions of one disk share its limit
+ */
+JobScheduler::Device JobScheduler::getDevice(const std::filesystem::path& directory) {
+  Device device;
+  device.id = directory.root_name().string(); // drive letter where nothing better is known
+
+#ifdef __linux__
+  struct stat stat_buffer;
+  if (stat(directory.c_str(), &stat_buffer) != 0) {
+    return device;
+  }
+
+  const std::string kNumbers = std::to_string(major(stat_buffer.st_dev)) + ":" + std::to_string(minor(stat_buffer.st_dev));
+  device.id = kNumbers;
+
+  // filesystems without a block device (tmpfs, network shares) are told apart by their device numbers
+  std::error_code ec;
+  std::filesystem::path sys_path = std::filesystem::canonical("/sys/dev/block/" + kNumbers, ec);
+  if (ec) {
+    return device;
+  }
+  else if (std::filesystem::exists(sys_path / "partition", ec)) {
+    sys_path = sys_path.parent_path();
+  }
+  device.id = sys_path.filename().string();
+
+  std::ifstream rotational(sys_path / "queue" / "rotational");
+  int value = 0;
+  device.rotational = (rotational >> value) && value == 1;
+#endif
+
+  return device;
+}
+
+/**
+ * @brief Constructor
+ *
+ * @param max_jobs most jobs running at the same time, over all devices
+ * @param jobs_per_device most jobs running at the same time on one device, 0 = 1 on hard drives and 4 on anything else
+ */
+JobScheduler::JobScheduler(unsigned int max_jobs, unsigned int jobs_per_device)
+  : m_max_jobs(std::max(max_jobs, 1u)), m_jobs_per_device(jobs_per_device) {
+}
+
+/**
+ * @brief Run every job, each on its own thread, starting jobs in list order as soon as their device has room
+ *
+ * Two jobs in the same directory never run at the same time, as they would share a temp folder and journal.
+ *
+ * @param directories main directory of every job
+ * @param run_job runs the job with the given index, returns whether it succeeded
+ * 
+ * @return std::vector<bool> whether each job succeeded
+ */
+std::vector<bool> JobScheduler::run(const std::vector<std::filesystem::path>& directories, const std::function<bool(size_t)>& run_job) {
+  const size_t kJobCount = directories.size();
+  std::vector<Device> devices(kJobCount);
+  std::vector<std::filesystem::path> canonical_directories(kJobCount);
+  for (size_t i = 0; i < kJobCount; i++) {
+    devices[i] = getDevice(directories[i]);
+
+    std::error_code ec;
+    canonical_directories[i] = std::filesystem::weakly_canonical(directories[i], ec);
+    if (ec) {
+      canonical_directories[i] = directories[i];
+    }
+  }
+
+  std::vector<bool> results(kJobCount, false);
+  std::vector<bool> started(kJobCount, false);
+  std::map<std::string, unsigned int> running_per_device;
+  std::set<std::filesystem::path> running_directories;
+  unsigned int running = 0;
+  size_t finished = 0;
+
+  std::mutex mutex;
+  std::condition_variable job_finished;
+  std::vector<std::thread> threads;
+  threads.reserve(kJobCount);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (finished < kJobCount) {
+    for (size_t i = 0; i < kJobCount && running < m_max_jobs; i++) {
+      const unsigned int kDeviceLimit = (m_jobs_per_device > 0) ? m_jobs_per_device
+                                      : (devices[i].rotational ? M_SPINNING_DISK_JOBS : M_OTHER_DEVICE_JOBS);
+      if (started[i] || running_per_device[devices[i].id] >= kDeviceLimit || running_directories.count(canonical_directories[i]) > 0) {
+        continue;
+      }
+
+      started[i] = true;
+      running++;
+      running_per_device[devices[i].id]++;
+      running_directories.insert(canonical_directories[i]);
+
+      threads.emplace_back([&, i] {
+        const bool kSuccess = run_job(i);
+
+        std::lock_guard<std::mutex> job_lock(mutex);
+        results[i] = kSuccess;
+        running--;
+        running_per_device[devices[i].id]--;
+        running_directories.erase(canonical_directories[i]);
+        finished++;
+        job_finished.notify_all();
+      });
+    }
+
+    const size_t kFinished = finished;
+    job_finished.wait(lock, [&] { return finished != kFinished; });
+  }
+  lock.unlock();
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  return results;
+}
@@ -0,0 +1,33 @@
+#ifndef JOB_SCHEDULER_HPP
+#define JOB_SCHEDULER_HPP
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <functional>
+
+// Runs merge jobs at the same time, with a limit on how many run on the same storage device
+class JobScheduler {
+ private:
+  // consts
+  const unsigned int M_SPINNING_DISK_JOBS = 1; // Default limit for hard drives, more jobs would only make the head seek
+  const unsigned int M_OTHER_DEVICE_JOBS = 4; // Default limit for SSDs and everything that is not a hard drive
+
+  // vars
+  unsigned int m_max_jobs; // Jobs running at once, over all devices
+  unsigned int m_jobs_per_device; // 0 = pick from the kind of device
+
+ public:
+  // The storage a directory is on
+  struct Device {
+    std::string id; // Whole disk a partition belongs to, or the filesystem if it has no block device
+    bool rotational = false;
+  };
+
+  JobScheduler(unsigned int max_jobs, unsigned int jobs_per_device);
+
+  static Device getDevice(const std::filesystem::path& directory);
+  std::vector<bool> run(const std::vector<std::filesystem::path>& directories, const std::function<bool(size_t)>& run_job);
+};
+
+#endif // JOB_SCHEDULER_HPP
@@ -1,21 +1,136 @@
 #include <vector>
+#include <memory>
 #include <filesystem>
+#include <csignal>
 
 #include "folder_merger.hpp"
+#include "command_line.hpp"
+#include "job_scheduler.hpp"
 
-int main() {
-  FolderMerger folder_merger(std::filesystem::current_path(), "fmerge.exe");
-
-  // exclude the files listed in 'excludes' from the directory search
-  int EXCLUDE_SIZE = 3;
-  std::vector<std::filesystem::path> excludes(EXCLUDE_SIZE);
-  excludes = {
+/**
+ * @brief Get the filenames that are never merged, no matter what the user excludes
+ */
+static std::vector<std::filesystem::path> getDefaultExcludes(const FolderMerger& folder_merger) {
+  return {
     "desktop.ini",
     ".git",
     folder_merger.getName() // wont work if you change the compiled name, but not the name in folder_merger on line 7
   };
+}
+
+// Set by Ctrl+C or SIGTERM while directories are watched, so they stop between merges instead of in the middle of one
+static volatile std::sig_atomic_t g_stop_requested = 0;
+
+static void requestStop(int) {
+  g_stop_requested = 1;
+}
+
+/**
+ * @brief Run every job from the command line and job files without prompts, several at once if asked to
+ *
+ * @param command_line parsed command line
+ * 
+ * @return int exit code, 0 if every job succeeded
+ */
+static int runJobs(const CommandLine& command_line) {
+  std::vector<MergeJob> jobs;
+  if (command_line.has_job) {
+    jobs.push_back(command_line.job);
+  }
+  for (const auto& job_file : command_line.job_files) {
+    if (!loadJobFile(job_file, command_line.options, jobs)) {
+      return 1;
+    }
+  }
+
+  std::vector<std::filesystem::path> directories;
+  bool watching = false;
+  for (const auto& job : jobs) {
+    directories.push_back(getJobDirectory(job));
+    watching = watching || job.watch_seconds > 0;
+  }
+
+  MergeCallbacks callbacks;
+  if (watching) {
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    callbacks.should_stop = []() { return g_stop_requested != 0; };
+  }
+
+  // jobs running at once share one set of workers, sized by the command line's --threads
+  const bool kConcurrent = (command_line.parallel_jobs > 1 && jobs.size() > 1);
+  std::unique_ptr<ThreadPool> shared_pool;
+  if (kConcurrent) {
+    shared_pool = std::make_unique<ThreadPool>(command_line.options.thread_count);
+  }
+
+  JobScheduler scheduler(command_line.parallel_jobs, command_line.jobs_per_device);
+  const std::vector<bool> kResults = scheduler.run(directories, [&](size_t idx) {
+    const MergeJob& job = jobs[idx];
+    MergeOptions options = job.options;
+    if (kConcurrent && options.verbosity == Verbosity::Progress) { // progress lines of jobs running at once would overwrite each other
+      options.verbosity = Verbosity::Quiet;
+    }
+
+    std::cout << "Job " << (idx + 1) << "/" << jobs.size() << " started: " << directories[idx] << std::endl;
+    std::unique_ptr<FolderMerger> folder_merger = kConcurrent
+      ? std::make_unique<FolderMerger>(directories[idx], "fmerge.exe", options, *shared_pool)
+      : std::make_unique<FolderMerger>(directories[idx], "fmerge.exe", options);
+
+    folder_merger->setCallbacks(callbacks);
+
+    bool success = true;
+    for (const auto& exclude_file : options.exclude_files) {
+      success = success && folder_merger->addExcludeFile(exclude_file);
+    }
+    folder_merger->addToExcludeList(getDefaultExcludes(*folder_merger));
+    folder_merger->addToExcludeList(std::vector<std::filesystem::path>(job.excludes.begin(), job.excludes.end()));
+
+    success = success && folder_merger->runJob(job);
+    std::cout << "Job " << (idx + 1) << "/" << jobs.size() << (success ? " finished: " : " failed: ") << directories[idx] << std::endl;
+    return success;
+  });
+
+  const size_t kSucceeded = std::count(kResults.begin(), kResults.end(), true);
+  std::cout << kSucceeded << " of " << jobs.size() << " jobs succeeded." << std::endl;
+  return kSucceeded == jobs.size() ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+  CommandLine command_line;
+  if (!parseCommandLine(argc, argv, command_line)) {
+    std::cout << "Usage: fmerge [" << THREADS_FLAG << " count] [" << MODE_FLAG << " copy|move] [" << BACKUP_BACKEND_FLAG << " backend]\n"
+              << "              [" << DEDUP_FLAG << " off|skip|hardlink] [" << EXCLUDE_FILE_FLAG << " file]\n"
+              << "              [" << VERBOSITY_FLAG << " quiet|progress|per-file] [" << LOG_FILE_FLAG << " file]\n"
+              << "              [" << ON_NESTED_FLAG << " ask|skip|quit|recurse] [" << REPORT_FLAG << " file]\n"
+              << "              [" << STREAM_FLAG << " off|fadvise|direct] [" << STREAM_THRESHOLD_FLAG << " size] [" << PREALLOCATE_FLAG << " on|off]\n"
+              << "              [" << IO_URING_FLAG << " queue-depth] [" << VERIFY_FLAG << " on|off] [" << WIDTH_GROWTH_FLAG << " rename|keep]\n"
+              << "              [" << ARCHIVE_COMPRESSION_FLAG << " auto|none|gzip|zstd|xz] [" << DURABILITY_FLAG << " none|batch|syncfs|strict]\n"
+              << "              [" << SORT_MEMORY_FLAG << " size] [" << BACKUP_STORE_FLAG << " folder] [" << IN_PLACE_FLAG << " on|off]\n"
+              << "Without prompts:\n"
+              << "              [" << DIR_FLAG << " directory] [" << FOLDER_FLAG << " name]... [" << EXCLUDE_FLAG << " pattern]...\n"
+              << "              [" << BACKUP_FLAG << " name|" << NONE_VALUE << "] [" << INDEX_FLAG << " name|" << NONE_VALUE << "] [" << ARCHIVE_FLAG << " file|" << NONE_VALUE << "]\n"
+              << "              [" << DRY_RUN_FLAG << " plan-file|" << NONE_VALUE << "] [" << RUN_PLAN_FLAG << " plan-file] [" << WATCH_FLAG << " seconds]\n"
+              << "              [" << RESTORE_FLAG << " manifest]\n"
+              << "              [" << JOB_FILE_FLAG << " file]... [" << PARALLEL_JOBS_FLAG << " count] [" << JOBS_PER_DEVICE_FLAG << " count]" << std::endl;
+    return 1;
+  }
+
+  if (command_line.isHeadless()) {
+    return runJobs(command_line);
+  }
+
+  const MergeOptions& options = command_line.options;
+  FolderMerger folder_merger(std::filesystem::current_path(), "fmerge.exe", options);
+
+  // exclude the files listed in 'excludes' from the directory search
+  for (const auto& exclude_file : options.exclude_files) {
+    if (!folder_merger.addExcludeFile(exclude_file)) {
+      return 1;
+    }
+  }
   folder_merger.getCustomExcludes();
-  folder_merger.addToExcludeList(excludes);
+  folder_merger.addToExcludeList(getDefaultExcludes(folder_merger));
 
   folder_merger.run();
 
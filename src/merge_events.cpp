@@ -0,0 +1,76 @@
+#include "merge_events.hpp"
+
+/**
+ * @brief Get a short name for an error code, e.g. for logs
+ *
+ * @param code error code to name
+ * 
+ * @return const char* name such as "backup-failed"
+ */
+const char* getErrorName(MergeErrorCode code) {
+  switch (code) {
+    case MergeErrorCode::None:                  return "none";
+    case MergeErrorCode::InvalidJob:            return "invalid-job";
+    case MergeErrorCode::ExcludeFileUnreadable: return "exclude-file-unreadable";
+    case MergeErrorCode::BackupFailed:          return "backup-failed";
+    case MergeErrorCode::IndexFailed:           return "index-failed";
+    case MergeErrorCode::ReadFailed:            return "read-failed";
+    case MergeErrorCode::NestedFolder:          return "nested-folder";
+    case MergeErrorCode::TransferFailed:        return "transfer-failed";
+    case MergeErrorCode::NotEnoughSpace:        return "not-enough-space";
+    case MergeErrorCode::PlanFailed:            return "plan-failed";
+    case MergeErrorCode::VerifyFailed:          return "verify-failed";
+    case MergeErrorCode::ArchiveFailed:         return "archive-failed";
+    case MergeErrorCode::SyncFailed:            return "sync-failed";
+    case MergeErrorCode::RestoreFailed:         return "restore-failed";
+    case MergeErrorCode::FileSystemError:       return "filesystem-error";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief Add a character to a line, handing the line over when it ends. m_mutex must be held
+ *
+ * @param line line of the writing thread
+ * @param c character written
+ */
+void MessageBuffer::put(std::string& line, char c) {
+  if (c == '\n') {
+    m_on_line(line);
+    line.clear();
+  }
+  else if (c != '\r') {
+    line += c;
+  }
+}
+
+/**
+ * @brief Collect a character, handing the line over when it ends
+ */
+int MessageBuffer::overflow(int c) {
+  if (c == traits_type::eof()) {
+    return traits_type::not_eof(c);
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  put(m_lines[std::this_thread::get_id()], traits_type::to_char_type(c));
+  return c;
+}
+
+/**
+ * @brief Collect a run of characters under a single lock
+ */
+std::streamsize MessageBuffer::xsputn(const char* s, std::streamsize count) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::string& line = m_lines[std::this_thread::get_id()];
+  for (std::streamsize i = 0; i < count; ++i) {
+    put(line, s[i]);
+  }
+  return count;
+}
+
+/**
+ * @brief Lines are handed over as soon as they end, so there is nothing to flush
+ */
+int MessageBuffer::sync() {
+  return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef MERGE_EVENTS_HPP
+#define MERGE_EVENTS_HPP
+
+#include <cstdint>
+#include <string>
+#include <streambuf>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Progress of the phase that is running
+struct MergeProgress {
+  std::string phase; // e.g. "Backing up" or "Copying"
+  uint64_t files_done = 0;
+  uint64_t total_files = 0;
+  uint64_t bytes_done = 0;
+  uint64_t total_bytes = 0; // 0 if the sizes were not read
+  double seconds = 0; // Time since the phase began
+  bool finished = false; // Last report of the phase
+};
+
+enum class FileEventType {
+  Planned, // The file was given its new name, nothing is copied yet
+  Transferred, // The file was copied, moved or linked into the merged folder
+  Excluded // The file matched an exclude pattern and is left out
+};
+
+// Something that happened to a single file
+struct FileEvent {
+  FileEventType type;
+  std::filesystem::path source;
+  std::filesystem::path destination; // Empty for excluded files
+  uint64_t size = 0; // 0 if the sizes were not read
+};
+
+enum class MergeErrorCode {
+  None,
+  InvalidJob, // The job names a folder that does not exist, lists one twice, or has nothing to merge
+  ExcludeFileUnreadable,
+  BackupFailed,
+  IndexFailed,
+  ReadFailed, // A folder could not be read
+  NestedFolder, // A folder holds another folder and the policy said to stop
+  TransferFailed, // Some files could not be copied or moved, the merge was undone
+  NotEnoughSpace, // The drive does not have room for the backup and the merged files
+  PlanFailed, // A plan file could not be read or written, or is for another directory
+  VerifyFailed, // Some copies did not match their source, the folders they came from were kept
+  ArchiveFailed, // The archive could not be written, the folders were left as they were
+  SyncFailed, // The merged files could not be synced to the disk, the folders and the temp folder were kept to resume from
+  RestoreFailed, // A backup from the backup store could not be restored
+  FileSystemError // A file or folder operation failed where the merge did not expect it to, the message names it
+};
+
+// Why a merge failed
+struct MergeError {
+  MergeErrorCode code = MergeErrorCode::None;
+  std::string message;
+  std::filesystem::path path; // File or folder the error is about, if any
+};
+
+// Functions a merge reports to, every one is optional
+struct MergeCallbacks {
+  std::function<void(const MergeProgress&)> on_progress; // Called from a helper thread about every 250 ms during backups and copies
+  std::function<void(const FileEvent&)> on_file; // Transferred events are called from worker threads
+  std::function<void(const std::string&)> on_message; // Every status and error line, without the newline. Not set = print to std::cout
+  std::function<bool()> should_stop; // Asked about every 250 ms while watching a directory, true stops the watch once no merge is running
+};
+
+const char* getErrorName(MergeErrorCode code);
+
+// Stream buffer that hands every complete line written to it to a callback.
+// The progress thread and the copy workers write to it at once, so every write is taken under one lock
+// and each thread builds its own line
+class MessageBuffer : public std::streambuf {
+ private:
+  // vars
+  std::function<void(const std::string&)> m_on_line;
+  std::mutex m_mutex; // Guards m_lines and the calls to m_on_line
+  std::unordered_map<std::thread::id, std::string> m_lines; // Unfinished line of each writing thread
+
+  // functions
+  void put(std::string& line, char c);
+
+ protected:
+  int overflow(int c) override;
+  std::streamsize xsputn(const char* s, std::streamsize count) override;
+  int sync() override;
+
+ public:
+  explicit MessageBuffer(std::function<void(const std::string&)> on_line) : m_on_line(std::move(on_line)) {}
+};
+
+#endif // MERGE_EVENTS_HPP
@@ -0,0 +1,114 @@
+#include "merge_job.hpp"
+
+#include <iostream>
+#include <fstream>
+
+#include "command_line.hpp"
+#include "merge_plan.hpp"
+
+/**
+ * @brief Get the directory a job merges in
+ *
+ * @param job job to look at
+ * 
+ * @return std::filesystem::path absolute directory, taken from the job's plan file if it has one and no directory
+ */
+std::filesystem::path getJobDirectory(const MergeJob& job) {
+  if (job.directory.empty() && !job.plan_file.empty()) {
+    const std::filesystem::path kPlanDirectory = getPlanDirectory(job.plan_file);
+    if (!kPlanDirectory.empty()) {
+      return kPlanDirectory;
+    }
+  }
+
+  std::error_code ec;
+  const std::filesystem::path kDirectory = job.directory.empty() ? std::filesystem::current_path(ec) : std::filesystem::absolute(job.directory, ec);
+  return ec ? job.directory : kDirectory;
+}
+
+/**
+ * @brief Read every job in a job file
+ *
+ * A job file holds one or more jobs, each started by a '[job]' line, with one 'key = value' setting per line.
+ * The keys are the command line flags without their leading '--', e.g. 'folder = 2023' or 'mode = move'.
+ * Lines starting with '#' are ignored, and a relative 'dir', 'dry-run', 'run-plan', 'restore' or 'exclude-file' is relative to the job file.
+ *
+ * @param job_file file to read
+ * @param defaults options every job starts with, before its own settings
+ * @param jobs where to add the jobs that were read
+ * 
+ * @return true if success ; false if the file cannot be read or has an error, no jobs are added then
+ */
+bool loadJobFile(const std::filesystem::path& job_file, const MergeOptions& defaults, std::vector<MergeJob>& jobs) {
+  std::ifstream ifstream(job_file);
+  if (!ifstream.is_open()) {
+    std::cout << "ERROR: Cannot read job file: " << job_file << std::endl;
+    return false;
+  }
+
+  std::vector<MergeJob> file_jobs;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(ifstream, line)) {
+    line_number++;
+
+    // trim whitespace and windows line endings
+    const size_t kStart = line.find_first_not_of(" \t\r");
+    if (kStart == std::string::npos || line[kStart] == '#') {
+      continue;
+    }
+    line = line.substr(kStart, line.find_last_not_of(" \t\r") - kStart + 1);
+
+    if (line == "[job]") {
+      file_jobs.emplace_back();
+      file_jobs.back().options = defaults;
+      continue;
+    }
+
+    const size_t kEquals = line.find('=');
+    if (kEquals == std::string::npos) {
+      std::cout << "ERROR: " << job_file.filename() << " line " << line_number << ": expected 'key = value', got: \"" << line << "\"" << std::endl;
+      return false;
+    }
+
+    std::string key = line.substr(0, kEquals);
+    std::string value = line.substr(kEquals + 1);
+    key.erase(key.find_last_not_of(" \t") + 1);
+    value.erase(0, value.find_first_not_of(" \t"));
+
+    // a file with a single job may leave out the '[job]' line
+    if (file_jobs.empty()) {
+      file_jobs.emplace_back();
+      file_jobs.back().options = defaults;
+    }
+
+    MergeJob& job = file_jobs.back();
+    if (!parseJobOption("--" + key, value, job)) {
+      std::cout << "ERROR: in " << job_file.filename() << " line " << line_number << std::endl;
+      return false;
+    }
+    else if (key == "dir" && job.directory.is_relative()) {
+      job.directory = job_file.parent_path() / job.directory;
+    }
+    else if (key == "run-plan" && job.plan_file.is_relative()) {
+      job.plan_file = job_file.parent_path() / job.plan_file;
+    }
+    else if (key == "restore" && job.restore_manifest.is_relative()) {
+      job.restore_manifest = job_file.parent_path() / job.restore_manifest;
+    }
+    else if (key == "dry-run" && !job.plan_output.empty() && job.plan_output.is_relative()) {
+      job.plan_output = job_file.parent_path() / job.plan_output;
+    }
+    else if (key == "exclude-file" && job.options.exclude_files.back().is_relative()) {
+      job.options.exclude_files.back() = job_file.parent_path() / job.options.exclude_files.back();
+    }
+  }
+
+  if (file_jobs.empty()) {
+    std::cout << "ERROR: " << job_file << " has no jobs." << std::endl;
+    return false;
+  }
+
+  jobs.insert(jobs.end(), file_jobs.begin(), file_jobs.end());
+  return true;
+}
@@ -0,0 +1,29 @@
+#ifndef MERGE_JOB_HPP
+#define MERGE_JOB_HPP
+
+#include <string>
+#include <vector>
+#include <filesystem>
+
+#include "merge_options.hpp"
+
+// Every answer a merge needs, so it can run without any prompts
+struct MergeJob {
+  std::filesystem::path directory; // Directory holding the folders to merge, empty = the current directory
+  std::vector<std::filesystem::path> folders; // Folder names in merge order, empty = every folder, sorted by name
+  std::filesystem::path backup_name = "Backup"; // Backup folder to create, empty = no backup
+  std::filesystem::path archive_name; // Write the merged files into this tar archive instead of a folder, relative to the directory, empty = no archive
+  std::filesystem::path index_name = "Index"; // Index file to create, without '.txt', empty = no index
+  std::vector<std::string> excludes; // Filenames and glob patterns to exclude
+  bool dry_run = false; // Only plan the merge and print the plan, nothing is written
+  std::filesystem::path plan_output; // Save the plan of a dry run here, empty = only print it
+  std::filesystem::path plan_file; // Run this plan saved by a dry run instead of planning again, see MergePlan
+  std::filesystem::path restore_manifest; // Restore the folders of this backup store manifest into the directory instead of merging
+  unsigned int watch_seconds = 0; // Keep running and append every new folder once it has not changed for this long, 0 = merge once
+  MergeOptions options;
+};
+
+std::filesystem::path getJobDirectory(const MergeJob& job);
+bool loadJobFile(const std::filesystem::path& job_file, const MergeOptions& defaults, std::vector<MergeJob>& jobs);
+
+#endif // MERGE_JOB_HPP
@@ -0,0 +1,389 @@
+#include "merge_journal.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <charconv>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/ 
+
+/**
+ * @brief Queue a record, it is written once a batch is full or enough time has passed
+ *
+ * @param record full line to append, including the newline
+ * @param sync_now write and sync every queued record right away
+ * 
+ * @return true if success ; false if this or an earlier write or sync of the journal failed
+ */
+bool MergeJournal::append(const std::string& record, bool sync_now) {
+  bool flush;
+  {
+    std::lock_guard<std::mutex> lock(m_buffer_mutex);
+    m_buffer += record;
+    flush = countRecord() || sync_now;
+  }
+
+  if (flush) {
+    return writeBuffer(true);
+  }
+  return !m_failed;
+}
+
+/**
+ * @brief Queue a record of two paths, escaped straight into the buffer
+ *
+ * A plan of a million files adds two million paths, none of them gets a string of its own on the way.
+ *
+ * @param type type of the record, e.g. "P"
+ * @param source first path of the record
+ * @param destination second path of the record
+ * @param extra_field field added after the paths, e.g. the size of a transfer, empty = none
+ * 
+ * @return true if success ; false if this or an earlier write or sync of the journal failed
+ */
+bool MergeJournal::appendPaths(const char* type, const FilePath& source, const FilePath& destination, const std::string& extra_field) {
+  bool flush;
+  {
+    std::lock_guard<std::mutex> lock(m_buffer_mutex);
+    m_buffer += type;
+    m_buffer += '\t';
+    size_t start = m_buffer.size();
+    source.appendTo(m_buffer);
+    escapeFrom(m_buffer, start);
+    m_buffer += '\t';
+    start = m_buffer.size();
+    destination.appendTo(m_buffer);
+    escapeFrom(m_buffer, start);
+    if (!extra_field.empty()) {
+      m_buffer += '\t';
+      m_buffer += extra_field;
+    }
+    m_buffer += '\n';
+    flush = countRecord();
+  }
+
+  if (flush) {
+    return writeBuffer(true);
+  }
+  return !m_failed;
+}
+
+/**
+ * @brief Count a record that was just queued, m_buffer_mutex has to be held
+ *
+ * @return true if the batch is full or has waited long enough to be written ; false if not
+ */
+bool MergeJournal::countRecord() {
+  m_unsynced++;
+  return m_unsynced >= M_SYNC_BATCH || std::chrono::steady_clock::now() - m_last_sync >= M_SYNC_INTERVAL;
+}
+
+/**
+ * @brief Write every queued record to the journal file
+ *
+ * @param sync also make sure the records reached the disk
+ * 
+ * @return true if success ; false if this or an earlier write or sync failed, the first error is kept in m_error
+ */
+bool MergeJournal::writeBuffer(bool sync) {
+  std::string records;
+  {
+    std::lock_guard<std::mutex> lock(m_buffer_mutex);
+    records.swap(m_buffer);
+    m_unsynced = 0;
+    m_last_sync = std::chrono::steady_clock::now();
+  }
+
+  std::lock_guard<std::mutex> lock(m_file_mutex);
+  if (m_file == nullptr || m_failed) {
+    return !m_failed;
+  }
+
+  errno = 0;
+  bool success = std::fwrite(records.data(), 1, records.size(), m_file) == records.size() && std::fflush(m_file) == 0;
+
+  if (success && sync) {
+#ifdef _WIN32
+    success = _commit(_fileno(m_file)) == 0;
+#else
+    success = fsync(fileno(m_file)) == 0;
+#endif
+  }
+
+  if (!success) {
+    m_error = std::error_code(errno != 0 ? errno : EIO, std::generic_category());
+    m_failed = true;
+  }
+  return success;
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/ 
+
+/**
+ * @brief Create a journal instance, nothing is read or written until asked
+ *
+ * @param path location of the journal file
+ */
+MergeJournal::MergeJournal(std::filesystem::path path)
+  : m_path(std::move(path)), m_last_sync(std::chrono::steady_clock::now()) {
+}
+
+/**
+ * @brief Write anything still queued and close the file
+ */
+MergeJournal::~MergeJournal() {
+  close();
+}
+
+/**
+ * @brief Start a new journal, replacing any old one
+ *
+ * @param transfer_mode whether files are copied or moved
+ * @param ordering_list folders being merged, in order
+ * @param is_append the first folder is an already merged folder that the others are appended to
+ * 
+ * @return true if success ; false if error
+ */
+bool MergeJournal::create(TransferMode transfer_mode, const std::vector<std::filesystem::path>& ordering_list, bool is_append) {
+  close();
+  m_file = std::fopen(m_path.string().c_str(), "wb");
+  if (m_file == nullptr) {
+    return false;
+  }
+  m_failed = false;
+  m_error.clear();
+
+  std::string header = std::string("M\t") + (transfer_mode == TransferMode::Move ? "move" : "copy") + "\n";
+  if (is_append) {
+    header += "A\n";
+  }
+  for (const auto& folder : ordering_list) {
+    header += "F\t" + escape(folder.string()) + "\n";
+  }
+  return append(header, false);
+}
+
+/**
+ * @brief Open an existing journal to add more records to it
+ *
+ * @return true if success ; false if error
+ */
+bool MergeJournal::open() {
+  close();
+  m_file = std::fopen(m_path.string().c_str(), "ab");
+  m_failed = false;
+  m_error.clear();
+  return m_file != nullptr;
+}
+
+/**
+ * @brief Get why the journal could not be written
+ *
+ * @return std::error_code of the first failed write or sync since the journal was created or opened, empty if none failed
+ */
+std::error_code MergeJournal::getError() {
+  std::lock_guard<std::mutex> lock(m_file_mutex);
+  return m_error;
+}
+
+/**
+ * @brief Write and sync anything still queued, then close the file
+ */
+void MergeJournal::close() {
+  if (m_file == nullptr) {
+    return;
+  }
+
+  writeBuffer(true);
+  std::fclose(m_file);
+  m_file = nullptr;
+}
+
+/**
+ * @brief Close and delete the journal, used once a merge is finished or undone
+ */
+void MergeJournal::remove() {
+  {
+    std::lock_guard<std::mutex> lock(m_buffer_mutex);
+    m_buffer.clear();
+  }
+  close();
+
+  std::error_code ec;
+  std::filesystem::remove(m_path, ec);
+}
+
+/**
+ * @brief Read an existing journal, a half written last line is ignored
+ *
+ * @return true if success ; false if the journal cannot be read or has no header
+ */
+bool MergeJournal::load() {
+  std::ifstream ifstream(m_path, std::ios_base::binary);
+  if (!ifstream.is_open()) {
+    return false;
+  }
+
+  std::stringstream contents;
+  contents << ifstream.rdbuf();
+  const std::string kContents = contents.str();
+
+  m_ordering_list.clear();
+  m_paths = std::make_shared<PathTable>();
+  m_tasks.clear();
+  m_done.clear();
+  m_unverified.clear();
+  m_renames.clear();
+  m_append = false;
+  m_plan_complete = false;
+  m_confirming = false;
+  m_renames_staged = false;
+  m_synced_done = false;
+  bool has_header = false;
+
+  size_t line_start = 0;
+  size_t line_end;
+  while ((line_end = kContents.find('\n', line_start)) != std::string::npos) {
+    const std::string kLine = kContents.substr(line_start, line_end - line_start);
+    line_start = line_end + 1;
+
+    std::vector<std::string> fields;
+    size_t field_start = 0;
+    size_t field_end;
+    while ((field_end = kLine.find('\t', field_start)) != std::string::npos) {
+      fields.push_back(kLine.substr(field_start, field_end - field_start));
+      field_start = field_end + 1;
+    }
+    fields.push_back(kLine.substr(field_start));
+
+    if (fields[0] == "M" && fields.size() == 2) {
+      m_transfer_mode = (fields[1] == "move") ? TransferMode::Move : TransferMode::Copy;
+      has_header = true;
+    }
+    else if (fields[0] == "A") {
+      m_append = true;
+    }
+    else if (fields[0] == "Y") {
+      m_synced_done = true;
+    }
+    else if (fields[0] == "F" && fields.size() == 2) {
+      m_ordering_list.push_back(unescape(fields[1]));
+    }
+    else if (fields[0] == "R" && fields.size() == 3) {
+      m_renames.push_back({ m_paths->add(unescape(fields[1])), m_paths->add(unescape(fields[2])), false });
+    }
+    else if ((fields[0] == "P" || fields[0] == "L") && (fields.size() == 3 || fields.size() == 4)) {
+      uint64_t size = 0; // older journals have no size, it stays unknown
+      if (fields.size() == 4) {
+        const char* kEnd = fields[3].data() + fields[3].size();
+        const std::from_chars_result kResult = std::from_chars(fields[3].data(), kEnd, size);
+        if (kResult.ec != std::errc() || kResult.ptr != kEnd) {
+          size = 0;
+        }
+      }
+      m_tasks.push_back({ m_paths->add(unescape(fields[1])), m_paths->add(unescape(fields[2])), fields[0] == "L", size });
+      m_done.push_back(false);
+    }
+    else if (fields[0] == "B") {
+      m_plan_complete = true;
+    }
+    else if (fields[0] == "D" && fields.size() == 2 && !fields[1].empty()
+             && fields[1].find_first_not_of("0123456789") == std::string::npos) {
+      const size_t kTaskIdx = std::stoull(fields[1]);
+      if (kTaskIdx < m_done.size()) {
+        m_done[kTaskIdx] = true;
+      }
+    }
+    else if (fields[0] == "V" && fields.size() == 2 && !fields[1].empty()
+             && fields[1].find_first_not_of("0123456789") == std::string::npos) {
+      const size_t kTaskIdx = std::stoull(fields[1]);
+      if (kTaskIdx < m_tasks.size()) {
+        m_unverified.push_back(kTaskIdx);
+      }
+    }
+    else if (fields[0] == "C") {
+      m_confirming = true;
+    }
+    else if (fields[0] == "T") {
+      m_renames_staged = true;
+    }
+  }
+
+  return has_header;
+}
+
+/**
+ * @brief Escape the characters that would break a journal record
+ *
+ * @param str text to escape
+ * 
+ * @return std::string without tabs or newlines
+ */
+std::string MergeJournal::escape(const std::string& str) {
+  std::string ret;
+  ret.reserve(str.size());
+  for (char c : str) {
+    switch (c) {
+      case '\\': ret += "\\\\"; break;
+      case '\t': ret += "\\t"; break;
+      case '\n': ret += "\\n"; break;
+      case '\r': ret += "\\r"; break;
+      default: ret += c;
+    }
+  }
+
+  return ret;
+}
+
+/**
+ * @brief Escape the end of a string in place, usually there is nothing to escape and nothing is copied
+ *
+ * @param str string to escape the end of
+ * @param start first character to escape
+ */
+void MergeJournal::escapeFrom(std::string& str, size_t start) {
+  if (str.find_first_of("\\\t\n\r", start) == std::string::npos) {
+    return;
+  }
+
+  const std::string kEscaped = escape(str.substr(start));
+  str.resize(start);
+  str += kEscaped;
+}
+
+/**
+ * @brief Undo escape()
+ *
+ * @param str text to unescape
+ * 
+ * @return std::string as it was before escaping
+ */
+std::string MergeJournal::unescape(const std::string& str) {
+  std::string ret;
+  ret.reserve(str.size());
+  for (size_t i = 0; i < str.size(); i++) {
+    if (str[i] != '\\' || i + 1 == str.size()) {
+      ret += str[i];
+      continue;
+    }
+
+    switch (str[++i]) {
+      case 't': ret += '\t'; break;
+      case 'n': ret += '\n'; break;
+      case 'r': ret += '\r'; break;
+      default: ret += str[i];
+    }
+  }
+
+  return ret;
+}
@@ -0,0 +1,115 @@
+#ifndef MERGE_JOURNAL_HPP
+#define MERGE_JOURNAL_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <system_error>
+#include <memory>
+
+#include "merge_options.hpp"
+#include "copy_engine.hpp"
+
+// Append-only record of a merge, used to resume it after a crash
+//
+// Every line is one record, fields are separated by tabs:
+//   M <transfer mode>        header, first line of the file
+//   A                        the first folder is kept as the merged folder, the others are appended to it
+//   Y                        every transfer is synced to the disk before it is marked done
+//   F <folder>               folder in the ordering list, in order
+//   R <old name> <new name>  file of the merged folder renamed to a wider number, or to its number, when the merge is confirmed
+//   P <source> <destination> <size>  planned transfer, numbered by the order they appear in, journals of older
+//                                    versions leave the size out
+//   L <source> <destination> <size>  planned hardlink of a duplicate, numbered along with the transfers
+//   B                        every transfer has been planned, copying has begun
+//   D <task number>          transfer finished
+//   V <task number>          transfer finished, but the copy did not match its source
+//   C                        every transfer finished, source folders are being deleted
+//   T                        every renamed file is under its temporary name, they are getting their new names
+class MergeJournal {
+ private:
+  // consts
+  const size_t M_SYNC_BATCH = 512; // Finished transfers to collect before syncing the journal
+  const std::chrono::milliseconds M_SYNC_INTERVAL = std::chrono::milliseconds(1000); // Longest time a finished transfer stays unsynced
+
+  // vars
+  std::filesystem::path m_path;
+  std::FILE* m_file = nullptr;
+  std::mutex m_buffer_mutex; // Guards m_buffer and the counters below
+  std::mutex m_file_mutex; // Guards writes to m_file
+  std::string m_buffer; // Records not yet written to the file
+  size_t m_unsynced = 0;
+  std::chrono::steady_clock::time_point m_last_sync;
+  std::atomic<bool> m_failed{ false }; // A write or sync failed, every record after it may be missing
+  std::error_code m_error; // Error of the first failed write or sync, guarded by m_file_mutex
+
+  // loaded state
+  TransferMode m_transfer_mode = TransferMode::Copy;
+  std::vector<std::filesystem::path> m_ordering_list;
+  std::shared_ptr<PathTable> m_paths; // Holds the paths of the loaded tasks and renames
+  std::vector<CopyTask> m_tasks;
+  std::vector<bool> m_done;
+  std::vector<size_t> m_unverified;
+  std::vector<CopyTask> m_renames;
+  bool m_append = false;
+  bool m_plan_complete = false;
+  bool m_confirming = false;
+  bool m_renames_staged = false;
+  bool m_synced_done = false;
+
+  // funcs
+  bool append(const std::string& record, bool sync_now);
+  bool appendPaths(const char* type, const FilePath& source, const FilePath& destination, const std::string& extra_field = "");
+  bool countRecord();
+  bool writeBuffer(bool sync);
+
+ public:
+  explicit MergeJournal(std::filesystem::path path);
+  ~MergeJournal();
+
+  MergeJournal(const MergeJournal&) = delete;
+  MergeJournal& operator=(const MergeJournal&) = delete;
+
+  const std::filesystem::path& getPath() const { return m_path; }
+  bool exists() const { return std::filesystem::exists(m_path); }
+
+  // Writing
+  bool create(TransferMode transfer_mode, const std::vector<std::filesystem::path>& ordering_list, bool is_append = false);
+  bool open();
+  // every record returns false once a write or sync of the journal failed, getError() tells why
+  bool addTask(const CopyTask& task) { return appendPaths(task.link ? "L" : "P", task.source, task.destination, std::to_string(task.size)); }
+  bool addRename(const CopyTask& rename) { return appendPaths("R", rename.source, rename.destination); }
+  bool markSyncedDone() { return append("Y\n", false); }
+  bool beginCopying() { return append("B\n", true); }
+  bool markDone(size_t task_idx) { return append("D\t" + std::to_string(task_idx) + "\n", false); }
+  bool markUnverified(size_t task_idx) { return append("V\t" + std::to_string(task_idx) + "\n", false); }
+  bool beginConfirm() { return append("C\n", true); }
+  bool markRenamesStaged() { return append("T\n", true); }
+  std::error_code getError();
+  void close();
+  void remove();
+
+  // Reading
+  bool load();
+  TransferMode getTransferMode() const { return m_transfer_mode; }
+  const std::vector<std::filesystem::path>& getOrderingList() const { return m_ordering_list; }
+  const std::vector<CopyTask>& getTasks() const { return m_tasks; }
+  const std::vector<bool>& getDone() const { return m_done; }
+  const std::vector<size_t>& getUnverified() const { return m_unverified; }
+  const std::vector<CopyTask>& getRenames() const { return m_renames; }
+  bool isAppend() const { return m_append; }
+  bool isPlanComplete() const { return m_plan_complete; }
+  bool isConfirming() const { return m_confirming; }
+  bool areRenamesStaged() const { return m_renames_staged; }
+  bool isDoneSynced() const { return m_synced_done; }
+
+  static std::string escape(const std::string& str);
+  static std::string unescape(const std::string& str);
+  static void escapeFrom(std::string& str, size_t start);
+};
+
+#endif // MERGE_JOURNAL_HPP
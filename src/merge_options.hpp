@@ -0,0 +1,101 @@
+#ifndef MERGE_OPTIONS_HPP
+#define MERGE_OPTIONS_HPP
+
+#include <cstdint>
+#include <vector>
+#include <filesystem>
+
+// How files get from the merged folders into the temp folder
+enum class TransferMode {
+  Copy, // Copy every file, sources are left untouched until the merge is confirmed
+  Move  // Rename every file into the temp folder, copy only when it sits on another device
+};
+
+// How a file's data is copied, see copy_backend.hpp
+enum class CopyBackend {
+  Auto,          // Use the cheapest backend the filesystem supports
+  Reflink,       // Share data blocks with the source (btrfs, XFS)
+  CopyFileRange, // Copy inside the kernel
+  Hardlink,      // Link to the source's data, only safe when the data is never changed afterwards
+  Copy           // Plain copy, always works
+};
+
+// How big files are kept out of the page cache while they are copied, see streamCopy()
+enum class StreamMode {
+  Off,     // Copy big files like every other file
+  Fadvise, // Write every chunk back to disk right away and drop it from the page cache
+  Direct   // Read and write around the page cache with O_DIRECT, Fadvise where the filesystem does not support it
+};
+
+// How a tar archive written instead of the merged folder is compressed, see TarWriter
+enum class ArchiveCompression {
+  Auto, // Pick from the archive's extension: .tar.gz or .tgz, .tar.zst, .tar.xz, anything else is not compressed
+  None,
+  Gzip,
+  Zstd,
+  Xz
+};
+
+// How sure a merge makes that the merged files are on the disk before it deletes the folders they came from
+//
+// Every mode but None also syncs the folders the merged files are in, so their names survive a power cut too.
+enum class DurabilityMode {
+  None,   // Leave writing back to the system, a power cut right after a merge can lose files whose folders are gone
+  Batch,  // Sync every merged file once all are written, each thread syncing a batch of files at a time
+  Syncfs, // Sync the whole filesystem with a single syncfs() call, Batch where there is no syncfs()
+  Strict  // Sync every file as soon as it is written, before the journal counts it as done
+};
+
+// What to do with files that have the same contents as an earlier file
+enum class DedupMode {
+  Off,     // Copy every file
+  Skip,    // Leave duplicates out of the merged folder
+  Hardlink // Number duplicates as usual, but hardlink them to the first copy
+};
+
+// What to do when a folder being merged holds another folder
+enum class NestedFolderPolicy {
+  Ask,  // Ask the user to skip it or quit
+  Skip, // Skip it, it keeps its number but nothing is copied
+  Quit, // Stop the merge
+  Recurse // Merge the files inside it too, in place of the folder, see DirTree
+};
+
+// What to do with the files of a merged folder when the files appended to it need a wider number, e.g. 999 to 1000
+enum class WidthGrowthPolicy {
+  Rename, // Rename every merged file once to the new width, so they keep sorting by name
+  Keep    // Leave them as they are, only programs that sort numbers naturally keep them in order
+};
+
+// How much is written to the console while merging
+enum class Verbosity {
+  Quiet,    // Only errors and prompts
+  Progress, // A progress line that is redrawn a few times a second
+  PerFile   // Every file's old and new name
+};
+
+// Settings for a FolderMerger, everything the interactive prompts do not ask for
+struct MergeOptions {
+  unsigned int thread_count = 0; // Number of copy workers, 0 = use the hardware concurrency
+  TransferMode transfer_mode = TransferMode::Copy;
+  CopyBackend backup_backend = CopyBackend::Auto; // How backups are made
+  unsigned int io_uring_depth = 0; // Files copied at once through io_uring on Linux, 0 = copy on the thread pool
+  StreamMode stream_mode = StreamMode::Off; // How files of at least stream_threshold bytes are copied
+  uint64_t stream_threshold = 64 * 1024 * 1024;
+  bool preallocate = true; // Reserve a streamed file's full size before writing it, unless the source is sparse
+  DedupMode dedup_mode = DedupMode::Off;
+  DurabilityMode durability = DurabilityMode::Syncfs; // Used for the backup and the merged files, see DurabilityMode
+  std::filesystem::path backup_store; // Keep backups in this store, relative to the main directory, empty = a new backup folder every run, see BackupStore
+  bool verify = false; // Check every copy against the bytes read from its source, folders with a bad copy are not deleted
+  bool in_place = false; // Renumber the first folder's files where they are and only transfer the other folders, see FolderMerger::planMerge()
+  uint64_t sort_memory = 0; // Read every folder on its own and sort it on disk past this many bytes of entries, 0 = read all at once
+  std::vector<std::filesystem::path> exclude_files; // Files listing exclude patterns, one per line
+  Verbosity verbosity = Verbosity::PerFile;
+  std::filesystem::path log_file; // Write the per-file log here instead of to the console, empty = no log file
+  NestedFolderPolicy nested_folder_policy = NestedFolderPolicy::Ask;
+  ArchiveCompression archive_compression = ArchiveCompression::Auto; // Used when a job writes an archive, see --archive
+  WidthGrowthPolicy width_growth = WidthGrowthPolicy::Rename; // Used when appending to a merged folder, see --watch
+  std::filesystem::path report_file; // Write a JSON report of every phase's timings here, empty = no report
+};
+
+#endif // MERGE_OPTIONS_HPP
@@ -0,0 +1,390 @@
+#include "merge_plan.hpp"
+
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+
+#include "merge_journal.hpp"
+#include "copy_backend.hpp"
+#include "progress_reporter.hpp"
+#include "job_scheduler.hpp"
+#include "tar_writer.hpp"
+
+// Rough speeds for the time estimate, a real merge is usually within a factor of two of it
+static const double HDD_BYTES_PER_SECOND = 120.0 * 1024 * 1024;
+static const double SSD_BYTES_PER_SECOND = 500.0 * 1024 * 1024;
+static const double HDD_SECONDS_PER_FILE = 0.008; // One seek to open and one to write
+static const double SSD_SECONDS_PER_FILE = 0.0002;
+static const double SECONDS_PER_RENAME = 0.0001; // Moves, hardlinks and deletes only change metadata
+
+static const char* const PLAN_HEADER = "fmerge-plan";
+static const char* const PLAN_VERSION = "1";
+
+/**
+ * @brief Split a plan record into its fields
+ *
+ * @param line record without the newline
+ *
+ * @return std::vector<std::string> fields, still escaped
+ */
+static std::vector<std::string> splitRecord(const std::string& line) {
+  std::vector<std::string> fields;
+  size_t field_start = 0;
+  size_t field_end;
+  while ((field_end = line.find('\t', field_start)) != std::string::npos) {
+    fields.push_back(line.substr(field_start, field_end - field_start));
+    field_start = field_end + 1;
+  }
+  fields.push_back(line.substr(field_start));
+
+  return fields;
+}
+
+/**
+ * @brief Read a number field of a plan record
+ *
+ * @param field field to read
+ * @param number set to the number
+ *
+ * @return true if success ; false if the field is not a number
+ */
+static bool parseNumber(const std::string& field, uint64_t& number) {
+  if (field.empty() || field.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+
+  number = std::stoull(field);
+  return true;
+}
+
+/**
+ * @brief Work out the totals, free space and time of a plan, and list every reason it cannot run
+ *
+ * Only looks at the paths in the plan and the free space of its drive, no folder is read.
+ *
+ * @param plan plan to check, its totals, estimate and problems are replaced
+ * @param thread_count number of files copied at the same time
+ */
+void checkPlan(MergePlan& plan, unsigned int thread_count) {
+  plan.problems.clear();
+  plan.backup_bytes = 0;
+  plan.merge_bytes = 0;
+  for (const auto& task : plan.backup_tasks) {
+    plan.backup_bytes += task.size;
+  }
+
+  size_t link_count = 0;
+  for (const auto& task : plan.tasks) {
+    if (task.link) {
+      link_count++;
+    }
+    else {
+      plan.merge_bytes += task.size;
+    }
+  }
+
+  std::error_code ec;
+  for (const auto& folder : plan.folders) {
+    if (!std::filesystem::is_directory(folder, ec)) {
+      plan.problems.push_back({ MergeErrorCode::InvalidJob, "The folder \"" + folder.string() + "\" does not exist.", folder });
+    }
+  }
+  if (!plan.backup_path.empty() && std::filesystem::exists(plan.backup_path, ec)) {
+    const std::string kWhat = plan.backup_store.empty() ? "The backup folder \"" : "The backup manifest \"";
+    plan.problems.push_back({ MergeErrorCode::BackupFailed, kWhat + plan.backup_path.filename().string() + "\" already exists.", plan.backup_path });
+  }
+  if (!plan.archive_path.empty() && std::filesystem::exists(plan.archive_path, ec)) {
+    plan.problems.push_back({ MergeErrorCode::ArchiveFailed, "The archive \"" + plan.archive_path.filename().string() + "\" already exists.", plan.archive_path });
+  }
+  // appends add to the index, and an archive holds its own
+  if (!plan.append && plan.archive_path.empty() && !plan.index_path.empty() && std::filesystem::exists(plan.index_path, ec)) {
+    plan.problems.push_back({ MergeErrorCode::IndexFailed, "The index file \"" + plan.index_path.filename().string() + "\" already exists.", plan.index_path });
+  }
+
+  // every path of a plan is in plan.paths, which stores each folder once, so equal folders are the same object
+  std::vector<std::pair<const std::filesystem::path*, std::string_view>> destinations;
+  destinations.reserve(plan.tasks.size());
+  for (const auto& task : plan.tasks) {
+    destinations.emplace_back(&task.destination.getFolder(), task.destination.getName());
+  }
+  std::sort(destinations.begin(), destinations.end());
+  const auto kDuplicate = std::adjacent_find(destinations.begin(), destinations.end());
+  if (kDuplicate != destinations.end()) {
+    plan.problems.push_back({ MergeErrorCode::InvalidJob, "Two files would be named \"" + std::string(kDuplicate->second) + "\".",
+                              *kDuplicate->first / std::string(kDuplicate->second) });
+  }
+
+  // reflinks and hardlinks share the data they copy, moves leave it where it is
+  const bool kBackupShares = (plan.backup_backend == CopyBackend::Reflink || plan.backup_backend == CopyBackend::Hardlink);
+  const bool kMove = (plan.transfer_mode == TransferMode::Move);
+  plan.required_bytes = (kBackupShares ? 0 : plan.backup_bytes) + (kMove ? 0 : plan.merge_bytes);
+
+  const std::filesystem::space_info kSpace = std::filesystem::space(plan.directory, ec);
+  plan.available_bytes = ec ? 0 : kSpace.available;
+  if (!ec && plan.required_bytes > plan.available_bytes) {
+    plan.problems.push_back({ MergeErrorCode::NotEnoughSpace, "Not enough free space: the merge needs " + ProgressReporter::formatBytes(plan.required_bytes)
+                              + ", only " + ProgressReporter::formatBytes(plan.available_bytes) + " is free.", plan.directory });
+  }
+
+  // a hard drive only does one thing at a time, anything else copies a file per thread
+  const bool kRotational = JobScheduler::getDevice(plan.directory).rotational;
+  const double kBytesPerSecond = kRotational ? HDD_BYTES_PER_SECOND : SSD_BYTES_PER_SECOND;
+  const double kParallelFiles = kRotational ? 1 : std::max(1u, thread_count);
+  const double kSecondsPerFile = (kRotational ? HDD_SECONDS_PER_FILE : SSD_SECONDS_PER_FILE) / kParallelFiles;
+
+  // copies read and write every byte on the same drive
+  double seconds = 0;
+  seconds += plan.backup_tasks.size() * kSecondsPerFile + (kBackupShares ? 0 : 2 * plan.backup_bytes / kBytesPerSecond);
+  if (kMove) {
+    seconds += plan.tasks.size() * SECONDS_PER_RENAME;
+  }
+  else {
+    seconds += (plan.tasks.size() - link_count) * kSecondsPerFile + 2 * plan.merge_bytes / kBytesPerSecond;
+    seconds += link_count * SECONDS_PER_RENAME;
+    seconds += plan.tasks.size() * SECONDS_PER_RENAME; // deleting the sources once the merge is confirmed
+  }
+  seconds += 2 * plan.renames.size() * SECONDS_PER_RENAME; // every rename goes through a temporary name
+  plan.estimated_seconds = seconds;
+}
+
+/**
+ * @brief Print a summary of a plan, checkPlan() has to be called first
+ *
+ * @param plan plan to print
+ * @param ostream where to print it
+ */
+void printPlan(const MergePlan& plan, std::ostream& ostream) {
+  size_t link_count = 0;
+  for (const auto& task : plan.tasks) {
+    link_count += task.link ? 1 : 0;
+  }
+
+  ostream << "Plan for " << plan.directory << ":\n";
+  if (plan.append) {
+    ostream << "  Append " << (plan.folders.size() - 1) << " folders to " << plan.folders[0].filename() << " from number " << plan.first_number;
+  }
+  else if (plan.in_place) {
+    ostream << "  Renumber " << plan.folders[0].filename() << " in place and append " << (plan.folders.size() - 1) << " folders to it";
+  }
+  else {
+    ostream << "  Merge " << plan.folders.size() << " folders into " << (plan.folders.empty() ? std::filesystem::path() : plan.folders[0].filename());
+  }
+  ostream << ": " << plan.tasks.size() << " files, " << ProgressReporter::formatBytes(plan.merge_bytes) << ", ";
+  if (!plan.archive_path.empty()) {
+    ostream << "written into the archive " << plan.archive_path.filename() << " (" << TarWriter::getCompressionName(plan.archive_compression) << ")";
+  }
+  else {
+    ostream << (plan.transfer_mode == TransferMode::Move ? "moved" : "copied");
+  }
+  if (link_count > 0) {
+    ostream << ", " << link_count << " of them linked duplicates";
+  }
+  ostream << "\n";
+
+  if (plan.in_place) {
+    ostream << "  Rename " << plan.renames.size() << " files of " << plan.folders[0].filename() << " to their numbers\n";
+  }
+  else if (!plan.renames.empty()) {
+    ostream << "  Rename " << plan.renames.size() << " merged files to " << plan.number_width << " digit numbers\n";
+  }
+  if (!plan.backup_path.empty()) {
+    ostream << "  Back up " << plan.backup_tasks.size() << " files, " << ProgressReporter::formatBytes(plan.backup_bytes);
+    if (!plan.backup_store.empty()) {
+      ostream << " at most, into the backup store " << plan.backup_store << " as " << plan.backup_path.filename();
+    }
+    else {
+      ostream << " into " << plan.backup_path.filename();
+    }
+    ostream << " using: " << getBackendName(plan.backup_backend) << "\n";
+  }
+  if (!plan.index_path.empty()) {
+    ostream << (plan.append ? "  Add to the index file " : "  Write the index file ") << plan.index_path.filename()
+            << (plan.archive_path.empty() ? "\n" : " into the archive\n");
+  }
+
+  ostream << "  Needs " << ProgressReporter::formatBytes(plan.required_bytes) << " of free space, "
+          << ProgressReporter::formatBytes(plan.available_bytes) << " is free\n";
+  ostream << "  Takes about " << ProgressReporter::formatDuration(plan.estimated_seconds) << "\n";
+
+  for (const auto& problem : plan.problems) {
+    ostream << "PROBLEM: " << problem.message << "\n";
+  }
+  ostream.flush();
+}
+
+/**
+ * @brief Write the index entries of a plan, the folders' numbers and the names of their first files
+ *
+ * @param plan plan made by planMerge()
+ * @param ostream where to write them, the index file or an archive member
+ */
+void writeIndex(const MergePlan& plan, std::ostream& ostream) {
+  for (size_t i = 0; i < plan.folders.size() && ostream; i++) {
+    if (!plan.index_starts[i].empty()) {
+      ostream << (plan.index_offset + i) << " - " << plan.folders[i].stem() << "\n"
+              << "Starts on the file named: " << plan.index_starts[i]
+              << "\n" << std::endl;
+    }
+  }
+}
+
+/**
+ * @brief Write a plan to a file, so it can be run later without reading the folders again
+ *
+ * @param plan plan to write
+ * @param plan_file file to write, replaced if it exists
+ *
+ * @return true if success ; false if the file could not be written
+ */
+bool savePlan(const MergePlan& plan, const std::filesystem::path& plan_file) {
+  std::ofstream ofstream(plan_file, std::ios_base::binary);
+  if (!ofstream.is_open()) {
+    return false;
+  }
+
+  auto field = [](const std::filesystem::path& path) { return MergeJournal::escape(path.string()); };
+  auto file_field = [](const FilePath& path) { return MergeJournal::escape(path.string()); };
+
+  ofstream << PLAN_HEADER << "\t" << PLAN_VERSION << "\n";
+  ofstream << "D\t" << field(plan.directory) << "\n";
+  ofstream << "M\t" << (plan.transfer_mode == TransferMode::Move ? "move" : "copy") << "\n";
+  if (plan.append) {
+    ofstream << "A\t" << plan.first_number << "\t" << plan.number_width << "\t" << plan.index_offset << "\n";
+  }
+  if (plan.in_place) {
+    ofstream << "N\n";
+  }
+  for (const auto& folder : plan.folders) {
+    ofstream << "F\t" << field(folder) << "\n";
+  }
+  for (const auto& rename : plan.renames) {
+    ofstream << "R\t" << file_field(rename.source) << "\t" << file_field(rename.destination) << "\n";
+  }
+
+  if (!plan.backup_path.empty()) {
+    ofstream << "K\t" << field(plan.backup_path) << "\t" << getBackendName(plan.backup_backend) << "\n";
+    if (!plan.backup_store.empty()) {
+      ofstream << "KS\t" << field(plan.backup_store) << "\n";
+    }
+    for (const auto& folder : plan.backup_folders) {
+      ofstream << "KD\t" << field(folder) << "\n";
+    }
+    for (const auto& task : plan.backup_tasks) {
+      ofstream << "KT\t" << file_field(task.source) << "\t" << file_field(task.destination) << "\t" << task.size << "\n";
+    }
+  }
+
+  if (!plan.archive_path.empty()) {
+    ofstream << "T\t" << field(plan.archive_path) << "\t" << TarWriter::getCompressionName(plan.archive_compression) << "\n";
+  }
+  if (!plan.index_path.empty()) {
+    ofstream << "I\t" << field(plan.index_path) << "\n";
+    for (size_t i = 0; i < plan.index_starts.size(); i++) {
+      if (!plan.index_starts[i].empty()) {
+        ofstream << "IS\t" << i << "\t" << field(plan.index_starts[i]) << "\n";
+      }
+    }
+  }
+
+  for (const auto& task : plan.tasks) {
+    ofstream << (task.link ? "L\t" : "P\t") << file_field(task.source) << "\t" << file_field(task.destination) << "\t" << task.size << "\n";
+  }
+
+  ofstream.close();
+  return !ofstream.fail();
+}
+
+/**
+ * @brief Read a plan written by savePlan()
+ *
+ * @param plan_file file to read
+ * @param plan plan to fill, checkPlan() still has to be called on it
+ *
+ * @return true if success ; false if the file cannot be read or is not a plan
+ */
+bool loadPlan(const std::filesystem::path& plan_file, MergePlan& plan) {
+  std::ifstream ifstream(plan_file, std::ios_base::binary);
+  if (!ifstream.is_open()) {
+    return false;
+  }
+
+  plan = MergePlan();
+  std::string line;
+  if (!std::getline(ifstream, line) || line != std::string(PLAN_HEADER) + "\t" + PLAN_VERSION) {
+    return false;
+  }
+
+  while (std::getline(ifstream, line)) {
+    const std::vector<std::string> kFields = splitRecord(line);
+    const std::string& kType = kFields[0];
+    uint64_t number = 0;
+
+    if (kType == "D" && kFields.size() == 2) {
+      plan.directory = MergeJournal::unescape(kFields[1]);
+    }
+    else if (kType == "M" && kFields.size() == 2) {
+      plan.transfer_mode = (kFields[1] == "move") ? TransferMode::Move : TransferMode::Copy;
+    }
+    else if (kType == "A" && kFields.size() == 4 && parseNumber(kFields[1], plan.first_number) && parseNumber(kFields[2], number)
+             && parseNumber(kFields[3], plan.index_offset)) {
+      plan.append = true;
+      plan.number_width = static_cast<int>(number);
+    }
+    else if (kType == "N" && kFields.size() == 1) {
+      plan.in_place = true;
+    }
+    else if (kType == "F" && kFields.size() == 2) {
+      plan.folders.push_back(MergeJournal::unescape(kFields[1]));
+    }
+    else if (kType == "R" && kFields.size() == 3) {
+      plan.renames.push_back({ plan.paths->add(MergeJournal::unescape(kFields[1])), plan.paths->add(MergeJournal::unescape(kFields[2])), false });
+    }
+    else if (kType == "K" && kFields.size() == 3 && parseBackendName(kFields[2], plan.backup_backend)) {
+      plan.backup_path = MergeJournal::unescape(kFields[1]);
+    }
+    else if (kType == "KS" && kFields.size() == 2) {
+      plan.backup_store = MergeJournal::unescape(kFields[1]);
+    }
+    else if (kType == "KD" && kFields.size() == 2) {
+      plan.backup_folders.push_back(MergeJournal::unescape(kFields[1]));
+    }
+    else if ((kType == "KT" || kType == "P" || kType == "L") && kFields.size() == 4 && parseNumber(kFields[3], number)) {
+      const CopyTask kTask = { plan.paths->add(MergeJournal::unescape(kFields[1])), plan.paths->add(MergeJournal::unescape(kFields[2])), kType == "L", number };
+      (kType == "KT" ? plan.backup_tasks : plan.tasks).push_back(kTask);
+    }
+    else if (kType == "T" && kFields.size() == 3 && TarWriter::parseCompressionName(kFields[2], plan.archive_compression)) {
+      plan.archive_path = MergeJournal::unescape(kFields[1]);
+    }
+    else if (kType == "I" && kFields.size() == 2) {
+      plan.index_path = MergeJournal::unescape(kFields[1]);
+    }
+    else if (kType == "IS" && kFields.size() == 3 && parseNumber(kFields[1], number) && number < plan.folders.size()) {
+      plan.index_starts.resize(plan.folders.size());
+      plan.index_starts[number] = MergeJournal::unescape(kFields[2]);
+    }
+    else if (!line.empty()) {
+      return false;
+    }
+  }
+
+  plan.index_starts.resize(plan.folders.size());
+  return !plan.directory.empty() && !plan.folders.empty();
+}
+
+/**
+ * @brief Read only the directory of a saved plan
+ *
+ * @param plan_file file written by savePlan()
+ *
+ * @return std::filesystem::path directory the plan merges in, empty if the file is not a plan
+ */
+std::filesystem::path getPlanDirectory(const std::filesystem::path& plan_file) {
+  std::ifstream ifstream(plan_file, std::ios_base::binary);
+  std::string line;
+  if (!std::getline(ifstream, line) || line != std::string(PLAN_HEADER) + "\t" + PLAN_VERSION || !std::getline(ifstream, line)) {
+    return "";
+  }
+
+  const std::vector<std::string> kFields = splitRecord(line);
+  return (kFields[0] == "D" && kFields.size() == 2) ? std::filesystem::path(MergeJournal::unescape(kFields[1])) : std::filesystem::path();
+}
@@ -0,0 +1,76 @@
+#ifndef MERGE_PLAN_HPP
+#define MERGE_PLAN_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <filesystem>
+#include <memory>
+
+#include "merge_options.hpp"
+#include "merge_events.hpp"
+#include "copy_engine.hpp"
+
+// Everything a merge will do, worked out before any file is written
+//
+// Saved as one record per line, fields are separated by tabs and escaped like the journal's:
+//   fmerge-plan 1            header, first line of the file
+//   D <directory>            directory holding the folders
+//   M <transfer mode>        copy or move
+//   A <first number> <number width> <index offset>  the first folder is an already merged folder, the others are appended to it
+//   N                        the first folder's files are renumbered where they are, the others are appended to it
+//   F <folder>               folder in the ordering list, in order
+//   R <old name> <new name>  file of the merged folder renamed to a wider number, or to its number when renumbered in place
+//   K <backup folder> <backend>
+//   KS <backup store>        the backup goes into this store, the backup folder is the manifest to write
+//   KD <folder>              folder to create inside the backup
+//   KT <source> <destination> <size>
+//   T <archive> <compression>  the merged files go into this tar archive instead of a folder
+//   I <index file>
+//   IS <folder number> <first file>
+//   P <source> <destination> <size>  planned transfer
+//   L <source> <destination> <size>  planned hardlink of a duplicate
+struct MergePlan {
+  std::filesystem::path directory;
+  TransferMode transfer_mode = TransferMode::Copy;
+  std::vector<std::filesystem::path> folders; // Folders to merge, in order
+  std::filesystem::path backup_path; // Backup folder to create, empty = no backup
+  std::filesystem::path backup_store; // Store the backup goes into, backup_path is then its manifest, see BackupStore
+  CopyBackend backup_backend = CopyBackend::Auto;
+  std::vector<std::filesystem::path> backup_folders; // Every folder to create inside the backup, parents first
+  std::vector<CopyTask> backup_tasks;
+  std::filesystem::path archive_path; // Tar archive to write instead of the merged folder, empty = merge into a folder
+  ArchiveCompression archive_compression = ArchiveCompression::None;
+  std::filesystem::path index_path; // Index file to create, empty = no index. Written into the archive when there is one
+  std::vector<std::filesystem::path> index_starts; // Name of the first file of every folder, empty if it has none
+  std::vector<CopyTask> tasks; // Every transfer into the temp folder, in numbering order
+  std::shared_ptr<PathTable> paths = std::make_shared<PathTable>(); // Holds the paths of every task and rename
+
+  // appending to an already merged folder, see FolderMerger::planAppend()
+  bool append = false; // folders[0] is an already merged folder, its files keep their numbers
+  uint64_t first_number = 1; // Number of the first planned file
+  int number_width = 0; // Digits every number is padded to, planMerge() widens it to fit the last number
+  uint64_t index_offset = 0; // Added to a folder's place in folders to get its number in the index file
+  std::vector<CopyTask> renames; // Files of folders[0] renamed to the wider number width, or to their numbers if in_place
+
+  // renumbering the first folder where it is, see FolderMerger::planMerge()
+  bool in_place = false; // folders[0] becomes the merged folder, its files are renamed and only the others are transferred
+
+  // worked out by checkPlan(), not saved
+  uint64_t backup_bytes = 0;
+  uint64_t merge_bytes = 0;
+  uint64_t required_bytes = 0; // Free space the backup and the temp folder need
+  uint64_t available_bytes = 0;
+  double estimated_seconds = 0;
+  std::vector<MergeError> problems; // Reasons the plan cannot be run as it is
+};
+
+void checkPlan(MergePlan& plan, unsigned int thread_count);
+void printPlan(const MergePlan& plan, std::ostream& ostream);
+void writeIndex(const MergePlan& plan, std::ostream& ostream);
+bool savePlan(const MergePlan& plan, const std::filesystem::path& plan_file);
+bool loadPlan(const std::filesystem::path& plan_file, MergePlan& plan);
+std::filesystem::path getPlanDirectory(const std::filesystem::path& plan_file);
+
+#endif // MERGE_PLAN_HPP
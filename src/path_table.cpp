@@ -0,0 +1,110 @@
+#include "path_table.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+/******************************************************************************
+*********************************** FilePath **********************************
+******************************************************************************/
+
+/**
+ * @brief Store a single path in a table of its own, for paths that do not come in bulk
+ *
+ * @param path full path of the file
+ */
+FilePath::FilePath(const std::filesystem::path& path) {
+  std::shared_ptr<PathTable> table = std::make_shared<PathTable>();
+  *this = table->add(path);
+}
+
+/**
+ * @brief Get the folder the file is in
+ *
+ * @return const std::filesystem::path& folder, empty for an empty FilePath
+ */
+const std::filesystem::path& FilePath::getFolder() const {
+  static const std::filesystem::path kNoFolder;
+  return m_table ? m_table->getFolder(m_folder) : kNoFolder;
+}
+
+/**
+ * @brief Append the full path to a string, without building a std::filesystem::path
+ *
+ * @param str string to append to, in the native format
+ */
+void FilePath::appendTo(std::string& str) const {
+  const std::filesystem::path& kFolder = getFolder();
+  if (!kFolder.empty()) {
+    str += kFolder.string();
+    if (str.back() != static_cast<char>(std::filesystem::path::preferred_separator)) {
+      str += static_cast<char>(std::filesystem::path::preferred_separator);
+    }
+  }
+  str.append(m_name, m_name_length);
+}
+
+/**
+ * @brief Check if two paths are in the same folder
+ *
+ * @param other path to compare with
+ *
+ * @return true if both folders are the same ; false if not, or if they are equal paths kept by different tables
+ */
+bool FilePath::isSameFolder(const FilePath& other) const {
+  return m_table == other.m_table ? m_folder == other.m_folder : getFolder() == other.getFolder();
+}
+
+/******************************************************************************
+*********************************** PathTable *********************************
+******************************************************************************/
+
+/**
+ * @brief Get the number of a folder, adding it the first time it is seen
+ *
+ * @param folder folder to add
+ *
+ * @return uint32_t number of the folder, the same for every path with the same folder
+ */
+uint32_t PathTable::addFolder(const std::filesystem::path& folder) {
+  auto found = m_folder_ids.find(folder.string());
+  if (found != m_folder_ids.end()) {
+    return found->second;
+  }
+
+  const uint32_t kId = static_cast<uint32_t>(m_folders.size());
+  m_folders.push_back(folder);
+  m_folder_ids.emplace(folder.string(), kId);
+  return kId;
+}
+
+/**
+ * @brief Copy a name into the table
+ *
+ * @param name name to add
+ *
+ * @return std::string_view the copy, valid as long as the table
+ */
+std::string_view PathTable::addName(std::string_view name) {
+  if (m_block_used + name.size() > m_block_size) {
+    m_block_size = std::max(M_BLOCK_SIZE, name.size());
+    m_blocks.emplace_back(new char[m_block_size]);
+    m_block_used = 0;
+  }
+
+  char* const kCopy = m_blocks.back().get() + m_block_used;
+  std::memcpy(kCopy, name.data(), name.size());
+  m_block_used += name.size();
+  m_name_bytes += name.size();
+  return std::string_view(kCopy, name.size());
+}
+
+/**
+ * @brief Add a full path, splitting it into its folder and its name
+ *
+ * @param path path to add
+ *
+ * @return FilePath the path, kept by this table
+ */
+FilePath PathTable::add(const std::filesystem::path& path) {
+  return add(addFolder(path.parent_path()), path.filename().string());
+}
@@ -0,0 +1,75 @@
+#ifndef PATH_TABLE_HPP
+#define PATH_TABLE_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <filesystem>
+
+class PathTable;
+
+// Path of a file as a folder and a name kept by a PathTable, turned into a full path only when one is needed
+//
+// Copying one copies a shared_ptr to the table and nothing else, the table lives as long as any of its paths.
+class FilePath {
+ private:
+  // vars
+  std::shared_ptr<const PathTable> m_table;
+  const char* m_name = "";
+  uint32_t m_name_length = 0;
+  uint32_t m_folder = 0;
+
+ public:
+  FilePath() = default;
+  FilePath(std::shared_ptr<const PathTable> table, uint32_t folder, std::string_view name)
+    : m_table(std::move(table)), m_name(name.data()), m_name_length(static_cast<uint32_t>(name.size())), m_folder(folder) {}
+  explicit FilePath(const std::filesystem::path& path);
+
+  bool empty() const { return m_table == nullptr; }
+  const std::filesystem::path& getFolder() const;
+  std::string_view getName() const { return std::string_view(m_name, m_name_length); }
+  std::filesystem::path filename() const { return std::filesystem::path(std::string(getName())); }
+  std::filesystem::path path() const { return getFolder() / filename(); }
+  std::string string() const { std::string str; appendTo(str); return str; }
+  void appendTo(std::string& str) const;
+  bool isSameFolder(const FilePath& other) const;
+};
+
+// Names of many files kept back to back in large blocks, with every folder they are in stored once
+//
+// A merge of millions of files would otherwise keep two std::filesystem::path per file, each with its own string and
+// a list of its components on the heap. Blocks are never moved or freed while the table lives, so names handed out
+// stay valid while more are added. Adding is not thread safe, reading is.
+class PathTable : public std::enable_shared_from_this<PathTable> {
+ private:
+  // consts
+  static constexpr size_t M_BLOCK_SIZE = 256 * 1024; // Bytes of names per block, a longer name gets a block of its own
+
+  // vars
+  std::deque<std::filesystem::path> m_folders;
+  std::unordered_map<std::string, uint32_t> m_folder_ids; // By the folder's native string
+  std::vector<std::unique_ptr<char[]>> m_blocks;
+  size_t m_block_used = 0; // Bytes used in the last block
+  size_t m_block_size = 0;
+  uint64_t m_name_bytes = 0;
+
+ public:
+  PathTable() = default;
+  PathTable(const PathTable&) = delete;
+  PathTable& operator=(const PathTable&) = delete;
+
+  uint32_t addFolder(const std::filesystem::path& folder);
+  std::string_view addName(std::string_view name);
+  FilePath add(uint32_t folder, std::string_view name) { return FilePath(shared_from_this(), folder, addName(name)); }
+  FilePath add(const std::filesystem::path& path);
+
+  const std::filesystem::path& getFolder(uint32_t folder) const { return m_folders[folder]; }
+  size_t getFolderCount() const { return m_folders.size(); }
+  uint64_t getNameBytes() const { return m_name_bytes; }
+};
+
+#endif // PATH_TABLE_HPP
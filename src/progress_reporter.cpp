@@ -0,0 +1,246 @@
+#include "progress_reporter.hpp"
+
+#include <iostream>
+#include <cstdio>
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/ 
+
+/**
+ * @brief Redraw the progress line until the phase ends
+ */
+void ProgressReporter::refreshLoop() {
+  std::unique_lock<std::mutex> lock(m_refresh_mutex);
+  while (!m_refresh_stop.wait_for(lock, M_REFRESH_INTERVAL, [this] { return !m_refreshing; })) {
+    drawProgress(false);
+  }
+}
+
+/**
+ * @brief Draw the progress line over the previous one, or only the final line if the console cannot redraw
+ *
+ * @param final_draw end the line, so later output starts on a new one
+ */
+void ProgressReporter::drawProgress(bool final_draw) {
+  const uint64_t kFilesDone = m_files_done;
+  const uint64_t kBytesDone = m_bytes_done;
+  const double kSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_phase_start).count();
+
+  if (m_on_progress) {
+    MergeProgress progress;
+    progress.phase = m_phase_name;
+    progress.files_done = kFilesDone;
+    progress.total_files = m_total_files;
+    progress.bytes_done = kBytesDone;
+    progress.total_bytes = m_total_bytes;
+    progress.seconds = kSeconds;
+    progress.finished = final_draw;
+    m_on_progress(progress);
+    return;
+  }
+  if (!m_console_redraws && !final_draw) {
+    return;
+  }
+
+  std::string line = (m_console_redraws ? "\r" : "") + m_phase_name + ": " + std::to_string(kFilesDone) + "/" + std::to_string(m_total_files) + " files";
+
+  if (kSeconds > 0) {
+    char rates[64];
+    std::snprintf(rates, sizeof(rates), " | %.0f files/s", kFilesDone / kSeconds);
+    line += rates;
+    line += " | " + formatBytes(static_cast<uint64_t>(kBytesDone / kSeconds)) + "/s";
+  }
+
+  // estimate from bytes when sizes are known, big files take longer than small ones
+  double fraction_done = 0;
+  if (m_total_bytes > 0) {
+    fraction_done = static_cast<double>(kBytesDone) / m_total_bytes;
+  }
+  else if (m_total_files > 0) {
+    fraction_done = static_cast<double>(kFilesDone) / m_total_files;
+  }
+
+  if (final_draw) {
+    line += " | took " + formatDuration(kSeconds);
+  }
+  else if (fraction_done > 0) {
+    line += " | ETA " + formatDuration(kSeconds / fraction_done - kSeconds);
+  }
+
+  if (m_console_redraws) {
+    line += "    "; // cover the end of a longer previous line
+  }
+  if (final_draw) {
+    line += "\n";
+  }
+
+  m_console->write(line.data(), line.size());
+  m_console->flush();
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/ 
+
+/**
+ * @brief Create a reporter
+ *
+ * @param verbosity how much to show on the console
+ * @param log_file write the per-file log here instead of to the console, empty = no log file
+ */
+ProgressReporter::ProgressReporter(Verbosity verbosity, const std::filesystem::path& log_file)
+  : m_verbosity(verbosity), m_console(&std::cout), m_files_done(0), m_bytes_done(0) {
+  if (log_file.empty()) {
+    return;
+  }
+
+  // the buffer has to be set before the file is opened
+  m_log_buffer.resize(M_LOG_BUFFER_SIZE);
+  m_log.rdbuf()->pubsetbuf(m_log_buffer.data(), m_log_buffer.size());
+  m_log.open(log_file, std::ios_base::app); // a log that cannot be opened is reported by the merger, see isLogOpen()
+}
+
+/**
+ * @brief Stop the progress line and write out anything still buffered
+ */
+ProgressReporter::~ProgressReporter() {
+  endPhase();
+  flush();
+}
+
+/**
+ * @brief Add a line to the per-file log, dropped if there is no log to write to
+ *
+ * @param line text to log, a newline is added
+ */
+void ProgressReporter::logLine(const std::string& line) {
+  if (m_log.is_open()) {
+    m_log << line << '\n';
+  }
+  else if (m_verbosity == Verbosity::PerFile) {
+    m_console_buffer += line;
+    m_console_buffer += '\n';
+    if (m_console_buffer.size() >= M_CONSOLE_BUFFER_SIZE) {
+      flush();
+    }
+  }
+}
+
+/**
+ * @brief Log the new name given to a file
+ *
+ * @param old_name name the file had in its folder
+ * @param new_name name the file has in the merged folder
+ */
+void ProgressReporter::logRename(const std::filesystem::path& old_name, const std::filesystem::path& new_name) {
+  if (!isLogging()) {
+    return;
+  }
+
+  // same format as operator<< on a path
+  logLine("Old filename: \"" + old_name.string() + "\"\nNew filename: \"" + new_name.string() + "\"");
+}
+
+/**
+ * @brief Write out everything buffered for the console and the log file
+ */
+void ProgressReporter::flush() {
+  if (!m_console_buffer.empty()) {
+    m_console->write(m_console_buffer.data(), m_console_buffer.size());
+    m_console_buffer.clear();
+  }
+  m_console->flush();
+
+  if (m_log.is_open()) {
+    m_log.flush();
+  }
+}
+
+/**
+ * @brief Start showing a progress line
+ *
+ * @param name what is being done, shown at the start of the line
+ * @param total_files number of files the phase will process
+ * @param total_bytes number of bytes the phase will process, 0 if unknown
+ */
+void ProgressReporter::beginPhase(const std::string& name, uint64_t total_files, uint64_t total_bytes) {
+  endPhase();
+  flush();
+
+  m_phase_name = name;
+  m_total_files = total_files;
+  m_total_bytes = total_bytes;
+  m_files_done = 0;
+  m_bytes_done = 0;
+  m_phase_start = std::chrono::steady_clock::now();
+
+  if (showsProgress()) {
+    m_refreshing = true;
+    m_refresh_thread = std::thread(&ProgressReporter::refreshLoop, this);
+  }
+}
+
+/**
+ * @brief Count a finished file, safe to call from any thread
+ *
+ * @param bytes size of the file
+ */
+void ProgressReporter::fileDone(uint64_t bytes) {
+  m_files_done.fetch_add(1, std::memory_order_relaxed);
+  m_bytes_done.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Stop the progress line and draw it one last time
+ */
+void ProgressReporter::endPhase() {
+  if (!m_refresh_thread.joinable()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_refresh_mutex);
+    m_refreshing = false;
+  }
+  m_refresh_stop.notify_all();
+  m_refresh_thread.join();
+
+  drawProgress(true);
+}
+
+/**
+ * @brief Format a byte count with a readable unit
+ *
+ * @param bytes number of bytes
+ * 
+ * @return std::string such as "512 B" or "1.5 GB"
+ */
+std::string ProgressReporter::formatBytes(uint64_t bytes) {
+  const char* const kUnits[] = { "B", "KB", "MB", "GB", "TB" };
+  double value = static_cast<double>(bytes);
+  int unit = 0;
+  while (value >= 1024 && unit < 4) {
+    value /= 1024;
+    unit++;
+  }
+
+  char text[32];
+  std::snprintf(text, sizeof(text), (unit == 0) ? "%.0f %s" : "%.1f %s", value, kUnits[unit]);
+  return text;
+}
+
+/**
+ * @brief Format a duration as hours, minutes and seconds
+ *
+ * @param seconds duration to format
+ * 
+ * @return std::string such as "0:01:23"
+ */
+std::string ProgressReporter::formatDuration(double seconds) {
+  const long long kTotal = (seconds > 0) ? static_cast<long long>(seconds + 0.5) : 0;
+
+  char text[32];
+  std::snprintf(text, sizeof(text), "%lld:%02lld:%02lld", kTotal / 3600, (kTotal / 60) % 60, kTotal % 60);
+  return text;
+}
@@ -0,0 +1,81 @@
+#ifndef PROGRESS_REPORTER_HPP
+#define PROGRESS_REPORTER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <functional>
+
+#include "merge_options.hpp"
+#include "merge_events.hpp"
+
+// Buffered per-file log and a progress line that is redrawn at a fixed rate
+class ProgressReporter {
+ private:
+  // consts
+  const std::chrono::milliseconds M_REFRESH_INTERVAL = std::chrono::milliseconds(250);
+  const size_t M_CONSOLE_BUFFER_SIZE = 64 * 1024; // Bytes of console output collected before writing
+  const size_t M_LOG_BUFFER_SIZE = 1024 * 1024; // Size of the log file's stream buffer
+
+  // vars
+  Verbosity m_verbosity;
+  std::ostream* m_console; // Where the per-file log and progress line are written
+  bool m_console_redraws = true; // The console can redraw a line with '\r', false = only the final progress line is written
+  std::function<void(const MergeProgress&)> m_on_progress; // Gets the progress instead of the console, if set
+  std::ofstream m_log;
+  std::vector<char> m_log_buffer;
+  std::string m_console_buffer;
+
+  // progress line
+  std::string m_phase_name;
+  uint64_t m_total_files = 0;
+  uint64_t m_total_bytes = 0;
+  std::atomic<uint64_t> m_files_done;
+  std::atomic<uint64_t> m_bytes_done;
+  std::chrono::steady_clock::time_point m_phase_start;
+  std::thread m_refresh_thread;
+  std::mutex m_refresh_mutex;
+  std::condition_variable m_refresh_stop;
+  bool m_refreshing = false;
+
+  // funcs
+  void refreshLoop();
+  void drawProgress(bool final_draw);
+
+ public:
+  ProgressReporter(Verbosity verbosity, const std::filesystem::path& log_file);
+  ~ProgressReporter();
+
+  ProgressReporter(const ProgressReporter&) = delete;
+  ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+  bool isLogOpen() const { return m_log.is_open(); }
+  bool isLogging() const { return m_verbosity == Verbosity::PerFile || m_log.is_open(); }
+  bool showsProgress() const { return m_on_progress || (m_verbosity != Verbosity::Quiet && !(m_verbosity == Verbosity::PerFile && !m_log.is_open())); }
+
+  void setConsole(std::ostream& console, bool redraws = true) { m_console = &console; m_console_redraws = redraws; }
+  void setProgressCallback(std::function<void(const MergeProgress&)> on_progress) { m_on_progress = std::move(on_progress); }
+
+  // Per-file log
+  void logLine(const std::string& line);
+  void logRename(const std::filesystem::path& old_name, const std::filesystem::path& new_name);
+  void flush();
+
+  // Progress line
+  void beginPhase(const std::string& name, uint64_t total_files, uint64_t total_bytes);
+  void fileDone(uint64_t bytes);
+  void endPhase();
+
+  static std::string formatBytes(uint64_t bytes);
+  static std::string formatDuration(double seconds);
+};
+
+#endif // PROGRESS_REPORTER_HPP
@@ -0,0 +1,294 @@
+#include "run_stats.hpp"
+
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+#include "copy_backend.hpp"
+#include "durability.hpp"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+/**
+ * @brief Quote a string for a JSON document
+ */
+static std::string jsonString(const std::string& str) {
+  std::string out = "\"";
+  for (char c : str) {
+    switch (c) {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      case '\r': out += "\\r"; break;
+      default: {
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[8];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out += escaped;
+        }
+        else {
+          out += c;
+        }
+      }
+    }
+  }
+  return out + "\"";
+}
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/ 
+
+/**
+ * @brief Read the process-wide counters the phases are measured with
+ *
+ * Counters that cannot be read on this system stay 0.
+ */
+RunStats::Sample RunStats::takeSample() {
+  Sample sample;
+  sample.time = std::chrono::steady_clock::now();
+  sample.sync_calls = getSyncCallCount();
+
+#ifdef __linux__
+  rusage usage {};
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    sample.cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    sample.major_faults = static_cast<uint64_t>(usage.ru_majflt);
+  }
+
+  std::ifstream io("/proc/self/io");
+  std::string key;
+  uint64_t value;
+  while (io >> key >> value) {
+    if (key == "rchar:")      { sample.bytes_read = value; }
+    else if (key == "wchar:") { sample.bytes_written = value; }
+    else if (key == "syscr:") { sample.read_syscalls = value; }
+    else if (key == "syscw:") { sample.write_syscalls = value; }
+  }
+#endif
+
+  return sample;
+}
+
+/**
+ * @brief Reset the kernel's peak RSS of the process to its current RSS
+ *
+ * @return true if success ; false if the peak cannot be reset on this system
+ */
+bool RunStats::resetPeakRss() {
+#ifdef __linux__
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+  clear_refs.flush();
+  return clear_refs.good();
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Read the peak RSS of the process
+ *
+ * @return uint64_t peak RSS in bytes, 0 if it cannot be read
+ */
+uint64_t RunStats::readPeakRss() {
+#ifdef __linux__
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stoull(line.substr(6)) * 1024;
+    }
+  }
+
+  // ru_maxrss is in kilobytes, and only ever grows
+  rusage usage {};
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+  }
+#endif
+
+  return 0;
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/ 
+
+/**
+ * @brief Constructor
+ *
+ * @param enabled collect measurements, a disabled instance does nothing
+ * @param process_wide other merges run in the same process at the same time. The peak RSS is then never reset,
+ *                     which would take it from them too, and the report marks the counters as the whole process's
+ */
+RunStats::RunStats(bool enabled, bool process_wide) : m_enabled(enabled), m_process_wide(process_wide) {
+  if (!m_enabled) {
+    return;
+  }
+
+  const std::time_t kNow = std::time(nullptr);
+  std::tm utc {};
+#ifdef _WIN32
+  gmtime_s(&utc, &kNow);
+#else
+  gmtime_r(&kNow, &utc);
+#endif
+  char buffer[32];
+  std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &utc);
+  m_start_time = buffer;
+}
+
+/**
+ * @brief Start measuring a phase, ends the previous one if it is still running
+ *
+ * @param name name of the phase in the report
+ */
+void RunStats::beginPhase(const std::string& name) {
+  if (!m_enabled) {
+    return;
+  }
+  else if (m_in_phase) {
+    endPhase();
+  }
+
+  PhaseStats phase;
+  phase.name = name;
+  phase.own_peak_rss = !m_process_wide && resetPeakRss();
+  m_phases.push_back(phase);
+
+  m_phase_start = takeSample();
+  m_in_phase = true;
+}
+
+/**
+ * @brief Count files handled by the current phase
+ *
+ * @param files number of files
+ * @param bytes total size of those files
+ */
+void RunStats::addWork(uint64_t files, uint64_t bytes) {
+  if (!m_in_phase) {
+    return;
+  }
+
+  m_phases.back().files += files;
+  m_phases.back().bytes += bytes;
+}
+
+/**
+ * @brief Stop measuring the current phase
+ */
+void RunStats::endPhase() {
+  if (!m_in_phase) {
+    return;
+  }
+
+  const Sample kEnd = takeSample();
+  PhaseStats& phase = m_phases.back();
+  phase.wall_seconds = std::chrono::duration<double>(kEnd.time - m_phase_start.time).count();
+  phase.cpu_seconds = kEnd.cpu_seconds - m_phase_start.cpu_seconds;
+  phase.read_syscalls = kEnd.read_syscalls - m_phase_start.read_syscalls;
+  phase.write_syscalls = kEnd.write_syscalls - m_phase_start.write_syscalls;
+  phase.bytes_read = kEnd.bytes_read - m_phase_start.bytes_read;
+  phase.bytes_written = kEnd.bytes_written - m_phase_start.bytes_written;
+  phase.major_faults = kEnd.major_faults - m_phase_start.major_faults;
+  phase.sync_calls = kEnd.sync_calls - m_phase_start.sync_calls;
+  phase.peak_rss = readPeakRss();
+  m_in_phase = false;
+}
+
+/**
+ * @brief Write every measured phase to a JSON file
+ *
+ * @param report_file file to write, replaced if it exists
+ * @param main_directory directory that was merged in
+ * @param options options the merge ran with
+ * 
+ * @return true if success ; false if the file could not be written
+ */
+bool RunStats::writeReport(const std::filesystem::path& report_file, const std::filesystem::path& main_directory, const MergeOptions& options) const {
+  std::ofstream ofstream(report_file);
+  if (!ofstream.is_open()) {
+    return false;
+  }
+
+  std::string host = "unknown";
+#ifdef __linux__
+  char host_buffer[256] = {};
+  if (gethostname(host_buffer, sizeof(host_buffer) - 1) == 0) {
+    host = host_buffer;
+  }
+#endif
+
+  const char* const kModeNames[] = { "copy", "move" };
+  const char* const kDedupNames[] = { "off", "skip", "hardlink" };
+
+  PhaseStats total;
+  for (const auto& phase : m_phases) {
+    total.wall_seconds += phase.wall_seconds;
+    total.cpu_seconds += phase.cpu_seconds;
+    total.read_syscalls += phase.read_syscalls;
+    total.write_syscalls += phase.write_syscalls;
+    total.bytes_read += phase.bytes_read;
+    total.bytes_written += phase.bytes_written;
+    total.major_faults += phase.major_faults;
+    total.sync_calls += phase.sync_calls;
+    total.peak_rss = std::max(total.peak_rss, phase.peak_rss);
+  }
+
+  auto write_counters = [&](const PhaseStats& phase, const std::string& indent) {
+    char seconds[96];
+    std::snprintf(seconds, sizeof(seconds), "\"wall_seconds\": %.6f,\n%s\"cpu_seconds\": %.6f,\n", phase.wall_seconds, indent.c_str(), phase.cpu_seconds);
+    ofstream << indent << seconds
+             << indent << "\"read_syscalls\": " << phase.read_syscalls << ",\n"
+             << indent << "\"write_syscalls\": " << phase.write_syscalls << ",\n"
+             << indent << "\"bytes_read\": " << phase.bytes_read << ",\n"
+             << indent << "\"bytes_written\": " << phase.bytes_written << ",\n"
+             << indent << "\"major_faults\": " << phase.major_faults << ",\n"
+             << indent << "\"sync_calls\": " << phase.sync_calls << ",\n"
+             << indent << "\"peak_rss_bytes\": " << phase.peak_rss;
+  };
+
+  ofstream << "{\n"
+           << "  \"version\": 1,\n"
+           << "  \"host\": " << jsonString(host) << ",\n"
+           << "  \"start_time\": " << jsonString(m_start_time) << ",\n"
+           << "  \"main_directory\": " << jsonString(main_directory.string()) << ",\n"
+           << "  \"outcome\": " << jsonString(m_outcome) << ",\n"
+           << "  \"process_wide_counters\": " << (m_process_wide ? "true" : "false") << ",\n"
+           << "  \"options\": {\n"
+           << "    \"threads\": " << options.thread_count << ",\n"
+           << "    \"mode\": " << jsonString(kModeNames[static_cast<int>(options.transfer_mode)]) << ",\n"
+           << "    \"backup_backend\": " << jsonString(getBackendName(options.backup_backend)) << ",\n"
+           << "    \"dedup\": " << jsonString(kDedupNames[static_cast<int>(options.dedup_mode)]) << ",\n"
+           << "    \"durability\": " << jsonString(getDurabilityName(options.durability)) << ",\n"
+           << "    \"sort_memory\": " << options.sort_memory << ",\n"
+           << "    \"in_place\": " << (options.in_place ? "true" : "false") << "\n"
+           << "  },\n"
+           << "  \"phases\": [";
+
+  for (size_t i = 0; i < m_phases.size(); i++) {
+    const PhaseStats& phase = m_phases[i];
+    ofstream << (i == 0 ? "\n" : ",\n")
+             << "    {\n"
+             << "      \"name\": " << jsonString(phase.name) << ",\n"
+             << "      \"files\": " << phase.files << ",\n"
+             << "      \"bytes\": " << phase.bytes << ",\n";
+    write_counters(phase, "      ");
+    ofstream << ",\n      \"own_peak_rss\": " << (phase.own_peak_rss ? "true" : "false") << "\n    }";
+  }
+
+  ofstream << (m_phases.empty() ? "],\n" : "\n  ],\n")
+           << "  \"total\": {\n";
+  write_counters(total, "    ");
+  ofstream << "\n  }\n"
+           << "}\n";
+
+  return ofstream.good();
+}
@@ -0,0 +1,72 @@
+#ifndef RUN_STATS_HPP
+#define RUN_STATS_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+
+#include "merge_options.hpp"
+
+// Resources used by one phase of a merge
+struct PhaseStats {
+  std::string name;
+  double wall_seconds = 0;
+  double cpu_seconds = 0; // User and system time of every thread
+  uint64_t files = 0; // Files the phase worked on
+  uint64_t bytes = 0; // Bytes in those files
+  uint64_t read_syscalls = 0; // read-like syscalls, as counted by the kernel's I/O accounting
+  uint64_t write_syscalls = 0; // write-like syscalls, as counted by the kernel's I/O accounting
+  uint64_t bytes_read = 0; // Bytes passed to read-like syscalls, including ones served from the page cache
+  uint64_t bytes_written = 0; // Bytes passed to write-like syscalls
+  uint64_t major_faults = 0;
+  uint64_t sync_calls = 0; // fsync() and syncfs() calls made to keep the merged files on the disk, see DurabilityMode
+  uint64_t peak_rss = 0; // Largest resident set size in bytes while the phase ran
+  bool own_peak_rss = false; // false if peak_rss could not be reset or other merges share the process, so it is the process's peak so far
+};
+
+// Per-phase measurements of a merge, written out as a JSON report
+class RunStats {
+ private:
+  // Process counters at one point in time
+  struct Sample {
+    std::chrono::steady_clock::time_point time;
+    double cpu_seconds = 0;
+    uint64_t read_syscalls = 0;
+    uint64_t write_syscalls = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t major_faults = 0;
+    uint64_t sync_calls = 0;
+  };
+
+  // vars
+  bool m_enabled;
+  bool m_process_wide; // Other merges run in the same process, so the process counters include their work too
+  std::string m_start_time; // UTC, ISO 8601
+  std::string m_outcome = "unfinished";
+  std::vector<PhaseStats> m_phases;
+  Sample m_phase_start;
+  bool m_in_phase = false;
+
+  // funcs
+  static Sample takeSample();
+  static bool resetPeakRss();
+  static uint64_t readPeakRss();
+
+ public:
+  explicit RunStats(bool enabled, bool process_wide = false);
+
+  bool isEnabled() const { return m_enabled; }
+  const std::vector<PhaseStats>& getPhases() const { return m_phases; }
+
+  void beginPhase(const std::string& name);
+  void addWork(uint64_t files, uint64_t bytes);
+  void endPhase();
+  void setOutcome(const std::string& outcome) { m_outcome = outcome; }
+
+  bool writeReport(const std::filesystem::path& report_file, const std::filesystem::path& main_directory, const MergeOptions& options) const;
+};
+
+#endif // RUN_STATS_HPP
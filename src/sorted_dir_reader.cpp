@@ -0,0 +1,302 @@
+#include "sorted_dir_reader.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+  const std::string kSpillPrefix = "_____[MergeSortRun]_____";
+  const size_t kWriteBlockSize = 256 * 1024; // Bytes of records gathered before they are written to the spill file
+
+  std::atomic<unsigned int> g_spill_files(0); // Spill files made by this process, keeps their names apart
+
+  bool seekTo(std::FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+  }
+}
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/
+
+/**
+ * @brief Create the spill file, on POSIX it is unlinked right away so it cannot be left behind
+ *
+ * @param ec set to the error if it cannot be created
+ *
+ * @return true if success ; false if error
+ */
+bool SortedDirReader::openSpillFile(std::error_code& ec) {
+  for (int attempt = 0; attempt < 100 && m_spill_file == nullptr; attempt++) {
+    m_spill_path = m_spill_folder / (kSpillPrefix + std::to_string(g_spill_files++) + ".tmp");
+#ifdef _WIN32
+    m_spill_file = _wfopen(m_spill_path.c_str(), L"w+bx");
+#else
+    m_spill_file = std::fopen(m_spill_path.c_str(), "w+bx");
+#endif
+    if (m_spill_file == nullptr && errno != EEXIST) {
+      break;
+    }
+  }
+
+  if (m_spill_file == nullptr) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+#ifndef _WIN32
+  std::error_code remove_ec;
+  std::filesystem::remove(m_spill_path, remove_ec);
+  m_spill_path.clear();
+#endif
+  return true;
+}
+
+/**
+ * @brief Sort the entries in memory and append them to the spill file as one run
+ *
+ * @param ec set to the error if the run cannot be written
+ *
+ * @return true if success ; false if error
+ */
+bool SortedDirReader::spillRun(std::error_code& ec) {
+  if (m_spill_file == nullptr && !openSpillFile(ec)) {
+    return false;
+  }
+  if (!seekTo(m_spill_file, m_spill_end)) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+
+  m_chunk.sortByName();
+  RunCursor run;
+  run.offset = m_spill_end;
+
+  std::string block;
+  block.reserve(kWriteBlockSize + M_RECORD_HEADER_SIZE + UINT16_MAX);
+  for (size_t i = 0; i < m_chunk.size(); i++) {
+    const std::string_view kName = m_chunk.getName(i);
+    const uint16_t kLength = static_cast<uint16_t>(kName.size());
+    char header[M_RECORD_HEADER_SIZE];
+    header[0] = static_cast<char>(m_chunk[i].type);
+    std::memcpy(header + 1, &m_chunk[i].size, sizeof(uint64_t));
+    std::memcpy(header + 9, &kLength, sizeof(uint16_t));
+    block.append(header, sizeof(header));
+    block.append(kName);
+
+    if (block.size() >= kWriteBlockSize || i + 1 == m_chunk.size()) {
+      if (std::fwrite(block.data(), 1, block.size(), m_spill_file) != block.size()) {
+        ec.assign(errno, std::generic_category());
+        return false;
+      }
+      m_spill_end += block.size();
+      block.clear();
+    }
+  }
+
+  run.end = m_spill_end;
+  m_runs.push_back(std::move(run));
+  m_chunk.clear();
+  return true;
+}
+
+/**
+ * @brief Move a run to its next entry, reading more of it from the spill file when its buffer runs out
+ *
+ * @param run run to move
+ * @param ec set to the error if the spill file cannot be read
+ *
+ * @return true if the run has another entry ; false once it is used up or on error
+ */
+bool SortedDirReader::advance(RunCursor& run, std::error_code& ec) {
+  // make sure the buffer holds the next needed bytes, keeping the ones not used yet
+  auto fill = [&](size_t needed) {
+    if (run.filled - run.pos >= needed) {
+      return true;
+    }
+
+    std::memmove(run.buffer.data(), run.buffer.data() + run.pos, run.filled - run.pos);
+    run.filled -= run.pos;
+    run.pos = 0;
+    if (run.buffer.size() < needed) {
+      run.buffer.resize(needed);
+    }
+
+    const size_t kToRead = static_cast<size_t>(std::min<uint64_t>(run.buffer.size() - run.filled, run.end - run.offset));
+    if (kToRead > 0) {
+      if (!seekTo(m_spill_file, run.offset) || std::fread(run.buffer.data() + run.filled, 1, kToRead, m_spill_file) != kToRead) {
+        ec = std::make_error_code(std::errc::io_error);
+        return false;
+      }
+      run.offset += kToRead;
+      run.filled += kToRead;
+    }
+    return run.filled >= needed;
+  };
+
+  if (run.pos == run.filled && run.offset == run.end) {
+    return false;
+  }
+  if (!fill(M_RECORD_HEADER_SIZE)) {
+    ec = std::make_error_code(std::errc::io_error);
+    return false;
+  }
+
+  uint16_t length;
+  run.type = static_cast<EntryType>(run.buffer[run.pos]);
+  std::memcpy(&run.size, run.buffer.data() + run.pos + 1, sizeof(uint64_t));
+  std::memcpy(&length, run.buffer.data() + run.pos + 9, sizeof(uint16_t));
+  if (!fill(M_RECORD_HEADER_SIZE + length)) {
+    ec = std::make_error_code(std::errc::io_error);
+    return false;
+  }
+
+  run.name = std::string_view(run.buffer.data() + run.pos + M_RECORD_HEADER_SIZE, length);
+  run.pos += M_RECORD_HEADER_SIZE + length;
+  return true;
+}
+
+/**
+ * @brief Heap order of the runs being merged
+ *
+ * @param a first run
+ * @param b second run
+ *
+ * @return true if the current name of run a comes after the one of run b
+ */
+bool SortedDirReader::isRunAfter(size_t a, size_t b) const {
+  return DirSnapshot::isNaturallyBefore(m_runs[b].name, m_runs[a].name);
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/
+
+/**
+ * @brief Set up a reader, nothing is read until read() is called
+ *
+ * @param directory folder to read
+ * @param spill_folder folder the spill file is made in, best on a disk rather than in memory
+ * @param memory_budget about how many bytes of entries are kept in memory, at least 64 KB
+ */
+SortedDirReader::SortedDirReader(const std::filesystem::path& directory, const std::filesystem::path& spill_folder, uint64_t memory_budget)
+  : m_directory(directory), m_spill_folder(spill_folder), m_memory_budget(std::max(memory_budget, M_MIN_MEMORY_BUDGET)),
+    m_chunk(directory) {}
+
+/**
+ * @brief Close the spill file, and delete it where it could not be deleted while open
+ */
+SortedDirReader::~SortedDirReader() {
+  if (m_spill_file != nullptr) {
+    std::fclose(m_spill_file);
+#ifdef _WIN32
+    std::error_code remove_ec;
+    std::filesystem::remove(m_spill_path, remove_ec);
+#endif
+  }
+}
+
+/**
+ * @brief Read every entry of the folder, spilling a sorted run each time the entries in memory reach the budget
+ *
+ * @param read_sizes also read the size of every file, costs one stat per file
+ * @param keep called with every entry, return false to leave it out
+ * @param ec set if the folder cannot be read or a run cannot be spilled
+ *
+ * @return true if success ; false if error
+ */
+bool SortedDirReader::read(bool read_sizes, const std::function<bool(const DirEntry&)>& keep, std::error_code& ec) {
+  DirReader reader(m_directory, read_sizes, ec);
+  DirEntry entry;
+  while (reader.next(entry, ec)) {
+    if (!keep(entry)) {
+      continue;
+    }
+
+    m_chunk.addEntry(entry.name, entry.type, entry.size);
+    m_entry_count++;
+    if (m_chunk.getMemoryUsage() >= m_memory_budget && !spillRun(ec)) {
+      return false;
+    }
+  }
+  if (ec) {
+    return false;
+  }
+
+  // once anything is spilled every entry has to be, the runs are merged from the file
+  if (!m_runs.empty()) {
+    return spill(ec);
+  }
+
+  m_chunk.sortByName();
+  return true;
+}
+
+/**
+ * @brief Write the entries still in memory to the spill file and free their memory, for a caller holding many readers
+ *
+ * @param ec set if the entries cannot be spilled
+ *
+ * @return true if success ; false if error
+ */
+bool SortedDirReader::spill(std::error_code& ec) {
+  if (m_chunk.size() > 0 && !spillRun(ec)) {
+    return false;
+  }
+  m_chunk = DirSnapshot(m_directory); // clear() would keep the capacity
+
+  m_heap.clear();
+  for (size_t i = 0; i < m_runs.size(); i++) {
+    m_runs[i].buffer.resize(M_RUN_BUFFER_SIZE);
+    if (advance(m_runs[i], ec)) {
+      m_heap.push_back(i);
+    }
+    else if (ec) {
+      return false;
+    }
+  }
+  std::make_heap(m_heap.begin(), m_heap.end(), [this](size_t a, size_t b) { return isRunAfter(a, b); });
+  return true;
+}
+
+/**
+ * @brief Get the next entries in name order, about the memory budget at a time
+ *
+ * @param ec set if the spill file cannot be read
+ *
+ * @return the entries, valid until the next call ; nullptr once every entry was handed out or on error
+ */
+const DirSnapshot* SortedDirReader::nextChunk(std::error_code& ec) {
+  ec.clear();
+  if (m_runs.empty()) { // everything fit in memory, it is already sorted
+    if (m_chunk_handed_out || m_chunk.size() == 0) {
+      return nullptr;
+    }
+    m_chunk_handed_out = true;
+    return &m_chunk;
+  }
+
+  const auto kIsRunAfter = [this](size_t a, size_t b) { return isRunAfter(a, b); };
+  m_chunk.clear();
+  while (!m_heap.empty() && m_chunk.getMemoryUsage() < m_memory_budget) {
+    std::pop_heap(m_heap.begin(), m_heap.end(), kIsRunAfter);
+    RunCursor& run = m_runs[m_heap.back()];
+    m_chunk.addEntry(run.name, run.type, run.size);
+
+    if (advance(run, ec)) {
+      std::push_heap(m_heap.begin(), m_heap.end(), kIsRunAfter);
+    }
+    else if (ec) {
+      return nullptr;
+    }
+    else {
+      m_heap.pop_back();
+    }
+  }
+
+  return m_chunk.size() > 0 ? &m_chunk : nullptr;
+}
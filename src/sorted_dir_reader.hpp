@@ -0,0 +1,77 @@
+#ifndef SORTED_DIR_READER_HPP
+#define SORTED_DIR_READER_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <filesystem>
+#include <system_error>
+
+#include "dir_reader.hpp"
+#include "dir_snapshot.hpp"
+
+// The entries of one folder in natural name order, sorted within a memory budget
+//
+// Entries are collected in a DirSnapshot until it holds about the budget, then it is sorted and written to a spill
+// file as one run. Once the folder is read the runs are merged back in name order, a chunk of entries at a time, so a
+// folder of any size is sorted in about the budget plus a small read buffer per run. A folder that fits in the budget
+// is never written out.
+class SortedDirReader {
+ private:
+  // One sorted run in the spill file, and the entry it is at while merging
+  struct RunCursor {
+    uint64_t offset; // Next byte of the run still in the file
+    uint64_t end;
+    std::vector<char> buffer;
+    size_t pos = 0;
+    size_t filled = 0;
+    std::string_view name; // Current entry, points into buffer
+    EntryType type = EntryType::Other;
+    uint64_t size = 0;
+  };
+
+  // consts
+  static constexpr uint64_t M_MIN_MEMORY_BUDGET = 64 * 1024;
+  static constexpr size_t M_RUN_BUFFER_SIZE = 16 * 1024; // Bytes of a run read back at once while merging
+  static constexpr size_t M_RECORD_HEADER_SIZE = 11; // Type, size and name length in front of every spilled name
+
+  // vars
+  std::filesystem::path m_directory;
+  std::filesystem::path m_spill_folder;
+  std::filesystem::path m_spill_path; // Only kept where the file cannot be deleted while it is open
+  uint64_t m_memory_budget;
+  std::FILE* m_spill_file = nullptr;
+  uint64_t m_spill_end = 0;
+  std::vector<RunCursor> m_runs;
+  std::vector<size_t> m_heap; // Runs that still have entries, the one with the first name on top
+  DirSnapshot m_chunk; // Entries not spilled yet while reading, the current chunk while merging
+  size_t m_entry_count = 0;
+  bool m_chunk_handed_out = false;
+
+  // funcs
+  bool openSpillFile(std::error_code& ec);
+  bool spillRun(std::error_code& ec);
+  bool advance(RunCursor& run, std::error_code& ec);
+  bool isRunAfter(size_t a, size_t b) const;
+
+ public:
+  SortedDirReader(const std::filesystem::path& directory, const std::filesystem::path& spill_folder, uint64_t memory_budget);
+  ~SortedDirReader();
+
+  SortedDirReader(const SortedDirReader&) = delete;
+  SortedDirReader& operator=(const SortedDirReader&) = delete;
+
+  const std::filesystem::path& getDirectory() const { return m_directory; }
+  size_t size() const { return m_entry_count; }
+  size_t getRunCount() const { return m_runs.size(); }
+  size_t getMemoryUsage() const { return m_chunk.getMemoryUsage(); }
+
+  bool read(bool read_sizes, const std::function<bool(const DirEntry&)>& keep, std::error_code& ec);
+  bool spill(std::error_code& ec);
+  const DirSnapshot* nextChunk(std::error_code& ec);
+};
+
+#endif // SORTED_DIR_READER_HPP
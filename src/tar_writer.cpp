@@ -0,0 +1,579 @@
+#include "tar_writer.hpp"
+
+#include <cstring>
+#include <ctime>
+#include <cctype>
+#include <algorithm>
+#include <cerrno>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+// Largest size the 12 byte octal size field holds, bigger files get a pax size record
+static const uint64_t MAX_USTAR_SIZE = 077777777777ULL;
+
+#ifdef __linux__
+// Blocks SIGPIPE on the calling thread while it writes into the compressor, so a compressor that dies shows up as a
+// failed write instead of killing the program. A SIGPIPE raised meanwhile is taken off the thread before the old mask
+// comes back, and nothing is changed for the rest of the process
+class PipeSignalBlock {
+ private:
+  bool m_active;
+  sigset_t m_pipe_signal;
+  sigset_t m_old_mask;
+  bool m_was_pending = false; // A SIGPIPE was already waiting, it is left for the thread to get
+
+ public:
+  explicit PipeSignalBlock(bool active) : m_active(active) {
+    if (!m_active) {
+      return;
+    }
+    sigemptyset(&m_pipe_signal);
+    sigaddset(&m_pipe_signal, SIGPIPE);
+    sigset_t pending;
+    sigpending(&pending);
+    m_was_pending = sigismember(&pending, SIGPIPE) == 1;
+    pthread_sigmask(SIG_BLOCK, &m_pipe_signal, &m_old_mask);
+  }
+
+  ~PipeSignalBlock() {
+    if (!m_active) {
+      return;
+    }
+    const int kErrno = errno;
+    sigset_t pending;
+    sigpending(&pending);
+    if (!m_was_pending && sigismember(&pending, SIGPIPE) == 1) {
+      const timespec kNoWait = { 0, 0 };
+      while (sigtimedwait(&m_pipe_signal, nullptr, &kNoWait) < 0 && errno == EINTR) {}
+    }
+    pthread_sigmask(SIG_SETMASK, &m_old_mask, nullptr);
+    errno = kErrno;
+  }
+
+  PipeSignalBlock(const PipeSignalBlock&) = delete;
+  PipeSignalBlock& operator=(const PipeSignalBlock&) = delete;
+};
+#endif
+
+// One ustar header block
+struct TarHeader {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char checksum[8];
+  char type;
+  char link_name[100];
+  char magic[6];
+  char version[2];
+  char user_name[32];
+  char group_name[32];
+  char dev_major[8];
+  char dev_minor[8];
+  char prefix[155];
+  char padding[12];
+};
+static_assert(sizeof(TarHeader) == 512, "a tar header is one block");
+
+/**
+ * @brief Write a number into a header field as zero padded octal, ending in a NUL
+ *
+ * @param field field to fill
+ * @param width size of the field, including the NUL
+ * @param value number to write, has to fit
+ */
+static void putOctal(char* field, size_t width, uint64_t value) {
+  field[width - 1] = '\0';
+  for (size_t i = width - 1; i > 0; i--) {
+    field[i - 1] = static_cast<char>('0' + (value & 7));
+    value >>= 3;
+  }
+}
+
+/**
+ * @brief Store a name in the name and prefix fields, split at a '/' when it is longer than the name field
+ *
+ * @param name entry name
+ * @param header header to fill
+ *
+ * @return true if it fits ; false if it needs a pax path record
+ */
+static bool putName(const std::string& name, TarHeader& header) {
+  if (name.size() <= sizeof(header.name)) {
+    std::memcpy(header.name, name.data(), name.size());
+    return true;
+  }
+
+  for (size_t slash = name.find('/'); slash != std::string::npos && slash <= sizeof(header.prefix); slash = name.find('/', slash + 1)) {
+    const size_t kRest = name.size() - slash - 1;
+    if (kRest > 0 && kRest <= sizeof(header.name)) {
+      std::memcpy(header.prefix, name.data(), slash);
+      std::memcpy(header.name, name.data() + slash + 1, kRest);
+      return true;
+    }
+  }
+
+  std::memcpy(header.name, name.data(), sizeof(header.name));
+  return false;
+}
+
+/**
+ * @brief Make one pax extended header record, "<length> <key>=<value>\n" where the length counts itself
+ *
+ * @param key record key, e.g. "path"
+ * @param value record value
+ *
+ * @return std::string the record
+ */
+static std::string getPaxRecord(const std::string& key, const std::string& value) {
+  const size_t kBody = 1 + key.size() + 1 + value.size() + 1;
+  size_t length = kBody;
+  while (length != kBody + std::to_string(length).size()) {
+    length = kBody + std::to_string(length).size();
+  }
+
+  return std::to_string(length) + " " + key + "=" + value + "\n";
+}
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/
+
+/**
+ * @brief Write bytes to the archive
+ *
+ * @param data bytes to write
+ * @param size number of bytes
+ * @param ec set if the archive cannot be written
+ *
+ * @return true if success ; false if error
+ */
+bool TarWriter::write(const void* data, size_t size, std::error_code& ec) {
+  if (m_file == nullptr) {
+    ec = std::make_error_code(std::errc::bad_file_descriptor);
+    return false;
+  }
+
+  bool written = false;
+  {
+#ifdef __linux__
+    const PipeSignalBlock kPipeBlock(m_compressor_pid >= 0);
+#endif
+    written = std::fwrite(data, 1, size, m_file) == size;
+  }
+  if (!written) {
+    ec.assign(errno != 0 ? errno : EIO, std::generic_category());
+#ifdef __linux__
+    // the compressor stopped reading, its exit status tells why
+    if (m_compressor_pid >= 0) {
+      closeArchive(ec);
+    }
+#endif
+    return false;
+  }
+
+  m_bytes_written += size;
+  return true;
+}
+
+/**
+ * @brief Fill the rest of the last block of an entry's data with zeros
+ *
+ * @param size size of the entry's data
+ * @param ec set if the archive cannot be written
+ *
+ * @return true if success ; false if error
+ */
+bool TarWriter::pad(uint64_t size, std::error_code& ec) {
+  static const char kZeros[M_BLOCK_SIZE] = {};
+  const size_t kRemainder = static_cast<size_t>(size % M_BLOCK_SIZE);
+  return kRemainder == 0 || write(kZeros, M_BLOCK_SIZE - kRemainder, ec);
+}
+
+/**
+ * @brief Write the header of an entry, after a pax header if the entry does not fit a ustar header
+ *
+ * @param name entry name, '/' separated
+ * @param type ustar type flag, e.g. '0' for a file
+ * @param size size of the data that follows
+ * @param mode permission bits
+ * @param mtime modification time in seconds since the epoch
+ * @param link_name target of a hardlink, empty for anything else
+ * @param ec set if the archive cannot be written
+ *
+ * @return true if success ; false if error
+ */
+bool TarWriter::writeHeader(const std::string& name, char type, uint64_t size, uint32_t mode, int64_t mtime, const std::string& link_name, std::error_code& ec) {
+  TarHeader header = {};
+  std::string pax;
+  if (!putName(name, header)) {
+    pax += getPaxRecord("path", name);
+  }
+  std::memcpy(header.link_name, link_name.data(), std::min(link_name.size(), sizeof(header.link_name)));
+  if (link_name.size() > sizeof(header.link_name)) {
+    pax += getPaxRecord("linkpath", link_name);
+  }
+  if (size > MAX_USTAR_SIZE) {
+    pax += getPaxRecord("size", std::to_string(size));
+  }
+
+  if (!pax.empty()) {
+    const std::string kBaseName = name.substr(name.find_last_of('/', name.size() - 2) + 1);
+    if (!writeHeader("PaxHeaders/" + kBaseName.substr(0, 80), 'x', pax.size(), 0644, mtime, "", ec)
+        || !write(pax.data(), pax.size(), ec) || !pad(pax.size(), ec)) {
+      return false;
+    }
+  }
+
+  putOctal(header.mode, sizeof(header.mode), mode & 07777);
+  putOctal(header.uid, sizeof(header.uid), 0);
+  putOctal(header.gid, sizeof(header.gid), 0);
+  putOctal(header.size, sizeof(header.size), size > MAX_USTAR_SIZE ? 0 : size);
+  putOctal(header.mtime, sizeof(header.mtime), static_cast<uint64_t>(std::max<int64_t>(mtime, 0)));
+  header.type = type;
+  std::memcpy(header.magic, "ustar", 6);
+  std::memcpy(header.version, "00", 2);
+
+  // the checksum is taken with its own field filled with spaces
+  std::memset(header.checksum, ' ', sizeof(header.checksum));
+  uint32_t checksum = 0;
+  for (size_t i = 0; i < sizeof(header); i++) {
+    checksum += reinterpret_cast<const unsigned char*>(&header)[i];
+  }
+  putOctal(header.checksum, 7, checksum);
+
+  return write(&header, sizeof(header), ec);
+}
+
+/**
+ * @brief Flush and close the archive, wait for the compressor and sync the archive to disk if asked to in open()
+ *
+ * @param ec set if anything was not written, or the compressor failed
+ *
+ * @return true if success ; false if error
+ */
+bool TarWriter::closeArchive(std::error_code& ec) {
+  if (m_file != nullptr) {
+    {
+#ifdef __linux__
+      const PipeSignalBlock kPipeBlock(m_compressor_pid >= 0);
+#endif
+      if (std::fflush(m_file) != 0 && !ec) {
+        ec.assign(errno, std::generic_category());
+      }
+    }
+#ifdef __linux__
+    if (m_sync && m_compressor_pid < 0 && fsync(fileno(m_file)) != 0 && !ec) {
+      ec.assign(errno, std::generic_category());
+    }
+#endif
+    if (std::fclose(m_file) != 0 && !ec) {
+      ec.assign(errno, std::generic_category());
+    }
+    m_file = nullptr;
+  }
+
+#ifdef __linux__
+  // the compressor sees the end of its input once the pipe is closed
+  if (m_compressor_pid >= 0) {
+    int status = 0;
+    while (waitpid(m_compressor_pid, &status, 0) < 0 && errno == EINTR) {}
+    m_compressor_pid = -1;
+
+    // a failed compressor is also why writing into it failed
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      const bool kNotFound = WIFEXITED(status) && WEXITSTATUS(status) == 127;
+      ec = std::make_error_code(kNotFound ? std::errc::no_such_file_or_directory : std::errc::io_error);
+    }
+    else if (m_sync && fsync(m_archive_fd) != 0 && !ec) {
+      ec.assign(errno, std::generic_category());
+    }
+  }
+  if (m_archive_fd >= 0) {
+    close(m_archive_fd);
+    m_archive_fd = -1;
+  }
+#endif
+
+  return !ec;
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/
+
+/**
+ * @brief Close an archive that was not finished, it is left without its end blocks
+ */
+TarWriter::~TarWriter() {
+  std::error_code ec;
+  closeArchive(ec);
+}
+
+/**
+ * @brief Create the archive, replacing any file at its path
+ *
+ * @param archive file to write
+ * @param compression how to compress it, Auto picks from the extension
+ * @param sync sync the archive to disk once it is finished, see DurabilityMode
+ * @param ec set if the archive cannot be created or the compressor cannot be started
+ *
+ * @return true if success ; false if error
+ */
+bool TarWriter::open(const std::filesystem::path& archive, ArchiveCompression compression, bool sync, std::error_code& ec) {
+  ec.clear();
+  m_bytes_written = 0;
+  m_sync = sync;
+  if (compression == ArchiveCompression::Auto) {
+    compression = getCompression(archive);
+  }
+
+  if (compression == ArchiveCompression::None) {
+    m_file = std::fopen(archive.string().c_str(), "wb");
+    if (m_file == nullptr) {
+      ec.assign(errno, std::generic_category());
+      return false;
+    }
+  }
+  else {
+#ifdef __linux__
+    // both ends are close-on-exec, so a compressor started by another job never holds this pipe open
+    int pipe_fds[2];
+    m_archive_fd = ::open(archive.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_archive_fd < 0 || pipe2(pipe_fds, O_CLOEXEC) != 0) {
+      ec.assign(errno, std::generic_category());
+      return false;
+    }
+
+    // posix_spawnp instead of fork(), which would copy the whole process while the thread pool is running. The
+    // compressor gets the default SIGPIPE handling and an empty signal mask, whatever the calling thread has
+    const char* const kProgram = getCompressionName(compression);
+    const char* const kArgs[] = { kProgram, "-q", "-c", nullptr };
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attributes;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipe_fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, m_archive_fd, STDOUT_FILENO);
+    posix_spawnattr_init(&attributes);
+    sigset_t default_signals;
+    sigset_t no_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigdefault(&attributes, &default_signals);
+    posix_spawnattr_setsigmask(&attributes, &no_signals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid = -1;
+    const int kSpawnError = posix_spawnp(&pid, kProgram, &actions, &attributes, const_cast<char* const*>(kArgs), environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipe_fds[0]);
+    if (kSpawnError != 0) {
+      close(pipe_fds[1]);
+      close(m_archive_fd);
+      m_archive_fd = -1;
+      ec.assign(kSpawnError, std::generic_category());
+      return false;
+    }
+    m_compressor_pid = pid;
+    m_file = fdopen(pipe_fds[1], "wb");
+    if (m_file == nullptr) {
+      ec.assign(errno, std::generic_category());
+      close(pipe_fds[1]);
+      closeArchive(ec);
+      return false;
+    }
+#else
+    ec = std::make_error_code(std::errc::not_supported);
+    return false;
+#endif
+  }
+
+  m_read_buffer.resize(M_READ_BUFFER_SIZE);
+  m_write_buffer.resize(M_WRITE_BUFFER_SIZE);
+  std::setvbuf(m_file, m_write_buffer.data(), _IOFBF, m_write_buffer.size());
+  return true;
+}
+
+/**
+ * @brief Add a directory entry
+ *
+ * @param name directory name, without a trailing '/'
+ * @param ec set if the archive cannot be written
+ *
+ * @return true if success ; false if error
+ */
+bool TarWriter::addDirectory(const std::string& name, std::error_code& ec) {
+  return writeHeader(name + "/", '5', 0, 0755, static_cast<int64_t>(std::time(nullptr)), "", ec);
+}
+
+/**
+ * @brief Add a file, reading it from the disk
+ *
+ * @param source file to read
+ * @param name entry name, '/' separated
+ * @param ec set if the file cannot be read or the archive cannot be written
+ *
+ * @return true if success ; false if error, the archive is unusable after a failed write
+ */
+bool TarWriter::addFile(const std::filesystem::path& source, const std::string& name, std::error_code& ec) {
+  std::FILE* file = std::fopen(source.string().c_str(), "rb");
+  if (file == nullptr) {
+    ec.assign(errno, std::generic_category());
+    return false;
+  }
+  // every read goes straight into m_read_buffer
+  std::setvbuf(file, nullptr, _IONBF, 0);
+
+  uint64_t size = 0;
+  uint32_t mode = 0644;
+  int64_t mtime = static_cast<int64_t>(std::time(nullptr));
+#ifdef __linux__
+  struct stat st;
+  if (fstat(fileno(file), &st) != 0) {
+    ec.assign(errno, std::generic_category());
+    std::fclose(file);
+    return false;
+  }
+  size = static_cast<uint64_t>(st.st_size);
+  mode = static_cast<uint32_t>(st.st_mode);
+  mtime = static_cast<int64_t>(st.st_mtime);
+  posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+  size = std::filesystem::file_size(source, ec);
+  if (ec) {
+    std::fclose(file);
+    return false;
+  }
+#endif
+
+  // only the size the header promised is copied, a file that shrinks while it is read cannot be archived
+  bool success = writeHeader(name, '0', size, mode, mtime, "", ec);
+  for (uint64_t remaining = size; success && remaining > 0;) {
+    const size_t kWant = static_cast<size_t>(std::min<uint64_t>(remaining, m_read_buffer.size()));
+    const size_t kRead = std::fread(m_read_buffer.data(), 1, kWant, file);
+    if (kRead == 0) {
+      ec = std::ferror(file) ? std::error_code(errno, std::generic_category()) : std::make_error_code(std::errc::io_error);
+      success = false;
+      break;
+    }
+    success = write(m_read_buffer.data(), kRead, ec);
+    remaining -= kRead;
+  }
+  std::fclose(file);
+
+  return success && pad(size, ec);
+}
+
+/**
+ * @brief Add a hardlink to an entry that is already in the archive
+ *
+ * @param name entry name
+ * @param target name of the earlier entry
+ * @param ec set if the archive cannot be written
+ *
+ * @return true if success ; false if error
+ */
+bool TarWriter::addHardlink(const std::string& name, const std::string& target, std::error_code& ec) {
+  return writeHeader(name, '1', 0, 0644, static_cast<int64_t>(std::time(nullptr)), target, ec);
+}
+
+/**
+ * @brief Add a file made from memory
+ *
+ * @param name entry name
+ * @param data contents of the file
+ * @param ec set if the archive cannot be written
+ *
+ * @return true if success ; false if error
+ */
+bool TarWriter::addData(const std::string& name, const std::string& data, std::error_code& ec) {
+  return writeHeader(name, '0', data.size(), 0644, static_cast<int64_t>(std::time(nullptr)), "", ec)
+         && write(data.data(), data.size(), ec) && pad(data.size(), ec);
+}
+
+/**
+ * @brief End the archive and close it, it is synced to disk once this returns
+ *
+ * @param ec set if the archive or the compressor failed
+ *
+ * @return true if success ; false if error, the archive is not usable then
+ */
+bool TarWriter::finish(std::error_code& ec) {
+  static const char kEnd[2 * M_BLOCK_SIZE] = {};
+  return write(kEnd, sizeof(kEnd), ec) && closeArchive(ec);
+}
+
+/**
+ * @brief Pick the compression an archive's extension asks for
+ *
+ * @param archive archive file
+ *
+ * @return ArchiveCompression Gzip for .tar.gz and .tgz, Zstd for .tar.zst and .tzst, Xz for .tar.xz and .txz, otherwise None
+ */
+ArchiveCompression TarWriter::getCompression(const std::filesystem::path& archive) {
+  std::string name = archive.filename().string();
+  std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  auto endsWith = [&name](const std::string& suffix) {
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+
+  if (endsWith(".tar.gz") || endsWith(".tgz")) {
+    return ArchiveCompression::Gzip;
+  }
+  else if (endsWith(".tar.zst") || endsWith(".tzst")) {
+    return ArchiveCompression::Zstd;
+  }
+  else if (endsWith(".tar.xz") || endsWith(".txz")) {
+    return ArchiveCompression::Xz;
+  }
+  return ArchiveCompression::None;
+}
+
+/**
+ * @brief Get the name of a compression, which is also the name of the program that does it
+ *
+ * @param compression compression to name
+ *
+ * @return const char* name such as "zstd"
+ */
+const char* TarWriter::getCompressionName(ArchiveCompression compression) {
+  switch (compression) {
+    case ArchiveCompression::Auto: return "auto";
+    case ArchiveCompression::None: return "none";
+    case ArchiveCompression::Gzip: return "gzip";
+    case ArchiveCompression::Zstd: return "zstd";
+    case ArchiveCompression::Xz:   return "xz";
+  }
+  return "none";
+}
+
+/**
+ * @brief Read a compression from its name
+ *
+ * @param name name as returned by getCompressionName()
+ * @param compression set to the compression
+ *
+ * @return true if success ; false if the name is not known
+ */
+bool TarWriter::parseCompressionName(const std::string& name, ArchiveCompression& compression) {
+  for (ArchiveCompression candidate : { ArchiveCompression::Auto, ArchiveCompression::None, ArchiveCompression::Gzip,
+                                        ArchiveCompression::Zstd, ArchiveCompression::Xz }) {
+    if (name == getCompressionName(candidate)) {
+      compression = candidate;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,62 @@
+#ifndef TAR_WRITER_HPP
+#define TAR_WRITER_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+
+#include "merge_options.hpp"
+
+// Writes a tar archive front to back, one entry after another, through a single large buffer
+//
+// Entries are POSIX ustar, with a pax header in front of any entry whose name is too long or whose size is too big
+// for the ustar fields. Compressed archives are piped through the gzip, zstd or xz program, so only Linux can write
+// them. Nothing is seekable, the archive can also be written into a pipe.
+class TarWriter {
+ private:
+  // consts
+  static const size_t M_BLOCK_SIZE = 512; // Every header and the end of every file's data is padded to this
+  static const size_t M_READ_BUFFER_SIZE = 1024 * 1024; // Bytes read from a source file at a time
+  static const size_t M_WRITE_BUFFER_SIZE = 4 * 1024 * 1024; // Bytes collected before they are written to the archive
+
+  // vars
+  std::FILE* m_file = nullptr; // The archive, or the pipe into the compressor
+  std::vector<char> m_read_buffer;
+  std::vector<char> m_write_buffer; // Given to m_file, so entries reach the archive in big sequential writes
+  uint64_t m_bytes_written = 0; // Uncompressed size of the archive so far
+  bool m_sync = true; // Sync the archive to disk when it is closed
+#ifdef __linux__
+  int m_archive_fd = -1; // The archive itself when compressing, the compressor writes into it
+  int m_compressor_pid = -1;
+#endif
+
+  // funcs
+  bool write(const void* data, size_t size, std::error_code& ec);
+  bool pad(uint64_t size, std::error_code& ec);
+  bool writeHeader(const std::string& name, char type, uint64_t size, uint32_t mode, int64_t mtime, const std::string& link_name, std::error_code& ec);
+  bool closeArchive(std::error_code& ec);
+
+ public:
+  TarWriter() = default;
+  ~TarWriter();
+
+  TarWriter(const TarWriter&) = delete;
+  TarWriter& operator=(const TarWriter&) = delete;
+
+  bool open(const std::filesystem::path& archive, ArchiveCompression compression, bool sync, std::error_code& ec);
+  bool addDirectory(const std::string& name, std::error_code& ec);
+  bool addFile(const std::filesystem::path& source, const std::string& name, std::error_code& ec);
+  bool addHardlink(const std::string& name, const std::string& target, std::error_code& ec);
+  bool addData(const std::string& name, const std::string& data, std::error_code& ec);
+  bool finish(std::error_code& ec);
+  uint64_t getBytesWritten() const { return m_bytes_written; }
+
+  static ArchiveCompression getCompression(const std::filesystem::path& archive);
+  static const char* getCompressionName(ArchiveCompression compression);
+  static bool parseCompressionName(const std::string& name, ArchiveCompression& compression);
+};
+
+#endif // TAR_WRITER_HPP
@@ -0,0 +1,132 @@
+#include "thread_pool.hpp"
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/ 
+
+/**
+ * @brief Loop run by every worker thread, pulls tasks from the queue until the pool stops
+ */
+void ThreadPool::workerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_task_available.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+
+      if (m_tasks.empty()) { // stopping and nothing left to do
+        return;
+      }
+
+      task = std::move(m_tasks.front());
+      m_tasks.pop();
+      m_active_tasks++;
+    }
+
+    task();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_active_tasks--;
+      if (m_tasks.empty() && m_active_tasks == 0) {
+        m_tasks_done.notify_all();
+      }
+    }
+  }
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/ 
+
+/**
+ * @brief Start a pool with a fixed number of worker threads
+ *
+ * @param thread_count number of workers to start, 0 = use defaultThreadCount()
+ */
+ThreadPool::ThreadPool(unsigned int thread_count) {
+  if (thread_count == 0) {
+    thread_count = defaultThreadCount();
+  }
+
+  m_workers.reserve(thread_count);
+  for (unsigned int i = 0; i < thread_count; i++) {
+    m_workers.emplace_back(&ThreadPool::workerLoop, this);
+  }
+}
+
+/**
+ * @brief Finish every queued task, then join all workers
+ */
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_task_available.notify_all();
+
+  for (auto& worker : m_workers) {
+    worker.join();
+  }
+}
+
+/**
+ * @brief Get the number of workers to use when none is given
+ *
+ * @return the hardware concurrency, or 1 if it cannot be detected
+ */
+unsigned int ThreadPool::defaultThreadCount() {
+  const unsigned int kHardwareThreads = std::thread::hardware_concurrency();
+  return (kHardwareThreads == 0) ? 1 : kHardwareThreads;
+}
+
+/**
+ * @brief Queue a task to be run by the next free worker
+ *
+ * @param task function to run, must not throw
+ */
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push(std::move(task));
+  }
+  m_task_available.notify_one();
+}
+
+/**
+ * @brief Block until every queued task has finished running
+ */
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_tasks_done.wait(lock, [this] { return m_tasks.empty() && m_active_tasks == 0; });
+}
+
+/**
+ * @brief Queue a task on the group's pool
+ *
+ * @param task function to run, must not throw
+ */
+void TaskGroup::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending_tasks++;
+  }
+
+  m_pool.submit([this, task = std::move(task)] {
+    task();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending_tasks--;
+    if (m_pending_tasks == 0) {
+      m_tasks_done.notify_all();
+    }
+  });
+}
+
+/**
+ * @brief Block until every task of this group has finished, tasks of other callers are not waited for
+ */
+void TaskGroup::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_tasks_done.wait(lock, [this] { return m_pending_tasks == 0; });
+}
@@ -0,0 +1,59 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool {
+ private:
+  // vars
+  std::vector<std::thread> m_workers;
+  std::queue<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_task_available; // Signalled when a task is queued or the pool is stopping
+  std::condition_variable m_tasks_done; // Signalled when the queue is empty and no task is running
+  unsigned int m_active_tasks = 0;
+  bool m_stopping = false;
+
+  // funcs
+  void workerLoop();
+
+ public:
+  explicit ThreadPool(unsigned int thread_count);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  static unsigned int defaultThreadCount();
+
+  unsigned int size() const { return static_cast<unsigned int>(m_workers.size()); }
+  void submit(std::function<void()> task);
+  void wait();
+};
+
+// Tasks submitted by one caller, so callers sharing a pool only wait for their own tasks
+class TaskGroup {
+ private:
+  // vars
+  ThreadPool& m_pool;
+  std::mutex m_mutex;
+  std::condition_variable m_tasks_done; // Signalled when the last pending task finishes
+  unsigned int m_pending_tasks = 0;
+
+ public:
+  explicit TaskGroup(ThreadPool& pool) : m_pool(pool) {}
+  ~TaskGroup() { wait(); }
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  void submit(std::function<void()> task);
+  void wait();
+};
+
+#endif // THREAD_POOL_HPP
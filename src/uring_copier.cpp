@@ -0,0 +1,488 @@
+#include "uring_copier.hpp"
+
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <filesystem>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+// Operations a slot waits on, stored in the low byte of each request's user_data
+enum UringOp : int {
+  OP_STAT,
+  OP_OPEN_SOURCE,
+  OP_OPEN_DESTINATION,
+  OP_READ,
+  OP_WRITE,
+  OP_FSYNC,
+  OP_CLOSE
+};
+
+// One file being copied
+struct UringCopier::Slot {
+  size_t task_idx = 0;
+  const CopyTask* task = nullptr;
+  bool active = false;
+  bool closing = false;
+  bool synced = false; // The copy was synced to the disk, only done when syncing
+  int source_fd = -1;
+  int destination_fd = -1;
+  int error = 0; // First errno the copy ran into
+  unsigned int pending = 0; // Requests submitted and not completed yet
+  uint64_t size = 0;
+  uint64_t offset = 0; // Bytes copied so far
+  uint32_t write_length = 0; // Bytes of the buffer being written
+  uint32_t write_done = 0;
+  char* buffer = nullptr;
+  std::string source_path; // Full paths of the task, kept for the kernel until the files are open
+  std::string destination_path;
+  FileHasher source_hasher; // Hash of the bytes read so far, if hashing
+  FileHasher destination_hasher; // Hash of the bytes written so far, if hashing
+#ifdef __linux__
+  struct statx stat_buffer;
+#endif
+};
+
+#ifdef __linux__
+
+// Submission and completion queues shared with the kernel
+struct UringCopier::Ring {
+  int fd = -1;
+  unsigned int entries = 0;
+
+  void* sq_map = MAP_FAILED;
+  size_t sq_map_size = 0;
+  void* cq_map = MAP_FAILED;
+  size_t cq_map_size = 0;
+  io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  size_t sqes_size = 0;
+
+  unsigned int* sq_head = nullptr;
+  unsigned int* sq_tail = nullptr;
+  unsigned int* sq_mask = nullptr;
+  unsigned int* sq_array = nullptr;
+  unsigned int* cq_head = nullptr;
+  unsigned int* cq_tail = nullptr;
+  unsigned int* cq_mask = nullptr;
+  io_uring_cqe* cqes = nullptr;
+
+  unsigned int local_tail = 0; // Tail including requests that were queued but not submitted
+  unsigned int to_submit = 0;
+
+  ~Ring() {
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_map != MAP_FAILED && cq_map != sq_map) {
+      munmap(cq_map, cq_map_size);
+    }
+    if (sq_map != MAP_FAILED) {
+      munmap(sq_map, sq_map_size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  /**
+   * @brief Create the ring and check that the kernel supports every operation a copy uses
+   *
+   * @return true if success ; false if io_uring cannot be used
+   */
+  bool setup(unsigned int ring_entries) {
+    io_uring_params params {};
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, ring_entries, &params));
+    if (fd < 0) {
+      return false;
+    }
+    entries = params.sq_entries;
+
+    sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool kSingleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (kSingleMap) {
+      sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+    }
+
+    sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+      return false;
+    }
+    cq_map = kSingleMap ? sq_map : mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_map == MAP_FAILED) {
+      return false;
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) {
+      return false;
+    }
+
+    char* sq = static_cast<char*>(sq_map);
+    char* cq = static_cast<char*>(cq_map);
+    sq_head = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    local_tail = *sq_tail;
+
+    return supportsCopyOps();
+  }
+
+  /**
+   * @brief Ask the kernel which operations it knows, older kernels lack some of them
+   */
+  bool supportsCopyOps() {
+    const unsigned int kOpCount = 64;
+    std::vector<char> probe_buffer(sizeof(io_uring_probe) + kOpCount * sizeof(io_uring_probe_op), 0);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probe_buffer.data());
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, kOpCount) < 0) {
+      return false;
+    }
+
+    for (int op : { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE }) {
+      if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Get the next free submission entry, cleared
+   */
+  io_uring_sqe* nextSqe(size_t slot_idx, int op) {
+    const unsigned int kHead = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (local_tail - kHead >= entries) {
+      return nullptr;
+    }
+
+    const unsigned int kIdx = local_tail & *sq_mask;
+    io_uring_sqe* sqe = &sqes[kIdx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (static_cast<uint64_t>(slot_idx) << 8) | static_cast<uint64_t>(op);
+    sq_array[kIdx] = kIdx;
+    local_tail++;
+    to_submit++;
+    return sqe;
+  }
+
+  /**
+   * @brief Submit every queued request and wait until at least one has completed
+   *
+   * @return 0 if success ; errno if the kernel refused the requests
+   */
+  int submitAndWait() {
+    __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    while (true) {
+      const long kResult = syscall(__NR_io_uring_enter, fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (kResult >= 0) {
+        to_submit -= static_cast<unsigned int>(kResult);
+        return 0;
+      }
+      else if (errno != EINTR) {
+        return errno;
+      }
+    }
+  }
+};
+
+#else
+
+struct UringCopier::Ring {};
+
+#endif
+
+/******************************************************************************
+*********************************** PRIVATE ***********************************
+******************************************************************************/ 
+
+/**
+ * @brief Begin copying a file in a free slot, its size and permissions are read first
+ *
+ * @param slot slot to use
+ * @param slot_idx index of the slot
+ * @param task file to copy
+ */
+void UringCopier::startFile(Slot& slot, size_t slot_idx, const CopyTask& task) {
+  // the path strings keep their capacity from one file to the next
+  char* const kBuffer = slot.buffer;
+  std::string source_path = std::move(slot.source_path);
+  std::string destination_path = std::move(slot.destination_path);
+  slot = Slot();
+  slot.buffer = kBuffer;
+  slot.source_path = std::move(source_path);
+  slot.destination_path = std::move(destination_path);
+  slot.source_path.clear();
+  slot.destination_path.clear();
+  task.source.appendTo(slot.source_path);
+  task.destination.appendTo(slot.destination_path);
+  slot.task = &task;
+  slot.active = true;
+
+#ifdef __linux__
+  io_uring_sqe* sqe = m_ring->nextSqe(slot_idx, OP_STAT);
+  sqe->opcode = IORING_OP_STATX;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = reinterpret_cast<uint64_t>(slot.source_path.c_str());
+  sqe->len = STATX_MODE | STATX_SIZE;
+  sqe->off = reinterpret_cast<uint64_t>(&slot.stat_buffer);
+  slot.pending++;
+#endif
+}
+
+/**
+ * @brief Handle a finished request of a slot and queue the next step of its copy
+ *
+ * @param slot slot the request belongs to
+ * @param slot_idx index of the slot
+ * @param op operation that finished
+ * @param result result of the operation, a negative errno on failure
+ */
+void UringCopier::advance(Slot& slot, size_t slot_idx, int op, int32_t result) {
+#ifdef __linux__
+  slot.pending--;
+  if (result < 0 && slot.error == 0) {
+    slot.error = -result;
+  }
+
+  switch (op) {
+    case OP_STAT: {
+      if (slot.error != 0) {
+        break;
+      }
+      slot.size = slot.stat_buffer.stx_size;
+
+      io_uring_sqe* sqe = m_ring->nextSqe(slot_idx, OP_OPEN_SOURCE);
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = reinterpret_cast<uint64_t>(slot.source_path.c_str());
+      sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+      sqe = m_ring->nextSqe(slot_idx, OP_OPEN_DESTINATION);
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = reinterpret_cast<uint64_t>(slot.destination_path.c_str());
+      sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+      sqe->len = slot.stat_buffer.stx_mode & 07777;
+      slot.pending += 2;
+      return;
+    }
+    case OP_OPEN_SOURCE: {
+      slot.source_fd = result >= 0 ? result : -1;
+      break;
+    }
+    case OP_OPEN_DESTINATION: {
+      slot.destination_fd = result >= 0 ? result : -1;
+      break;
+    }
+    case OP_READ: {
+      if (slot.error != 0 || result == 0) { // the file shrank since it was stat'ed
+        break;
+      }
+      slot.write_length = static_cast<uint32_t>(result);
+      slot.write_done = 0;
+      if (m_hash) {
+        slot.source_hasher.update(slot.buffer, slot.write_length);
+      }
+      break;
+    }
+    case OP_WRITE: {
+      if (slot.error != 0) {
+        break;
+      }
+      if (m_hash) {
+        slot.destination_hasher.update(slot.buffer + slot.write_done, static_cast<size_t>(result));
+      }
+      slot.write_done += static_cast<uint32_t>(result);
+      if (slot.write_done == slot.write_length) {
+        slot.offset += slot.write_length;
+        slot.write_length = slot.write_done = 0;
+      }
+      break;
+    }
+    case OP_FSYNC: {
+      break;
+    }
+    case OP_CLOSE: {
+      return;
+    }
+  }
+
+  // wait for both opens
+  if (slot.pending > 0) {
+    return;
+  }
+  else if (slot.error != 0 || (op == OP_READ && result == 0)) {
+    closeFiles(slot, slot_idx);
+    return;
+  }
+
+  if (slot.write_done < slot.write_length) {
+    // write what is left of the buffer
+    io_uring_sqe* sqe = m_ring->nextSqe(slot_idx, OP_WRITE);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = slot.destination_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(slot.buffer + slot.write_done);
+    sqe->len = slot.write_length - slot.write_done;
+    sqe->off = slot.offset + slot.write_done;
+    slot.pending++;
+  }
+  else if (slot.offset < slot.size) {
+    io_uring_sqe* sqe = m_ring->nextSqe(slot_idx, OP_READ);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot.source_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(slot.buffer);
+    sqe->len = static_cast<uint32_t>(std::min<uint64_t>(M_BUFFER_SIZE, slot.size - slot.offset));
+    sqe->off = slot.offset;
+    slot.pending++;
+  }
+  else if (m_sync && !slot.synced) {
+    io_uring_sqe* sqe = m_ring->nextSqe(slot_idx, OP_FSYNC);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = slot.destination_fd;
+    slot.synced = true;
+    slot.pending++;
+  }
+  else {
+    closeFiles(slot, slot_idx);
+  }
+#endif
+}
+
+/**
+ * @brief Close whichever files of a slot are open, the slot is done once the closes complete
+ *
+ * @param slot slot to close
+ * @param slot_idx index of the slot
+ */
+void UringCopier::closeFiles(Slot& slot, size_t slot_idx) {
+  slot.closing = true;
+#ifdef __linux__
+  for (int* fd : { &slot.source_fd, &slot.destination_fd }) {
+    if (*fd < 0) {
+      continue;
+    }
+    io_uring_sqe* sqe = m_ring->nextSqe(slot_idx, OP_CLOSE);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = *fd;
+    slot.pending++;
+    *fd = -1;
+  }
+#endif
+}
+
+/******************************************************************************
+*********************************** PUBLIC ************************************
+******************************************************************************/ 
+
+/**
+ * @brief Set up the ring and buffers, check isAvailable() before using it
+ *
+ * @param queue_depth number of files copied at the same time, each one holds a 256 KB buffer
+ */
+UringCopier::UringCopier(unsigned int queue_depth) : m_queue_depth(std::max(queue_depth, 1u)) {
+#ifdef __linux__
+  // every file has at most two requests in flight, its two opens or its two closes
+  m_ring = std::make_unique<Ring>();
+  if (!m_ring->setup(m_queue_depth * 2)) {
+    m_ring.reset();
+    return;
+  }
+  m_buffers.resize(static_cast<size_t>(m_queue_depth) * M_BUFFER_SIZE);
+#endif
+}
+
+UringCopier::~UringCopier() = default;
+
+/**
+ * @brief Copy a set of files, overwriting whatever is at their destinations
+ *
+ * @param tasks list the copies are taken from
+ * @param task_indices indices into tasks of the files to copy
+ * @param on_task_finished called with the task's index, the error, empty on success, and the hashes of the bytes read
+ *                         and written after each copy ends. The hashes are only set if hashWhileCopying() was turned on
+ */
+void UringCopier::run(const std::vector<CopyTask>& tasks, const std::vector<size_t>& task_indices,
+                      const std::function<void(size_t, const std::error_code&, const CopyHashes&)>& on_task_finished) {
+  if (!isAvailable()) {
+    for (size_t idx : task_indices) {
+      on_task_finished(idx, std::make_error_code(std::errc::function_not_supported), CopyHashes());
+    }
+    return;
+  }
+
+#ifdef __linux__
+  std::vector<Slot> slots(m_queue_depth);
+  for (size_t i = 0; i < slots.size(); i++) {
+    slots[i].buffer = m_buffers.data() + i * M_BUFFER_SIZE;
+  }
+
+  size_t next_task = 0;
+  size_t active_slots = 0;
+  while (next_task < task_indices.size() || active_slots > 0) {
+    // fill every free slot with the next file
+    for (size_t i = 0; i < slots.size() && next_task < task_indices.size(); i++) {
+      if (!slots[i].active) {
+        startFile(slots[i], i, tasks[task_indices[next_task]]);
+        slots[i].task_idx = task_indices[next_task];
+        next_task++;
+        active_slots++;
+      }
+    }
+
+    const int kError = m_ring->submitAndWait();
+    if (kError != 0) {
+      // the ring is unusable, fail everything that is left
+      for (auto& slot : slots) {
+        if (slot.active) {
+          on_task_finished(slot.task_idx, std::error_code(kError, std::generic_category()), CopyHashes());
+        }
+      }
+      for (; next_task < task_indices.size(); next_task++) {
+        on_task_finished(task_indices[next_task], std::error_code(kError, std::generic_category()), CopyHashes());
+      }
+      m_ring.reset();
+      return;
+    }
+
+    unsigned int head = *m_ring->cq_head;
+    const unsigned int kTail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != kTail; head++) {
+      const io_uring_cqe& cqe = m_ring->cqes[head & *m_ring->cq_mask];
+      const size_t kSlotIdx = static_cast<size_t>(cqe.user_data >> 8);
+      Slot& slot = slots[kSlotIdx];
+      advance(slot, kSlotIdx, static_cast<int>(cqe.user_data & 0xff), cqe.res);
+
+      if (slot.closing && slot.pending == 0) {
+        std::error_code ec;
+        if (slot.error != 0) {
+          ec = std::error_code(slot.error, std::generic_category());
+          std::error_code remove_ec;
+          std::filesystem::remove(slot.destination_path, remove_ec);
+        }
+        CopyHashes hashes;
+        if (m_hash) {
+          hashes.source = slot.source_hasher.digest();
+          hashes.destination = slot.destination_hasher.digest();
+        }
+        on_task_finished(slot.task_idx, ec, hashes);
+        slot.active = false;
+        active_slots--;
+      }
+    }
+    __atomic_store_n(m_ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+#endif
+}
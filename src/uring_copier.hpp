@@ -0,0 +1,49 @@
+#ifndef URING_COPIER_HPP
+#define URING_COPIER_HPP
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <system_error>
+
+#include "copy_engine.hpp"
+#include "file_hash.hpp"
+
+// Copies files through a Linux io_uring, keeping the opens, reads, writes and closes of many files in flight at once
+class UringCopier {
+ private:
+  // consts
+  const size_t M_BUFFER_SIZE = 256 * 1024; // Bytes read and written at a time, one buffer per file in flight
+
+  struct Ring;
+  struct Slot;
+
+  // vars
+  unsigned int m_queue_depth; // Files copied at the same time
+  bool m_hash = false; // Hash every file's bytes as they pass through the buffers
+  bool m_sync = false; // Sync every copy to the disk before closing it
+  std::unique_ptr<Ring> m_ring; // Empty if io_uring cannot be used
+  std::vector<char> m_buffers; // m_queue_depth buffers of M_BUFFER_SIZE bytes
+
+  // funcs
+  void startFile(Slot& slot, size_t slot_idx, const CopyTask& task);
+  void advance(Slot& slot, size_t slot_idx, int op, int32_t result);
+  void closeFiles(Slot& slot, size_t slot_idx);
+
+ public:
+  explicit UringCopier(unsigned int queue_depth);
+  ~UringCopier();
+
+  UringCopier(const UringCopier&) = delete;
+  UringCopier& operator=(const UringCopier&) = delete;
+
+  bool isAvailable() const { return m_ring != nullptr; }
+  void hashWhileCopying(bool hash) { m_hash = hash; }
+  void syncEachFile(bool sync) { m_sync = sync; }
+
+  void run(const std::vector<CopyTask>& tasks, const std::vector<size_t>& task_indices,
+           const std::function<void(size_t, const std::error_code&, const CopyHashes&)>& on_task_finished);
+};
+
+#endif // URING_COPIER_HPP